@@ -18,14 +18,27 @@
 
 #include "benchmark.h"
 
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <deque>
 #include <fstream>
 #include <iostream>
 #include <istream>
+#include <sstream>
 #include <vector>
 
+#include "evaluate.h"
+#include "movegen.h"
 #include "position.h"
+#include "thread.h"
 #include "uci.h"
 
+#ifdef USE_NNUE
+#include "nnue/evaluate_nnue.h"
+#endif
+
 using namespace std;
 using Stockfish::SUBVARIANT_NB;
 
@@ -397,6 +410,10 @@ const vector<string> Defaults[SUBVARIANT_NB] = {
 #endif
 };
 
+// The packed positions file of the last bench, mapped until the next one
+const Stockfish::PackedPosition* BenchPacked;
+size_t BenchPackedSize;
+
 } // namespace
 
 namespace Stockfish {
@@ -404,7 +421,8 @@ namespace Stockfish {
 /// setup_bench() builds a list of UCI commands to be run by bench. There
 /// are five parameters: TT size in MB, number of search threads that
 /// should be used, the limit value spent for each position, a file name
-/// where to look for positions in FEN format, the type of the limit:
+/// where to look for positions in FEN format (or packed, if its name ends
+/// with ".pack"), the type of the limit:
 /// depth, perft, nodes and movetime (in millisecs), and evaluation type
 /// mixed (default), classical, NNUE.
 ///
@@ -450,6 +468,30 @@ vector<string> setup_bench(const Position& current, istream& is) {
   else if (fenFile == "current")
       fens.push_back(current.fen());
 
+  else if (fenFile.size() > 5 && fenFile.compare(fenFile.size() - 5, 5, ".pack") == 0)
+  {
+      // A file of packed positions, kept mapped for the bench, which sets them
+      // up in place with "packed <index>", see bench_packed(). Their variant is
+      // set before each of them.
+      unmap_file(BenchPacked, BenchPackedSize);
+      BenchPacked = static_cast<const PackedPosition*>(map_file(fenFile, BenchPackedSize));
+
+      if (!BenchPacked)
+      {
+          cerr << "Unable to open file " << fenFile << endl;
+          exit(EXIT_FAILURE);
+      }
+
+      Variant last = variant;
+
+      for (size_t i = 0; i < BenchPackedSize / sizeof(PackedPosition); ++i)
+      {
+          if (Variant(BenchPacked[i].variant) != last)
+              fens.push_back("setoption name UCI_Variant value " + variants[last = Variant(BenchPacked[i].variant)]);
+          fens.push_back("packed " + std::to_string(i));
+      }
+  }
+
   else
   {
       string fen;
@@ -490,7 +532,7 @@ vector<string> setup_bench(const Position& current, istream& is) {
           else if (evalType == "NNUE" || (evalType == "mixed" && posCounter % 2 != 0))
               list.emplace_back("setoption name Use NNUE value true");
 #endif
-          list.emplace_back("position fen " + fen);
+          list.emplace_back(fen.rfind("packed ", 0) == 0 ? fen : "position fen " + fen);
           list.emplace_back(go);
           ++posCounter;
       }
@@ -503,4 +545,270 @@ vector<string> setup_bench(const Position& current, istream& is) {
   return list;
 }
 
+
+/// bench_packed() returns the idx-th position of the packed file of the last
+/// bench, for its "packed <idx>" commands.
+
+const PackedPosition& bench_packed(size_t idx) {
+
+  assert(BenchPacked && idx < BenchPackedSize / sizeof(PackedPosition));
+
+  return BenchPacked[idx];
+}
+
+
+namespace {
+
+  volatile uint64_t Sink; // Keeps the timed work from being optimized away
+
+  // Timing is the mean time of an operation of a pass, in nanoseconds, with
+  // its 95% confidence interval over the samples.
+  struct Timing {
+    double mean, interval;
+    uint64_t ops;
+  };
+
+  // time_pass() times a pass of a component over the positions, which returns
+  // the number of operations done. A sample repeats the pass for at least
+  // 10 ms, to keep the timer resolution out.
+  template<typename Pass>
+  Timing time_pass(int samples, Pass pass) {
+
+    using Clock = std::chrono::steady_clock;
+    auto elapsed = [](Clock::time_point t) {
+        return double(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - t).count());
+    };
+
+    // Calibrate the repetitions of a sample on a first, warming up, pass
+    Clock::time_point start = Clock::now();
+    uint64_t ops = pass();
+    if (!ops)
+        return { 0, 0, 0 };
+
+    int reps = std::max(1, int(1e7 / std::max(elapsed(start), 1.0)));
+    double sum = 0, sumSq = 0;
+
+    for (int i = 0; i < samples; ++i)
+    {
+        start = Clock::now();
+        for (int r = 0; r < reps; ++r)
+            pass();
+        double ns = elapsed(start) / (double(reps) * ops);
+        sum += ns;
+        sumSq += ns * ns;
+    }
+
+    double mean = sum / samples;
+    double stdev = samples > 1 ? std::sqrt(std::max(sumSq - samples * mean * mean, 0.0) / (samples - 1)) : 0;
+    return { mean, 1.96 * stdev / std::sqrt(double(samples)), ops };
+  }
+
+  void report(const char* name, const Timing& t) {
+
+    char line[128];
+    std::snprintf(line, sizeof(line), "%-24s %10.1f ns/op +- %.1f (%llu ops per pass)",
+                  name, t.mean, t.interval, (unsigned long long)t.ops);
+    cerr << line << endl;
+  }
+
+  // measure() times a pass of a component and prints its timing
+  template<typename Pass>
+  void measure(const char* name, int samples, Pass pass) {
+
+    Timing t = time_pass(samples, pass);
+    if (t.ops)
+        report(name, t);
+  }
+
+} // namespace
+
+
+/// speedtest() times, separately, the components of the search on the bench
+/// positions of a variant: legal move generation, do_move()/undo_move(),
+/// pseudo_legal() and legal() on the pseudo legal moves, see_ge(),
+/// gives_check(), the classical evaluation and the NNUE evaluation, either
+/// from scratch or updated after a move. Its parameters are the variant,
+/// the current one by default, and the number of samples.
+///
+/// speedtest -> time the components on the positions of the current variant
+/// speedtest atomic 50 -> time them on the atomic positions, over 50 samples
+
+void speedtest(istream& is) {
+
+  string token;
+  Variant variant = UCI::variant_from_name(Options["UCI_Variant"]);
+  int samples = 20;
+
+  if (is >> token)
+  {
+      if (std::find(variants.begin(), variants.end(), token) != variants.end())
+          variant = UCI::variant_from_name(token), is >> samples;
+      else
+          samples = std::stoi(token);
+  }
+  samples = std::max(samples, 2);
+
+  // Set up the positions from scratch, the moves of a bench entry applied,
+  // so that the states have no previous accumulator to update from.
+  Thread* th = Threads.main();
+  th->alloc_tables(variant);
+
+  std::deque<Position> positions;
+  std::deque<StateInfo> states;
+  vector<vector<Move>> pseudoLegal;
+  bool chess960 = false;
+
+  for (const string& entry : Defaults[variant])
+  {
+      if (entry.find("setoption") != string::npos)
+      {
+          if (entry.find("UCI_Chess960") != string::npos)
+              chess960 = entry.find("value true") != string::npos;
+          continue;
+      }
+
+      size_t movesIdx = entry.find(" moves ");
+      StateListPtr moveStates(new std::deque<StateInfo>(1));
+      Position p;
+      p.set(entry.substr(0, movesIdx), chess960, variant, &moveStates->back(), th);
+
+      if (movesIdx != string::npos)
+      {
+          istringstream moves(entry.substr(movesIdx + 7));
+          string m;
+          while (moves >> m)
+          {
+              moveStates->emplace_back();
+              p.do_move(UCI::to_move(p, m), moveStates->back());
+          }
+      }
+
+      states.emplace_back();
+      positions.emplace_back().set(p.fen(), chess960, variant, &states.back(), th);
+
+      Position& pos = positions.back();
+      ExtMove list[MAX_MOVES];
+      ExtMove* last = pos.checkers() ? generate<EVASIONS>(pos, list) : generate<NON_EVASIONS>(pos, list);
+      pseudoLegal.emplace_back();
+      for (ExtMove* m = list; m < last; ++m)
+          pseudoLegal.back().push_back(*m);
+  }
+
+  cerr << "Speedtest of " << positions.size() << " " << variants[variant]
+       << " positions over " << samples << " samples\n" << endl;
+
+  measure("movegen legal", samples, [&]() {
+      uint64_t ops = 0, sum = 0;
+      for (Position& pos : positions)
+          sum += MoveList<LEGAL>(pos).size(), ++ops;
+      Sink = sum;
+      return ops;
+  });
+
+  measure("do_move/undo_move", samples, [&]() {
+      uint64_t ops = 0, sum = 0;
+      StateInfo st;
+      for (Position& pos : positions)
+          for (const auto& m : MoveList<LEGAL>(pos))
+          {
+              pos.do_move(m, st);
+              sum += pos.key();
+              pos.undo_move(m);
+              ++ops;
+          }
+      Sink = sum;
+      return ops;
+  });
+
+  measure("pseudo_legal + legal", samples, [&]() {
+      uint64_t ops = 0, sum = 0;
+      for (size_t i = 0; i < positions.size(); ++i)
+          for (Move m : pseudoLegal[i])
+              sum += positions[i].pseudo_legal(m) && positions[i].legal(m), ++ops;
+      Sink = sum;
+      return ops;
+  });
+
+  measure("see_ge", samples, [&]() {
+      uint64_t ops = 0, sum = 0;
+      for (Position& pos : positions)
+          for (const auto& m : MoveList<LEGAL>(pos))
+              sum += pos.see_ge(m), ++ops;
+      Sink = sum;
+      return ops;
+  });
+
+  measure("gives_check", samples, [&]() {
+      uint64_t ops = 0, sum = 0;
+      for (Position& pos : positions)
+          for (const auto& m : MoveList<LEGAL>(pos))
+              sum += pos.gives_check(m), ++ops;
+      Sink = sum;
+      return ops;
+  });
+
+  measure("classical eval", samples, [&]() {
+      uint64_t ops = 0, sum = 0;
+      for (Position& pos : positions)
+          if (!pos.checkers() && !pos.is_variant_end())
+              sum += Eval::classical(pos), ++ops;
+      Sink = sum;
+      return ops;
+  });
+
+#ifdef USE_NNUE
+  if (!Eval::useNNUE || !Eval::nnueAvailable[variant])
+      return;
+
+  Threads.main()->check_networks();
+
+  measure("nnue eval refresh", samples, [&]() {
+      uint64_t ops = 0, sum = 0;
+      for (Position& pos : positions)
+          if (!pos.checkers() && !pos.is_variant_end())
+          {
+              pos.state()->accumulator->computed[WHITE] = pos.state()->accumulator->computed[BLACK] = false;
+              sum += Eval::NNUE::evaluate(pos), ++ops;
+          }
+      Sink = sum;
+      return ops;
+  });
+
+  // The positions share the root accumulator of the thread, so the one of a
+  // position is refreshed before its moves, making each evaluation after a
+  // move an incremental update. The same pass without the evaluations after
+  // the moves, which times the refreshes, the move generation and the moves,
+  // is subtracted, to leave the updates only.
+  auto incremental = [&](bool afterMoves) {
+      return [&, afterMoves]() {
+          uint64_t ops = 0, sum = 0;
+          StateInfo st;
+          for (Position& pos : positions)
+          {
+              if (!pos.checkers() && !pos.is_variant_end())
+                  sum += Eval::NNUE::evaluate(pos);
+
+              for (const auto& m : MoveList<LEGAL>(pos))
+              {
+                  pos.do_move(m, st);
+                  if (!pos.checkers() && !pos.is_variant_end())
+                      sum += afterMoves ? Eval::NNUE::evaluate(pos) : 0, ++ops;
+                  pos.undo_move(m);
+              }
+          }
+          Sink = sum;
+          return ops;
+      };
+  };
+
+  Timing moves = time_pass(samples, incremental(false));
+  Timing updates = time_pass(samples, incremental(true));
+
+  if (updates.ops)
+      report("nnue eval incremental", { updates.mean - moves.mean,
+                                        std::sqrt(updates.interval * updates.interval + moves.interval * moves.interval),
+                                        updates.ops });
+#endif
+}
+
 } // namespace Stockfish
@@ -26,8 +26,11 @@
 namespace Stockfish {
 
 class Position;
+struct PackedPosition;
 
 std::vector<std::string> setup_bench(const Position&, std::istream&);
+const PackedPosition& bench_packed(size_t idx);
+void speedtest(std::istream&);
 
 } // namespace Stockfish
 
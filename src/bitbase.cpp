@@ -16,7 +16,9 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <atomic>
 #include <cassert>
+#include <mutex>
 #include <vector>
 #include <bitset>
 
@@ -33,6 +35,12 @@ namespace {
 
   std::bitset<MAX_INDEX> KPKBitbase;
 
+  // The bitbase is only computed at its first probe, see Bitbases::init()
+  std::atomic_bool KPKReady;
+  std::once_flag KPKOnce;
+
+  void compute_bitbase();
+
   // A KPK bitbase index is an integer in [0, IndexMax] range
   //
   // Information is mapped in a way that minimizes the number of iterations:
@@ -72,30 +80,49 @@ bool Bitbases::probe(Square wksq, Square wpsq, Square bksq, Color stm) {
 
   assert(file_of(wpsq) <= FILE_D);
 
+  if (!KPKReady.load(std::memory_order_acquire))
+      init();
+
   return KPKBitbase[index(stm, bksq, wksq, wpsq)];
 }
 
 
+/// Bitbases::init() computes the KPK bitbase, unless it is already done. It
+/// takes a few milliseconds, so it is left to the first probe instead of the
+/// startup of the engine.
+
 void Bitbases::init() {
 
-  std::vector<KPKPosition> db(MAX_INDEX);
-  unsigned idx, repeat = 1;
+  std::call_once(KPKOnce, [] {
+      compute_bitbase();
+      KPKReady.store(true, std::memory_order_release);
+  });
+}
 
-  // Initialize db with known win / draw positions
-  for (idx = 0; idx < MAX_INDEX; ++idx)
-      db[idx] = KPKPosition(idx);
+namespace {
 
-  // Iterate through the positions until none of the unknown positions can be
-  // changed to either wins or draws (15 cycles needed).
-  while (repeat)
-      for (repeat = idx = 0; idx < MAX_INDEX; ++idx)
-          repeat |= (db[idx] == UNKNOWN && db[idx].classify(db) != UNKNOWN);
+  void compute_bitbase() {
 
-  // Fill the bitbase with the decisive results
-  for (idx = 0; idx < MAX_INDEX; ++idx)
-      if (db[idx] == WIN)
-          KPKBitbase.set(idx);
-}
+    std::vector<KPKPosition> db(MAX_INDEX);
+    unsigned idx, repeat = 1;
+
+    // Initialize db with known win / draw positions
+    for (idx = 0; idx < MAX_INDEX; ++idx)
+        db[idx] = KPKPosition(idx);
+
+    // Iterate through the positions until none of the unknown positions can be
+    // changed to either wins or draws (15 cycles needed).
+    while (repeat)
+        for (repeat = idx = 0; idx < MAX_INDEX; ++idx)
+            repeat |= (db[idx] == UNKNOWN && db[idx].classify(db) != UNKNOWN);
+
+    // Fill the bitbase with the decisive results
+    for (idx = 0; idx < MAX_INDEX; ++idx)
+        if (db[idx] == WIN)
+            KPKBitbase.set(idx);
+  }
+
+} // namespace
 
 namespace {
 
@@ -203,6 +203,24 @@ constexpr Bitboard pawn_double_attacks_bb(Bitboard b) {
 }
 
 
+/// forward_fill() returns the squares of the given bitboard and all the squares
+/// in front of them, from the point of view of the given color, by a Kogge-Stone
+/// fill along the files. file_fill() returns the files of the given squares.
+
+template<Color C>
+constexpr Bitboard forward_fill(Bitboard b) {
+  if (C == WHITE)
+      b |= b << 8, b |= b << 16, b |= b << 32;
+  else
+      b |= b >> 8, b |= b >> 16, b |= b >> 32;
+  return b;
+}
+
+constexpr Bitboard file_fill(Bitboard b) {
+  return forward_fill<WHITE>(forward_fill<BLACK>(b));
+}
+
+
 /// adjacent_files_bb() returns a bitboard representing all the squares on the
 /// adjacent files of a given square.
 
@@ -0,0 +1,172 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2023 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include "book.h"
+#include "misc.h"
+#include "movegen.h"
+#include "position.h"
+#include "uci.h"
+
+namespace Stockfish::Book {
+
+namespace {
+
+  // A book file starts with this header, followed by its entries
+  struct Header {
+    char magic[8];
+    uint32_t variant;
+    uint32_t count;
+  };
+
+  static_assert(sizeof(Header) == sizeof(Entry), "Unexpected Header size");
+
+  constexpr char Magic[8] = { 'S', 'F', 'M', 'V', 'B', 'O', 'O', 'K' };
+
+  struct MappedBook {
+    std::string path;
+    const void* mem = nullptr;
+    size_t size = 0;
+    const Entry* entries = nullptr;
+    size_t count = 0;
+  };
+
+  MappedBook books[SUBVARIANT_NB];
+  PRNG rng(now());
+
+  // The option of the book of a variant, subvariants included: "BookFile" for
+  // chess, "BookFile_<variant>" otherwise.
+  std::string option_name(Variant v) {
+    return v == CHESS_VARIANT ? "BookFile" : "BookFile_" + variants[v];
+  }
+
+} // namespace
+
+
+/// Book::init() maps the books set in the options, keeping the ones already
+/// mapped from the same file.
+
+void init() {
+
+  for (Variant v = CHESS_VARIANT; v < SUBVARIANT_NB; ++v)
+  {
+      std::string path = Options[option_name(v)];
+      if (path == "<empty>")
+          path.clear();
+
+      MappedBook& book = books[v];
+      if (path == book.path)
+          continue;
+
+      unmap_file(book.mem, book.size);
+      book = MappedBook();
+      book.path = path;
+
+      if (path.empty())
+          continue;
+
+      book.mem = map_file(path, book.size);
+      const Header* header = static_cast<const Header*>(book.mem);
+
+      if (   !header
+          || book.size < sizeof(Header)
+          || std::memcmp(header->magic, Magic, sizeof(Magic))
+          || header->variant != uint32_t(v)
+          || book.size != sizeof(Header) + size_t(header->count) * sizeof(Entry))
+      {
+          sync_cout << "info string " << path << " is not a book of " << variants[v] << sync_endl;
+          unmap_file(book.mem, book.size);
+          book.mem = nullptr;
+          continue;
+      }
+
+      book.entries = reinterpret_cast<const Entry*>(header + 1);
+      book.count = header->count;
+      sync_cout << "info string Book " << path << " with " << book.count << " entries" << sync_endl;
+  }
+}
+
+
+/// Book::probe() returns a legal move of the position picked from its entries
+/// in the book of its variant, with a probability proportional to its weight,
+/// or MOVE_NONE if the book has no such move.
+
+Move probe(const Position& pos) {
+
+  const MappedBook& book = books[pos.subvariant()];
+  if (!book.entries)
+      return MOVE_NONE;
+
+  auto [first, last] = std::equal_range(book.entries, book.entries + book.count, Entry{ pos.key(), 0, 0, 0 },
+                                        [](const Entry& a, const Entry& b) { return a.key < b.key; });
+
+  // Skip the moves which are not legal, in case of key collisions
+  MoveList<LEGAL> legal(pos);
+  uint64_t total = 0;
+  for (const Entry* e = first; e < last; ++e)
+      if (legal.contains(Move(e->move)))
+          total += e->weight;
+
+  if (!total)
+      return MOVE_NONE;
+
+  uint64_t r = rng.rand<uint64_t>() % total;
+  for (const Entry* e = first; e < last; ++e)
+      if (legal.contains(Move(e->move)))
+      {
+          if (r < e->weight)
+              return Move(e->move);
+          r -= e->weight;
+      }
+
+  return MOVE_NONE;
+}
+
+
+/// Book::save() writes a book of the given entries, sorted by key and move, the
+/// weights of the same move of a position being summed up.
+
+bool save(const std::string& path, Variant v, std::vector<Entry>& entries) {
+
+  std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+      return a.key < b.key || (a.key == b.key && a.move < b.move); });
+
+  std::vector<Entry> merged;
+  for (const Entry& e : entries)
+      if (!merged.empty() && merged.back().key == e.key && merged.back().move == e.move)
+          merged.back().weight = uint16_t(std::min(merged.back().weight + e.weight, 0xFFFF));
+      else
+          merged.push_back({ e.key, e.move, e.weight, 0 });
+
+  entries.swap(merged);
+
+  Header header;
+  std::memcpy(header.magic, Magic, sizeof(Magic));
+  header.variant = uint32_t(v);
+  header.count = uint32_t(entries.size());
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(entries.data()), std::streamsize(entries.size() * sizeof(Entry)));
+  return bool(file);
+}
+
+} // namespace Stockfish::Book
@@ -0,0 +1,60 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2023 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BOOK_H_INCLUDED
+#define BOOK_H_INCLUDED
+
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+namespace Stockfish {
+
+class Position;
+
+/// The opening books are files of entries sorted by the key of their position,
+/// Position::key(), so that the terms of the variants (pockets, checks given...)
+/// are part of it. A book is memory mapped read-only, shared by the engines
+/// using it, and probed by the main thread before searching a timed game: a
+/// move of the root position is then played at once, picked at random with a
+/// probability proportional to its weight. A subvariant has a book of its own,
+/// apart from the one of its main variant. The books are set with the options
+/// "BookFile" for chess and "BookFile_<variant>" otherwise, and written with
+/// the "makebook" command.
+
+namespace Book {
+
+struct Entry {
+  Key key;
+  uint16_t move;
+  uint16_t weight;
+  uint32_t padding;
+};
+
+static_assert(sizeof(Entry) == 16, "Unexpected Entry size");
+
+void init();
+Move probe(const Position& pos);
+bool save(const std::string& path, Variant v, std::vector<Entry>& entries);
+
+} // namespace Book
+
+} // namespace Stockfish
+
+#endif // #ifndef BOOK_H_INCLUDED
@@ -0,0 +1,622 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2023 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <thread>
+
+#if !defined(_WIN32)
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "cluster.h"
+#include "misc.h"
+#include "server.h"
+#include "thread.h"
+#include "tt.h"
+#include "uci.h"
+
+using namespace std;
+
+namespace Stockfish::Cluster {
+
+std::atomic_bool Active;
+
+namespace {
+
+  // The root result of a node: the best move of its last completed iteration,
+  // and the nodes and tablebase hits of its search so far.
+  struct Result {
+    uint64_t nodes = 0, tbHits = 0;
+    Depth depth = 0;
+    Value value = VALUE_NONE;
+    Move move = MOVE_NONE;
+  };
+
+  // A Link is the connection to another node. It is written under its mutex,
+  // by the thread of the UCI commands and the main thread of the search, and
+  // read by the thread of the commands on a node, by a thread of its own on
+  // the leader. The list of the links is changed by init() and serve() under
+  // LinksMutex, which the search holds while going through it.
+  struct Link {
+    int fd;
+    mutex sendMutex, resultMutex;
+    Result result; // Of the current search of the node, on the leader
+    std::thread receiver;
+  };
+
+  vector<unique_ptr<Link>> Links;
+  mutex LinksMutex;
+  bool Node;                      // Serving a leader, with a single link to it
+  string Position;                // The "go" line of the next search, on the leader
+  std::atomic<uint32_t> SearchId; // Of the current search, echoed by the nodes
+  Result Local;                   // Of the search of this node, see report()
+  mutex LocalMutex;
+
+#if !defined(_WIN32)
+
+  void send_line(Link& link, const string& s) {
+
+    lock_guard<mutex> lk(link.sendMutex);
+
+    for (size_t sent = 0; sent < s.size(); )
+    {
+#ifdef MSG_NOSIGNAL
+        ssize_t n = ::send(link.fd, s.data() + sent, s.size() - sent, MSG_NOSIGNAL);
+#else
+        ssize_t n = ::send(link.fd, s.data() + sent, s.size() - sent, 0);
+#endif
+        if (n <= 0)
+            break; // The receiver gets the end of the connection
+
+        sent += size_t(n);
+    }
+  }
+
+  // connect_socket() connects to a node, at the path of a Unix socket or at a
+  // port with an optional host ("127.0.0.1" by default). It returns -1 on failure.
+
+  int connect_socket(const string& address) {
+
+    int fd = -1;
+
+    if (address.find('/') != string::npos)
+    {
+        sockaddr_un sa = {};
+
+        if (address.size() >= sizeof(sa.sun_path))
+            return -1;
+
+        sa.sun_family = AF_UNIX;
+        address.copy(sa.sun_path, address.size());
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd != -1 && connect(fd, (sockaddr*)&sa, sizeof(sa)))
+            ::close(fd), fd = -1;
+
+        return fd;
+    }
+
+    size_t colon = address.rfind(':');
+    string host = colon == string::npos ? "127.0.0.1" : address.substr(0, colon);
+    string port = colon == string::npos ? address : address.substr(colon + 1);
+
+    addrinfo hints = {}, *res;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res))
+        return -1;
+
+    for (addrinfo* ai = res; ai && fd == -1; ai = ai->ai_next)
+    {
+        int one = 1;
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd == -1)
+            continue;
+
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen))
+            ::close(fd), fd = -1;
+        else
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    freeaddrinfo(res);
+
+    return fd;
+  }
+
+  // stdin_quit() reads the standard input, when there is some, and tells whether
+  // it is at its end or has a "quit" line.
+
+  bool stdin_quit(string& pending) {
+
+    char buf[4096];
+    ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+    bool quit = n <= 0;
+
+    pending.append(buf, n > 0 ? size_t(n) : 0);
+
+    for (size_t eol; (eol = pending.find('\n')) != string::npos; pending.erase(0, eol + 1))
+    {
+        istringstream ls(pending.substr(0, eol));
+        string token;
+        quit |= (ls >> token) && token == "quit";
+    }
+
+    return quit;
+  }
+
+  // read_lines() calls handle() with each line received from the given socket,
+  // until the connection is closed, and returns true, or the standard input
+  // is at its end or has a "quit" line, if watched, and returns false.
+
+  template<typename F>
+  bool read_lines(int fd, bool watchStdin, F handle) {
+
+    string in, pending;
+    char buf[65536];
+
+    while (true)
+    {
+        pollfd fds[] = { { fd, POLLIN, 0 }, { STDIN_FILENO, POLLIN, 0 } };
+
+        if (poll(fds, watchStdin ? 2 : 1, -1) < 0)
+            continue; // Interrupted by a signal
+
+        if (watchStdin && fds[1].revents && stdin_quit(pending))
+            return false;
+
+        if (!fds[0].revents)
+            continue;
+
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0)
+            return true;
+
+        in.append(buf, size_t(n));
+
+        size_t start = 0;
+        for (size_t eol; (eol = in.find('\n', start)) != string::npos; start = eol + 1)
+            handle(in.substr(start, eol - start));
+        in.erase(0, start);
+    }
+  }
+
+#else
+
+  void send_line(Link&, const string&) {}
+
+#endif
+
+  // store() saves in the TT an entry received from another node, unless the
+  // TT already has a deeper one.
+
+  void store(istringstream& ls) {
+
+    Key key;
+    int move, value, eval, depth, bound;
+    TTStats stats;
+    bool found;
+
+    if (!(ls >> std::hex >> key >> std::dec >> move >> value >> eval >> depth >> bound))
+        return;
+
+    const TranspositionTable::Slice& slice = Threads.main()->ttSlice;
+    TTEntry* tte = TT.probe(slice, key, found, stats);
+    if (!found || tte->depth() < depth)
+        tte->save(key, Value(value), false, Bound(bound), Depth(depth), Move(move), Value(eval),
+                  slice.generation8);
+  }
+
+  // update() records the result line of a node, if of the current search
+
+  void update(Link& link, istringstream& ls) {
+
+    uint32_t id;
+    Result r;
+    int depth, value, move;
+
+    if (   (ls >> id >> r.nodes >> r.tbHits >> depth >> value >> move)
+        && id == SearchId)
+    {
+        r.depth = Depth(depth), r.value = Value(value), r.move = Move(move);
+
+        lock_guard<mutex> lk(link.resultMutex);
+        link.result = r;
+    }
+  }
+
+  void clear_outboxes() {
+
+    for (Thread* th : Threads)
+    {
+        lock_guard<mutex> lk(th->clusterOutbox.mutex);
+        th->clusterOutbox.entries.clear();
+    }
+  }
+
+} // namespace
+
+
+/// Cluster::init() connects the leader to the nodes of the given comma separated
+/// list of addresses, a port, host:port or the path of a Unix socket each, after
+/// closing the connections to the previous ones. "<empty>", the default of the
+/// option "Cluster Nodes", is no node. It is called when the option changes.
+
+void init(const string& nodes) {
+
+#if !defined(_WIN32)
+
+  lock_guard<mutex> lk(LinksMutex);
+
+  for (auto& link : Links)
+  {
+      shutdown(link->fd, SHUT_RDWR);
+      link->receiver.join();
+      ::close(link->fd);
+  }
+  Links.clear();
+
+  istringstream ss(nodes);
+  for (string address; getline(ss, address, ','); )
+  {
+      address.erase(std::remove(address.begin(), address.end(), ' '), address.end());
+      if (address.empty() || address == "<empty>")
+          continue;
+
+      int fd = connect_socket(address);
+      if (fd == -1)
+      {
+          sync_cout << "info string Failed to connect to cluster node " << address << sync_endl;
+          continue;
+      }
+
+      Links.push_back(make_unique<Link>());
+      Link& link = *Links.back();
+      link.fd = fd;
+      link.receiver = std::thread([&link] {
+          read_lines(link.fd, false, [&link](const string& line) {
+              istringstream ls(line);
+              string token;
+              ls >> token;
+              if (token == "t")
+                  store(ls);
+              else if (token == "r")
+                  update(link, ls);
+          });
+      });
+  }
+
+  if (!Links.empty())
+      sync_cout << "info string Cluster of " << Links.size() + 1 << " nodes" << sync_endl;
+
+#else
+
+  if (!nodes.empty())
+      sync_cout << "info string The cluster mode is not supported on Windows" << sync_endl;
+
+#endif
+}
+
+
+/// Cluster::set_position() records the variant and the arguments of the last
+/// "position" command, to be sent to the nodes with the next search.
+
+void set_position(const string& variant, bool chess960, const string& args) {
+
+  Position = variant + " " + (chess960 ? "1 " : "0 ") + args;
+}
+
+
+/// Cluster::start() is called by the main thread of the leader at the start of
+/// a search, to start an infinite search of the same position on the nodes.
+
+void start() {
+
+  lock_guard<mutex> lk(LinksMutex);
+
+  if (Links.empty() || Node)
+      return;
+
+  ++SearchId;
+  clear_outboxes();
+
+  for (auto& link : Links)
+  {
+      {
+          lock_guard<mutex> rlk(link->resultMutex);
+          link->result = Result();
+      }
+      send_line(*link, "go " + std::to_string(SearchId) + " " + Position + "\n");
+  }
+
+  Active = true;
+}
+
+
+/// Cluster::finish() stops the search of the nodes at the end of the search of
+/// the leader.
+
+void finish() {
+
+  lock_guard<mutex> lk(LinksMutex);
+
+  if (Links.empty() || Node)
+      return;
+
+  Active = false;
+
+  for (auto& link : Links)
+      send_line(*link, "stop\n");
+}
+
+
+/// Cluster::exchange() is called every few milliseconds by the timer of the
+/// search, see SearchTimer::loop(). It sends the entries of the outboxes of the
+/// threads to the other nodes, with the root result of its search on a node.
+
+void exchange() {
+
+  if (!Active.load(std::memory_order_relaxed))
+      return;
+
+  string out;
+  vector<Entry> entries;
+  char buf[96];
+
+  for (Thread* th : Threads)
+  {
+      {
+          lock_guard<mutex> lk(th->clusterOutbox.mutex);
+          entries.swap(th->clusterOutbox.entries);
+      }
+
+      for (const Entry& e : entries)
+      {
+          int n = snprintf(buf, sizeof(buf), "t %llx %d %d %d %d %d\n",
+                           (unsigned long long)e.key, e.move16, e.value16, e.eval16, e.depth16, e.bound8);
+          out.append(buf, size_t(n));
+      }
+      entries.clear();
+  }
+
+  Result local;
+  {
+      lock_guard<mutex> lk(LocalMutex);
+      local = Local;
+  }
+
+  if (Node && local.move)
+      out += "r " + std::to_string(SearchId) + " " + std::to_string(Threads.nodes_searched())
+           + " " + std::to_string(Threads.tb_hits()) + " " + std::to_string(local.depth)
+           + " " + std::to_string(local.value) + " " + std::to_string(local.move) + "\n";
+
+  lock_guard<mutex> lk(LinksMutex);
+
+  if (!out.empty())
+      for (auto& link : Links)
+          send_line(*link, out);
+}
+
+
+/// Cluster::report() records the best move of the last iteration completed by
+/// the main thread, sent to the leader by exchange() on a node.
+
+void report(Depth d, Value v, Move m) {
+
+  lock_guard<mutex> lk(LocalMutex);
+  Local.depth = d, Local.value = v, Local.move = m;
+}
+
+
+/// Cluster::vote() returns the best move of the cluster, given the one of the
+/// leader, voted for by the nodes with the same weights as in get_best_thread().
+
+Move vote(Move m, Value v, Depth d) {
+
+  lock_guard<mutex> lk(LinksMutex);
+
+  if (Links.empty() || Node)
+      return m;
+
+  vector<Result> results = { Result() };
+  results[0].move = m, results[0].value = v, results[0].depth = d;
+
+  for (auto& link : Links)
+  {
+      lock_guard<mutex> rlk(link->resultMutex);
+      if (link->result.move && link->result.depth > 0)
+          results.push_back(link->result);
+  }
+
+  Value minScore = VALUE_NONE;
+  for (const Result& r : results)
+      minScore = std::min(minScore, r.value);
+
+  map<Move, int64_t> votes;
+  for (const Result& r : results)
+      votes[r.move] += (r.value - minScore + 14) * int(r.depth);
+
+  Move best = m;
+  for (const auto& [move, n] : votes)
+      if (n > votes[best])
+          best = move;
+
+  return best;
+}
+
+
+/// Cluster::nodes_searched() and Cluster::tb_hits() return the nodes and the
+/// tablebase hits of the nodes in the current search of the leader.
+
+uint64_t nodes_searched() {
+
+  lock_guard<mutex> lk(LinksMutex);
+
+  uint64_t sum = 0;
+  for (auto& link : Links)
+  {
+      lock_guard<mutex> rlk(link->resultMutex);
+      sum += link->result.nodes;
+  }
+  return sum;
+}
+
+uint64_t tb_hits() {
+
+  lock_guard<mutex> lk(LinksMutex);
+
+  uint64_t sum = 0;
+  for (auto& link : Links)
+  {
+      lock_guard<mutex> rlk(link->resultMutex);
+      sum += link->result.tbHits;
+  }
+  return sum;
+}
+
+
+/// Cluster::serve() is called when the engine receives the "cluster <address>"
+/// command, with a port, host:port or the path of a Unix socket as address. The
+/// engine is then a node of a cluster: it waits for a connection of the leader,
+/// and searches the positions it is given until the leader stops it, sending
+/// its results as it goes along, until the leader disconnects. The node serves
+/// the next leader after that, and stops on a "quit" line or at the end of the
+/// standard input unless watchStdin is false.
+
+#if defined(_WIN32)
+
+void serve(std::istream&, bool) {
+  sync_cout << "info string The cluster mode is not supported on Windows" << sync_endl;
+}
+
+#else
+
+void serve(std::istream& args, bool watchStdin) {
+
+  string address, pending;
+  args >> address;
+
+  int listenFd = Server::open_socket(address);
+  if (listenFd == -1)
+  {
+      sync_cout << "info string Failed to listen on " << address << sync_endl;
+      return;
+  }
+
+  sync_cout << "info string Cluster node listening on " << address << sync_endl;
+
+  init(""); // A node leads no other nodes
+  Node = true;
+
+  auto stop_search = [] {
+      Active = false;
+      Threads.stop = true;
+      Threads.main()->wait_for_search_finished();
+  };
+
+  bool quit = false;
+
+  while (!quit)
+  {
+      pollfd fds[] = { { listenFd, POLLIN, 0 }, { STDIN_FILENO, POLLIN, 0 } };
+
+      if (poll(fds, watchStdin ? 2 : 1, -1) < 0)
+          continue;
+
+      if (watchStdin && fds[1].revents && stdin_quit(pending))
+          break;
+
+      int fd = accept(listenFd, nullptr, nullptr);
+      if (fd == -1)
+          continue;
+
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef SO_NOSIGPIPE
+      setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+      {
+          lock_guard<mutex> lk(LinksMutex);
+          Links.push_back(make_unique<Link>());
+          Links.back()->fd = fd;
+      }
+
+      sync_cout << "info string Cluster leader connected" << sync_endl;
+
+      quit = !read_lines(fd, watchStdin, [&](const string& line) {
+          istringstream ls(line);
+          string token, variant, position;
+          int chess960;
+          ls >> token;
+
+          if (token == "t")
+              store(ls);
+
+          else if (token == "go")
+          {
+              stop_search();
+
+              uint32_t id;
+              ls >> id >> variant >> chess960;
+              SearchId = id;
+              getline(ls >> std::ws, position);
+
+              Options["UCI_Chess960"] = string(chess960 ? "true" : "false");
+              report(0, VALUE_NONE, MOVE_NONE);
+              clear_outboxes();
+              Active = true;
+              UCI::start_search(Threads, UCI::variant_from_name(variant), position, "infinite", now());
+          }
+          else if (token == "stop")
+          {
+              Active = false;
+              Threads.stop = true;
+          }
+      });
+
+      stop_search();
+      {
+          lock_guard<mutex> lk(LinksMutex);
+          Links.clear();
+      }
+      ::close(fd);
+
+      sync_cout << "info string Cluster leader disconnected" << sync_endl;
+  }
+
+  Node = false;
+  ::close(listenFd);
+
+  if (address.find('/') != string::npos)
+      unlink(address.c_str());
+}
+
+#endif
+
+} // namespace Stockfish::Cluster
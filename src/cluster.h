@@ -0,0 +1,91 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2023 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CLUSTER_H_INCLUDED
+#define CLUSTER_H_INCLUDED
+
+#include <atomic>
+#include <istream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+namespace Stockfish {
+
+class Thread;
+
+/// The cluster mode extends the search of a position over several engines, on
+/// different machines, connected by TCP. The engine given the nodes in the
+/// option "Cluster Nodes" leads: its searches are run by all the nodes, each on
+/// its own threads, which periodically exchange their deep TT entries and send
+/// their root result, the best move being voted for by the whole cluster. The
+/// nodes are engines waiting for the leader with the "cluster <address>" command.
+
+namespace Cluster {
+
+// Entries of at least this depth are sent to the other nodes
+constexpr Depth MinDepth = 6;
+
+struct Entry {
+  Key key;
+  int16_t value16, eval16;
+  int16_t depth16;
+  uint8_t bound8;
+  uint16_t move16;
+};
+
+// Outbox holds the entries saved by a thread until they are sent by the timer
+// of the search, see exchange().
+struct Outbox {
+  static constexpr size_t Capacity = 256;
+  std::mutex mutex;
+  std::vector<Entry> entries;
+};
+
+extern std::atomic_bool Active; // Connected to other nodes, and searching
+
+void init(const std::string& nodes);
+void serve(std::istream& args, bool watchStdin);
+void set_position(const std::string& variant, bool chess960, const std::string& args);
+void start();
+void finish();
+void exchange();
+void report(Depth d, Value v, Move m);
+Move vote(Move m, Value v, Depth d);
+uint64_t nodes_searched();
+uint64_t tb_hits();
+
+// save() queues an entry just saved in the TT by the given thread, to be sent to
+// the other nodes if it is deep enough and the outbox is not full.
+inline void save(Outbox& box, Key k, Value v, Bound b, Depth d, Move m, Value ev) {
+
+  if (!Active.load(std::memory_order_relaxed) || d < MinDepth || v == VALUE_NONE)
+      return;
+
+  std::lock_guard<std::mutex> lk(box.mutex);
+  if (box.entries.size() < Outbox::Capacity)
+      box.entries.push_back({ k, int16_t(v), int16_t(ev), int16_t(d), uint8_t(b), uint16_t(m) });
+}
+
+} // namespace Cluster
+
+} // namespace Stockfish
+
+#endif // #ifndef CLUSTER_H_INCLUDED
@@ -0,0 +1,610 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2023 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+
+#include "misc.h"
+#include "movegen.h"
+#include "position.h"
+#include "search.h"
+#include "thread.h"
+#include "tt.h"
+#include "tune.h"
+#include "uci.h"
+#include "nnue/evaluate_nnue.h"
+
+namespace Stockfish {
+
+using namespace Search;
+
+namespace {
+
+  // The self-play games of generate_training_data are written to a single file
+  // in chunks of the entries of complete games, see Thread::self_play()
+  std::ofstream DatagenFile;
+  std::mutex DatagenMutex;
+  std::atomic<int64_t> DatagenPositions, DatagenGames;
+  TimePoint DatagenStart;
+
+  void write_entries(std::vector<TrainingEntry>& entries) {
+
+    if (entries.empty())
+        return;
+
+    std::lock_guard<std::mutex> lk(DatagenMutex);
+
+    DatagenFile.write(reinterpret_cast<const char*>(entries.data()),
+                      std::streamsize(entries.size() * sizeof(TrainingEntry)));
+    entries.clear();
+
+    TimePoint elapsed = now() - DatagenStart + 1;
+    sync_cout << "info string positions " << DatagenPositions << " games " << DatagenGames
+              << " time " << elapsed << " pps " << DatagenPositions * 1000 / elapsed << sync_endl;
+  }
+
+  // The SPSA tuning plays, for each iteration, two rounds of one game per thread
+  // between the parameters shifted up and down, all the games moving in
+  // lockstep as the parameters are global, see Search::spsa()
+  constexpr int SpsaPlaying = 2;
+
+  struct SpsaGame {
+    Position pos; // The current position of the game, on its states
+    std::deque<StateInfo> states;
+    Color plusColor;
+    int result; // For the parameters shifted up, or SpsaPlaying
+  };
+
+  std::deque<SpsaGame> SpsaGames;
+  std::string SpsaStartFen;
+  bool SpsaChess960;
+  Variant SpsaVariant;
+  uint64_t SpsaSeed; // Of the random plies of the games of the iteration
+  bool SpsaPlus;     // The parameters shifted up are set
+
+  // The positions of analyse, as FENs with the id of their EPD operations or as
+  // a file of packed positions, are taken one by one by the threads, see
+  // Thread::analyse()
+  struct AnalyseItem {
+    std::string fen, id;
+  };
+
+  std::vector<AnalyseItem> AnalyseItems;
+  const PackedPosition* AnalysePacked;
+  size_t AnalysePackedSize, AnalyseCount;
+  std::atomic<size_t> AnalyseNext;
+  std::atomic<uint64_t> AnalyseNodes;
+
+  bool load_analyse_file(const std::string& path) {
+
+    AnalyseItems.clear();
+    AnalysePacked = nullptr;
+
+    if (path.size() > 5 && path.compare(path.size() - 5, 5, ".pack") == 0)
+    {
+        AnalysePacked = static_cast<const PackedPosition*>(map_file(path, AnalysePackedSize));
+        AnalyseCount = AnalysePacked ? AnalysePackedSize / sizeof(PackedPosition) : 0;
+        return AnalysePacked;
+    }
+
+    std::ifstream file(path);
+    std::string line, token;
+
+    while (std::getline(file, line))
+    {
+        std::istringstream is(line);
+        AnalyseItem item;
+
+        // The 4 fields of an EPD, followed by the move counters and check counts
+        // of a FEN if any, then by the EPD operations.
+        for (int i = 0; i < 4 && is >> token; ++i)
+            item.fen += (i ? " " : "") + token;
+
+        std::streampos ops = is.tellg();
+        while (   is >> token
+               && token.find_first_not_of("0123456789+") == std::string::npos)
+            item.fen += " " + token, ops = is.tellg();
+
+        if (item.fen.empty() || item.fen[0] == '#')
+            continue;
+
+        size_t id = line.find("id \"", ops == std::streampos(-1) ? line.size() : size_t(ops));
+        if (id != std::string::npos)
+            item.id = line.substr(id + 4, line.find('"', id + 4) - id - 4);
+
+        AnalyseItems.push_back(item);
+    }
+
+    AnalyseCount = AnalyseItems.size();
+    return file.eof();
+  }
+
+} // namespace
+
+
+/// MainThread::generate_data() plays independent self-play games on all the
+/// threads until the requested number of positions is written or a stop
+/// command, see Thread::self_play().
+
+void MainThread::generate_data() {
+
+#ifdef USE_NNUE
+  Eval::NNUE::verify(rootPos.variant());
+#endif
+  DatagenFile.open(pool.limits.datagenFile, std::ios::binary | std::ios::app);
+  if (!DatagenFile)
+  {
+      sync_cout << "info string Unable to open file " << pool.limits.datagenFile << sync_endl;
+      return;
+  }
+
+  DatagenPositions = DatagenGames = 0;
+  DatagenStart = now();
+
+  pool.start_searching(); // start non-main threads
+  Thread::search();       // main thread plays games too
+  pool.wait_for_search_finished();
+
+  DatagenFile.close();
+  sync_cout << "info string Generated " << DatagenPositions << " positions in "
+            << DatagenGames << " games to " << pool.limits.datagenFile << sync_endl;
+}
+
+
+/// MainThread::analyse_file() analyses a file of positions, each with a search
+/// of its own by one of the threads, printed as a JSON line as soon as it is
+/// done, see Thread::analyse().
+
+void MainThread::analyse_file() {
+
+  if (!load_analyse_file(pool.limits.analyseFile))
+  {
+      sync_cout << "info string Unable to read file " << pool.limits.analyseFile << sync_endl;
+      return;
+  }
+
+#ifdef USE_NNUE
+  bool verified[VARIANT_NB] = {};
+  for (size_t i = 0; AnalysePacked && i < AnalyseCount; ++i)
+      verified[main_variant(Variant(AnalysePacked[i].variant))] = true;
+  verified[rootPos.variant()] |= !AnalysePacked;
+
+  for (Variant v = CHESS_VARIANT; v < VARIANT_NB; ++v)
+      if (verified[v])
+          Eval::NNUE::verify(v);
+#endif
+
+  AnalyseNext = 0;
+  AnalyseNodes = 0;
+  TimePoint elapsed = now();
+
+  pool.start_searching(); // start non-main threads
+  Thread::search();       // main thread analyses positions too
+  pool.wait_for_search_finished();
+  elapsed = now() - elapsed + 1;
+
+  unmap_file(AnalysePacked, AnalysePackedSize);
+  AnalysePacked = nullptr;
+  AnalyseItems.clear();
+
+  sync_cout << "info string Analysed " << std::min(size_t(AnalyseNext), AnalyseCount)
+            << " positions in " << elapsed << " ms, nodes " << AnalyseNodes
+            << " nps " << AnalyseNodes * 1000 / elapsed << sync_endl;
+}
+
+
+/// Thread::analyse() takes the positions of the analysis file one by one and
+/// prints the result of the search of each as a JSON line, with the index of
+/// the position in the file.
+
+void Thread::analyse() {
+
+  const bool chess960 = rootPos.is_chess960();
+  const Variant variant = rootPos.subvariant();
+
+  ownSearch = true;
+
+  for (size_t i; !pool.stop && (i = AnalyseNext++) < AnalyseCount; )
+  {
+      if (AnalysePacked)
+          rootPos.set_packed(AnalysePacked[i], &rootState, this);
+      else
+          rootPos.set(AnalyseItems[i].fen, chess960, variant, &rootState, this);
+
+      MoveList<LEGAL> moves(rootPos);
+      std::stringstream ss;
+
+      ss << "{\"index\":" << i;
+      if (!AnalysePacked && !AnalyseItems[i].id.empty())
+          ss << ",\"id\":\"" << AnalyseItems[i].id << "\"";
+      ss << ",\"fen\":\"" << rootPos.fen() << "\"";
+
+      Value score;
+      if (rootPos.is_variant_end() || !moves.size())
+      {
+          score = rootPos.is_variant_end() ? rootPos.variant_result()
+                 : rootPos.checkers() ? rootPos.checkmate_value()
+                 : rootPos.stalemate_value();
+          rootMoves.clear();
+          rootMoves.emplace_back(MOVE_NONE);
+          ownStartTime = now();
+          nodes = completedDepth = 0;
+      }
+      else
+      {
+          own_search(moves);
+          if (pool.stop)
+              break;
+          score = rootMoves[0].score;
+      }
+
+      const std::string value = UCI::value(score);
+      const size_t space = value.find(' ');
+
+      ss << ",\"bestmove\":\"" << UCI::move(rootMoves[0].pv[0], rootPos.is_chess960()) << "\""
+         << ",\"score\":{\"" << value.substr(0, space) << "\":" << value.substr(space + 1) << "}"
+         << ",\"depth\":" << completedDepth
+         << ",\"pv\":\"";
+      for (size_t j = 0; j < rootMoves[0].pv.size() && rootMoves[0].pv[j] != MOVE_NONE; ++j)
+          ss << (j ? " " : "") << UCI::move(rootMoves[0].pv[j], rootPos.is_chess960());
+      ss << "\",\"nodes\":" << nodes
+         << ",\"time\":" << now() - ownStartTime << "}";
+
+      AnalyseNodes += nodes;
+      sync_cout << ss.str() << sync_endl;
+  }
+
+  ownSearch = false;
+}
+
+
+/// Thread::own_search() searches the root position on this thread only, within
+/// the depth, nodes and movetime limits, see Thread::check_own_limits().
+
+void Thread::own_search(const MoveList<LEGAL>& moves) {
+
+  rootMoves.clear();
+  for (const auto& m : moves)
+      rootMoves.emplace_back(m);
+
+  nodes = nmpMinPly = bestMoveChanges = 0;
+  rootDepth = completedDepth = 0;
+  ownStop = false;
+  ownCallsCnt = 0;
+  ownStartTime = now();
+
+  iterative_deepening();
+}
+
+
+/// Thread::self_play() plays games from the root position with a search of
+/// fixed depth, nodes or movetime per move, after a few random moves, until
+/// enough positions have been generated. The positions not in check whose best
+/// move is not a capture are stored with the score of their search and the
+/// game result, and written once the game is over, in chunks per thread. A
+/// game is adjudicated as soon as a mate or tablebase score is found.
+
+void Thread::self_play() {
+
+  constexpr size_t ChunkSize = 4096;
+  constexpr int MaxGamePly = 400;
+
+  PRNG rng(uint64_t(now()) ^ (0x9E3779B97F4A7C15ULL * (idx + 1)));
+  const std::string startFen = rootPos.fen();
+  const bool chess960 = rootPos.is_chess960();
+  const Variant variant = rootPos.subvariant();
+
+  std::deque<StateInfo> states;
+  std::vector<TrainingEntry> entries, game;
+
+  ownSearch = true;
+
+  while (!pool.stop && DatagenPositions < pool.limits.datagen)
+  {
+      states.clear();
+      rootPos.set(startFen, chess960, variant, &states.emplace_back(), this);
+      game.clear();
+
+      for (int i = 0; i < pool.limits.randomPlies && !rootPos.is_variant_end(); ++i)
+      {
+          MoveList<LEGAL> moves(rootPos);
+          if (!moves.size())
+              break;
+          rootPos.do_move(*(moves.begin() + rng.rand<uint64_t>() % moves.size()), states.emplace_back());
+      }
+
+      Value result;
+      while (true)
+      {
+          MoveList<LEGAL> moves(rootPos);
+
+          if (rootPos.is_variant_end())
+              result = rootPos.variant_result();
+          else if (!moves.size())
+              result = rootPos.checkers() ? rootPos.checkmate_value() : rootPos.stalemate_value();
+          else if (rootPos.is_draw(0) || rootPos.game_ply() >= MaxGamePly)
+              result = VALUE_DRAW;
+          else
+              result = VALUE_NONE;
+
+          if (result != VALUE_NONE)
+              break;
+
+          own_search(moves);
+
+          if (pool.stop)
+              break;
+
+          const Move best = rootMoves[0].pv[0];
+          const Value score = rootMoves[0].score;
+
+          if (std::abs(score) >= VALUE_TB_WIN_IN_MAX_PLY)
+          {
+              result = score;
+              break;
+          }
+
+          if (!rootPos.checkers() && !rootPos.capture(best))
+              game.push_back({ rootPos.pack(), int16_t(score), uint16_t(best), 0, {} });
+
+          rootPos.do_move(best, states.emplace_back());
+      }
+
+      // An interrupted game is dropped
+      if (pool.stop)
+          break;
+
+      // The result is from the point of view of the side to move at the end of
+      // the game, turned into the one of white, then of the side of each entry.
+      const int us = (result > VALUE_DRAW) - (result < VALUE_DRAW);
+      const int white = rootPos.side_to_move() == WHITE ? us : -us;
+
+      for (TrainingEntry& e : game)
+      {
+          e.result = int8_t((e.pos.flags & 1) == WHITE ? white : -white);
+          entries.push_back(e);
+      }
+
+      DatagenPositions += int64_t(game.size());
+      ++DatagenGames;
+
+      if (entries.size() >= ChunkSize)
+          write_entries(entries);
+  }
+
+  write_entries(entries);
+  ownSearch = false;
+
+  // Do not leave the root position on the states of the last game
+  rootPos.set(startFen, chess960, variant, &rootState, this);
+}
+
+
+/// Search::spsa() tunes the parameters flagged with TUNE() by the SPSA method
+/// with the gains of fishtest. In each iteration, the parameters are shifted up
+/// and down by a random perturbation, and two rounds of one game per thread are
+/// played between them from the given position, after a few random plies, the
+/// colors being swapped between the rounds. The parameters are then moved in
+/// the direction of the winning side, and written with the score of the
+/// iteration as a CSV line of the output file. It runs on the UCI thread, which
+/// sets the parameters while no search is running, and returns, as bench does,
+/// once all the iterations are played.
+
+void Search::spsa(Position& pos, StateListPtr& states, const LimitsType& limits) {
+
+  constexpr double Alpha = 0.602, Gamma = 0.101, REnd = 0.002;
+
+  const std::vector<Tune::Param>& params = Tune::params();
+  if (params.empty())
+  {
+      sync_cout << "info string No parameters to tune, flag them with TUNE()" << sync_endl;
+      return;
+  }
+
+  std::ofstream file(limits.spsaFile, std::ios::app);
+  if (!file)
+  {
+      sync_cout << "info string Unable to open file " << limits.spsaFile << sync_endl;
+      return;
+  }
+
+#ifdef USE_NNUE
+  Eval::NNUE::verify(pos.variant());
+#endif
+
+  const size_t n = params.size();
+  const int iterations = limits.spsa;
+  const double A = 0.1 * iterations;
+  PRNG rng(now());
+
+  std::vector<double> theta(n), cEnd(n);
+  std::vector<int> plus(n), minus(n), flip(n), values(n);
+
+  file << "iteration,score";
+  for (size_t i = 0; i < n; ++i)
+  {
+      theta[i] = int(Options[params[i].name]);
+      cEnd[i] = (params[i].max - params[i].min) / 20.0;
+      file << "," << params[i].name;
+  }
+  file << std::endl;
+
+  SpsaStartFen = pos.fen();
+  SpsaChess960 = pos.is_chess960();
+  SpsaVariant = pos.subvariant();
+  SpsaGames.clear();
+  for (size_t i = 0; i < Threads.size(); ++i)
+      SpsaGames.emplace_back();
+
+  for (int k = 0; k < iterations; ++k)
+  {
+      for (size_t i = 0; i < n; ++i)
+      {
+          double c = cEnd[i] * std::pow(iterations, Gamma) / std::pow(k + 1, Gamma);
+          flip[i] = rng.rand<uint64_t>() & 1 ? 1 : -1;
+          plus[i]  = std::clamp(int(std::lround(theta[i] + c * flip[i])), params[i].min, params[i].max);
+          minus[i] = std::clamp(int(std::lround(theta[i] - c * flip[i])), params[i].min, params[i].max);
+      }
+
+      SpsaSeed = rng.rand<uint64_t>() | 1;
+      int score = 0;
+
+      for (int round = 0; round < 2; ++round)
+      {
+          for (size_t i = 0; i < SpsaGames.size(); ++i)
+          {
+              SpsaGames[i].states.clear();
+              SpsaGames[i].plusColor = Color((i + round) & 1);
+              SpsaGames[i].result = SpsaPlaying;
+          }
+
+          // The games of a round start from a clear TT and clear histories
+          Threads.clear();
+          TT.clear_slice(Threads.ttIdx, Threads.ttSlices);
+
+          // Each side of the games moves with its parameters set, by a search
+          // of all the threads, each one playing the move of its own game.
+          while (std::any_of(SpsaGames.begin(), SpsaGames.end(),
+                             [](const SpsaGame& g) { return g.result == SpsaPlaying; }))
+              for (bool side : { true, false })
+              {
+                  SpsaPlus = side;
+                  Tune::set(side ? plus : minus);
+                  Threads.start_thinking(pos, states, limits);
+                  Threads.main()->wait_for_search_finished();
+              }
+
+          for (const SpsaGame& game : SpsaGames)
+              score += game.result;
+      }
+
+      for (size_t i = 0; i < n; ++i)
+      {
+          double c = cEnd[i] * std::pow(iterations, Gamma) / std::pow(k + 1, Gamma);
+          double a = REnd * cEnd[i] * cEnd[i] * std::pow(A + iterations, Alpha) / std::pow(A + k + 1, Alpha);
+          theta[i] = std::clamp(theta[i] + a / c * score * flip[i], double(params[i].min), double(params[i].max));
+      }
+
+      file << k + 1 << "," << score;
+      for (size_t i = 0; i < n; ++i)
+          file << "," << theta[i];
+      file << std::endl;
+
+      sync_cout << "info string spsa iteration " << k + 1 << " games " << 2 * (k + 1) * Threads.size()
+                << " score " << score << sync_endl;
+  }
+
+  std::stringstream ss;
+  for (size_t i = 0; i < n; ++i)
+  {
+      values[i] = int(std::lround(theta[i]));
+      ss << " " << params[i].name << " " << values[i];
+  }
+
+  Tune::set(values);
+  sync_cout << "info string spsa" << ss.str() << sync_endl;
+
+  // Do not leave the root positions on the states of the last games
+  for (Thread* th : Threads)
+      th->rootPos.set(SpsaStartFen, SpsaChess960, SpsaVariant, &th->rootState, th);
+}
+
+
+/// Thread::spsa_move() plays a move of the SPSA game of the thread, if its side
+/// to move has the parameters which are set. A game is started after a few
+/// random plies, the same for both rounds of an iteration, and is adjudicated
+/// as soon as a mate or tablebase score is found.
+
+void Thread::spsa_move() {
+
+  constexpr int MaxGamePly = 400;
+
+  SpsaGame& game = SpsaGames[idx];
+  if (game.result != SpsaPlaying)
+      return;
+
+  if (game.states.empty())
+  {
+      PRNG rng(SpsaSeed ^ (0x9E3779B97F4A7C15ULL * (idx + 1)));
+      game.pos.set(SpsaStartFen, SpsaChess960, SpsaVariant, &game.states.emplace_back(), this);
+
+      for (int i = 0; i < pool.limits.randomPlies && !game.pos.is_variant_end(); ++i)
+      {
+          MoveList<LEGAL> moves(game.pos);
+          if (!moves.size())
+              break;
+          game.pos.do_move(*(moves.begin() + rng.rand<uint64_t>() % moves.size()), game.states.emplace_back());
+      }
+  }
+
+  if ((game.pos.side_to_move() == game.plusColor) != SpsaPlus)
+      return;
+
+  MoveList<LEGAL> moves(game.pos);
+  Value result =  game.pos.is_variant_end() ? game.pos.variant_result()
+                : !moves.size() ? (game.pos.checkers() ? game.pos.checkmate_value() : game.pos.stalemate_value())
+                : game.pos.is_draw(0) || game.pos.game_ply() >= MaxGamePly ? VALUE_DRAW
+                : VALUE_NONE;
+
+  if (result == VALUE_NONE)
+  {
+      // The root position, set up again by each search, is a copy of the game
+      rootPos.clone(game.pos, &rootState, this);
+
+      ownSearch = true;
+      own_search(moves);
+      ownSearch = false;
+
+      if (pool.stop)
+          return;
+
+      if (std::abs(rootMoves[0].score) >= VALUE_TB_WIN_IN_MAX_PLY)
+          result = rootMoves[0].score;
+      else
+          game.pos.do_move(rootMoves[0].pv[0], game.states.emplace_back());
+  }
+
+  if (result != VALUE_NONE)
+      game.result =  ((result > VALUE_DRAW) - (result < VALUE_DRAW))
+                   * (game.pos.side_to_move() == game.plusColor ? 1 : -1);
+}
+
+
+/// Thread::check_own_limits() checks the time and nodes limits of a thread
+/// searching a position of its own, see Thread::own_search(). The search is never stopped before the
+/// first iteration is completed, so that there is a best move.
+
+void Thread::check_own_limits() {
+
+  if (--ownCallsCnt > 0)
+      return;
+
+  ownCallsCnt = pool.limits.nodes ? std::min(1024, int(pool.limits.nodes / 1024)) : 1024;
+
+  if (   completedDepth >= 1
+      && (   (pool.limits.movetime && now() - ownStartTime >= pool.limits.movetime)
+          || (pool.limits.nodes && nodes >= (uint64_t)pool.limits.nodes)))
+      ownStop = true;
+}
+
+} // namespace Stockfish
@@ -0,0 +1,131 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2023 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Entry point of a dispatch build ("make dispatch-build"). The executable holds
+// a copy of the whole engine per architecture of DISPATCH_ARCHS, each compiled
+// in its own namespace and partially linked with only its entry point left
+// global. The static initializers of a copy are moved to its own section, so
+// that only those of the copy selected from CPUID at startup are ever run.
+
+#include <cstdlib>
+#include <iostream>
+
+#if defined(USE_NNUE) && !defined(NNUE_EMBEDDING_OFF)
+#include "evaluate.h"
+#include "incbin/incbin.h"
+
+// The default network is embedded once and shared by all the copies
+INCBIN(EmbeddedNNUE, EvalFileDefaultName);
+#endif
+
+namespace {
+
+typedef void (*Initializer)();
+
+struct EngineCopy {
+  const char* arch;
+  bool (*supported)();
+  int (*main)(int argc, char* argv[]);
+  Initializer* initBegin;
+  Initializer* initEnd;
+};
+
+} // namespace
+
+// Declare the entry point and the static initializers of a copy
+#define DISPATCH_DECLARE(name) \
+  extern "C" int dispatch_main_##name(int argc, char* argv[]); \
+  extern "C" Initializer __start_dispatch_init_##name[], __stop_dispatch_init_##name[];
+
+#define DISPATCH_COPY(name, arch, test) \
+  { arch, [] { return bool(test); }, dispatch_main_##name, \
+    __start_dispatch_init_##name, __stop_dispatch_init_##name },
+
+// Zen 1 and Zen 2 implement pext in microcode, slower than the fallback
+#define HAS_FAST_PEXT \
+  (__builtin_cpu_supports("bmi2") && !__builtin_cpu_is("znver1") && !__builtin_cpu_is("znver2"))
+
+#define HAS_AVX512 \
+  (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+
+#define HAS_VNNI512 \
+  (HAS_AVX512 && __builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512dq") \
+              && __builtin_cpu_supports("avx512vl"))
+
+#ifdef DISPATCH_x86_64_vnni512
+DISPATCH_DECLARE(x86_64_vnni512)
+#endif
+#ifdef DISPATCH_x86_64_avx512
+DISPATCH_DECLARE(x86_64_avx512)
+#endif
+#ifdef DISPATCH_x86_64_bmi2
+DISPATCH_DECLARE(x86_64_bmi2)
+#endif
+#ifdef DISPATCH_x86_64_avx2
+DISPATCH_DECLARE(x86_64_avx2)
+#endif
+#ifdef DISPATCH_x86_64_sse41_popcnt
+DISPATCH_DECLARE(x86_64_sse41_popcnt)
+#endif
+#ifdef DISPATCH_x86_64
+DISPATCH_DECLARE(x86_64)
+#endif
+
+namespace {
+
+// The copies, from the most to the least demanding architecture
+const EngineCopy Copies[] = {
+#ifdef DISPATCH_x86_64_vnni512
+  DISPATCH_COPY(x86_64_vnni512, "x86-64-vnni512", HAS_VNNI512 && HAS_FAST_PEXT)
+#endif
+#ifdef DISPATCH_x86_64_avx512
+  DISPATCH_COPY(x86_64_avx512, "x86-64-avx512", HAS_AVX512 && HAS_FAST_PEXT)
+#endif
+#ifdef DISPATCH_x86_64_bmi2
+  DISPATCH_COPY(x86_64_bmi2, "x86-64-bmi2", __builtin_cpu_supports("avx2") && HAS_FAST_PEXT)
+#endif
+#ifdef DISPATCH_x86_64_avx2
+  DISPATCH_COPY(x86_64_avx2, "x86-64-avx2", __builtin_cpu_supports("avx2"))
+#endif
+#ifdef DISPATCH_x86_64_sse41_popcnt
+  DISPATCH_COPY(x86_64_sse41_popcnt, "x86-64-sse41-popcnt",
+                __builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("popcnt"))
+#endif
+#ifdef DISPATCH_x86_64
+  DISPATCH_COPY(x86_64, "x86-64", true)
+#endif
+};
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+
+  __builtin_cpu_init();
+
+  for (const EngineCopy& copy : Copies)
+      if (copy.supported())
+      {
+          for (Initializer* init = copy.initBegin; init < copy.initEnd; ++init)
+              (*init)();
+
+          return copy.main(argc, argv);
+      }
+
+  std::cerr << "No engine copy of this build supports the CPU" << std::endl;
+  return EXIT_FAILURE;
+}
@@ -19,10 +19,9 @@
 #ifndef ENDGAME_H_INCLUDED
 #define ENDGAME_H_INCLUDED
 
-#include <memory>
+#include <cassert>
 #include <string>
 #include <type_traits>
-#include <unordered_map>
 #include <utility>
 
 #include "position.h"
@@ -78,57 +77,102 @@ template<Variant V, EndgameCode E> using
 eg_type = typename std::conditional<(E < SCALING_FUNCTIONS), Value, ScaleFactor>::type;
 
 
-/// Base and derived functors for endgame evaluation and scaling functions
+/// Base and derived functors for endgame evaluation and scaling functions. The
+/// base is a plain value holding a pointer to the function of the derived type,
+/// so that it can be stored by value and called without virtual dispatch.
 
 template<typename T>
 struct EndgameBase {
 
-  explicit EndgameBase(Color c) : strongSide(c), weakSide(~c) {}
-  virtual ~EndgameBase() = default;
-  virtual T operator()(const Position&) const = 0;
+  using Function = T (*)(const EndgameBase&, const Position&);
 
-  const Color strongSide, weakSide;
+  EndgameBase() = default;
+  EndgameBase(Function f, Color c) : function(f), strongSide(c), weakSide(~c) {}
+  T operator()(const Position& pos) const { return function(*this, pos); }
+
+  Function function = nullptr;
+  Color strongSide, weakSide;
 };
 
 
 template<Variant V, EndgameCode E, typename T = eg_type<V, E>>
 struct Endgame : public EndgameBase<T> {
 
-  explicit Endgame(Color c) : EndgameBase<T>(c) {}
-  T operator()(const Position&) const override;
+  explicit Endgame(Color c) : EndgameBase<T>(call, c) {}
+  T operator()(const Position&) const;
+
+private:
+  static T call(const EndgameBase<T>& eg, const Position& pos) { return Endgame(eg.strongSide)(pos); }
 };
 
 
-/// The Endgames namespace handles the pointers to endgame evaluation and scaling
-/// base objects in two std::map. We use polymorphism to invoke the actual
-/// endgame function by calling its virtual operator().
+/// The Endgames namespace handles the endgame evaluation and scaling functions
+/// in two flat, open-addressed tables keyed by the material key, which also
+/// encodes the variant. Set up at init, they are read only afterwards.
 
 namespace Endgames {
 
-  template<typename T> using Ptr = std::unique_ptr<EndgameBase<T>>;
-  template<typename T> using Map = std::unordered_map<Key, Ptr<T>>;
+  template<typename T>
+  struct Table {
+
+    static constexpr size_t Size = 128; // At most half full, see add()
+
+    struct Entry {
+      Key key;
+      EndgameBase<T> endgame;
+    };
 
-  extern std::pair<Map<Value>, Map<ScaleFactor>> maps;
+    Entry entries[Size];
+    size_t count;
+  };
+
+  extern std::pair<Table<Value>, Table<ScaleFactor>> tables;
 
   void init();
 
   template<typename T>
-  Map<T>& map() {
-    return std::get<std::is_same<T, ScaleFactor>::value>(maps);
+  Table<T>& table() {
+    return std::get<std::is_same<T, ScaleFactor>::value>(tables);
+  }
+
+  // The probes are bounded by the size of the table, so that a full one, if
+  // more endgames were ever added than it holds, fails them instead of looping.
+
+  template<typename T>
+  void insert(Key key, const EndgameBase<T>& endgame) {
+
+    Table<T>& t = table<T>();
+    size_t i = key & (t.Size - 1);
+
+    assert(t.count < t.Size / 2);
+
+    for (size_t n = 0; t.entries[i].endgame.function && t.entries[i].key != key; i = (i + 1) & (t.Size - 1))
+        if (++n == t.Size)
+            return;
+
+    t.count += !t.entries[i].endgame.function;
+    t.entries[i] = { key, endgame };
   }
 
   template<Variant V, EndgameCode E, typename T = eg_type<V, E>>
   void add(const std::string& code) {
 
     StateInfo st;
-    map<T>()[Position().set(code, WHITE, V, &st).material_key()] = Ptr<T>(new Endgame<V, E>(WHITE));
-    map<T>()[Position().set(code, BLACK, V, &st).material_key()] = Ptr<T>(new Endgame<V, E>(BLACK));
+    insert<T>(Position().set(code, WHITE, V, &st).material_key(), Endgame<V, E>(WHITE));
+    insert<T>(Position().set(code, BLACK, V, &st).material_key(), Endgame<V, E>(BLACK));
   }
 
   template<typename T>
   const EndgameBase<T>* probe(Key key) {
-    auto it = map<T>().find(key);
-    return it != map<T>().end() ? it->second.get() : nullptr;
+
+    const Table<T>& t = table<T>();
+    size_t i = key & (t.Size - 1);
+
+    for (size_t n = 0; n < t.Size && t.entries[i].endgame.function; ++n, i = (i + 1) & (t.Size - 1))
+        if (t.entries[i].key == key)
+            return &t.entries[i].endgame;
+
+    return nullptr;
   }
 }
 
@@ -22,6 +22,7 @@
 #include <cstring>   // For std::memset
 #include <fstream>
 #include <iomanip>
+#include <mutex>
 #include <sstream>
 #include <iostream>
 #include <streambuf>
@@ -47,7 +48,12 @@
 // Note that this does not work in Microsoft Visual Studio.
 #ifdef USE_NNUE
 #if !defined(_MSC_VER) && !defined(NNUE_EMBEDDING_OFF)
+#if defined(DISPATCH_ENTRY)
+  // In a dispatch build the network is embedded once, by dispatch.cpp
+  INCBIN_EXTERN(EmbeddedNNUE);
+#else
   INCBIN(EmbeddedNNUE, EvalFileDefaultName);
+#endif
 #else
   const unsigned char        gEmbeddedNNUEData[1] = {0x0};
   const unsigned char *const gEmbeddedNNUEEnd = &gEmbeddedNNUEData[1];
@@ -64,25 +70,42 @@ namespace Stockfish {
 namespace Eval {
 
   bool useNNUE;
-  string currentEvalFileName = "None";
+  bool nnueAvailable[VARIANT_NB];
+  string currentEvalFileName[VARIANT_NB] = { "None" };
 
-  /// NNUE::init() tries to load a NNUE network at startup time, or when the engine
-  /// receives a UCI command "setoption name EvalFile value nn-[a-z0-9]{12}.nnue"
-  /// The name of the NNUE network is always retrieved from the EvalFile option.
-  /// We search the given network in three locations: internally (the default
-  /// network may be embedded in the binary), in the active working directory and
-  /// in the engine directory. Distro packagers may define the DEFAULT_NNUE_DIRECTORY
-  /// variable to have the engine search in a special directory in their distro.
+  namespace {
 
-  void NNUE::init() {
+  // Serializes the loads of the networks and their replication, as the searches
+  // of the pools of the server may verify their networks at the same time
+  std::mutex NetworkMutex;
 
-    useNNUE = Options["Use NNUE"];
-    if (!useNNUE)
-        return;
+  /// eval_file_option() returns the name of the UCI option holding the network
+  /// of a main variant: "EvalFile" for chess, "EvalFile_<variant>" otherwise.
+  string eval_file_option(Variant v) {
+    return v == CHESS_VARIANT ? "EvalFile" : "EvalFile_" + variants[v];
+  }
+
+  /// eval_file() returns the network file name configured for a main variant,
+  /// or an empty string if the variant has no network configured.
+  string eval_file(Variant v) {
+    string file = string(Options[eval_file_option(v)]);
+    if (v == CHESS_VARIANT)
+        return file.empty() ? EvalFileDefaultName : file;
+    return file == "<empty>" ? "" : file;
+  }
 
-    string eval_file = string(Options["EvalFile"]);
-    if (eval_file.empty())
-        eval_file = EvalFileDefaultName;
+  /// load_network() tries to load the network of a main variant, unless it has
+  /// already been loaded. We search the given network in three locations:
+  /// internally (the default network may be embedded in the binary), in the
+  /// active working directory and in the engine directory. Distro packagers may
+  /// define the DEFAULT_NNUE_DIRECTORY variable to have the engine search in a
+  /// special directory in their distro. A network image, as written by the
+  /// "export_image" command, is memory mapped instead of being read.
+  void load_network(Variant v) {
+
+    string file = eval_file(v);
+    if (file.empty() || currentEvalFileName[v] == file)
+        return;
 
     #if defined(DEFAULT_NNUE_DIRECTORY)
     vector<string> dirs = { "<internal>" , "" , CommandLine::binaryDirectory , stringify(DEFAULT_NNUE_DIRECTORY) };
@@ -91,16 +114,22 @@ namespace Eval {
     #endif
 
     for (const string& directory : dirs)
-        if (currentEvalFileName != eval_file)
+        if (currentEvalFileName[v] != file)
         {
             if (directory != "<internal>")
             {
-                ifstream stream(directory + eval_file, ios::binary);
-                if (NNUE::load_eval(eval_file, stream))
-                    currentEvalFileName = eval_file;
+                // A network image is mapped, a network file is read
+                if (NNUE::map_eval(file, directory + file, v))
+                    currentEvalFileName[v] = file;
+                else
+                {
+                    ifstream stream(directory + file, ios::binary);
+                    if (NNUE::load_eval(file, stream, v))
+                        currentEvalFileName[v] = file;
+                }
             }
 
-            if (directory == "<internal>" && eval_file == EvalFileDefaultName)
+            if (directory == "<internal>" && v == CHESS_VARIANT && file == EvalFileDefaultName)
             {
                 // C++ way to prepare a buffer for a memory stream
                 class MemoryBuffer : public basic_streambuf<char> {
@@ -112,24 +141,73 @@ namespace Eval {
                 (void) gEmbeddedNNUEEnd; // Silence warning on unused variable
 
                 istream stream(&buffer);
-                if (NNUE::load_eval(eval_file, stream))
-                    currentEvalFileName = eval_file;
+                if (NNUE::load_eval(file, stream, v))
+                    currentEvalFileName[v] = file;
             }
         }
+
+    nnueAvailable[v] = currentEvalFileName[v] == file;
+
+    // The copies of the networks of the other variants may be in use by the
+    // searches of other pools, so only the networks of this one are replicated
+    if (nnueAvailable[v])
+        NNUE::replicate_variant(v);
   }
 
-  /// NNUE::verify() verifies that the last net used was loaded successfully
-  void NNUE::verify() {
+  } // namespace
+
+  /// NNUE::init() is called at startup time, or when the engine receives a UCI
+  /// command "setoption name EvalFile value nn-[a-z0-9]{12}.nnue" (or any of the
+  /// EvalFile_<variant> options). The chess network is loaded right away, the
+  /// networks of the other main variants are loaded lazily by NNUE::verify() the
+  /// first time a search or an eval is started in that variant.
+
+  void NNUE::init() {
 
-    string eval_file = string(Options["EvalFile"]);
-    if (eval_file.empty())
-        eval_file = EvalFileDefaultName;
+    std::lock_guard<std::mutex> lk(NetworkMutex);
 
-    if (useNNUE && currentEvalFileName != eval_file)
+    useNNUE = Options["Use NNUE"];
+    if (!useNNUE)
+        return;
+
+    // Forget networks whose option has changed since they were loaded
+    for (Variant v = CHESS_VARIANT; v < VARIANT_NB; ++v)
+        if (currentEvalFileName[v] != eval_file(v))
+        {
+            currentEvalFileName[v] = "None";
+            nnueAvailable[v] = false;
+        }
+
+    load_network(CHESS_VARIANT);
+    NNUE::replicate(Options["NumaReplicateNNUE"]);
+  }
+
+  /// NNUE::replicate() copies the networks to the NUMA nodes of the threads of
+  /// the UCI searches, if the option "NumaReplicateNNUE" is set.
+  void NNUE::replicate() {
+
+    std::lock_guard<std::mutex> lk(NetworkMutex);
+
+    NNUE::replicate(Options["NumaReplicateNNUE"]);
+  }
+
+  /// NNUE::verify() loads the network of the given main variant if needed and
+  /// verifies that it was loaded successfully. A missing chess network is fatal,
+  /// the other variants fall back to the classical evaluation.
+  void NNUE::verify(Variant v) {
+
+    std::lock_guard<std::mutex> lk(NetworkMutex);
+
+    if (useNNUE)
+        load_network(v);
+
+    string file = eval_file(v);
+
+    if (useNNUE && v == CHESS_VARIANT && currentEvalFileName[v] != file)
     {
 
         string msg1 = "If the UCI option \"Use NNUE\" is set to true, network evaluation parameters compatible with the engine must be available.";
-        string msg2 = "The option is set to true, but the network file " + eval_file + " was not loaded successfully.";
+        string msg2 = "The option is set to true, but the network file " + file + " was not loaded successfully.";
         string msg3 = "The UCI option EvalFile might need to specify the full path, including the directory name, to the network file.";
         string msg4 = "The default net can be downloaded from: https://tests.stockfishchess.org/api/nn/" + std::string(EvalFileDefaultName);
         string msg5 = "The engine will be terminated now.";
@@ -143,8 +221,11 @@ namespace Eval {
         exit(EXIT_FAILURE);
     }
 
-    if (useNNUE)
-        sync_cout << "info string NNUE evaluation using " << eval_file << " enabled" << sync_endl;
+    if (useNNUE && nnueAvailable[v])
+        sync_cout << "info string NNUE evaluation using " << file << " enabled" << sync_endl;
+    else if (useNNUE && !file.empty())
+        sync_cout << "info string WARNING: network file " << file << " for " << variants[v]
+                  << " was not loaded successfully, classical evaluation enabled" << sync_endl;
     else
         sync_cout << "info string classical evaluation enabled" << sync_endl;
   }
@@ -1585,7 +1666,19 @@ namespace {
         // Rather than generating attackedBy (which would be complex and slow)
         // use the same (non-queen) occupancy mask for all sliding attackers
         Bitboard pieces = pos.pieces() ^ pos.pieces(QUEEN);
-        for (Bitboard b = pos.pieces(Them) & ~attacks_bb<KING>(pos.square<KING>(Us)); b; )
+
+        // Squares reached by our pieces with this occupancy, so that the
+        // attackers are only looked up for the enemy pieces which have some.
+        // Our king is left out, as the squares next to it are skipped anyway.
+        Bitboard reached = pawn_attacks_bb<Us>(pos.pieces(Us, PAWN));
+        for (Bitboard b = pos.pieces(Us, KNIGHT); b; )
+            reached |= attacks_bb<KNIGHT>(pop_lsb(b));
+        for (Bitboard b = pos.pieces(Us, BISHOP, QUEEN); b; )
+            reached |= attacks_bb<BISHOP>(pop_lsb(b), pieces);
+        for (Bitboard b = pos.pieces(Us, ROOK, QUEEN); b; )
+            reached |= attacks_bb<ROOK>(pop_lsb(b), pieces);
+
+        for (Bitboard b = pos.pieces(Them) & reached & ~attacks_bb<KING>(pos.square<KING>(Us)); b; )
         {
             Square s = pop_lsb(b);
             Bitboard attackers = pos.attackers_to(s, pieces) & pos.pieces(Us);
@@ -1861,7 +1954,7 @@ namespace {
     // Initialize score by reading the incrementally updated scores included in
     // the position object (material + piece square tables) and the material
     // imbalance. Score is computed internally from the white point of view.
-    Score score = pos.psq_score() + me->imbalance();
+    Score score = pos.psq_score() + me->imbalance(pos);
 
     // Probe the pawn hash table
     pe = Pawns::probe(pos);
@@ -1869,11 +1962,15 @@ namespace {
 
     // Early exit if score is high
     auto lazy_skip = [&](Value lazyThreshold) {
-        return abs(mg_value(score) + eg_value(score)) >   lazyThreshold
-                                                        + std::abs(pos.this_thread()->bestValue) * 5 / 4
-                                                        + pos.non_pawn_material() / 32;
+        bool skip = abs(mg_value(score) + eg_value(score)) >   lazyThreshold
+                                                             + std::abs(pos.this_thread()->bestValue) * 5 / 4
+                                                             + pos.non_pawn_material() / 32;
+        if (skip)
+            Counters::inc(Counters::LAZY_SKIPS);
+        return skip;
     };
 
+    Counters::inc(Counters::CLASSICAL_EVALS);
     if (lazy_skip(LazyThreshold1[pos.variant()]))
         goto make_v;
 
@@ -1910,7 +2007,7 @@ make_v:
     if constexpr (T)
     {
         Trace::add(MATERIAL, pos.psq_score());
-        Trace::add(IMBALANCE, me->imbalance());
+        Trace::add(IMBALANCE, me->imbalance(pos));
         Trace::add(PAWN, pe->pawn_score(WHITE), pe->pawn_score(BLACK));
         Trace::add(MOBILITY, mobility[WHITE], mobility[BLACK]);
     }
@@ -1957,7 +2054,7 @@ Value Eval::evaluate(const Position& pos) {
   // We use the much less accurate but faster Classical eval when the NNUE
   // option is set to false. Otherwise we use the NNUE eval unless the
   // PSQ advantage is decisive. (~4 Elo at STC, 1 Elo at LTC)
-  bool useClassical = !useNNUE || abs(psq) > 2048;
+  bool useClassical = !useNNUE || !nnueAvailable[pos.variant()] || abs(psq) > 2048;
 
   if (useClassical)
 #endif
@@ -1988,6 +2085,18 @@ Value Eval::evaluate(const Position& pos) {
   return v;
 }
 
+/// classical() returns the classical evaluation of the position, as timed by
+/// speedtest. Unlike that of evaluate(), it is not damped by the rule50 counter,
+/// as the NNUE raw output.
+
+Value Eval::classical(const Position& pos) {
+
+  assert(!pos.checkers());
+
+  return Evaluation<NO_TRACE>(pos).value();
+}
+
+
 /// trace() is like evaluate(), but instead of returning a value, it returns
 /// a string (suitable for outputting to stdout) that contains the detailed
 /// descriptions and values of each evaluation term. Useful for debugging.
@@ -2037,7 +2146,7 @@ std::string Eval::trace(Position& pos) {
      << "+------------+-------------+-------------+-------------+\n";
 
 #ifdef USE_NNUE
-  if (Eval::useNNUE)
+  if (Eval::useNNUE && Eval::nnueAvailable[pos.variant()])
       ss << '\n' << NNUE::trace(pos) << '\n';
 #endif
 
@@ -2046,7 +2155,7 @@ std::string Eval::trace(Position& pos) {
   v = pos.side_to_move() == WHITE ? v : -v;
   ss << "\nClassical evaluation   " << to_cp(v) << " (white side)\n";
 #ifdef USE_NNUE
-  if (Eval::useNNUE)
+  if (Eval::useNNUE && Eval::nnueAvailable[pos.variant()])
   {
       v = NNUE::evaluate(pos, false);
       v = pos.side_to_move() == WHITE ? v : -v;
@@ -2058,7 +2167,7 @@ std::string Eval::trace(Position& pos) {
   v = pos.side_to_move() == WHITE ? v : -v;
   ss << "Final evaluation       " << to_cp(v) << " (white side)";
 #ifdef USE_NNUE
-  if (Eval::useNNUE)
+  if (Eval::useNNUE && Eval::nnueAvailable[pos.variant()])
      ss << " [with scaled NNUE, hybrid, ...]";
 #endif
   ss << "\n";
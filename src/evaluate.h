@@ -32,10 +32,12 @@ namespace Eval {
 
   std::string trace(Position& pos);
   Value evaluate(const Position& pos);
+  Value classical(const Position& pos);
 
 #ifdef USE_NNUE
   extern bool useNNUE;
-  extern std::string currentEvalFileName;
+  extern bool nnueAvailable[VARIANT_NB];
+  extern std::string currentEvalFileName[VARIANT_NB];
 
   // The default net name MUST follow the format nn-[SHA256 first 12 digits].nnue
   // for the build process (profile-build and fishtest) to work. Do not change the
@@ -45,7 +47,8 @@ namespace Eval {
   namespace NNUE {
 
     void init();
-    void verify();
+    void replicate();
+    void verify(Variant v = CHESS_VARIANT);
 
   } // namespace NNUE
 #endif
@@ -19,7 +19,9 @@
 #include <iostream>
 
 #include "bitboard.h"
+#include "cluster.h"
 #include "endgame.h"
+#include "nnue/evaluate_nnue.h"
 #include "position.h"
 #include "psqt.h"
 #include "search.h"
@@ -30,26 +32,43 @@
 
 using namespace Stockfish;
 
+#ifdef DISPATCH_ENTRY
+// In a dispatch build, the entry point of this copy of the engine, its only
+// visible symbol, is called by the main() of dispatch.cpp when the CPU supports
+// its architecture.
+extern "C" __attribute__((visibility("default"))) int DISPATCH_ENTRY(int argc, char* argv[]);
+
+int DISPATCH_ENTRY(int argc, char* argv[]) {
+#else
 int main(int argc, char* argv[]) {
+#endif
 
   std::cout << engine_info() << std::endl;
 
   CommandLine::init(argc, argv);
   UCI::init(Options);
   Tune::init();
+  startup_step("options");
   PSQT::init();
   Bitboards::init();
+  startup_step("bitboards");
   Position::init();
-  Bitbases::init();
-  Endgames::init();
-  Threads.set(size_t(Options["Threads"]));
-  Search::clear(); // After threads are up
+  Endgames::init(); // The KPK bitbase is computed at its first probe
+  startup_step("endgames");
+  Threads.set(size_t(Options["Threads"])); // Also clears the threads and the TT
+  Tablebases::init(UCI::variant_from_name(Options["UCI_Variant"]), Options["SyzygyPath"]);
+  startup_step("threads");
 #ifdef USE_NNUE
   Eval::NNUE::init();
+  startup_step("nnue");
 #endif
 
   UCI::loop(argc, argv);
 
+  Cluster::init(""); // Disconnect from the nodes, if any
   Threads.set(0);
+#ifdef USE_NNUE
+  Eval::NNUE::release();
+#endif
   return 0;
 }
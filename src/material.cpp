@@ -400,15 +400,15 @@ namespace {
   }
 
 
-  /// imbalance() calculates the imbalance by comparing the piece count of each
-  /// piece type for both colors.
+  /// imbalance_of() calculates the imbalance of a color by comparing the piece
+  /// count of each piece type for both colors.
 
   template<Color Us>
 #ifdef CRAZYHOUSE
-  Score imbalance(const Position& pos, const int pieceCount[][PIECE_TYPE_NB],
-                  const int pieceCountInHand[][PIECE_TYPE_NB]) {
+  Score imbalance_of(const Position& pos, const int pieceCount[][PIECE_TYPE_NB],
+                     const int pieceCountInHand[][PIECE_TYPE_NB]) {
 #else
-  Score imbalance(const Position& pos, const int pieceCount[][PIECE_TYPE_NB]) {
+  Score imbalance_of(const Position& pos, const int pieceCount[][PIECE_TYPE_NB]) {
 #endif
 
     constexpr Color Them = ~Us;
@@ -608,9 +608,24 @@ Entry* probe(const Position& pos) {
                                  npm_w <= BishopValueMg ? 4 : 14);
   }
 
-  // Evaluate the material imbalance. We use PIECE_TYPE_NONE as a place holder
-  // for the bishop pair "extended piece", which allows us to be more flexible
-  // in defining bishop pair bonuses.
+#ifdef CRAZYHOUSE
+  // With pieces in hand the imbalance is kept in StateInfo, see imbalance()
+  if (!pos.is_house())
+#endif
+  e->score = imbalance(pos);
+  return e;
+}
+
+
+/// Material::imbalance() calculates the material imbalance of the position, which
+/// the material hash table stores for the position's material key. The pieces in
+/// hand of the house variants are not part of that key, so their imbalance is
+/// instead computed by do_move() when the material changes, see StateInfo.
+
+Score imbalance(const Position& pos) {
+
+  // We use PIECE_TYPE_NONE as a place holder for the bishop pair "extended
+  // piece", which allows us to be more flexible in defining bishop pair bonuses.
   const int pieceCount[COLOR_NB][PIECE_TYPE_NB] = {
   { pos.count<BISHOP>(WHITE) > 1, pos.count<PAWN>(WHITE), pos.count<KNIGHT>(WHITE),
     pos.count<BISHOP>(WHITE)    , pos.count<ROOK>(WHITE), pos.count<QUEEN >(WHITE), pos.count<KING>(WHITE) },
@@ -625,14 +640,13 @@ Entry* probe(const Position& pos) {
       { pos.count_in_hand<ALL_PIECES>(BLACK) == 0, pos.count_in_hand<PAWN>(BLACK), pos.count_in_hand<KNIGHT>(BLACK),
         pos.count_in_hand<BISHOP>(BLACK)         , pos.count_in_hand<ROOK>(BLACK), pos.count_in_hand<QUEEN >(BLACK), pos.count_in_hand<KING>(BLACK) } };
 
-      e->score = (imbalance<WHITE>(pos, pieceCount, pieceCountInHand) - imbalance<BLACK>(pos, pieceCount, pieceCountInHand)) / 16;
+      return (imbalance_of<WHITE>(pos, pieceCount, pieceCountInHand) - imbalance_of<BLACK>(pos, pieceCount, pieceCountInHand)) / 16;
   }
-  else
-      e->score = (imbalance<WHITE>(pos, pieceCount, NULL) - imbalance<BLACK>(pos, pieceCount, NULL)) / 16;
+
+  return (imbalance_of<WHITE>(pos, pieceCount, NULL) - imbalance_of<BLACK>(pos, pieceCount, NULL)) / 16;
 #else
-  e->score = (imbalance<WHITE>(pos, pieceCount) - imbalance<BLACK>(pos, pieceCount)) / 16;
+  return (imbalance_of<WHITE>(pos, pieceCount) - imbalance_of<BLACK>(pos, pieceCount)) / 16;
 #endif
-  return e;
 }
 
 } // namespace Material
@@ -37,7 +37,13 @@ namespace Stockfish::Material {
 
 struct Entry {
 
-  Score imbalance() const { return score; }
+  Score imbalance([[maybe_unused]] const Position& pos) const {
+#ifdef CRAZYHOUSE
+    if (pos.is_house())
+        return pos.imbalance();
+#endif
+    return score;
+  }
   Phase game_phase() const { return (Phase)gamePhase; }
   bool specialized_eval_exists() const { return evaluationFunction != nullptr; }
   Value evaluate(const Position& pos) const { return (*evaluationFunction)(pos); }
@@ -62,9 +68,10 @@ struct Entry {
   uint8_t factor[COLOR_NB];
 };
 
-using Table = HashTable<Entry, 8192>;
+using Table = HashTable<Entry>;
 
 Entry* probe(const Position& pos);
+Score imbalance(const Position& pos);
 
 } // namespace Stockfish::Material
 
@@ -44,20 +44,30 @@ using fun8_t = bool(*)(HANDLE, BOOL, PTOKEN_PRIVILEGES, DWORD, PTOKEN_PRIVILEGES
 }
 #endif
 
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <sstream>
 #include <string_view>
 #include <vector>
 
 #if defined(__linux__) && !defined(__ANDROID__)
+#include <sched.h>
 #include <stdlib.h>
 #include <sys/mman.h>
 #endif
 
+#if !defined(_WIN32) && !defined(__ANDROID__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #if defined(__APPLE__) || defined(__ANDROID__) || defined(__OpenBSD__) || (defined(__GLIBCXX__) && !defined(_GLIBCXX_HAVE_ALIGNED_ALLOC) && !defined(_WIN32)) || defined(__e2k__)
 #define POSIXALIGNEDALLOC
 #include <stdlib.h>
@@ -103,6 +113,43 @@ struct Tie: public streambuf { // MSVC requires split streambuf for cin and cout
   }
 };
 
+/// The prefix of the lines written by the current thread to std::cout, see
+/// sync_prefix().
+
+thread_local string syncPrefix;
+
+/// The receiver of the prefixed lines instead of std::cout, see sync_redirect()
+
+SyncSink syncSink;
+
+struct Prefixer: public streambuf {
+
+  explicit Prefixer(streambuf* b) : buf(b) {}
+
+  int sync() override { return buf->pubsync(); }
+  int overflow(int c) override {
+
+    if (syncSink && !syncPrefix.empty())
+    {
+        if (c != '\n')
+            line += char(c);
+        else
+            syncSink(syncPrefix, line), line.clear();
+        return c;
+    }
+
+    if (lineStart && !syncPrefix.empty())
+        buf->sputn(syncPrefix.data(), streamsize(syncPrefix.size()));
+
+    lineStart = c == '\n';
+    return buf->sputc((char)c);
+  }
+
+  streambuf* buf;
+  string line; // The line being redirected
+  bool lineStart = true; // Lines are written under the sync_cout lock
+};
+
 class Logger {
 
   Logger() : in(cin.rdbuf(), file.rdbuf()), out(cout.rdbuf(), file.rdbuf()) {}
@@ -284,6 +331,9 @@ std::string compiler_info() {
   #if defined(USE_NEON)
     compiler += " NEON";
   #endif
+  #if defined(TT_CLUSTER_64)
+    compiler += " TT64";
+  #endif
 
   #if !defined(NDEBUG)
     compiler += " DEBUG";
@@ -393,6 +443,112 @@ void dbg_print() {
 }
 
 
+namespace Counters {
+
+namespace {
+
+  const char* Names[COUNTER_NB] = {
+    "search nodes", "qsearch nodes",
+    "tt moves picked", "capture stages", "quiet stages", "drop stages", "bad capture stages",
+    "evasion stages", "quiet check stages", "probcut stages",
+    "classical evals", "lazy skips",
+    "see tests", "tb probes"
+  };
+
+  std::mutex RegistryMutex;
+  std::vector<Block*> Registry;
+  uint64_t Retired[COUNTER_NB]; // Counts of the exited threads
+
+} // namespace
+
+Block::Block() {
+
+  std::lock_guard<std::mutex> lk(RegistryMutex);
+  Registry.push_back(this);
+}
+
+Block::~Block() {
+
+  std::lock_guard<std::mutex> lk(RegistryMutex);
+  for (int c = 0; c < COUNTER_NB; ++c)
+      Retired[c] += count[c].load(std::memory_order_relaxed) - reported[c];
+  Registry.erase(std::find(Registry.begin(), Registry.end(), this));
+}
+
+/// report() returns the counts of all the threads since the previous call,
+/// with their rate per node searched. The counts are not reset, as a thread
+/// incrementing one at the same time would write back the old total, but are
+/// reported as their difference with the snapshot of the previous call.
+
+std::string report() {
+
+  uint64_t total[COUNTER_NB];
+  {
+      std::lock_guard<std::mutex> lk(RegistryMutex);
+      for (int c = 0; c < COUNTER_NB; ++c)
+      {
+          total[c] = Retired[c];
+          Retired[c] = 0;
+          for (Block* b : Registry)
+          {
+              uint64_t count = b->count[c].load(std::memory_order_relaxed);
+              total[c] += count - b->reported[c];
+              b->reported[c] = count;
+          }
+      }
+  }
+
+  uint64_t nodes = std::max<uint64_t>(total[SEARCH_NODES] + total[QSEARCH_NODES], 1);
+  std::stringstream ss;
+  for (int c = 0; c < COUNTER_NB; ++c)
+      ss << std::left << std::setw(20) << Names[c] << std::right << std::setw(14) << total[c]
+         << std::fixed << std::setprecision(3) << std::setw(10) << double(total[c]) / nodes
+         << " per node" << (c < COUNTER_NB - 1 ? "\n" : "");
+
+  return ss.str();
+}
+
+} // namespace Counters
+
+
+/// startup_step() records the time since the previous step of the engine
+/// startup, or since the static initialization for the first one, and
+/// startup_times() reports them in milliseconds, as printed by bench.
+
+namespace {
+
+auto StartupBegin = std::chrono::steady_clock::now();
+std::vector<std::pair<const char*, double>> StartupSteps;
+
+}  // namespace
+
+void startup_step(const char* name) {
+
+  static auto last = StartupBegin;
+  auto t = std::chrono::steady_clock::now();
+
+  StartupSteps.emplace_back(name, std::chrono::duration<double, std::milli>(t - last).count());
+  last = t;
+}
+
+std::string startup_times() {
+
+  std::stringstream ss;
+  double total = 0;
+
+  for (auto& [name, ms] : StartupSteps)
+      total += ms;
+
+  ss << std::fixed << std::setprecision(2) << total << " (";
+
+  for (auto& [name, ms] : StartupSteps)
+      ss << (&name == &StartupSteps.front().first ? "" : ", ") << name << " " << ms;
+
+  ss << ")";
+  return ss.str();
+}
+
+
 /// Used to serialize access to std::cout to avoid multiple threads writing at
 /// the same time.
 
@@ -414,16 +570,42 @@ std::ostream& operator<<(std::ostream& os, SyncCout sc) {
 void start_logger(const std::string& fname) { Logger::start(fname); }
 
 
+/// sync_prefix() sets the prefix of each line the calling thread writes to
+/// std::cout, used by the "server" command to tag the output of a game.
+
+void sync_prefix(const std::string& prefix) {
+
+  static Prefixer prefixer(cout.rdbuf());
+
+  if (!prefix.empty() && cout.rdbuf() != &prefixer)
+      cout.rdbuf(&prefixer);
+
+  syncPrefix = prefix;
+}
+
+
+/// sync_redirect() hands each complete line written with a prefix to the given
+/// sink instead of std::cout, used by the "listen" command to send the output
+/// of a game to its connection. The sink is called under the sync_cout lock.
+
+void sync_redirect(SyncSink sink) {
+
+  std::cout << IO_LOCK;
+  syncSink = sink;
+  std::cout << IO_UNLOCK;
+}
+
+
 /// prefetch() preloads the given address in L1/L2 cache. This is a non-blocking
 /// function that doesn't stall the CPU waiting for data to be loaded from memory,
 /// which can be quite slow.
 #ifdef NO_PREFETCH
 
-void prefetch(void*) {}
+void prefetch(const void*) {}
 
 #else
 
-void prefetch(void* addr) {
+void prefetch(const void* addr) {
 
 #  if defined(__INTEL_COMPILER)
    // This hack prevents prefetches from being optimized away by
@@ -432,7 +614,7 @@ void prefetch(void* addr) {
 #  endif
 
 #  if defined(__INTEL_COMPILER) || defined(_MSC_VER)
-  _mm_prefetch((char*)addr, _MM_HINT_T0);
+  _mm_prefetch((const char*)addr, _MM_HINT_T0);
 #  else
   __builtin_prefetch(addr);
 #  endif
@@ -606,11 +788,310 @@ void aligned_large_pages_free(void *mem) {
 #endif
 
 
+/// shared_memory_alloc() maps the named shared memory segment of the given size,
+/// creating it zero filled if it does not exist yet, so that several processes
+/// can work on the same memory. It returns nullptr if that is not possible, e.g.
+/// when the segment exists with a different size. The segment outlives the
+/// process on POSIX systems, until removed (from /dev/shm on Linux).
+
+#if defined(_WIN32)
+
+void* shared_memory_alloc(const std::string& name, size_t size) {
+
+  HANDLE hMap = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                   DWORD(uint64_t(size) >> 32), DWORD(size), name.c_str());
+  if (!hMap)
+      return nullptr;
+
+  void* mem = MapViewOfFile(hMap, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+
+  // The view keeps the mapping alive, check that it is as large as requested
+  MEMORY_BASIC_INFORMATION info;
+  if (mem && (!VirtualQuery(mem, &info, sizeof(info)) || info.RegionSize < size))
+  {
+      UnmapViewOfFile(mem);
+      mem = nullptr;
+  }
+
+  CloseHandle(hMap);
+  return mem;
+}
+
+void shared_memory_free(void* mem, size_t) {
+
+  if (mem)
+      UnmapViewOfFile(mem);
+}
+
+#elif !defined(__ANDROID__)
+
+void* shared_memory_alloc(const std::string& name, size_t size) {
+
+  const std::string shmName = name[0] == '/' ? name : "/" + name;
+
+  int fd = shm_open(shmName.c_str(), O_CREAT | O_RDWR, 0600);
+  if (fd == -1)
+      return nullptr;
+
+  struct stat st;
+  if (   fstat(fd, &st) == -1
+      || (st.st_size == 0 && ftruncate(fd, off_t(size)) == -1)
+      || (st.st_size != 0 && size_t(st.st_size) != size))
+  {
+      close(fd);
+      return nullptr;
+  }
+
+  void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (mem == MAP_FAILED)
+      return nullptr;
+
+#if defined(MADV_HUGEPAGE)
+  madvise(mem, size, MADV_HUGEPAGE);
+#endif
+  return mem;
+}
+
+void shared_memory_free(void* mem, size_t size) {
+
+  if (mem)
+      munmap(mem, size);
+}
+
+#else
+
+void* shared_memory_alloc(const std::string&, size_t) { return nullptr; }
+void shared_memory_free(void*, size_t) {}
+
+#endif
+
+
+/// map_file() maps a whole file read-only into memory and returns its address
+/// and size, or nullptr if the file cannot be opened or is empty. The mapping
+/// is released with unmap_file().
+
+#if defined(_WIN32)
+
+const void* map_file(const std::string& path, size_t& size) {
+
+  HANDLE fd = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                          OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (fd == INVALID_HANDLE_VALUE)
+      return nullptr;
+
+  DWORD sizeHigh;
+  DWORD sizeLow = GetFileSize(fd, &sizeHigh);
+  size = size_t(uint64_t(sizeHigh) << 32 | sizeLow);
+
+  HANDLE hMap = size ? CreateFileMapping(fd, nullptr, PAGE_READONLY, sizeHigh, sizeLow, nullptr)
+                     : nullptr;
+  CloseHandle(fd);
+
+  if (!hMap)
+      return nullptr;
+
+  // The view keeps the mapping alive
+  const void* mem = MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(hMap);
+  return mem;
+}
+
+void unmap_file(const void* mem, size_t) {
+
+  if (mem)
+      UnmapViewOfFile(mem);
+}
+
+#elif !defined(__ANDROID__)
+
+const void* map_file(const std::string& path, size_t& size) {
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1)
+      return nullptr;
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 || st.st_size == 0)
+  {
+      close(fd);
+      return nullptr;
+  }
+
+  size = size_t(st.st_size);
+  void* mem = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (mem == MAP_FAILED)
+      return nullptr;
+
+#if defined(MADV_SEQUENTIAL)
+  madvise(mem, size, MADV_SEQUENTIAL);
+#endif
+  return mem;
+}
+
+void unmap_file(const void* mem, size_t size) {
+
+  if (mem)
+      munmap(const_cast<void*>(mem), size);
+}
+
+#else
+
+const void* map_file(const std::string&, size_t&) { return nullptr; }
+void unmap_file(const void*, size_t) {}
+
+#endif
+
+
 namespace WinProcGroup {
 
-#ifndef _WIN32
+#if defined(__linux__) && !defined(__ANDROID__)
+
+namespace {
+
+/// parse_cpu_list() reads a list of logical processors or of nodes in the
+/// format of the Linux sysfs files, like "0-15,32-47". The list of a node
+/// without processors is empty, malformed ranges are skipped.
+
+vector<int> parse_cpu_list(const string& path) {
+
+  vector<int> cpus;
+  ifstream file(path);
+  string range;
+
+  while (getline(file, range, ','))
+  {
+      const char* str = range.c_str();
+      char* end;
+
+      long first = strtol(str, &end, 10);
+      if (end == str || first < 0)
+          continue;
+
+      long last = first;
+      if (*end == '-')
+      {
+          str = end + 1;
+          last = strtol(str, &end, 10);
+          if (end == str || last < first)
+              continue;
+      }
+
+      for (long cpu = first; cpu <= last; ++cpu)
+          cpus.push_back(int(cpu));
+  }
+
+  return cpus;
+}
+
+/// node_cpus() returns, for each NUMA node, the logical processors this
+/// process may run on. The result is computed once, it's empty if the
+/// system has a single node.
+
+const vector<vector<int>>& node_cpus() {
+
+  static const vector<vector<int>> nodes = [] {
+
+      vector<vector<int>> result;
+      cpu_set_t allowed;
+
+      if (sched_getaffinity(0, sizeof(allowed), &allowed))
+          return result;
+
+      // Node ids may be sparse, so enumerate those listed as online
+      for (int n : parse_cpu_list("/sys/devices/system/node/online"))
+      {
+          string path = "/sys/devices/system/node/node" + to_string(n) + "/cpulist";
+
+          vector<int> cpus;
+          for (int cpu : parse_cpu_list(path))
+              if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+                  cpus.push_back(cpu);
+
+          if (!cpus.empty())
+              result.push_back(cpus);
+      }
+
+      if (result.size() < 2)
+          result.clear();
+
+      return result;
+  }();
+
+  return nodes;
+}
+
+/// best_node() returns the best node id for the thread with index idx, filling
+/// the physical cores of a node before moving on to the next one, as done on
+/// Windows.
+
+int best_node(size_t idx) {
+
+  const vector<vector<int>>& nodes = node_cpus();
+  if (nodes.empty())
+      return -1;
+
+  vector<int> groups;
+  size_t threads = 0;
+
+  for (size_t n = 0; n < nodes.size(); ++n)
+  {
+      // A logical processor is a core of its own if it is the first of its siblings
+      for (int cpu : nodes[n])
+      {
+          string path = "/sys/devices/system/cpu/cpu" + to_string(cpu) + "/topology/thread_siblings_list";
+          vector<int> siblings = parse_cpu_list(path);
+          if (siblings.empty() || siblings[0] == cpu)
+              groups.push_back(int(n));
+      }
+      threads += nodes[n].size();
+  }
 
-void bindThisThread(size_t) {}
+  // Spread the remaining logical processors evenly across the nodes
+  for (size_t t = groups.size(), n = 0; t < threads; ++t, ++n)
+      groups.push_back(int(n % nodes.size()));
+
+  return idx < groups.size() ? groups[idx] : -1;
+}
+
+} // namespace
+
+
+/// bindThisThreadToNode() restricts the current thread to the processors of
+/// the given node, so that the memory it touches first is placed on that node
+
+void bindThisThreadToNode(int node) {
+
+  const vector<vector<int>>& nodes = node_cpus();
+  if (node < 0 || size_t(node) >= nodes.size())
+      return;
+
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  for (int cpu : nodes[node])
+      CPU_SET(cpu, &mask);
+
+  sched_setaffinity(0, sizeof(mask), &mask);
+}
+
+
+/// bindThisThread() binds the current thread to the best node for its index
+/// and returns that node, or -1 when the system has a single node
+
+int bindThisThread(size_t idx) {
+
+  int node = best_node(idx);
+  bindThisThreadToNode(node);
+  return node;
+}
+
+#elif !defined(_WIN32)
+
+void bindThisThreadToNode(int) {}
+int bindThisThread(size_t) { return -1; }
 
 #else
 
@@ -688,13 +1169,13 @@ static int best_node(size_t idx) {
 
 /// bindThisThread() set the group affinity of the current thread
 
-void bindThisThread(size_t idx) {
+int bindThisThread(size_t idx) {
 
   // Use only local variables to be thread-safe
   int node = best_node(idx);
 
   if (node == -1)
-      return;
+      return -1;
 
   // Early exit if the needed API are not available at runtime
   HMODULE k32 = GetModuleHandle(TEXT("Kernel32.dll"));
@@ -704,7 +1185,7 @@ void bindThisThread(size_t idx) {
   auto fun5 = (fun5_t)(void(*)())GetProcAddress(k32, "GetMaximumProcessorGroupCount");
 
   if (!fun2 || !fun3)
-      return;
+      return -1;
 
   if (!fun4 || !fun5)
   {
@@ -723,8 +1204,15 @@ void bindThisThread(size_t idx) {
           fun3(GetCurrentThread(), &affinity[idx % returnedElements], nullptr);  // SetThreadGroupAffinity
       free(affinity);
   }
+
+  return node;
 }
 
+/// bindThisThreadToNode() is not needed on Windows, where the networks are
+/// not replicated
+
+void bindThisThreadToNode(int) {}
+
 #endif
 
 } // namespace WinProcGroup
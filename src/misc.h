@@ -19,10 +19,14 @@
 #ifndef MISC_H_INCLUDED
 #define MISC_H_INCLUDED
 
+#include <atomic>
 #include <cassert>
 #include <chrono>
+#include <iostream>
+#include <memory>
 #include <ostream>
 #include <string>
+#include <type_traits>
 #include <vector>
 #include <cstdint>
 
@@ -35,12 +39,19 @@ namespace Stockfish {
 
 std::string engine_info(bool to_uci = false);
 std::string compiler_info();
-void prefetch(void* addr);
+void prefetch(const void* addr);
 void start_logger(const std::string& fname);
+void sync_prefix(const std::string& prefix);
+using SyncSink = void (*)(const std::string& prefix, const std::string& line);
+void sync_redirect(SyncSink sink);
 void* std_aligned_alloc(size_t alignment, size_t size);
 void std_aligned_free(void* ptr);
 void* aligned_large_pages_alloc(size_t size); // memory aligned by page size, min alignment: 4096 bytes
 void aligned_large_pages_free(void* mem); // nop if mem == nullptr
+void* shared_memory_alloc(const std::string& name, size_t size); // nullptr on failure
+void shared_memory_free(void* mem, size_t size); // nop if mem == nullptr
+const void* map_file(const std::string& path, size_t& size); // Read-only, nullptr on failure
+void unmap_file(const void* mem, size_t size); // nop if mem == nullptr
 
 void dbg_hit_on(bool cond, int slot = 0);
 void dbg_mean_of(int64_t value, int slot = 0);
@@ -48,6 +59,50 @@ void dbg_stdev_of(int64_t value, int slot = 0);
 void dbg_correl_of(int64_t value1, int64_t value2, int slot = 0);
 void dbg_print();
 
+/// Counters are named event counters of the hot paths of the search, compiled
+/// in by "make stats=yes" (-DUSE_STATS) and free otherwise. Each thread counts
+/// in its own cache lines, registered on first use, and the "stats" command
+/// adds up the counts of all the threads since its previous call, including the
+/// exited ones. The counts are only written by their thread and never reset.
+/// The TT probes and the NNUE updates are not counted here but by the always-on
+/// TTStats and nnueUpdates of the threads, which "stats" reports.
+
+namespace Counters {
+
+enum Counter {
+  SEARCH_NODES, QSEARCH_NODES,
+  PICK_TT_MOVES, PICK_CAPTURES, PICK_QUIETS, PICK_DROPS, PICK_BAD_CAPTURES,
+  PICK_EVASIONS, PICK_QUIET_CHECKS, PICK_PROBCUT,
+  CLASSICAL_EVALS, LAZY_SKIPS,
+  SEE_TESTS, TB_PROBES,
+  COUNTER_NB
+};
+
+struct alignas(64) Block {
+  Block();
+ ~Block();
+  std::atomic<uint64_t> count[COUNTER_NB] = {};
+  uint64_t reported[COUNTER_NB] = {}; // Counts at the previous report()
+};
+
+inline void inc(Counter c) {
+#if defined(USE_STATS)
+  thread_local Block block;
+  // Only this thread writes its counts, no need for an atomic increment
+  block.count[c].store(block.count[c].load(std::memory_order_relaxed) + 1,
+                       std::memory_order_relaxed);
+#else
+  (void)c;
+#endif
+}
+
+std::string report(); // Adds up the counts of all the threads since the previous report
+
+} // namespace Counters
+
+void startup_step(const char* name); // Times the startup step which just ended
+std::string startup_times();
+
 using TimePoint = std::chrono::milliseconds::rep; // A value in milliseconds
 static_assert(sizeof(TimePoint) == sizeof(int64_t), "TimePoint should be 64 bits");
 inline TimePoint now() {
@@ -55,12 +110,60 @@ inline TimePoint now() {
         (std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
-template<class Entry, int Size>
+/// HashTable is a power of 2 sized table of entries indexed by the low bits of
+/// a key, as used for the pawn and material caches of each thread. It is empty
+/// until resize() allocates it, on large pages when it is big enough for them.
+
+template<class Entry>
 struct HashTable {
-  Entry* operator[](Key key) { return &table[(uint32_t)key & (Size - 1)]; }
+
+  static_assert(std::is_trivially_destructible_v<Entry>, "Entries are never destroyed");
+
+  HashTable() = default;
+  HashTable(const HashTable&) = delete;
+  HashTable& operator=(const HashTable&) = delete;
+ ~HashTable() { free(); }
+
+  Entry* operator[](Key key) { return &table[(uint32_t)key & mask]; }
+  size_t size() const { return table ? size_t(mask) + 1 : 0; }
+
+  // Allocate the largest power of 2 number of entries fitting in the given
+  // bytes, all value initialized. Nothing is done if the size is unchanged.
+  void resize(size_t bytes) {
+
+    size_t count = 1;
+    while (count * 2 * sizeof(Entry) <= bytes && count < (size_t(1) << 31))
+        count *= 2;
+
+    if (count == size())
+        return;
+
+    free();
+    largePages = count * sizeof(Entry) >= LargePageSize;
+    table = static_cast<Entry*>(largePages ? aligned_large_pages_alloc(count * sizeof(Entry))
+                                           : std_aligned_alloc(64, count * sizeof(Entry)));
+    if (!table)
+    {
+        std::cerr << "Failed to allocate " << count * sizeof(Entry) << " bytes for hash table." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    std::uninitialized_value_construct_n(table, count);
+    mask = uint32_t(count - 1);
+  }
 
 private:
-  std::vector<Entry> table = std::vector<Entry>(Size); // Allocate on the heap
+  static constexpr size_t LargePageSize = 2 * 1024 * 1024;
+
+  void free() {
+    largePages ? aligned_large_pages_free(table) : std_aligned_free(table);
+    table = nullptr;
+    mask = 0;
+  }
+
+  Entry* table = nullptr;
+  uint32_t mask = 0;
+  bool largePages = false;
 };
 
 
@@ -95,6 +198,7 @@ class ValueList {
 public:
   std::size_t size() const { return size_; }
   void push_back(const T& value) { values_[size_++] = value; }
+  const T& operator[](std::size_t index) const { return values_[index]; }
   const T* begin() const { return values_; }
   const T* end() const { return values_ + size_; }
 
@@ -158,10 +262,12 @@ inline uint64_t mul_hi64(uint64_t a, uint64_t b) {
 /// logical processor group. This usually means to be limited to use max 64
 /// cores. To overcome this, some special platform specific API should be
 /// called to set group affinity for each thread. Original code from Texel by
-/// Peter Österlund.
+/// Peter Österlund. On Linux, threads are bound to the processors of a NUMA
+/// node, so that the memory they touch first is local.
 
 namespace WinProcGroup {
-  void bindThisThread(size_t idx);
+  int bindThisThread(size_t idx);
+  void bindThisThreadToNode(int node);
 }
 
 namespace CommandLine {
@@ -16,6 +16,7 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <cassert>
 
 #include "movegen.h"
@@ -349,6 +350,10 @@ namespace {
     {
         Square from = pop_lsb(bb);
         Bitboard b = attacks_bb<Pt>(from, pos.pieces()) & target;
+#ifdef GRID
+        if constexpr (V == GRID_VARIANT)
+            b &= ~pos.grid_bb(from);
+#endif
 #ifdef KNIGHTRELAY
         if constexpr (V == KNIGHTRELAY_VARIANT)
         {
@@ -391,11 +396,6 @@ namespace {
         ksq = pos.castling_king_square(Us);
     break;
 #endif
-#ifdef TWOKINGS
-    case TWOKINGS_VARIANT:
-        ksq = pos.castling_king_square(Us);
-    break;
-#endif
 #ifdef HORDE
     case HORDE_VARIANT:
         if (pos.is_horde_color(Us))
@@ -441,6 +441,20 @@ namespace {
             target &= pos.pieces(~Us);
 #endif
 
+#ifdef GRID
+        // The pawn moves inside a cell are removed after their bulk generation.
+        // As with the piece moves, leaving out these illegal moves does not
+        // change perft, but it changes the list the move picker sorts, and so
+        // the order of the moves of equal score and the bench.
+        if constexpr (V == GRID_VARIANT)
+        {
+            ExtMove* pawnMoves = moveList;
+            moveList = generate_pawn_moves<V, Us, Type>(pos, moveList, target);
+            moveList = std::remove_if(pawnMoves, moveList, [&](const ExtMove& m) {
+                           return pos.grid_bb(from_sq(m)) & to_sq(m); });
+        }
+        else
+#endif
         moveList = generate_pawn_moves<V, Us, Type>(pos, moveList, target);
         moveList = generate_moves<V, Us, KNIGHT, Checks>(pos, moveList, target);
         moveList = generate_moves<V, Us, BISHOP, Checks>(pos, moveList, target);
@@ -449,7 +463,7 @@ namespace {
     }
 
 #ifdef CRAZYHOUSE
-    if (V == CRAZYHOUSE_VARIANT && Type != CAPTURES && pos.count_in_hand<ALL_PIECES>(Us))
+    if (V == CRAZYHOUSE_VARIANT && Type != CAPTURES && Type != QUIETS && pos.count_in_hand<ALL_PIECES>(Us))
     {
         if (Type == EVASIONS)
             target = between_bb(ksq, lsb(pos.checkers()));
@@ -494,9 +508,11 @@ namespace {
     break;
 #endif
 #ifdef TWOKINGS
+    // Any king move may evade a check, by moving the royal king, by blocking
+    // or capturing the checker, or by giving the royalty to the other king.
+    // Their legality is tested one by one, see generate<LEGAL>.
     case TWOKINGS_VARIANT:
-        if (Type != EVASIONS)
-            moveList = generate_king_moves<V, Us, Type>(pos, moveList, target);
+        moveList = generate_king_moves<V, Us, Type>(pos, moveList, Type == EVASIONS ? ~pos.pieces(Us) : target);
     break;
 #endif
 #ifdef HORDE
@@ -509,6 +525,10 @@ namespace {
     if (!Checks || pos.blockers_for_king(~Us) & ksq)
     {
         Bitboard b = attacks_bb<KING>(ksq) & (Type == EVASIONS ? ~pos.pieces(Us) : target);
+#ifdef GRID
+        if constexpr (V == GRID_VARIANT)
+            b &= ~pos.grid_bb(ksq);
+#endif
         if (Checks)
             b &= ~attacks_bb<QUEEN>(pos.square<KING>(~Us));
 #ifdef RACE
@@ -556,7 +576,8 @@ namespace {
 
 
 /// <CAPTURES>     Generates all pseudo-legal captures plus queen promotions
-/// <QUIETS>       Generates all pseudo-legal non-captures and underpromotions
+/// <QUIETS>       Generates all pseudo-legal non-captures and underpromotions,
+///                except the drops, see generate_drops()
 /// <EVASIONS>     Generates all pseudo-legal check evasions when the side to move is in check
 /// <QUIET_CHECKS> Generates all pseudo-legal non-captures giving check, except castling and promotions
 /// <NON_EVASIONS> Generates all pseudo-legal captures and non-captures
@@ -647,6 +668,54 @@ template ExtMove* generate<QUIET_CHECKS>(const Position&, ExtMove*);
 template ExtMove* generate<NON_EVASIONS>(const Position&, ExtMove*);
 
 
+#ifdef CRAZYHOUSE
+/// generate_drops() generates all the pseudo-legal drops of the given piece
+/// type when not in check, used by the MovePicker to generate them a piece
+/// type at a time, after the quiets.
+
+ExtMove* generate_drops(const Position& pos, PieceType pt, ExtMove* moveList) {
+
+  assert(pos.is_house() && !pos.checkers());
+
+  Color us = pos.side_to_move();
+  Bitboard b = ~pos.pieces();
+#ifdef PLACEMENT
+  if (pos.is_placement())
+      b &= (us == WHITE ? Rank1BB : Rank8BB);
+#endif
+
+  switch (pt)
+  {
+  case PAWN:
+      b &= ~(Rank1BB | Rank8BB);
+      return us == WHITE ? generate_drops<WHITE, PAWN, false>(pos, moveList, b)
+                         : generate_drops<BLACK, PAWN, false>(pos, moveList, b);
+  case KNIGHT:
+      return us == WHITE ? generate_drops<WHITE, KNIGHT, false>(pos, moveList, b)
+                         : generate_drops<BLACK, KNIGHT, false>(pos, moveList, b);
+  case BISHOP:
+      return us == WHITE ? generate_drops<WHITE, BISHOP, false>(pos, moveList, b)
+                         : generate_drops<BLACK, BISHOP, false>(pos, moveList, b);
+  case ROOK:
+      return us == WHITE ? generate_drops<WHITE, ROOK, false>(pos, moveList, b)
+                         : generate_drops<BLACK, ROOK, false>(pos, moveList, b);
+  case QUEEN:
+      return us == WHITE ? generate_drops<WHITE, QUEEN, false>(pos, moveList, b)
+                         : generate_drops<BLACK, QUEEN, false>(pos, moveList, b);
+#ifdef PLACEMENT
+  case KING:
+      if (!pos.is_placement())
+          return moveList;
+      return us == WHITE ? generate_drops<WHITE, KING, false>(pos, moveList, b)
+                         : generate_drops<BLACK, KING, false>(pos, moveList, b);
+#endif
+  default:
+      return moveList;
+  }
+}
+#endif
+
+
 /// generate<LEGAL> generates all the legal moves in the given position
 
 template<>
@@ -658,15 +727,9 @@ ExtMove* generate<LEGAL>(const Position& pos, ExtMove* moveList) {
   Color us = pos.side_to_move();
   Bitboard pinned = pos.blockers_for_king(us) & pos.pieces(us);
   bool validate = false;
-#ifdef GRID
-  if (pos.is_grid()) validate = true;
-#endif
 #ifdef RACE
   if (pos.is_race()) validate = true;
 #endif
-#ifdef TWOKINGS
-  if (pos.is_two_kings()) validate = true;
-#endif
 #ifdef PLACEMENT
   if (pos.is_placement() && pos.count_in_hand<ALL_PIECES>(us)) validate = true;
 #endif
@@ -693,6 +756,9 @@ ExtMove* generate<LEGAL>(const Position& pos, ExtMove* moveList) {
 #endif
 #ifdef CRAZYHOUSE
                   || (pos.is_house() && type_of(*cur) == DROP)
+#endif
+#ifdef TWOKINGS
+                  || (pos.is_two_kings() && (pos.pieces(us, KING) & from_sq(*cur)))
 #endif
                   || ((pinned & from_sq(*cur)) || from_sq(*cur) == ksq || type_of(*cur) == EN_PASSANT))
                && !pos.legal(*cur))
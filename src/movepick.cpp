@@ -16,17 +16,20 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <cassert>
+#include <iterator>
 
 #include "bitboard.h"
 #include "movepick.h"
+#include "thread.h"
 
 namespace Stockfish {
 
 namespace {
 
   enum Stages {
-    MAIN_TT, CAPTURE_INIT, GOOD_CAPTURE, REFUTATION, QUIET_INIT, QUIET, BAD_CAPTURE,
+    MAIN_TT, CAPTURE_INIT, GOOD_CAPTURE, REFUTATION, QUIET_INIT, QUIET, DROP_INIT, DROPS, BAD_QUIET, BAD_CAPTURE,
     EVASION_TT, EVASION_INIT, EVASION,
     PROBCUT_TT, PROBCUT_INIT, PROBCUT,
     QSEARCH_TT, QCAPTURE_INIT, QCAPTURE, QCHECK_INIT, QCHECK
@@ -47,6 +50,22 @@ namespace {
         }
   }
 
+  // tt_move_ok() checks the TT move, counting the ones which are not pseudo
+  // legal as false matches of the TT for the statistics.
+  bool tt_move_ok(const Position& pos, Move ttm) {
+
+    if (pos.pseudo_legal(ttm))
+        return true;
+
+    ++pos.this_thread()->ttStats.falseMatches;
+    return false;
+  }
+
+#ifdef CRAZYHOUSE
+  // The drops are generated a piece type at a time, in this order
+  constexpr PieceType DropOrder[] = { QUEEN, ROOK, BISHOP, KNIGHT, PAWN, KING };
+#endif
+
 } // namespace
 
 
@@ -60,29 +79,33 @@ namespace {
 MovePicker::MovePicker(const Position& p, Move ttm, Depth d, const ButterflyHistory* mh,
                                                              const CapturePieceToHistory* cph,
                                                              const PieceToHistory** ch,
+                                                             const DropHistory* dh,
+                                                             const DropToHistory* dch,
                                                              Move cm,
                                                              const Move* killers)
            : pos(p), mainHistory(mh), captureHistory(cph), continuationHistory(ch),
-             ttMove(ttm), refutations{{killers[0], 0}, {killers[1], 0}, {cm, 0}}, depth(d)
+             dropHistory(dh), dropContinuation(dch), ttMove(ttm), refutations{{killers[0], 0}, {killers[1], 0}, {cm, 0}}, depth(d)
 {
   assert(d > 0);
 
   stage = (pos.checkers() ? EVASION_TT : MAIN_TT) +
-          !(ttm && pos.pseudo_legal(ttm));
+          !(ttm && tt_move_ok(pos, ttm));
 }
 
 /// MovePicker constructor for quiescence search
 MovePicker::MovePicker(const Position& p, Move ttm, Depth d, const ButterflyHistory* mh,
                                                              const CapturePieceToHistory* cph,
                                                              const PieceToHistory** ch,
+                                                             const DropHistory* dh,
                                                              Square rs)
-           : pos(p), mainHistory(mh), captureHistory(cph), continuationHistory(ch), ttMove(ttm), recaptureSquare(rs), depth(d)
+           : pos(p), mainHistory(mh), captureHistory(cph), continuationHistory(ch), dropHistory(dh),
+             ttMove(ttm), recaptureSquare(rs), depth(d)
 {
   assert(d <= 0);
 
   stage = (pos.checkers() ? EVASION_TT : QSEARCH_TT) +
           !(   ttm
-            && pos.pseudo_legal(ttm));
+            && tt_move_ok(pos, ttm));
 }
 
 /// MovePicker constructor for ProbCut: we generate captures with SEE greater
@@ -135,9 +158,20 @@ void MovePicker::score() {
       }
       else if constexpr (Type == QUIETS)
       {
+#ifdef CRAZYHOUSE
+          // Drops are scored by their own history instead of sharing the slots
+          // of the butterfly one, and by the one of the drops answering the
+          // previous move
+          if (type_of(m) == DROP)
+              m.value =  2 * (*dropHistory)[dropped_piece(m)][to_sq(m)]
+                       + 2 * (*continuationHistory[0])[pos.moved_piece(m)][to_sq(m)]
+                       +     (*dropContinuation)[type_of(dropped_piece(m))][to_sq(m)];
+          else
+#endif
           m.value =  2 * (*mainHistory)[pos.side_to_move()][from_to(m)]
-                   + 2 * (*continuationHistory[0])[pos.moved_piece(m)][to_sq(m)]
-                   +     (*continuationHistory[1])[pos.moved_piece(m)][to_sq(m)]
+                   + 2 * (*continuationHistory[0])[pos.moved_piece(m)][to_sq(m)];
+
+          m.value +=     (*continuationHistory[1])[pos.moved_piece(m)][to_sq(m)]
                    +     (*continuationHistory[3])[pos.moved_piece(m)][to_sq(m)]
                    +     (*continuationHistory[5])[pos.moved_piece(m)][to_sq(m)]
 #ifdef CRAZYHOUSE
@@ -163,7 +197,11 @@ void MovePicker::score() {
                        - Value(type_of(pos.moved_piece(m)))
                        + (1 << 28);
           else
-              m.value =  (*mainHistory)[pos.side_to_move()][from_to(m)]
+              m.value =  (
+#ifdef CRAZYHOUSE
+                          type_of(m) == DROP ? (*dropHistory)[dropped_piece(m)][to_sq(m)] :
+#endif
+                          (*mainHistory)[pos.side_to_move()][from_to(m)])
                        + (*continuationHistory[0])[pos.moved_piece(m)][to_sq(m)];
       }
 }
@@ -198,12 +236,14 @@ top:
   case EVASION_TT:
   case QSEARCH_TT:
   case PROBCUT_TT:
+      Counters::inc(Counters::PICK_TT_MOVES);
       ++stage;
       return ttMove;
 
   case CAPTURE_INIT:
   case PROBCUT_INIT:
   case QCAPTURE_INIT:
+      Counters::inc(stage == PROBCUT_INIT ? Counters::PICK_PROBCUT : Counters::PICK_CAPTURES);
       cur = endBadCaptures = moves;
       endMoves = generate<CAPTURES>(pos, cur);
 
@@ -240,13 +280,22 @@ top:
       [[fallthrough]];
 
   case QUIET_INIT:
+      cur = endGoodQuiets = endQuiets = endBadCaptures;
       if (!skipQuiets)
       {
-          cur = endBadCaptures;
-          endMoves = generate<QUIETS>(pos, cur);
+          Counters::inc(Counters::PICK_QUIETS);
+          endMoves = endGoodQuiets = endQuiets = generate<QUIETS>(pos, cur);
 
           score<QUIETS>();
           partial_insertion_sort(cur, endMoves, -3000 * depth);
+
+#ifdef CRAZYHOUSE
+          // In house variants the drops are tried after the good quiets, the
+          // ones sorted by partial_insertion_sort(), and before the others.
+          if (pos.is_house())
+              endMoves = endGoodQuiets = std::find_if(cur, endMoves,
+                                         [&](const ExtMove& m) { return m.value < -3000 * depth; });
+#endif
       }
 
       ++stage;
@@ -259,9 +308,56 @@ top:
                                       && *cur != refutations[2].move;}))
           return *(cur - 1);
 
+      ++stage;
+      [[fallthrough]];
+
+  case DROP_INIT:
+#ifdef CRAZYHOUSE
+      // Generate and score the next piece type with some drops, so that a
+      // cutoff leaves the drops of the other piece types ungenerated.
+      while (!skipQuiets && pos.is_house() && dropIdx < int(std::size(DropOrder)))
+      {
+          cur = endQuiets;
+          endMoves = generate_drops(pos, DropOrder[dropIdx++], cur);
+
+          if (cur != endMoves)
+          {
+              Counters::inc(Counters::PICK_DROPS);
+              score<QUIETS>();
+              partial_insertion_sort(cur, endMoves, -3000 * depth);
+              stage = DROPS;
+              goto top;
+          }
+      }
+#endif
+
+      // Prepare the pointers to loop over the bad quiets
+      cur = endGoodQuiets;
+      endMoves = endQuiets;
+      stage = BAD_QUIET;
+      goto top;
+
+  case DROPS:
+      if (   !skipQuiets
+          && select<Next>([&](){return   *cur != refutations[0].move
+                                      && *cur != refutations[1].move
+                                      && *cur != refutations[2].move;}))
+          return *(cur - 1);
+
+      stage = DROP_INIT;
+      goto top;
+
+  case BAD_QUIET:
+      if (   !skipQuiets
+          && select<Next>([&](){return   *cur != refutations[0].move
+                                      && *cur != refutations[1].move
+                                      && *cur != refutations[2].move;}))
+          return *(cur - 1);
+
       // Prepare the pointers to loop over the bad captures
       cur = moves;
       endMoves = endBadCaptures;
+      Counters::inc(Counters::PICK_BAD_CAPTURES);
 
       ++stage;
       [[fallthrough]];
@@ -270,6 +366,7 @@ top:
       return select<Next>([](){ return true; });
 
   case EVASION_INIT:
+      Counters::inc(Counters::PICK_EVASIONS);
       cur = moves;
       endMoves = generate<EVASIONS>(pos, cur);
 
@@ -296,6 +393,7 @@ top:
       [[fallthrough]];
 
   case QCHECK_INIT:
+      Counters::inc(Counters::PICK_QUIET_CHECKS);
       cur = moves;
       endMoves = generate<QUIET_CHECKS>(pos, cur);
 
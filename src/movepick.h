@@ -105,6 +105,16 @@ using PieceToHistory = Stats<int16_t, 29952, PIECE_NB, SQUARE_NB>;
 /// (~63 elo)
 using ContinuationHistory = Stats<PieceToHistory, NOT_USED, PIECE_NB, SQUARE_NB>;
 
+/// DropHistory is the ButterflyHistory of the drops of the house variants,
+/// which have no from square, addressed by their [dropped piece][to]
+using DropHistory = Stats<int16_t, 7183, PIECE_NB, SQUARE_NB>;
+
+/// DropContinuationHistory is the history of the drops given the previous move,
+/// addressed by its [piece][to] and then by the [dropped piece type][to] of the
+/// drop, the dropping side being the side to move.
+using DropToHistory = Stats<int16_t, 29952, PIECE_TYPE_NB, SQUARE_NB>;
+using DropContinuationHistory = Stats<DropToHistory, NOT_USED, PIECE_NB, SQUARE_NB>;
+
 
 /// MovePicker class is used to pick one pseudo-legal move at a time from the
 /// current position. The most important method is next_move(), which returns a
@@ -122,11 +132,14 @@ public:
   MovePicker(const Position&, Move, Depth, const ButterflyHistory*,
                                            const CapturePieceToHistory*,
                                            const PieceToHistory**,
+                                           const DropHistory*,
+                                           const DropToHistory*,
                                            Move,
                                            const Move*);
   MovePicker(const Position&, Move, Depth, const ButterflyHistory*,
                                            const CapturePieceToHistory*,
                                            const PieceToHistory**,
+                                           const DropHistory*,
                                            Square);
   MovePicker(const Position&, Move, Value, const CapturePieceToHistory*);
   Move next_move(bool skipQuiets = false);
@@ -141,9 +154,14 @@ private:
   const ButterflyHistory* mainHistory;
   const CapturePieceToHistory* captureHistory;
   const PieceToHistory** continuationHistory;
+  const DropHistory* dropHistory;
+  const DropToHistory* dropContinuation = nullptr;
   Move ttMove;
-  ExtMove refutations[3], *cur, *endMoves, *endBadCaptures;
+  ExtMove refutations[3], *cur, *endMoves, *endBadCaptures, *endGoodQuiets, *endQuiets;
   int stage;
+#ifdef CRAZYHOUSE
+  int dropIdx = 0;
+#endif
   Square recaptureSquare;
   Value threshold;
   Depth depth;
@@ -23,19 +23,19 @@
 
 #include "nnue_feature_transformer.h"
 
+#include <atomic>
 #include <memory>
 
 namespace Stockfish::Eval::NNUE {
 
-  // Hash value of evaluation function structure
-  constexpr std::uint32_t HashValue =
-      FeatureTransformer::get_hash_value() ^ Network::get_hash_value();
-
-
-  // Deleter for automating release of memory area
+  // Deleter for automating release of memory area. Memory that belongs to
+  // a mapped network image is flagged, as it is released by unmapping it.
   template <typename T>
   struct AlignedDeleter {
+    bool mapped = false;
     void operator()(T* ptr) const {
+      if (mapped)
+          return;
       ptr->~T();
       std_aligned_free(ptr);
     }
@@ -43,7 +43,10 @@ namespace Stockfish::Eval::NNUE {
 
   template <typename T>
   struct LargePageDeleter {
+    bool mapped = false;
     void operator()(T* ptr) const {
+      if (mapped)
+          return;
       ptr->~T();
       aligned_large_pages_free(ptr);
     }
@@ -58,10 +61,20 @@ namespace Stockfish::Eval::NNUE {
   std::string trace(Position& pos);
   Value evaluate(const Position& pos, bool adjusted = false, int* complexity = nullptr);
   void hint_common_parent_position(const Position& pos);
-
-  bool load_eval(std::string name, std::istream& stream);
-  bool save_eval(std::ostream& stream);
-  bool save_eval(const std::optional<std::string>& filename);
+  void evaluate_batch(const Position* const* positions, std::size_t n, Value* out);
+
+  bool load_eval(std::string name, std::istream& stream, Variant v = CHESS_VARIANT);
+  bool save_eval(std::ostream& stream, Variant v = CHESS_VARIANT);
+  bool save_eval(const std::optional<std::string>& filename, Variant v = CHESS_VARIANT);
+  bool map_eval(std::string name, const std::string& path, Variant v = CHESS_VARIANT);
+  bool save_image(const std::string& filename, Variant v = CHESS_VARIANT);
+  void replicate(bool enabled);
+  void replicate_variant(Variant v);
+  void release();
+
+  // Count of the changes of the networks, which free the memory of the old
+  // ones, see Thread::check_networks()
+  extern std::atomic<std::uint64_t> networksVersion;
 
 }  // namespace Stockfish::Eval::NNUE
 
@@ -24,19 +24,24 @@
 
 namespace Stockfish::Eval::NNUE::Features {
 
-  // Index of a feature for a given king position and another piece on some square
+  // Square of the king used for the piece-square features
   template<Color Perspective>
-  inline IndexType HalfKAv2_hm::make_index(Square s, Piece pc, Square ksq) {
-    return IndexType((int(s) ^ OrientTBL[Perspective][ksq]) + PieceSquareIndex[Perspective][pc] + KingBuckets[Perspective][ksq]);
+  Square HalfKAv2_hm::king_square(const Position& pos) {
+    return pos.pieces(Perspective, KING) ? pos.square<KING>(Perspective)
+                                         : relative_square(Perspective, SQ_E1);
   }
 
+  // Explicit template instantiations
+  template Square HalfKAv2_hm::king_square<WHITE>(const Position& pos);
+  template Square HalfKAv2_hm::king_square<BLACK>(const Position& pos);
+
   // Get a list of indices for active features
   template<Color Perspective>
   void HalfKAv2_hm::append_active_indices(
     const Position& pos,
     IndexList& active
   ) {
-    Square ksq = pos.square<KING>(Perspective);
+    Square ksq = king_square<Perspective>(pos);
     Bitboard bb = pos.pieces();
     while (bb)
     {
@@ -78,7 +83,12 @@ namespace Stockfish::Eval::NNUE::Features {
   }
 
   bool HalfKAv2_hm::requires_refresh(const StateInfo* st, Color perspective) {
-    return st->dirtyPiece.piece[0] == make_piece(perspective, KING);
+    // In variants where kings can be captured, the king square of the
+    // perspective may also change when its king is not the moved piece.
+    for (int i = 0; i < st->dirtyPiece.dirty_num; ++i)
+        if (st->dirtyPiece.piece[i] == make_piece(perspective, KING))
+            return true;
+    return false;
   }
 
 }  // namespace Stockfish::Eval::NNUE::Features
@@ -36,6 +36,7 @@ namespace Stockfish::Eval::NNUE::Features {
   // and the position of pieces. Position mirrored such that king always on e..h files.
   class HalfKAv2_hm {
 
+   protected:
     // unique number for each piece type on each square
     enum {
       PS_NONE     =  0,
@@ -62,11 +63,18 @@ namespace Stockfish::Eval::NNUE::Features {
         PS_NONE, PS_W_PAWN, PS_W_KNIGHT, PS_W_BISHOP, PS_W_ROOK, PS_W_QUEEN, PS_KING, PS_NONE }
     };
 
+   public:
     // Index of a feature for a given king position and another piece on some square
     template<Color Perspective>
     static IndexType make_index(Square s, Piece pc, Square ksq);
 
-   public:
+    // Square of the king used for the piece-square features. The perspective
+    // may have no king on the board, e.g. the horde side, an antichess side
+    // whose king was captured, or in placement before the king is dropped.
+    // Its initial square is used instead.
+    template<Color Perspective>
+    static Square king_square(const Position& pos);
+
     // Feature name
     static constexpr const char* Name = "HalfKAv2_hm(Friend)";
 
@@ -118,8 +126,9 @@ namespace Stockfish::Eval::NNUE::Features {
         SQ_H8, SQ_H8, SQ_H8, SQ_H8, SQ_A8, SQ_A8, SQ_A8, SQ_A8 }
     };
 
-    // Maximum number of simultaneously active features.
-    static constexpr IndexType MaxActiveDimensions = 32;
+    // Maximum number of simultaneously active features. Some variants,
+    // e.g. horde, have more than 32 pieces on the board.
+    static constexpr IndexType MaxActiveDimensions = 64;
     using IndexList = ValueList<IndexType, MaxActiveDimensions>;
 
     // Get a list of indices for active features
@@ -147,6 +156,12 @@ namespace Stockfish::Eval::NNUE::Features {
     static bool requires_refresh(const StateInfo* st, Color perspective);
   };
 
+  // Index of a feature for a given king position and another piece on some square
+  template<Color Perspective>
+  inline IndexType HalfKAv2_hm::make_index(Square s, Piece pc, Square ksq) {
+    return IndexType((int(s) ^ OrientTBL[Perspective][ksq]) + PieceSquareIndex[Perspective][pc] + KingBuckets[Perspective][ksq]);
+  }
+
 }  // namespace Stockfish::Eval::NNUE::Features
 
 #endif // #ifndef NNUE_FEATURES_HALF_KA_V2_HM_H_INCLUDED
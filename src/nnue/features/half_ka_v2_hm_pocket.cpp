@@ -0,0 +1,124 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2023 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+//Definition of input features HalfKAv2_hm_Pocket of NNUE evaluation function
+
+#include <algorithm>
+
+#include "half_ka_v2_hm_pocket.h"
+
+#include "../../position.h"
+
+namespace Stockfish::Eval::NNUE::Features {
+
+  // Index of a feature for the k-th piece of a given type in hand
+  template<Color Perspective>
+  inline IndexType HalfKAv2_hm_Pocket::make_hand_index(Piece pc, int k) {
+    return IndexType(  HalfKAv2_hm::Dimensions
+                     + ((color_of(pc) != Perspective) * HandPieceTypes + type_of(pc) - PAWN) * MaxHandCount + k);
+  }
+
+  // Get a list of indices for active features
+  template<Color Perspective>
+  void HalfKAv2_hm_Pocket::append_active_indices(
+    const Position& pos,
+    IndexList& active
+  ) {
+    Square ksq = king_square<Perspective>(pos);
+    Bitboard bb = pos.pieces();
+    while (bb)
+    {
+      Square s = pop_lsb(bb);
+      active.push_back(make_index<Perspective>(s, pos.piece_on(s), ksq));
+    }
+
+#ifdef CRAZYHOUSE
+    for (Color c : { WHITE, BLACK })
+    {
+      const int inHand[HandPieceTypes] = {
+        pos.count_in_hand<PAWN>(c), pos.count_in_hand<KNIGHT>(c), pos.count_in_hand<BISHOP>(c),
+        pos.count_in_hand<ROOK>(c), pos.count_in_hand<QUEEN>(c), pos.count_in_hand<KING>(c) };
+
+      for (PieceType pt = PAWN; pt <= KING; ++pt)
+        for (int k = 0; k < std::min(inHand[pt - PAWN], MaxHandCount); ++k)
+          active.push_back(make_hand_index<Perspective>(make_piece(c, pt), k));
+    }
+#endif
+  }
+
+  // Explicit template instantiations
+  template void HalfKAv2_hm_Pocket::append_active_indices<WHITE>(const Position& pos, IndexList& active);
+  template void HalfKAv2_hm_Pocket::append_active_indices<BLACK>(const Position& pos, IndexList& active);
+
+  // append_changed_indices() : get a list of indices for recently changed features
+  template<Color Perspective>
+  void HalfKAv2_hm_Pocket::append_changed_indices(
+    Square ksq,
+    const DirtyPiece& dp,
+    IndexList& removed,
+    IndexList& added
+  ) {
+    for (int i = 0; i < dp.dirty_num; ++i) {
+      if (dp.from[i] != SQ_NONE)
+        removed.push_back(make_index<Perspective>(dp.from[i], dp.piece[i], ksq));
+      if (dp.to[i] != SQ_NONE)
+        added.push_back(make_index<Perspective>(dp.to[i], dp.piece[i], ksq));
+    }
+
+#ifdef CRAZYHOUSE
+    // A count going from n to n + 1 activates feature n, and back again
+    for (int i = 0; i < dp.hand_num; ++i) {
+      const int k = std::min(dp.handFrom[i], dp.handTo[i]);
+      if (k >= MaxHandCount)
+        continue;
+      if (dp.handTo[i] > dp.handFrom[i])
+        added.push_back(make_hand_index<Perspective>(dp.handPiece[i], k));
+      else
+        removed.push_back(make_hand_index<Perspective>(dp.handPiece[i], k));
+    }
+#endif
+  }
+
+  // Explicit template instantiations
+  template void HalfKAv2_hm_Pocket::append_changed_indices<WHITE>(Square ksq, const DirtyPiece& dp, IndexList& removed, IndexList& added);
+  template void HalfKAv2_hm_Pocket::append_changed_indices<BLACK>(Square ksq, const DirtyPiece& dp, IndexList& removed, IndexList& added);
+
+  int HalfKAv2_hm_Pocket::update_cost(const StateInfo* st) {
+#ifdef CRAZYHOUSE
+    return st->dirtyPiece.dirty_num + st->dirtyPiece.hand_num;
+#else
+    return st->dirtyPiece.dirty_num;
+#endif
+  }
+
+  int HalfKAv2_hm_Pocket::refresh_cost(const Position& pos) {
+    // In the house variants the count includes the pieces in hand
+    return pos.count<ALL_PIECES>();
+  }
+
+  bool HalfKAv2_hm_Pocket::requires_refresh(const StateInfo* st, Color perspective) {
+    // In variants where kings can be captured, the king square of the
+    // perspective may also change when its king is not the moved piece.
+    for (int i = 0; i < st->dirtyPiece.dirty_num; ++i)
+        if (st->dirtyPiece.piece[i] == make_piece(perspective, KING))
+            return true;
+    return false;
+  }
+
+}  // namespace Stockfish::Eval::NNUE::Features
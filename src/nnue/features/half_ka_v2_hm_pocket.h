@@ -0,0 +1,89 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2023 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+//Definition of input features HalfKAv2_hm_Pocket of NNUE evaluation function
+
+#ifndef NNUE_FEATURES_HALF_KA_V2_HM_POCKET_H_INCLUDED
+#define NNUE_FEATURES_HALF_KA_V2_HM_POCKET_H_INCLUDED
+
+#include "half_ka_v2_hm.h"
+
+namespace Stockfish::Eval::NNUE::Features {
+
+  // Feature HalfKAv2_hm_Pocket: HalfKAv2_hm extended by the pieces in hand of
+  // both sides, used by the house variants. For each color and piece type there
+  // is one feature per possible in-hand count k, active while the hand holds
+  // more than k such pieces, so that a drop or a capture into the hand changes
+  // exactly one feature.
+  class HalfKAv2_hm_Pocket : public HalfKAv2_hm {
+
+    // Piece types which can be in hand, the king only in placement
+    static constexpr int HandPieceTypes = 6;
+
+    // In-hand counts beyond this limit are not represented
+    static constexpr int MaxHandCount = 16;
+
+    static constexpr IndexType PocketDimensions = COLOR_NB * HandPieceTypes * MaxHandCount;
+
+    // Index of a feature for the k-th piece of a given type in hand
+    template<Color Perspective>
+    static IndexType make_hand_index(Piece pc, int k);
+
+   public:
+    // Feature name
+    static constexpr const char* Name = "HalfKAv2_hm_Pocket(Friend)";
+
+    // Hash value embedded in the evaluation file
+    static constexpr std::uint32_t HashValue = 0x7f234cb8u ^ 0x504f434bu;
+
+    // Number of feature dimensions
+    static constexpr IndexType Dimensions = HalfKAv2_hm::Dimensions + PocketDimensions;
+
+    // Maximum number of simultaneously active features.
+    static constexpr IndexType MaxActiveDimensions = 64;
+    using IndexList = ValueList<IndexType, MaxActiveDimensions>;
+
+    // Get a list of indices for active features
+    template<Color Perspective>
+    static void append_active_indices(
+      const Position& pos,
+      IndexList& active);
+
+    // Get a list of indices for recently changed features
+    template<Color Perspective>
+    static void append_changed_indices(
+      Square ksq,
+      const DirtyPiece& dp,
+      IndexList& removed,
+      IndexList& added
+    );
+
+    // Returns the cost of updating one perspective, the most costly one.
+    // Assumes no refresh needed.
+    static int update_cost(const StateInfo* st);
+    static int refresh_cost(const Position& pos);
+
+    // Returns whether the change stored in this StateInfo means that
+    // a full accumulator refresh is required.
+    static bool requires_refresh(const StateInfo* st, Color perspective);
+  };
+
+}  // namespace Stockfish::Eval::NNUE::Features
+
+#endif // #ifndef NNUE_FEATURES_HALF_KA_V2_HM_POCKET_H_INCLUDED
@@ -30,6 +30,67 @@ namespace Stockfish::Eval::NNUE {
     std::int16_t accumulation[2][TransformedFeatureDimensions];
     std::int32_t psqtAccumulation[2][PSQTBuckets];
     bool computed[2];
+    const void* owner; // State the accumulator belongs to, see AccumulatorStack
+  };
+
+  // Per-thread stack of the accumulators of the states of the positions of the
+  // thread, indexed by ply. A state takes the slot following the one of its
+  // previous state, wrapping around in long games, so a slot is only valid
+  // for the state it was last handed out to.
+  struct AccumulatorStack {
+
+    static constexpr size_t Size = MAX_PLY + 10;
+
+    Accumulator* claim(size_t idx, const void* owner) {
+      Accumulator* acc = &entries[idx];
+      acc->owner = owner;
+      acc->computed[WHITE] = acc->computed[BLACK] = false;
+      return acc;
+    }
+
+    Accumulator* next(const Accumulator* prev, const void* owner) {
+      return claim(prev ? size_t(prev - entries + 1) % Size : 0, owner);
+    }
+
+    bool contains(const Accumulator* acc) const {
+      return acc >= entries && acc < entries + Size;
+    }
+
+    bool owns(const Accumulator* acc, const void* owner) const {
+      return contains(acc) && acc->owner == owner;
+    }
+
+    // Returns the slot of the owner, claiming it again if it is not valid
+    Accumulator* reclaim(Accumulator* acc, const void* owner) {
+      return   owns(acc, owner) ? acc
+             : claim(contains(acc) ? size_t(acc - entries) : 0, owner);
+    }
+
+    Accumulator entries[Size];
+  };
+
+  // Per-thread cache of accumulators used for refreshes, also known as "finny
+  // table". For every king square and perspective it keeps the accumulation
+  // of the position last refreshed with that king square, along with its piece
+  // placement, so that a refresh only needs to apply the difference between
+  // that placement and the current one.
+  struct AccumulatorCache {
+
+    struct alignas(CacheLineSize) Entry {
+      std::int16_t accumulation[TransformedFeatureDimensions];
+      std::int32_t psqtAccumulation[PSQTBuckets];
+      Bitboard byColorBB[COLOR_NB];
+      Bitboard byTypeBB[PIECE_TYPE_NB];
+      const void* owner; // Feature transformer the entry was computed with
+    };
+
+    void clear() {
+      for (auto& entriesBySquare : entries)
+          for (Entry& entry : entriesBySquare)
+              entry.owner = nullptr;
+    }
+
+    Entry entries[SQUARE_NB][COLOR_NB];
   };
 
 }  // namespace Stockfish::Eval::NNUE
@@ -26,6 +26,7 @@
 #include "nnue_common.h"
 
 #include "features/half_ka_v2_hm.h"
+#include "features/half_ka_v2_hm_pocket.h"
 
 #include "layers/affine_transform_sparse_input.h"
 #include "layers/affine_transform.h"
@@ -39,17 +40,28 @@ namespace Stockfish::Eval::NNUE {
 // Input features used in evaluation function
 using FeatureSet = Features::HalfKAv2_hm;
 
-// Number of input feature dimensions after conversion
+// Input features used in evaluation function of the house variants
+using PocketFeatureSet = Features::HalfKAv2_hm_Pocket;
+
+// Widths of the feature transformer, the number of its output dimensions for
+// one side, of the supported nets. The width of a net is told by the hash of its
+// header, so that the smaller and faster ones can be loaded for short time
+// controls. The accumulators are sized for the largest one.
+constexpr IndexType ArchitectureWidths[] = { 512, 1024, 2048 };
 constexpr IndexType TransformedFeatureDimensions = 2048;
 constexpr IndexType PSQTBuckets = 8;
 constexpr IndexType LayerStacks = 8;
 
+// Layer stack of the evaluation function, for a feature transformer of width L1
+template <IndexType L1>
 struct Network
 {
+  static_assert(L1 <= TransformedFeatureDimensions);
+
   static constexpr int FC_0_OUTPUTS = 15;
   static constexpr int FC_1_OUTPUTS = 32;
 
-  Layers::AffineTransformSparseInput<TransformedFeatureDimensions, FC_0_OUTPUTS + 1> fc_0;
+  Layers::AffineTransformSparseInput<L1, FC_0_OUTPUTS + 1> fc_0;
   Layers::SqrClippedReLU<FC_0_OUTPUTS + 1> ac_sqr_0;
   Layers::ClippedReLU<FC_0_OUTPUTS + 1> ac_0;
   Layers::AffineTransform<FC_0_OUTPUTS * 2, FC_1_OUTPUTS> fc_1;
@@ -60,7 +72,7 @@ struct Network
   static constexpr std::uint32_t get_hash_value() {
     // input slice hash
     std::uint32_t hashValue = 0xEC42E90Du;
-    hashValue ^= TransformedFeatureDimensions * 2;
+    hashValue ^= L1 * 2;
 
     hashValue = decltype(fc_0)::get_hash_value(hashValue);
     hashValue = decltype(ac_0)::get_hash_value(hashValue);
@@ -93,12 +105,12 @@ struct Network
   {
     struct alignas(CacheLineSize) Buffer
     {
-      alignas(CacheLineSize) decltype(fc_0)::OutputBuffer fc_0_out;
-      alignas(CacheLineSize) decltype(ac_sqr_0)::OutputType ac_sqr_0_out[ceil_to_multiple<IndexType>(FC_0_OUTPUTS * 2, 32)];
-      alignas(CacheLineSize) decltype(ac_0)::OutputBuffer ac_0_out;
-      alignas(CacheLineSize) decltype(fc_1)::OutputBuffer fc_1_out;
-      alignas(CacheLineSize) decltype(ac_1)::OutputBuffer ac_1_out;
-      alignas(CacheLineSize) decltype(fc_2)::OutputBuffer fc_2_out;
+      alignas(CacheLineSize) typename decltype(fc_0)::OutputBuffer fc_0_out;
+      alignas(CacheLineSize) typename decltype(ac_sqr_0)::OutputType ac_sqr_0_out[ceil_to_multiple<IndexType>(FC_0_OUTPUTS * 2, 32)];
+      alignas(CacheLineSize) typename decltype(ac_0)::OutputBuffer ac_0_out;
+      alignas(CacheLineSize) typename decltype(fc_1)::OutputBuffer fc_1_out;
+      alignas(CacheLineSize) typename decltype(ac_1)::OutputBuffer ac_1_out;
+      alignas(CacheLineSize) typename decltype(fc_2)::OutputBuffer fc_2_out;
 
       Buffer()
       {
@@ -118,7 +130,7 @@ struct Network
     fc_0.propagate(transformedFeatures, buffer.fc_0_out);
     ac_sqr_0.propagate(buffer.fc_0_out, buffer.ac_sqr_0_out);
     ac_0.propagate(buffer.fc_0_out, buffer.ac_0_out);
-    std::memcpy(buffer.ac_sqr_0_out + FC_0_OUTPUTS, buffer.ac_0_out, FC_0_OUTPUTS * sizeof(decltype(ac_0)::OutputType));
+    std::memcpy(buffer.ac_sqr_0_out + FC_0_OUTPUTS, buffer.ac_0_out, FC_0_OUTPUTS * sizeof(typename decltype(ac_0)::OutputType));
     fc_1.propagate(buffer.ac_sqr_0_out, buffer.fc_1_out);
     ac_1.propagate(buffer.fc_1_out, buffer.ac_1_out);
     fc_2.propagate(buffer.ac_1_out, buffer.fc_2_out);
@@ -24,7 +24,10 @@
 #include "nnue_common.h"
 #include "nnue_architecture.h"
 
+#include "../thread.h"
+
 #include <cstring> // std::memset()
+#include <type_traits> // std::is_same_v
 #include <utility> // std::pair
 
 namespace Stockfish::Eval::NNUE {
@@ -210,7 +213,6 @@ namespace Stockfish::Eval::NNUE {
           return 1;
       }
 
-      static constexpr int NumRegs     = BestRegisterCount<vec_t, WeightType, TransformedFeatureDimensions, NumRegistersSIMD>();
       static constexpr int NumPsqtRegs = BestRegisterCount<psqt_vec_t, PSQTWeightType, PSQTBuckets, NumRegistersSIMD>();
       #if defined(__GNUC__)
       #pragma GCC diagnostic pop
@@ -219,14 +221,30 @@ namespace Stockfish::Eval::NNUE {
 
 
 
-  // Input feature converter
-  class FeatureTransformer {
+  // Input feature converter, parameterized by its input feature set and its
+  // width, the number of its output dimensions for one side. A narrower one
+  // only uses the beginning of the accumulators.
+  template <typename FeatureSetType, IndexType L1>
+  class BasicFeatureTransformer {
+
+    using FeatureSet = FeatureSetType;
 
    private:
     // Number of output dimensions for one side
-    static constexpr IndexType HalfDimensions = TransformedFeatureDimensions;
+    static constexpr IndexType HalfDimensions = L1;
+
+    static_assert(HalfDimensions <= TransformedFeatureDimensions);
 
     #ifdef VECTOR
+    #if defined(__GNUC__)
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wignored-attributes"
+    #endif
+    static constexpr int NumRegs = BestRegisterCount<vec_t, WeightType, HalfDimensions, NumRegistersSIMD>();
+    #if defined(__GNUC__)
+    #pragma GCC diagnostic pop
+    #endif
+
     static constexpr IndexType TileHeight = NumRegs * sizeof(vec_t) / 2;
     static constexpr IndexType PsqtTileHeight = NumPsqtRegs * sizeof(psqt_vec_t) / 4;
     static_assert(HalfDimensions % TileHeight == 0, "TileHeight must divide HalfDimensions");
@@ -272,12 +290,13 @@ namespace Stockfish::Eval::NNUE {
 
     // Convert input features
     std::int32_t transform(const Position& pos, OutputType* output, int bucket) const {
+      claim_accumulator(pos);
       update_accumulator<WHITE>(pos);
       update_accumulator<BLACK>(pos);
 
       const Color perspectives[2] = {pos.side_to_move(), ~pos.side_to_move()};
-      const auto& accumulation = pos.state()->accumulator.accumulation;
-      const auto& psqtAccumulation = pos.state()->accumulator.psqtAccumulation;
+      const auto& accumulation = pos.state()->accumulator->accumulation;
+      const auto& psqtAccumulation = pos.state()->accumulator->psqtAccumulation;
 
       const auto psqt = (
             psqtAccumulation[perspectives[0]][bucket]
@@ -336,23 +355,35 @@ namespace Stockfish::Eval::NNUE {
     } // end of function transform()
 
     void hint_common_access(const Position& pos) const {
+      claim_accumulator(pos);
       hint_common_access_for_perspective<WHITE>(pos);
       hint_common_access_for_perspective<BLACK>(pos);
     }
 
    private:
+    // claim_accumulator() takes back the slot of the current state in case
+    // the slot has been handed out to a later state since, e.g. by the search
+    // on the setup states of the game.
+    static void claim_accumulator(const Position& pos) {
+      StateInfo* st = pos.state();
+      st->accumulator = pos.this_thread()->accumulatorStack.reclaim(st->accumulator, st);
+    }
+
     template<Color Perspective>
     [[nodiscard]] std::pair<StateInfo*, StateInfo*> try_find_computed_accumulator(const Position& pos) const {
       // Look for a usable accumulator of an earlier position. We keep track
       // of the estimated gain in terms of features to be added/subtracted.
+      // Stop at a state whose slot is not in the thread's stack anymore.
+      const auto& stack = pos.this_thread()->accumulatorStack;
       StateInfo *st = pos.state(), *next = nullptr;
       int gain = FeatureSet::refresh_cost(pos);
-      while (st->previous && !st->accumulator.computed[Perspective])
+      while (st->previous && !st->accumulator->computed[Perspective])
       {
         // This governs when a full feature refresh is needed and how many
         // updates are better than just one full refresh.
         if (   FeatureSet::requires_refresh(st, Perspective)
-            || (gain -= FeatureSet::update_cost(st) + 1) < 0)
+            || (gain -= FeatureSet::update_cost(st) + 1) < 0
+            || !stack.owns(st->previous->accumulator, st->previous))
           break;
         next = st;
         st = st->previous;
@@ -382,13 +413,13 @@ namespace Stockfish::Eval::NNUE {
       // Update incrementally going back through states_to_update.
 
       // Gather all features to be updated.
-      const Square ksq = pos.square<KING>(Perspective);
+      const Square ksq = FeatureSet::template king_square<Perspective>(pos);
 
       // The size must be enough to contain the largest possible update.
       // That might depend on the feature set and generally relies on the
       // feature set's update cost calculation to be correct and never
       // allow updates with more added/removed features than MaxActiveDimensions.
-      FeatureSet::IndexList removed[N-1], added[N-1];
+      typename FeatureSet::IndexList removed[N-1], added[N-1];
 
       {
         int i = N-2; // last potential state to update. Skip last element because it must be nullptr.
@@ -399,12 +430,12 @@ namespace Stockfish::Eval::NNUE {
 
         for (; i >= 0; --i)
         {
-          states_to_update[i]->accumulator.computed[Perspective] = true;
+          states_to_update[i]->accumulator->computed[Perspective] = true;
 
           StateInfo* end_state = i == 0 ? computed_st : states_to_update[i - 1];
 
           for (; st2 != end_state; st2 = st2->previous)
-            FeatureSet::append_changed_indices<Perspective>(
+            FeatureSet::template append_changed_indices<Perspective>(
               ksq, st2->dirtyPiece, removed[i], added[i]);
         }
       }
@@ -417,16 +448,28 @@ namespace Stockfish::Eval::NNUE {
       {
         // Load accumulator
         auto accTile = reinterpret_cast<vec_t*>(
-          &st->accumulator.accumulation[Perspective][j * TileHeight]);
+          &st->accumulator->accumulation[Perspective][j * TileHeight]);
         for (IndexType k = 0; k < NumRegs; ++k)
           acc[k] = vec_load(&accTile[k]);
 
         for (IndexType i = 0; states_to_update[i]; ++i)
         {
-          // Difference calculation for the deactivated features
-          for (const auto index : removed[i])
+          // Difference calculation for the deactivated features. Atomic
+          // explosions remove many features at once, so columns are summed
+          // pairwise first to halve the dependency chain on the accumulator.
+          std::size_t r = 0;
+          for (; r + 1 < removed[i].size(); r += 2)
           {
-            const IndexType offset = HalfDimensions * index + j * TileHeight;
+            const IndexType offset0 = HalfDimensions * removed[i][r    ] + j * TileHeight;
+            const IndexType offset1 = HalfDimensions * removed[i][r + 1] + j * TileHeight;
+            auto column0 = reinterpret_cast<const vec_t*>(&weights[offset0]);
+            auto column1 = reinterpret_cast<const vec_t*>(&weights[offset1]);
+            for (IndexType k = 0; k < NumRegs; ++k)
+              acc[k] = vec_sub_16(acc[k], vec_add_16(column0[k], column1[k]));
+          }
+          for (; r < removed[i].size(); ++r)
+          {
+            const IndexType offset = HalfDimensions * removed[i][r] + j * TileHeight;
             auto column = reinterpret_cast<const vec_t*>(&weights[offset]);
             for (IndexType k = 0; k < NumRegs; ++k)
               acc[k] = vec_sub_16(acc[k], column[k]);
@@ -443,7 +486,7 @@ namespace Stockfish::Eval::NNUE {
 
           // Store accumulator
           accTile = reinterpret_cast<vec_t*>(
-            &states_to_update[i]->accumulator.accumulation[Perspective][j * TileHeight]);
+            &states_to_update[i]->accumulator->accumulation[Perspective][j * TileHeight]);
           for (IndexType k = 0; k < NumRegs; ++k)
             vec_store(&accTile[k], acc[k]);
         }
@@ -453,16 +496,26 @@ namespace Stockfish::Eval::NNUE {
       {
         // Load accumulator
         auto accTilePsqt = reinterpret_cast<psqt_vec_t*>(
-          &st->accumulator.psqtAccumulation[Perspective][j * PsqtTileHeight]);
+          &st->accumulator->psqtAccumulation[Perspective][j * PsqtTileHeight]);
         for (std::size_t k = 0; k < NumPsqtRegs; ++k)
           psqt[k] = vec_load_psqt(&accTilePsqt[k]);
 
         for (IndexType i = 0; states_to_update[i]; ++i)
         {
           // Difference calculation for the deactivated features
-          for (const auto index : removed[i])
+          std::size_t r = 0;
+          for (; r + 1 < removed[i].size(); r += 2)
           {
-            const IndexType offset = PSQTBuckets * index + j * PsqtTileHeight;
+            const IndexType offset0 = PSQTBuckets * removed[i][r    ] + j * PsqtTileHeight;
+            const IndexType offset1 = PSQTBuckets * removed[i][r + 1] + j * PsqtTileHeight;
+            auto columnPsqt0 = reinterpret_cast<const psqt_vec_t*>(&psqtWeights[offset0]);
+            auto columnPsqt1 = reinterpret_cast<const psqt_vec_t*>(&psqtWeights[offset1]);
+            for (std::size_t k = 0; k < NumPsqtRegs; ++k)
+              psqt[k] = vec_sub_psqt_32(psqt[k], vec_add_psqt_32(columnPsqt0[k], columnPsqt1[k]));
+          }
+          for (; r < removed[i].size(); ++r)
+          {
+            const IndexType offset = PSQTBuckets * removed[i][r] + j * PsqtTileHeight;
             auto columnPsqt = reinterpret_cast<const psqt_vec_t*>(&psqtWeights[offset]);
             for (std::size_t k = 0; k < NumPsqtRegs; ++k)
               psqt[k] = vec_sub_psqt_32(psqt[k], columnPsqt[k]);
@@ -479,7 +532,7 @@ namespace Stockfish::Eval::NNUE {
 
           // Store accumulator
           accTilePsqt = reinterpret_cast<psqt_vec_t*>(
-            &states_to_update[i]->accumulator.psqtAccumulation[Perspective][j * PsqtTileHeight]);
+            &states_to_update[i]->accumulator->psqtAccumulation[Perspective][j * PsqtTileHeight]);
           for (std::size_t k = 0; k < NumPsqtRegs; ++k)
             vec_store_psqt(&accTilePsqt[k], psqt[k]);
         }
@@ -488,12 +541,12 @@ namespace Stockfish::Eval::NNUE {
 #else
       for (IndexType i = 0; states_to_update[i]; ++i)
       {
-        std::memcpy(states_to_update[i]->accumulator.accumulation[Perspective],
-            st->accumulator.accumulation[Perspective],
+        std::memcpy(states_to_update[i]->accumulator->accumulation[Perspective],
+            st->accumulator->accumulation[Perspective],
             HalfDimensions * sizeof(BiasType));
 
         for (std::size_t k = 0; k < PSQTBuckets; ++k)
-          states_to_update[i]->accumulator.psqtAccumulation[Perspective][k] = st->accumulator.psqtAccumulation[Perspective][k];
+          states_to_update[i]->accumulator->psqtAccumulation[Perspective][k] = st->accumulator->psqtAccumulation[Perspective][k];
 
         st = states_to_update[i];
 
@@ -503,10 +556,10 @@ namespace Stockfish::Eval::NNUE {
           const IndexType offset = HalfDimensions * index;
 
           for (IndexType j = 0; j < HalfDimensions; ++j)
-            st->accumulator.accumulation[Perspective][j] -= weights[offset + j];
+            st->accumulator->accumulation[Perspective][j] -= weights[offset + j];
 
           for (std::size_t k = 0; k < PSQTBuckets; ++k)
-            st->accumulator.psqtAccumulation[Perspective][k] -= psqtWeights[index * PSQTBuckets + k];
+            st->accumulator->psqtAccumulation[Perspective][k] -= psqtWeights[index * PSQTBuckets + k];
         }
 
         // Difference calculation for the activated features
@@ -515,10 +568,10 @@ namespace Stockfish::Eval::NNUE {
           const IndexType offset = HalfDimensions * index;
 
           for (IndexType j = 0; j < HalfDimensions; ++j)
-            st->accumulator.accumulation[Perspective][j] += weights[offset + j];
+            st->accumulator->accumulation[Perspective][j] += weights[offset + j];
 
           for (std::size_t k = 0; k < PSQTBuckets; ++k)
-            st->accumulator.psqtAccumulation[Perspective][k] += psqtWeights[index * PSQTBuckets + k];
+            st->accumulator->psqtAccumulation[Perspective][k] += psqtWeights[index * PSQTBuckets + k];
         }
       }
 #endif
@@ -540,10 +593,10 @@ namespace Stockfish::Eval::NNUE {
       // Refresh the accumulator
       // Could be extracted to a separate function because it's done in 2 places,
       // but it's unclear if compilers would correctly handle register allocation.
-      auto& accumulator = pos.state()->accumulator;
+      auto& accumulator = *pos.state()->accumulator;
       accumulator.computed[Perspective] = true;
-      FeatureSet::IndexList active;
-      FeatureSet::append_active_indices<Perspective>(pos, active);
+      typename FeatureSet::IndexList active;
+      FeatureSet::template append_active_indices<Perspective>(pos, active);
 
 #ifdef VECTOR
       for (IndexType j = 0; j < HalfDimensions / TileHeight; ++j)
@@ -612,6 +665,163 @@ namespace Stockfish::Eval::NNUE {
   #endif
     }
 
+    // update_accumulator_refresh_cache() refreshes the accumulator by applying
+    // to the cached accumulator of the same king square only the features that
+    // differ from the cached piece placement, then updates the cache entry.
+    template<Color Perspective>
+    void update_accumulator_refresh_cache(const Position& pos, Square ksq) const {
+  #ifdef VECTOR
+      vec_t acc[NumRegs];
+      psqt_vec_t psqt[NumPsqtRegs];
+  #endif
+
+      auto& entry = pos.this_thread()->accumulatorCache.entries[ksq][Perspective];
+
+      // Reset the entry to an empty board if it belongs to another network
+      if (entry.owner != this)
+      {
+          std::memcpy(entry.accumulation, biases, HalfDimensions * sizeof(BiasType));
+          std::memset(entry.psqtAccumulation, 0, sizeof(entry.psqtAccumulation));
+          std::memset(entry.byColorBB, 0, sizeof(entry.byColorBB));
+          std::memset(entry.byTypeBB, 0, sizeof(entry.byTypeBB));
+          entry.owner = this;
+      }
+
+      typename FeatureSet::IndexList removed, added;
+      for (Color c : { WHITE, BLACK })
+          for (PieceType pt = PAWN; pt <= KING; ++pt)
+          {
+              const Piece pc = make_piece(c, pt);
+              const Bitboard oldBB = entry.byColorBB[c] & entry.byTypeBB[pt];
+              const Bitboard newBB = pos.pieces(c, pt);
+              Bitboard toRemove = oldBB & ~newBB;
+              Bitboard toAdd = newBB & ~oldBB;
+
+              while (toRemove)
+                  removed.push_back(FeatureSet::template make_index<Perspective>(pop_lsb(toRemove), pc, ksq));
+              while (toAdd)
+                  added.push_back(FeatureSet::template make_index<Perspective>(pop_lsb(toAdd), pc, ksq));
+          }
+
+      auto& accumulator = *pos.state()->accumulator;
+      accumulator.computed[Perspective] = true;
+
+#ifdef VECTOR
+      for (IndexType j = 0; j < HalfDimensions / TileHeight; ++j)
+      {
+        auto entryTile = reinterpret_cast<vec_t*>(&entry.accumulation[j * TileHeight]);
+        for (IndexType k = 0; k < NumRegs; ++k)
+          acc[k] = entryTile[k];
+
+        for (const auto index : removed)
+        {
+          const IndexType offset = HalfDimensions * index + j * TileHeight;
+          auto column = reinterpret_cast<const vec_t*>(&weights[offset]);
+          for (IndexType k = 0; k < NumRegs; ++k)
+            acc[k] = vec_sub_16(acc[k], column[k]);
+        }
+        for (const auto index : added)
+        {
+          const IndexType offset = HalfDimensions * index + j * TileHeight;
+          auto column = reinterpret_cast<const vec_t*>(&weights[offset]);
+          for (IndexType k = 0; k < NumRegs; ++k)
+            acc[k] = vec_add_16(acc[k], column[k]);
+        }
+
+        auto accTile = reinterpret_cast<vec_t*>(
+            &accumulator.accumulation[Perspective][j * TileHeight]);
+        for (IndexType k = 0; k < NumRegs; k++)
+        {
+          vec_store(&entryTile[k], acc[k]);
+          vec_store(&accTile[k], acc[k]);
+        }
+      }
+
+      for (IndexType j = 0; j < PSQTBuckets / PsqtTileHeight; ++j)
+      {
+        auto entryTilePsqt = reinterpret_cast<psqt_vec_t*>(
+          &entry.psqtAccumulation[j * PsqtTileHeight]);
+        for (std::size_t k = 0; k < NumPsqtRegs; ++k)
+          psqt[k] = entryTilePsqt[k];
+
+        for (const auto index : removed)
+        {
+          const IndexType offset = PSQTBuckets * index + j * PsqtTileHeight;
+          auto columnPsqt = reinterpret_cast<const psqt_vec_t*>(&psqtWeights[offset]);
+          for (std::size_t k = 0; k < NumPsqtRegs; ++k)
+            psqt[k] = vec_sub_psqt_32(psqt[k], columnPsqt[k]);
+        }
+        for (const auto index : added)
+        {
+          const IndexType offset = PSQTBuckets * index + j * PsqtTileHeight;
+          auto columnPsqt = reinterpret_cast<const psqt_vec_t*>(&psqtWeights[offset]);
+          for (std::size_t k = 0; k < NumPsqtRegs; ++k)
+            psqt[k] = vec_add_psqt_32(psqt[k], columnPsqt[k]);
+        }
+
+        auto accTilePsqt = reinterpret_cast<psqt_vec_t*>(
+          &accumulator.psqtAccumulation[Perspective][j * PsqtTileHeight]);
+        for (std::size_t k = 0; k < NumPsqtRegs; ++k)
+        {
+          vec_store_psqt(&entryTilePsqt[k], psqt[k]);
+          vec_store_psqt(&accTilePsqt[k], psqt[k]);
+        }
+      }
+
+#else
+      for (const auto index : removed)
+      {
+        const IndexType offset = HalfDimensions * index;
+
+        for (IndexType j = 0; j < HalfDimensions; ++j)
+          entry.accumulation[j] -= weights[offset + j];
+
+        for (std::size_t k = 0; k < PSQTBuckets; ++k)
+          entry.psqtAccumulation[k] -= psqtWeights[index * PSQTBuckets + k];
+      }
+      for (const auto index : added)
+      {
+        const IndexType offset = HalfDimensions * index;
+
+        for (IndexType j = 0; j < HalfDimensions; ++j)
+          entry.accumulation[j] += weights[offset + j];
+
+        for (std::size_t k = 0; k < PSQTBuckets; ++k)
+          entry.psqtAccumulation[k] += psqtWeights[index * PSQTBuckets + k];
+      }
+
+      std::memcpy(accumulator.accumulation[Perspective], entry.accumulation,
+          HalfDimensions * sizeof(BiasType));
+      std::memcpy(accumulator.psqtAccumulation[Perspective], entry.psqtAccumulation,
+          PSQTBuckets * sizeof(PSQTWeightType));
+#endif
+
+      for (Color c : { WHITE, BLACK })
+          entry.byColorBB[c] = pos.pieces(c);
+      for (PieceType pt = PAWN; pt <= KING; ++pt)
+          entry.byTypeBB[pt] = pos.pieces(pt);
+
+  #if defined(USE_MMX)
+      _mm_empty();
+  #endif
+    }
+
+    // refresh_accumulator() picks the refresh method. The cache only describes
+    // piece placements, so it is not used by feature sets with pocket features,
+    // nor when the perspective has no king on the board.
+    template<Color Perspective>
+    void refresh_accumulator(const Position& pos) const {
+
+      if constexpr (std::is_same_v<FeatureSet, Features::HalfKAv2_hm>)
+          if (pos.pieces(Perspective, KING))
+          {
+              update_accumulator_refresh_cache<Perspective>(pos, pos.square<KING>(Perspective));
+              return;
+          }
+
+      update_accumulator_refresh<Perspective>(pos);
+    }
+
     template<Color Perspective>
     void hint_common_access_for_perspective(const Position& pos) const {
 
@@ -621,20 +831,22 @@ namespace Stockfish::Eval::NNUE {
       // Look for a usable accumulator of an earlier position. We keep track
       // of the estimated gain in terms of features to be added/subtracted.
       // Fast early exit.
-      if (pos.state()->accumulator.computed[Perspective])
+      if (pos.state()->accumulator->computed[Perspective])
         return;
 
       auto [oldest_st, _] = try_find_computed_accumulator<Perspective>(pos);
 
-      if (oldest_st->accumulator.computed[Perspective])
+      if (oldest_st->accumulator->computed[Perspective])
       {
         // Only update current position accumulator to minimize work.
         StateInfo* states_to_update[2] = { pos.state(), nullptr };
         update_accumulator_incremental<Perspective, 2>(pos, oldest_st, states_to_update);
+        ++pos.this_thread()->nnueUpdates[pos.variant()];
       }
       else
       {
-        update_accumulator_refresh<Perspective>(pos);
+        refresh_accumulator<Perspective>(pos);
+        ++pos.this_thread()->nnueRefreshes[pos.variant()];
       }
     }
 
@@ -643,7 +855,7 @@ namespace Stockfish::Eval::NNUE {
 
       auto [oldest_st, next] = try_find_computed_accumulator<Perspective>(pos);
 
-      if (oldest_st->accumulator.computed[Perspective])
+      if (oldest_st->accumulator->computed[Perspective])
       {
         if (next == nullptr)
           return;
@@ -657,10 +869,12 @@ namespace Stockfish::Eval::NNUE {
           { next, next == pos.state() ? nullptr : pos.state(), nullptr };
 
         update_accumulator_incremental<Perspective, 3>(pos, oldest_st, states_to_update);
+        ++pos.this_thread()->nnueUpdates[pos.variant()];
       }
       else
       {
-        update_accumulator_refresh<Perspective>(pos);
+        refresh_accumulator<Perspective>(pos);
+        ++pos.this_thread()->nnueRefreshes[pos.variant()];
       }
     }
 
@@ -669,6 +883,13 @@ namespace Stockfish::Eval::NNUE {
     alignas(CacheLineSize) PSQTWeightType psqtWeights[InputDimensions * PSQTBuckets];
   };
 
+  template <IndexType L1>
+  using FeatureTransformer = BasicFeatureTransformer<FeatureSet, L1>;
+#ifdef CRAZYHOUSE
+  template <IndexType L1>
+  using PocketFeatureTransformer = BasicFeatureTransformer<PocketFeatureSet, L1>;
+#endif
+
 }  // namespace Stockfish::Eval::NNUE
 
 #endif // #ifndef NNUE_FEATURE_TRANSFORMER_H_INCLUDED
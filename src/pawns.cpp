@@ -265,7 +265,10 @@ namespace {
   /// evaluate() calculates a score for the static pawn structure of the given position.
   /// We cannot use the location of pieces or king in this function, as the evaluation
   /// of the pawn structure will be stored in a small cache for speed reasons, and will
-  /// be re-used even when the pieces have moved.
+  /// be re-used even when the pieces have moved. The pawns are not scored one by one
+  /// but flagged all at once, each flag being the bitboard of the pawns it applies to,
+  /// as computed by shifting and filling the pawn bitboards along the files. Only the
+  /// connected pawns, scored by rank, are looped through.
 
   template<Color Us>
   Score evaluate(const Position& pos, Pawns::Entry* e) {
@@ -273,20 +276,17 @@ namespace {
     constexpr Color     Them = ~Us;
     constexpr Direction Up   = pawn_push(Us);
     constexpr Direction Down = -Up;
+    constexpr Bitboard  TRank5BB = (Us == WHITE ? Rank5BB : Rank4BB);
+    constexpr Bitboard  TRank6BB = (Us == WHITE ? Rank6BB : Rank3BB);
+    constexpr Bitboard  TRank7BB = (Us == WHITE ? Rank7BB : Rank2BB);
 
-    Bitboard neighbours, stoppers, support, phalanx, opposed;
-    Bitboard lever, leverPush, blocked;
-    Square s;
-    bool backward, passed, doubled;
     Score score = SCORE_ZERO;
-    Bitboard b = pos.pieces(Us, PAWN);
 
     Bitboard ourPawns   = pos.pieces(  Us, PAWN);
     Bitboard theirPawns = pos.pieces(Them, PAWN);
 
     Bitboard doubleAttackThem = pawn_double_attacks_bb<Them>(theirPawns);
 
-    e->passedPawns[Us] = 0;
     e->kingSquares[Us] = SQ_NONE;
     e->pawnAttacks[Us] = e->pawnAttacksSpan[Us] = pawn_attacks_bb<Us>(ourPawns);
     e->blockedCount += popcount(shift<Up>(ourPawns) & (theirPawns | doubleAttackThem));
@@ -302,105 +302,95 @@ namespace {
         }
     }
 #endif
-    // Loop through all pawns of the current color and score each pawn
-    while (b)
-    {
-        s = pop_lsb(b);
-
-        assert(pos.piece_on(s) == make_piece(Us, PAWN));
 
+    // Squares next to our and their pawns, squares attacked by their pawns and
+    // squares behind their pawns on the same file.
+    Bitboard ourSides     = shift<EAST>(ourPawns) | shift<WEST>(ourPawns);
+    Bitboard theirSides   = shift<EAST>(theirPawns) | shift<WEST>(theirPawns);
+    Bitboard theirAttacks = pawn_attacks_bb<Them>(theirPawns);
+    Bitboard theirFronts  = forward_fill<Them>(shift<Down>(theirPawns));
+
+    // Flag the pawns
+    Bitboard opposed        = ourPawns & theirFronts;
+    Bitboard blocked        = ourPawns & shift<Down>(theirPawns);
+    Bitboard doubled        = ourPawns & shift<Up>(ourPawns);
+    Bitboard isolated       = ourPawns & ~file_fill(ourSides);
+    Bitboard phalanx        = ourPawns & ourSides;
+    Bitboard supported      = ourPawns & pawn_attacks_bb<Us>(ourPawns);
+    Bitboard supportedTwice = ourPawns & pawn_double_attacks_bb<Us>(ourPawns);
+    Bitboard leverPush      = ourPawns & shift<Down>(theirAttacks);
+
+    // Additional doubled penalty if none of their pawns is fixed
+    if (!(ourPawns & shift<Down>(theirPawns | theirAttacks)))
+        score -= DoubledEarly * popcount(doubled);
+
+    // A pawn is backward when it is behind all pawns of the same color on
+    // the adjacent files and cannot safely advance.
+    Bitboard backward = ourPawns & ~forward_fill<Us>(ourSides) & (leverPush | blocked);
+
+    // Compute additional span of the pawns neither backward nor blocked
+    Bitboard b = ourPawns & ~(backward | blocked);
+    e->pawnAttacksSpan[Us] |= forward_fill<Us>(shift<Up>(shift<EAST>(b) | shift<WEST>(b)));
+
+    // A pawn is passed if one of the three following conditions is true:
+    // (a) there is no stoppers except some levers
+    // (b) the only stoppers are the leverPush, but we outnumber them
+    // (c) there is only one front stopper which can be levered.
+    //     (Refined in Evaluation::passed)
+    Bitboard sideStoppers = forward_fill<Them>(shift<Down>(shift<Down>(theirSides)));
+    Bitboard outnumbered  =  ~shift<Down>(theirAttacks)
+                          | (ourSides & ~shift<Down>(doubleAttackThem))
+                          | (shift<EAST>(ourPawns) & shift<WEST>(ourPawns));
+    b = shift<Up>(ourPawns) & ~(theirPawns | doubleAttackThem);
+
+    Bitboard passed =   ~(theirFronts | sideStoppers)
+                     | (~(theirFronts | theirAttacks | shift<Down>(sideStoppers)) & outnumbered)
+                     | (  ~(shift<Down>(theirFronts) | theirAttacks | sideStoppers)
+                        & (TRank5BB | TRank6BB | TRank7BB)
+                        & (shift<EAST>(b) | shift<WEST>(b)));
+
+    passed &= ourPawns & ~forward_fill<Them>(shift<Down>(ourPawns));
+
+    // Passed pawns will be properly scored later in evaluation when we have
+    // full attack info.
+    e->passedPawns[Us] = passed;
+
+    // Score the connected pawns
+    for (b = supported | phalanx; b; )
+    {
+        Square s = pop_lsb(b);
         Rank r = relative_rank(Us, s);
+        int v =  Connected[r] * (2 + bool(phalanx & s) - bool(opposed & s))
+               + 22 * (bool(supported & s) + bool(supportedTwice & s));
 
-        // Flag the pawn
-        opposed    = theirPawns & forward_file_bb(Us, s);
-        blocked    = theirPawns & (s + Up);
-        stoppers   = theirPawns & passed_pawn_span(Us, s);
-        lever      = theirPawns & pawn_attacks_bb(Us, s);
-        leverPush  = theirPawns & pawn_attacks_bb(Us, s + Up);
-#ifdef HORDE
-        if (pos.is_horde() && relative_rank(Us, s) == RANK_1)
-            doubled = 0;
-        else
-#endif
-        doubled    = ourPawns   & (s - Up);
-        neighbours = ourPawns   & adjacent_files_bb(s);
-        phalanx    = neighbours & rank_bb(s);
-#ifdef HORDE
-        if (pos.is_horde() && relative_rank(Us, s) == RANK_1)
-            support = 0;
-        else
-#endif
-        support    = neighbours & rank_bb(s - Up);
-
-        if (doubled)
-        {
-            // Additional doubled penalty if none of their pawns is fixed
-            if (!(ourPawns & shift<Down>(theirPawns | pawn_attacks_bb<Them>(theirPawns))))
-                score -= DoubledEarly;
-        }
-
-        // A pawn is backward when it is behind all pawns of the same color on
-        // the adjacent files and cannot safely advance.
-        backward =  !(neighbours & forward_ranks_bb(Them, s + Up))
-                  && (leverPush | blocked);
-
-        // Compute additional span if pawn is not backward nor blocked
-        if (!backward && !blocked)
-            e->pawnAttacksSpan[Us] |= pawn_attack_span(Us, s);
-
-        // A pawn is passed if one of the three following conditions is true:
-        // (a) there is no stoppers except some levers
-        // (b) the only stoppers are the leverPush, but we outnumber them
-        // (c) there is only one front stopper which can be levered.
-        //     (Refined in Evaluation::passed)
-        passed =   !(stoppers ^ lever)
-                || (   !(stoppers ^ leverPush)
-                    && popcount(phalanx) >= popcount(leverPush))
-                || (   stoppers == blocked && r >= RANK_5
-                    && (shift<Up>(support) & ~(theirPawns | doubleAttackThem)));
-
-        passed &= !(forward_file_bb(Us, s) & ourPawns);
-
-        // Passed pawns will be properly scored later in evaluation when we have
-        // full attack info.
-        if (passed)
-            e->passedPawns[Us] |= s;
-
-        // Score this pawn
-        if (support | phalanx)
-        {
-            int v =  Connected[r] * (2 + bool(phalanx) - bool(opposed))
-                   + 22 * popcount(support);
+        score += make_score(v, v * (r - 2) / 4);
+    }
 
-            score += make_score(v, v * (r - 2) / 4);
-        }
+    // Score the isolated pawns, counted as doubled when an opposed pawn of
+    // ours is behind them and no pawn of theirs can lever them.
+    Bitboard weakDoubled =   isolated & opposed
+                          &  forward_fill<Us>(shift<Up>(ourPawns))
+                          & ~file_fill(theirSides);
 
-        else if (!neighbours)
-        {
-            if (     opposed
-                &&  (ourPawns & forward_file_bb(Them, s))
-                && !(theirPawns & adjacent_files_bb(s)))
-                score -= Doubled[pos.variant()];
-            else
-                score -=  Isolated[pos.variant()]
-                        + WeakUnopposed * !opposed;
-        }
+    score -=  Doubled[pos.variant()] * popcount(weakDoubled)
+            + Isolated[pos.variant()] * popcount(isolated ^ weakDoubled)
+            + WeakUnopposed * popcount(isolated & ~opposed);
 
-        else if (backward)
-            score -=  Backward[pos.variant()]
-                    + WeakUnopposed * !opposed * bool(~(FileABB | FileHBB) & s);
+    // Score the backward pawns which are neither connected nor isolated
+    backward &= ~(supported | phalanx | isolated);
+    score -=  Backward[pos.variant()] * popcount(backward)
+            + WeakUnopposed * popcount(backward & ~opposed & ~(FileABB | FileHBB));
 
 #ifdef HORDE
-        if (!support || pos.is_horde())
+    b = pos.is_horde() ? ourPawns : ourPawns & ~supported;
 #else
-        if (!support)
+    b = ourPawns & ~supported;
 #endif
-            score -=  Doubled[pos.variant()] * doubled
-                    + WeakLever * more_than_one(lever);
+    score -=  Doubled[pos.variant()] * popcount(doubled & b)
+            + WeakLever * popcount(pawn_double_attacks_bb<Them>(theirPawns) & b);
 
-        if (blocked && r >= RANK_5)
-            score += BlockedPawn[r - RANK_5];
-    }
+    score +=  BlockedPawn[0] * popcount(blocked & TRank5BB)
+            + BlockedPawn[1] * popcount(blocked & TRank6BB);
 
     return score;
   }
@@ -19,7 +19,7 @@
 #include <algorithm>
 #include <cassert>
 #include <cstddef> // For offsetof()
-#include <cstring> // For std::memset, std::memcmp
+#include <cstring> // For std::memset, std::memcmp, std::memcpy
 #include <iomanip>
 #include <sstream>
 #include <string_view>
@@ -87,9 +87,6 @@ std::ostream& operator<<(std::ostream& os, const Position& pos) {
       && !pos.can_castle(ANY_CASTLING))
   {
       StateInfo st;
-#ifdef USE_NNUE
-      ASSERT_ALIGNED(&st, Eval::NNUE::CacheLineSize);
-#endif
 
       Position p;
       p.set(pos.fen(), pos.is_chess960(), pos.subvariant(), &st, pos.this_thread());
@@ -273,6 +270,13 @@ Position& Position::set(const string& fenStr, bool isChess960, Variant v, StateI
       }
 #endif
 
+#ifdef TWOKINGS
+  // The castling rights below belong to the royal kings
+  if (is_two_kings())
+      for (Color c : { WHITE, BLACK })
+          st->royalKing[c] = royal_king(c);
+#endif
+
   // 2. Active color
   ss >> token;
   sideToMove = (token == 'w' ? WHITE : BLACK);
@@ -421,6 +425,10 @@ Position& Position::set(const string& fenStr, bool isChess960, Variant v, StateI
 
   chess960 = isChess960;
   thisThread = th;
+#ifdef USE_NNUE
+  if (th)
+      st->accumulator = th->accumulatorStack.claim(0, st);
+#endif
   set_state();
 
   assert(pos_is_ok());
@@ -429,6 +437,27 @@ Position& Position::set(const string& fenStr, bool isChess960, Variant v, StateI
 }
 
 
+/// Position::clone() copies the given position for the given thread, with its
+/// current state copied to si. Unlike set() from its FEN, it is a plain copy,
+/// and keeps the fields of the state which a FEN cannot tell, like previous.
+
+Position& Position::clone(const Position& pos, StateInfo* si, Thread* th) {
+
+  std::memcpy(static_cast<void*>(this), &pos, sizeof(Position));
+  *si = *pos.st;
+  st = si;
+  thisThread = th;
+#ifdef USE_NNUE
+  if (th)
+      st->accumulator = th->accumulatorStack.claim(0, st);
+#endif
+
+  assert(pos_is_ok());
+
+  return *this;
+}
+
+
 /// Position::set_castling_right() is a helper function used to set castling
 /// rights given the corresponding color and the rook starting square.
 
@@ -452,10 +481,26 @@ void Position::set_castling_right(Color c, Square kfrom, Square rfrom) {
 }
 
 
-/// Position::set_check_info() sets king attacks to detect if a move gives check
+/// Position::set_check_info() sets king attacks to detect if a move gives check,
+/// resets the cached answers of can_capture() and relay_lines(), tests for adjacent kings in
+/// atomic chess and computes the status of the position at the end of a
+/// variant game
 
 void Position::set_check_info() const {
 
+  st->variantEnd = variant_end();
+
+#if defined(ANTI) || defined(LOSERS)
+  st->canCapture = -1;
+#endif
+#ifdef RELAY
+  st->relayLines = 0;
+#endif
+#ifdef ATOMIC
+  if (is_atomic())
+      st->kingsAdjacent = adjacent_squares_bb(byTypeBB[KING]) & byTypeBB[KING];
+#endif
+
 #ifdef PLACEMENT
   // Unplaced kings (during the placement phase) cannot be checked
   if (is_placement() && count_in_hand<KING>())
@@ -563,6 +608,16 @@ void Position::set_state() const {
   st->pawnKey = Zobrist::noPawns;
   st->nonPawnMaterial[WHITE] = st->nonPawnMaterial[BLACK] = VALUE_ZERO;
 
+#ifdef TWOKINGS
+  if (is_two_kings())
+      for (Color c : { WHITE, BLACK })
+          st->royalKing[c] = royal_king(c);
+#endif
+#ifdef ATOMIC
+  if (is_atomic())
+      st->kingsAdjacent = adjacent_squares_bb(byTypeBB[KING]) & byTypeBB[KING];
+#endif
+
 #ifdef HORDE
   if (is_horde() && is_horde_color(sideToMove))
       st->checkersBB = 0;
@@ -629,6 +684,11 @@ void Position::set_state() const {
 #endif
   }
 
+#ifdef CRAZYHOUSE
+  if (is_house())
+      st->imbalance = Material::imbalance(*this);
+#endif
+
 #ifdef THREECHECK
   if (is_three_check())
       for (Color c : { WHITE, BLACK })
@@ -673,6 +733,111 @@ Position& Position::set(const string& code, Color c, Variant v, StateInfo* si) {
 }
 
 
+/// Position::set_packed() initializes the position from its binary encoding,
+/// see PackedPosition. Like set(), it does not validate its input.
+
+Position& Position::set_packed(const PackedPosition& pp, StateInfo* si, Thread* th) {
+
+  assert(pp.variant < SUBVARIANT_NB);
+
+  std::memset(this, 0, sizeof(Position));
+  std::memset(si, 0, sizeof(StateInfo));
+  st = si;
+  subvar = Variant(pp.variant);
+  var = main_variant(subvar);
+
+  for (Square s = SQ_A1; s <= SQ_H8; ++s)
+      if (Piece pc = Piece((pp.board[s / 2] >> (4 * (int(s) & 1))) & 0xF))
+          put_piece(pc, s);
+
+#ifdef CRAZYHOUSE
+  if (is_house())
+  {
+      promotedPieces = pp.promoted;
+      for (Color c : { WHITE, BLACK })
+          for (PieceType pt = PAWN; pt <= KING; ++pt)
+              for (int n = pp.hand[c][pt - 1]; n > 0; --n)
+                  add_to_hand(c, pt);
+  }
+#endif
+
+  sideToMove = Color(pp.flags & 1);
+  chess960 = pp.flags & 2;
+
+  for (int i = 0; i < 4; ++i)
+      if (pp.castlingRooks[i] != SQ_NONE)
+      {
+          Color c = i < 2 ? WHITE : BLACK;
+          set_castling_right(c, Square(pp.castlingKings[c]), Square(pp.castlingRooks[i]));
+      }
+
+  st->epSquare = Square(pp.epSquare);
+#ifdef THREECHECK
+  st->checksGiven[WHITE] = CheckCount((pp.flags >> 2) & 3);
+  st->checksGiven[BLACK] = CheckCount((pp.flags >> 4) & 3);
+#endif
+  st->rule50 = pp.rule50;
+  gamePly = pp.gamePly;
+
+  thisThread = th;
+#ifdef USE_NNUE
+  if (th)
+      st->accumulator = th->accumulatorStack.claim(0, st);
+#endif
+  set_state();
+
+  assert(pos_is_ok());
+
+  return *this;
+}
+
+
+/// Position::pack() returns the binary encoding of the position, see PackedPosition
+
+PackedPosition Position::pack() const {
+
+  PackedPosition pp = {};
+
+  for (Square s = SQ_A1; s <= SQ_H8; ++s)
+      pp.board[s / 2] |= uint8_t(board[s] << (4 * (int(s) & 1)));
+
+#ifdef CRAZYHOUSE
+  if (is_house())
+  {
+      pp.promoted = promotedPieces;
+      for (Color c : { WHITE, BLACK })
+          for (PieceType pt = PAWN; pt <= KING; ++pt)
+              pp.hand[c][pt - 1] = uint8_t(pieceCountInHand[c][pt]);
+  }
+#endif
+
+  for (int i = 0; i < 4; ++i)
+  {
+      CastlingRights cr = CastlingRights(1 << i);
+      Color c = i < 2 ? WHITE : BLACK;
+
+      pp.castlingRooks[i] = can_castle(cr) ? castlingRookSquare[cr] : SQ_NONE;
+      if (can_castle(cr))
+#if defined(GIVEAWAY) || defined(EXTINCTION) || defined(TWOKINGS)
+          pp.castlingKings[c] = castlingKingSquare[c];
+#else
+          pp.castlingKings[c] = square<KING>(c);
+#endif
+  }
+
+  pp.epSquare = uint8_t(st->epSquare);
+  pp.variant = uint8_t(subvar);
+  pp.flags = uint8_t(sideToMove | chess960 << 1);
+#ifdef THREECHECK
+  pp.flags |= uint8_t(st->checksGiven[WHITE] << 2 | st->checksGiven[BLACK] << 4);
+#endif
+  pp.rule50 = uint8_t(std::min(st->rule50, 255));
+  pp.gamePly = uint16_t(gamePly);
+
+  return pp;
+}
+
+
 /// Position::fen() returns a FEN representation of the position. In case of
 /// Chess960 the Shredder-FEN notation is used. This is mainly a debugging function.
 
@@ -852,6 +1017,30 @@ Bitboard Position::relayed_attackers_to(Square s, Color c, Bitboard occupied) co
   }
   return b;
 }
+
+/// Position::relay_lines() returns the squares of the position whose vacating
+/// may expose the king of the side to move to a relayed slider attack: the
+/// first blockers of the lines from the king and from the enemy sliders, or
+/// all the squares if the king is already exposed to one. Vacating any other
+/// square changes none of the lines, so legal() only tests these squares, the
+/// answer being cached in StateInfo.
+
+Bitboard Position::relay_lines() const {
+
+  if (st->relayLines)
+      return st->relayLines;
+
+  Square ksq = square<KING>(sideToMove);
+  Bitboard lines = attacks_bb<QUEEN>(ksq, pieces());
+
+  if (relayed_attackers_to<BISHOP, QUEEN>(ksq, ~sideToMove))
+      lines = AllSquares;
+  else
+      for (Bitboard b = pieces(~sideToMove, BISHOP, ROOK) | pieces(~sideToMove, QUEEN); b; )
+          lines |= attacks_bb<QUEEN>(pop_lsb(b), pieces());
+
+  return st->relayLines = lines;
+}
 #endif
 
 #ifdef ATOMIC
@@ -1082,7 +1271,9 @@ bool Position::legal(Move m) const {
   // A non-king move is legal if and only if it is not pinned or it
   // is moving along the ray towards or away from the king.
 #ifdef RELAY
-  if (is_relay() && relayed_attackers_to<BISHOP, QUEEN>(square<KING>(us), ~us, pieces() ^ from))
+  if (   is_relay()
+      && (relay_lines() & from)
+      && relayed_attackers_to<BISHOP, QUEEN>(square<KING>(us), ~us, pieces() ^ from))
       return false;
 #endif
   return !(blockers_for_king(us) & from)
@@ -1442,13 +1633,6 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
   // ones which are going to be recalculated from scratch anyway and then switch
   // our state pointer to point to the new (ready to be updated) state.
   std::memcpy(&newSt, st, offsetof(StateInfo, key));
-#ifdef ATOMIC
-  if (is_atomic())
-  {
-      std::memset(newSt.blastByTypeBB, 0, sizeof(newSt.blastByTypeBB));
-      std::memset(newSt.blastByColorBB, 0, sizeof(newSt.blastByColorBB));
-  }
-#endif
   newSt.previous = st;
   st = &newSt;
 
@@ -1460,10 +1644,12 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
 
   // Used by NNUE
 #ifdef USE_NNUE
-  st->accumulator.computed[WHITE] = false;
-  st->accumulator.computed[BLACK] = false;
+  st->accumulator = thisThread->accumulatorStack.next(st->previous->accumulator, st);
   auto& dp = st->dirtyPiece;
   dp.dirty_num = 1;
+#ifdef CRAZYHOUSE
+  dp.hand_num = 0;
+#endif
 #endif
 
   Color us = sideToMove;
@@ -1577,12 +1763,22 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
               Piece add = is_promoted(capsq) ? make_piece(~color_of(captured), PAWN) : ~captured;
               add_to_hand(color_of(add), type_of(add));
               k ^= Zobrist::inHand[add][pieceCountInHand[color_of(add)][type_of(add)] - 1];
+#ifdef USE_NNUE
+              if (Eval::useNNUE)
+              {
+                  dp.handPiece[dp.hand_num] = add;
+                  dp.handTo[dp.hand_num] = pieceCountInHand[color_of(add)][type_of(add)];
+                  dp.handFrom[dp.hand_num] = dp.handTo[dp.hand_num] - 1;
+                  dp.hand_num++;
+              }
+#endif
           }
           promotedPieces -= capsq;
       }
 #endif
 
-      // Update material hash key and prefetch access to materialTable
+      // Update material hash key, whose materialTable entry is prefetched by
+      // prefetch_after() in the search
       k ^= Zobrist::psq[captured][capsq];
       st->materialKey ^= Zobrist::psq[captured][pieceCount[captured]];
 #ifdef ATOMIC
@@ -1622,11 +1818,12 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
               }
 
           }
+
+          // The blasts are left out of prefetch_after()
+          prefetch(thisThread->materialTable[st->materialKey]);
       }
 #endif
 
-      prefetch(thisThread->materialTable[st->materialKey]);
-
       // Reset rule 50 counter
       st->rule50 = 0;
   }
@@ -1687,6 +1884,19 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
   {
       drop_piece(pc, to);
       st->materialKey ^= Zobrist::psq[pc][pieceCount[pc]-1];
+#ifdef USE_NNUE
+      if (Eval::useNNUE)
+      {
+          // Dropped piece from SQ_NONE, and one piece less in hand
+          dp.piece[0] = pc;
+          dp.from[0] = SQ_NONE;
+          dp.to[0] = to;
+          dp.handPiece[dp.hand_num] = pc;
+          dp.handTo[dp.hand_num] = pieceCountInHand[us][type_of(pc)];
+          dp.handFrom[dp.hand_num] = dp.handTo[dp.hand_num] + 1;
+          dp.hand_num++;
+      }
+#endif
 #ifdef PLACEMENT
       if (is_placement() && !count_in_hand<ALL_PIECES>(us))
       {
@@ -1825,6 +2035,13 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
       st->rule50 = 0;
   }
 
+#ifdef CRAZYHOUSE
+  // The pieces in hand are not part of the material key, so the imbalance
+  // of the material of the house variants is not read from the material table.
+  if (is_house() && (captured || type_of(m) == DROP || type_of(m) == PROMOTION))
+      st->imbalance = Material::imbalance(*this);
+#endif
+
   // Set capture piece
   st->capturedPiece = captured;
 #ifdef CRAZYHOUSE
@@ -1845,9 +2062,18 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
       givesCheck = true;
 #endif
 #ifdef TWOKINGS
-  // If one king is captured, maybe the remaining king is in check
-  if (is_two_kings() && type_of(captured) == KING)
-      givesCheck = true;
+  // The royal king of a side only changes when one of its kings moves or is
+  // captured. If one king is captured, maybe the remaining king is in check.
+  if (is_two_kings())
+  {
+      if (type_of(pc) == KING)
+          st->royalKing[us] = royal_king(us);
+      if (type_of(captured) == KING)
+      {
+          st->royalKing[them] = royal_king(them);
+          givesCheck = true;
+      }
+  }
 #endif
   st->checkersBB = givesCheck ? attackers_to(square<KING>(them)) & pieces(us) : 0;
 
@@ -1861,9 +2087,18 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
   // Update king attacks used for fast check detection
   set_check_info();
 
-  // Calculate the repetition info. It is the ply distance from the previous
-  // occupiedurrence of the same position, negative in the 3-fold case, or zero
-  // if the position was not repeated.
+  set_repetition();
+
+  assert(pos_is_ok());
+}
+
+
+/// Position::set_repetition() calculates the repetition info. It is the ply
+/// distance from the previous occurrence of the same position, negative in the
+/// 3-fold case, or zero if the position was not repeated.
+
+void Position::set_repetition() {
+
   st->repetition = 0;
 #ifdef CRAZYHOUSE
   int end = is_house() ? st->pliesFromNull : std::min(st->rule50, st->pliesFromNull);
@@ -1883,8 +2118,6 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
           }
       }
   }
-
-  assert(pos_is_ok());
 }
 
 
@@ -2105,9 +2338,11 @@ void Position::do_null_move(StateInfo& newSt) {
 
 #ifdef USE_NNUE
   st->dirtyPiece.dirty_num = 0;
+#ifdef CRAZYHOUSE
+  st->dirtyPiece.hand_num = 0;
+#endif
   st->dirtyPiece.piece[0] = NO_PIECE; // Avoid checks in UpdateAccumulator()
-  st->accumulator.computed[WHITE] = false;
-  st->accumulator.computed[BLACK] = false;
+  st->accumulator = thisThread->accumulatorStack.next(st->previous->accumulator, st);
 #endif
 
   if (st->epSquare != SQ_NONE)
@@ -2118,7 +2353,7 @@ void Position::do_null_move(StateInfo& newSt) {
 
   st->key ^= Zobrist::side;
   ++st->rule50;
-  prefetch(TT.first_entry(key()));
+  prefetch(TT.first_entry(thisThread->ttSlice, key()));
 
   st->pliesFromNull = 0;
 
@@ -2142,6 +2377,35 @@ void Position::undo_null_move() {
   sideToMove = ~sideToMove;
 }
 
+#ifdef BUGHOUSE
+/// Position::transfer_to_hand() puts in the hand of its color a piece captured
+/// on the board of the partner. The current state is updated in place, so that
+/// the earlier states are kept, and with them the repetitions.
+
+void Position::transfer_to_hand(Piece pc) {
+
+  assert(is_bughouse() && type_of(pc) != KING);
+
+  st->key ^= Zobrist::inHand[pc][pieceCountInHand[color_of(pc)][type_of(pc)]];
+  add_to_hand(color_of(pc), type_of(pc));
+
+  if (type_of(pc) != PAWN)
+      st->nonPawnMaterial[color_of(pc)] += PieceValue[CHESS_VARIANT][MG][pc];
+  st->imbalance = Material::imbalance(*this);
+
+#ifdef USE_NNUE
+  // The pocket features of the accumulator have changed. The state gives up its
+  // slot rather than clearing it, as the slot may be the root one of a search
+  // of the thread meanwhile, and claims a new one when evaluated.
+  st->accumulator = nullptr;
+#endif
+
+  set_repetition();
+
+  assert(pos_is_ok());
+}
+#endif
+
 
 /// Position::key_after() computes the new hash key after the given move. Needed
 /// for speculative prefetch. It doesn't recognize special moves like castling,
@@ -2198,6 +2462,68 @@ Key Position::key_after(Move m) const {
       ? k : adjust_key50<true>(k);
 }
 
+
+/// Position::prefetch_after() prefetches the TT entry and the pawn and material
+/// table entries of the position after the given move, as early as possible in
+/// the move loops of the search. It returns the key after the move, as
+/// key_after() does. The keys of the atomic blasts are left to do_move().
+
+Key Position::prefetch_after(Move m) const {
+
+  Key k = key_after(m);
+  prefetch(TT.first_entry(thisThread->ttSlice, k));
+
+  Square from = from_sq(m);
+  Square to = to_sq(m);
+#ifdef CRAZYHOUSE
+  bool drop = is_house() && type_of(m) == DROP;
+  Piece pc = drop ? dropped_piece(m) : piece_on(from);
+#else
+  bool drop = false;
+  Piece pc = piece_on(from);
+#endif
+  Square capsq = type_of(m) == EN_PASSANT ? to - pawn_push(sideToMove) : to;
+  Piece captured = type_of(m) == CASTLING ? NO_PIECE : piece_on(capsq);
+
+#ifdef ATOMIC
+  if (!(is_atomic() && captured))
+#endif
+  {
+      Key pawnKey = st->pawnKey;
+      Key materialKey = st->materialKey;
+
+      if (captured)
+      {
+          if (type_of(captured) == PAWN)
+              pawnKey ^= Zobrist::psq[captured][capsq];
+          materialKey ^= Zobrist::psq[captured][pieceCount[captured] - 1];
+      }
+
+      if (drop)
+      {
+          materialKey ^= Zobrist::psq[pc][pieceCount[pc]];
+          if (type_of(pc) == PAWN)
+              pawnKey ^= Zobrist::psq[pc][to];
+      }
+      else if (type_of(m) == PROMOTION)
+      {
+          Piece promotion = make_piece(sideToMove, promotion_type(m));
+          pawnKey ^= Zobrist::psq[pc][from];
+          materialKey ^=  Zobrist::psq[promotion][pieceCount[promotion]]
+                        ^ Zobrist::psq[pc][pieceCount[pc] - 1];
+      }
+      else if (type_of(pc) == PAWN)
+          pawnKey ^= Zobrist::psq[pc][from] ^ Zobrist::psq[pc][to];
+
+      if (pawnKey != st->pawnKey)
+          prefetch(thisThread->pawnsTable[pawnKey]);
+      if (materialKey != st->materialKey)
+          prefetch(thisThread->materialTable[materialKey]);
+  }
+
+  return k;
+}
+
 #ifdef ATOMIC
 template<>
 Value Position::see<ATOMIC_VARIANT>(Move m, PieceType nextVictim, Square s) const {
@@ -2233,6 +2559,7 @@ Value Position::see<ATOMIC_VARIANT>(Move m, PieceType nextVictim, Square s) cons
 bool Position::see_ge(Move m, Bitboard& occupied, Value threshold) const {
 
   assert(is_ok(m));
+  Counters::inc(Counters::SEE_TESTS);
 #ifdef CRAZYHOUSE
   // Crazyhouse captures double in value (threshold is halved)
   if (is_house() && color_of(moved_piece(m)) == sideToMove)
@@ -35,6 +35,14 @@
 
 namespace Stockfish {
 
+/// VariantEnd is the status of a position at the end of a variant game, from
+/// the point of view of the side to move.
+
+enum VariantEnd : int8_t {
+  VARIANT_NOT_END, VARIANT_WIN, VARIANT_LOSS, VARIANT_DRAW
+};
+
+
 /// StateInfo struct stores information needed to restore a Position object to
 /// its previous state when we retract a move. Whenever a move is made on the
 /// board (by calling Position::do_move), a StateInfo object must be passed.
@@ -52,6 +60,12 @@ struct StateInfo {
   CheckCount checksGiven[COLOR_NB];
 #endif
   Square epSquare;
+#ifdef TWOKINGS
+  Square royalKing[COLOR_NB];
+#endif
+#ifdef CRAZYHOUSE
+  Score  imbalance; // Material imbalance with the pieces in hand, see Material::imbalance()
+#endif
 
   // Not copied when making a move (will be recomputed anyhow)
   Key        key;
@@ -62,19 +76,31 @@ struct StateInfo {
   Bitboard   checkSquares[PIECE_TYPE_NB];
   Piece      capturedPiece;
   int        repetition;
+  VariantEnd variantEnd;
 #ifdef ATOMIC
-  Bitboard   blastByTypeBB[PIECE_TYPE_NB];
-  Bitboard   blastByColorBB[COLOR_NB];
+  bool       kingsAdjacent;
 #endif
 #ifdef CRAZYHOUSE
   bool       capturedpromoted;
 #endif
+#if defined(ANTI) || defined(LOSERS)
+  int8_t     canCapture; // -1 until can_capture() has been called
+#endif
+#ifdef RELAY
+  Bitboard   relayLines; // 0 until relay_lines() has been called
+#endif
 
-  // Used by NNUE
+  // Used by NNUE. The accumulator lives in the AccumulatorStack of the thread.
 #ifdef USE_NNUE
-  Eval::NNUE::Accumulator accumulator;
+  Eval::NNUE::Accumulator* accumulator;
   DirtyPiece dirtyPiece;
 #endif
+
+  // Rarely used, kept last to leave the fields above in as few cache lines as possible
+#ifdef ATOMIC
+  Bitboard   blastByTypeBB[PIECE_TYPE_NB]; // Set only by captures
+  Bitboard   blastByColorBB[COLOR_NB];
+#endif
 };
 
 
@@ -85,6 +111,38 @@ struct StateInfo {
 using StateListPtr = std::unique_ptr<std::deque<StateInfo>>;
 
 
+/// PackedPosition is the 64 byte binary encoding of a position of any variant,
+/// written by Position::pack() and read by Position::set_packed() without any
+/// parsing. Files of packed positions are plain arrays of them in the byte order
+/// of the machine, so that they can be mapped and read in place.
+///
+/// promoted        64 bit  promoted pieces of the house variants
+/// board          256 bit  piece on each square, 4 bits per square from A1
+/// hand            96 bit  number of pieces in hand, by color and piece type
+/// castlingRooks   32 bit  rook square of each castling right, or SQ_NONE
+/// castlingKings   16 bit  king square of the castling rights of each color
+/// epSquare         8 bit
+/// variant          8 bit  subvariant
+/// flags            8 bit  side to move, chess960 and checks given by each side
+/// rule50           8 bit  capped at 255
+/// gamePly         16 bit
+
+struct PackedPosition {
+  uint64_t promoted;
+  uint8_t  board[SQUARE_NB / 2];
+  uint8_t  hand[COLOR_NB][KING];
+  uint8_t  castlingRooks[4];
+  uint8_t  castlingKings[COLOR_NB];
+  uint8_t  epSquare;
+  uint8_t  variant;
+  uint8_t  flags;
+  uint8_t  rule50;
+  uint16_t gamePly;
+};
+
+static_assert(sizeof(PackedPosition) == 64, "Unexpected PackedPosition size");
+
+
 /// Position class stores information regarding the board representation as
 /// pieces, side to move, hash keys, castling info, etc. Important methods are
 /// do_move() and undo_move(), used by the search to update node info when
@@ -102,7 +160,10 @@ public:
   // FEN string input/output
   Position& set(const std::string& fenStr, bool isChess960, Variant v, StateInfo* si, Thread* th);
   Position& set(const std::string& code, Color c, Variant v, StateInfo* si);
+  Position& clone(const Position& pos, StateInfo* si, Thread* th);
   std::string fen() const;
+  Position& set_packed(const PackedPosition& pp, StateInfo* si, Thread* th);
+  PackedPosition pack() const;
 
   // Position representation
   Bitboard pieces(PieceType pt = ALL_PIECES) const;
@@ -142,6 +203,7 @@ public:
 #ifdef RELAY
   template<PieceType, PieceType> Bitboard relayed_attackers_to(Square s, Color c) const;
   template<PieceType, PieceType> Bitboard relayed_attackers_to(Square s, Color c, Bitboard occupied) const;
+  Bitboard relay_lines() const;
 #endif
 #ifdef ATOMIC
   Bitboard slider_attackers_to(Square s) const;
@@ -184,6 +246,7 @@ public:
   // Accessing hash keys
   Key key() const;
   Key key_after(Move m) const;
+  Key prefetch_after(Move m) const;
   Key material_key() const;
   Key pawn_key() const;
 
@@ -211,14 +274,17 @@ public:
   bool is_house() const;
   template<PieceType Pt> int count_in_hand(Color c) const;
   template<PieceType Pt> int count_in_hand() const;
+  Score imbalance() const;
   void add_to_hand(Color c, PieceType pt);
   void remove_from_hand(Color c, PieceType pt);
   bool is_promoted(Square s) const;
+  Bitboard promoted_pieces() const;
   void drop_piece(Piece pc, Square s);
   void undrop_piece(Piece pc, Square s);
 #endif
 #ifdef BUGHOUSE
   bool is_bughouse() const;
+  void transfer_to_hand(Piece pc);
 #endif
 #ifdef LOOP
   bool is_loop() const;
@@ -325,6 +391,8 @@ private:
   void set_castling_right(Color c, Square kfrom, Square rfrom);
   void set_state() const;
   void set_check_info() const;
+  void set_repetition();
+  VariantEnd variant_end() const;
 
   // Other helpers
   void move_piece(Square from, Square to);
@@ -442,8 +510,8 @@ template<PieceType Pt> inline Square Position::square(Color c) const {
 #endif
 #ifdef TWOKINGS
   case TWOKINGS_VARIANT:
-      if (Pt == KING && count<Pt>(c) > 1)
-          return royal_king(c);
+      if (Pt == KING)
+          return st->royalKing[c];
   [[fallthrough]];
 #endif
   default:
@@ -557,7 +625,8 @@ inline Bitboard Position::slider_attackers_to(Square s) const {
 
 inline bool Position::kings_adjacent() const {
   assert(is_atomic());
-  return adjacent_squares_bb(byTypeBB[KING]) & byTypeBB[KING];
+  assert(st->kingsAdjacent == bool(adjacent_squares_bb(byTypeBB[KING]) & byTypeBB[KING]));
+  return st->kingsAdjacent;
 }
 
 inline bool Position::kings_adjacent(Move m) const {
@@ -786,23 +855,29 @@ inline bool Position::is_anti_win() const {
 #endif
 
 #if defined(ANTI) || defined(LOSERS)
+// Position::can_capture() tests whether we have a pseudo-legal capture, from
+// the attack sets only. It is called several times per node by the move
+// generation, legal() and the search, so the answer is cached in StateInfo.
+
 inline bool Position::can_capture() const {
+
+  if (st->canCapture >= 0)
+      return st->canCapture;
+
   Square ep = ep_square();
   assert(ep == SQ_NONE
          || (pawn_attacks_bb(~sideToMove, ep) & pieces(sideToMove, PAWN)));
-  if (ep != SQ_NONE)
-      return true;
   Bitboard target = pieces(~sideToMove);
   Bitboard b1 = pieces(sideToMove, PAWN), b2 = pieces(sideToMove) - b1;
-  if ((sideToMove == WHITE ? pawn_attacks_bb<WHITE>(b1) : pawn_attacks_bb<BLACK>(b1)) & target)
-      return true;
-  while (b2)
+  bool found =   ep != SQ_NONE
+              || ((sideToMove == WHITE ? pawn_attacks_bb<WHITE>(b1) : pawn_attacks_bb<BLACK>(b1)) & target);
+  while (!found && b2)
   {
       Square s = pop_lsb(b2);
-      if (attacks_bb(type_of(piece_on(s)), s, pieces()) & target)
-          return true;
+      found = attacks_bb(type_of(piece_on(s)), s, pieces()) & target;
   }
-  return false;
+  st->canCapture = found;
+  return found;
 }
 #endif
 
@@ -916,6 +991,10 @@ template<PieceType Pt> inline int Position::count_in_hand() const {
   return count_in_hand<Pt>(WHITE) + count_in_hand<Pt>(BLACK);
 }
 
+inline Score Position::imbalance() const {
+  return st->imbalance;
+}
+
 inline void Position::add_to_hand(Color c, PieceType pt) {
   pieceCountInHand[c][pt]++;
   pieceCountInHand[c][ALL_PIECES]++;
@@ -931,6 +1010,10 @@ inline void Position::remove_from_hand(Color c, PieceType pt) {
 inline bool Position::is_promoted(Square s) const {
   return promotedPieces & s;
 }
+
+inline Bitboard Position::promoted_pieces() const {
+  return promotedPieces;
+}
 #endif
 
 #ifdef BUGHOUSE
@@ -1028,117 +1111,60 @@ inline Variant Position::subvariant() const {
 }
 
 inline bool Position::is_variant_end() const {
-  switch (var)
-  {
-#ifdef ANTI
-  case ANTI_VARIANT:
-      return is_anti_win() || is_anti_loss();
-#endif
-#ifdef ATOMIC
-  case ATOMIC_VARIANT:
-      return is_atomic_win() || is_atomic_loss();
-#endif
-#ifdef EXTINCTION
-  case EXTINCTION_VARIANT:
-      return is_extinction_win() || is_extinction_loss();
-#endif
-#ifdef HORDE
-  case HORDE_VARIANT:
-      return is_horde_loss();
-#endif
-#ifdef KOTH
-  case KOTH_VARIANT:
-      return is_koth_win() || is_koth_loss();
-#endif
-#ifdef LOSERS
-  case LOSERS_VARIANT:
-      return is_losers_win() || is_losers_loss();
-#endif
-#ifdef RACE
-  case RACE_VARIANT:
-      return is_race_draw() || is_race_win() || is_race_loss();
-#endif
-#ifdef THREECHECK
-  case THREECHECK_VARIANT:
-      return is_three_check_win() || is_three_check_loss();
-#endif
-  default:
-      return false;
-  }
+  return st->variantEnd != VARIANT_NOT_END;
 }
 
 inline Value Position::variant_result(int ply, Value draw_value) const {
+  // variant_result should not be called if is_variant_end is false.
+  assert(is_variant_end());
+  return  st->variantEnd == VARIANT_WIN  ? mate_in(ply)
+        : st->variantEnd == VARIANT_LOSS ? mated_in(ply)
+                                         : draw_value;
+}
+
+// Position::variant_end() computes the status of the position at the end of a
+// variant game once per move, see set_check_info(), for is_variant_end() and
+// variant_result() to read it back at every node.
+inline VariantEnd Position::variant_end() const {
   switch (var)
   {
 #ifdef ANTI
   case ANTI_VARIANT:
-      if (is_anti_win())
-          return mate_in(ply);
-      if (is_anti_loss())
-          return mated_in(ply);
-      break;
+      return is_anti_win() ? VARIANT_WIN : is_anti_loss() ? VARIANT_LOSS : VARIANT_NOT_END;
 #endif
 #ifdef ATOMIC
   case ATOMIC_VARIANT:
-      if (is_atomic_win())
-          return mate_in(ply);
-      if (is_atomic_loss())
-          return mated_in(ply);
-      break;
+      return is_atomic_win() ? VARIANT_WIN : is_atomic_loss() ? VARIANT_LOSS : VARIANT_NOT_END;
 #endif
 #ifdef EXTINCTION
   case EXTINCTION_VARIANT:
-      if (is_extinction_win())
-          return mate_in(ply);
-      if (is_extinction_loss())
-          return mated_in(ply);
-      break;
+      return is_extinction_win() ? VARIANT_WIN : is_extinction_loss() ? VARIANT_LOSS : VARIANT_NOT_END;
 #endif
 #ifdef HORDE
   case HORDE_VARIANT:
-      if (is_horde_loss())
-          return mated_in(ply);
-      break;
+      return is_horde_loss() ? VARIANT_LOSS : VARIANT_NOT_END;
 #endif
 #ifdef KOTH
   case KOTH_VARIANT:
-      if (is_koth_win())
-          return mate_in(ply);
-      if (is_koth_loss())
-          return mated_in(ply);
-      break;
+      return is_koth_win() ? VARIANT_WIN : is_koth_loss() ? VARIANT_LOSS : VARIANT_NOT_END;
 #endif
 #ifdef LOSERS
   case LOSERS_VARIANT:
-      if (is_losers_win())
-          return mate_in(ply);
-      if (is_losers_loss())
-          return mated_in(ply);
-      break;
+      return is_losers_win() ? VARIANT_WIN : is_losers_loss() ? VARIANT_LOSS : VARIANT_NOT_END;
 #endif
 #ifdef RACE
   case RACE_VARIANT:
-      if (is_race_draw())
-          return draw_value;
-      if (is_race_win())
-          return mate_in(ply);
-      if (is_race_loss())
-          return mated_in(ply);
-      break;
+      return  is_race_draw() ? VARIANT_DRAW
+            : is_race_win()  ? VARIANT_WIN
+            : is_race_loss() ? VARIANT_LOSS : VARIANT_NOT_END;
 #endif
 #ifdef THREECHECK
   case THREECHECK_VARIANT:
-      if (is_three_check_win())
-          return mate_in(ply);
-      if (is_three_check_loss())
-          return mated_in(ply);
-      break;
+      return is_three_check_win() ? VARIANT_WIN : is_three_check_loss() ? VARIANT_LOSS : VARIANT_NOT_END;
 #endif
-  default:;
+  default:
+      return VARIANT_NOT_END;
   }
-  // variant_result should not be called if is_variant_end is false.
-  assert(false);
-  return VALUE_ZERO;
 }
 
 inline Value Position::checkmate_value(int ply) const {
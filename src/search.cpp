@@ -17,12 +17,18 @@
 */
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <charconv>
 #include <cmath>
 #include <cstring>   // For std::memset
 #include <iostream>
+#include <mutex>
 #include <sstream>
 
+#include "book.h"
+#include "cluster.h"
 #include "evaluate.h"
 #include "misc.h"
 #include "movegen.h"
@@ -38,19 +44,6 @@
 
 namespace Stockfish {
 
-namespace Search {
-
-  LimitsType Limits;
-}
-
-namespace Tablebases {
-
-  int Cardinality;
-  bool RootInTB;
-  bool UseRule50;
-  Depth ProbeDepth;
-}
-
 namespace TB = Tablebases;
 
 using std::string;
@@ -85,11 +78,64 @@ namespace {
     return std::min(336 * d - 547, 1561);
   }
 
+  // The butterfly history of a quiet move, or the drop history of a drop,
+  // which has no from square
+  StatsEntry<int16_t, 7183>& quiet_history(Thread* thisThread, Color c, Move m) {
+#ifdef CRAZYHOUSE
+    if (type_of(m) == DROP)
+        return thisThread->dropHistory[dropped_piece(m)][to_sq(m)];
+#endif
+    return thisThread->mainHistory[c][from_to(m)];
+  }
+
   // Add a small random component to draw evaluations to avoid 3-fold blindness
   Value value_draw(const Thread* thisThread) {
     return VALUE_DRAW - 1 + Value(thisThread->nodes & 0x2);
   }
 
+  // Breadcrumbs are used to mark nodes as being searched by a given thread
+  struct Breadcrumb {
+    std::atomic<Thread*> thread;
+    std::atomic<Key> key;
+  };
+  std::array<Breadcrumb, 1024> breadcrumbs; // Shared by the pools, marking the nodes by thread
+
+  // ThreadHolding structure keeps track of which thread left breadcrumbs at the given
+  // node for potential reductions. A free node will be marked upon entering the moves
+  // loop by the constructor, and unmarked upon leaving that loop by the destructor.
+  struct ThreadHolding {
+    explicit ThreadHolding(Thread* thisThread, Key posKey, int ply) {
+       location = thisThread->pool.useBreadcrumbs && ply < 8 ? &breadcrumbs[posKey & (breadcrumbs.size() - 1)] : nullptr;
+       otherThread = false;
+       owning = false;
+       if (location)
+       {
+          // See if another already marked this location, if not, mark it ourselves
+          Thread* tmp = (*location).thread.load(std::memory_order_relaxed);
+          if (tmp == nullptr)
+          {
+              (*location).thread.store(thisThread, std::memory_order_relaxed);
+              (*location).key.store(posKey, std::memory_order_relaxed);
+              owning = true;
+          }
+          else if (   tmp != thisThread
+                   && (*location).key.load(std::memory_order_relaxed) == posKey)
+              otherThread = true;
+       }
+    }
+
+    ~ThreadHolding() {
+       if (owning) // Free the marked location
+           (*location).thread.store(nullptr, std::memory_order_relaxed);
+    }
+
+    bool marked() { return otherThread; }
+
+  private:
+    Breadcrumb* location;
+    bool otherThread, owning;
+  };
+
   // Skill structure is used to implement strength limit. If we have an uci_elo then
   // we convert it to a suitable fractional skill level using anchoring to CCRL Elo
   // (goldfish 1.13 = 2000) and a fit through Ordo derived Elo for a match (TC 60+0.6)
@@ -106,56 +152,147 @@ namespace {
     }
     bool enabled() const { return level < 20.0; }
     bool time_to_pick(Depth depth) const { return depth == 1 + int(level); }
-    Move pick_best(size_t multiPV);
+    Move pick_best(const RootMoves& rootMoves, size_t multiPV);
 
     double level;
     Move best = MOVE_NONE;
   };
 
-  template <NodeType nodeType>
+  template <Variant V, NodeType nodeType>
   Value search(Position& pos, Stack* ss, Value alpha, Value beta, Depth depth, bool cutNode);
 
-  template <NodeType nodeType>
+  template <Variant V, NodeType nodeType>
   Value qsearch(Position& pos, Stack* ss, Value alpha, Value beta, Depth depth = 0);
 
+  // search<> and qsearch<> are instantiated once per main variant so that rule
+  // checks on pos.variant() fold away at compile time. Subvariants still share
+  // the instantiation of their main variant and are tested at runtime.
+  typedef Value (*RootSearch)(Position&, Stack*, Value, Value, Depth, bool);
+
+  RootSearch root_search(Variant v) {
+    switch (v)
+    {
+#ifdef ANTI
+    case ANTI_VARIANT: return search<ANTI_VARIANT, Root>;
+#endif
+#ifdef ATOMIC
+    case ATOMIC_VARIANT: return search<ATOMIC_VARIANT, Root>;
+#endif
+#ifdef CRAZYHOUSE
+    case CRAZYHOUSE_VARIANT: return search<CRAZYHOUSE_VARIANT, Root>;
+#endif
+#ifdef EXTINCTION
+    case EXTINCTION_VARIANT: return search<EXTINCTION_VARIANT, Root>;
+#endif
+#ifdef GRID
+    case GRID_VARIANT: return search<GRID_VARIANT, Root>;
+#endif
+#ifdef HORDE
+    case HORDE_VARIANT: return search<HORDE_VARIANT, Root>;
+#endif
+#ifdef KOTH
+    case KOTH_VARIANT: return search<KOTH_VARIANT, Root>;
+#endif
+#ifdef LOSERS
+    case LOSERS_VARIANT: return search<LOSERS_VARIANT, Root>;
+#endif
+#ifdef RACE
+    case RACE_VARIANT: return search<RACE_VARIANT, Root>;
+#endif
+#ifdef THREECHECK
+    case THREECHECK_VARIANT: return search<THREECHECK_VARIANT, Root>;
+#endif
+#ifdef TWOKINGS
+    case TWOKINGS_VARIANT: return search<TWOKINGS_VARIANT, Root>;
+#endif
+    default: return search<CHESS_VARIANT, Root>;
+    }
+  }
+
   Value value_to_tt(Value v, int ply);
   Value value_from_tt(Value v, int ply, int r50c);
   void update_pv(Move* pv, Move move, const Move* childPv);
   void update_continuation_histories(Stack* ss, Piece pc, Square to, int bonus);
+  void update_quiet_histories(const Position& pos, Stack* ss, Move move, int bonus);
   void update_quiet_stats(const Position& pos, Stack* ss, Move move, int bonus);
   void update_all_stats(const Position& pos, Stack* ss, Move bestMove, Value bestValue, Value beta, Square prevSq,
                         Move* quietsSearched, int quietCount, Move* capturesSearched, int captureCount, Depth depth);
 
+  // The perft hash caches the node counts of the subtrees of 3 plies or more,
+  // keyed by the position and the depth. An entry is written without a lock,
+  // its check being the xor of the key and the count, so that a torn entry
+  // does not match.
+  struct PerftEntry {
+    Key check;
+    uint64_t nodes;
+  };
+
+  PerftEntry* PerftTable;
+  size_t PerftEntries;
+
+  // The root moves are taken one by one by the threads, see Thread::search()
+  std::atomic<size_t> PerftNextMove;
+  std::vector<uint64_t> PerftCounts;
+
+  Key perft_key(const Position& pos, Depth depth) {
+
+    Key key = pos.key() ^ make_key(depth);
+#ifdef CRAZYHOUSE
+    // Captured promoted pieces go to the hand as pawns
+    if (pos.is_house())
+        key ^= make_key(pos.promoted_pieces());
+#endif
+    return key;
+  }
+
   // perft() is our utility to verify move generation. All the leaf nodes up
-  // to the given depth are generated and counted, and the sum is returned.
-  template<bool Root>
+  // to the given depth, at least 2, are generated and counted, and the sum
+  // is returned.
   uint64_t perft(Position& pos, Depth depth) {
 
     StateInfo st;
-#ifdef USE_NNUE
-    ASSERT_ALIGNED(&st, Eval::NNUE::CacheLineSize);
-#endif
 
-    uint64_t cnt, nodes = 0;
+    PerftEntry* tte = nullptr;
+    Key key = 0;
+
+    if (depth >= 3 && PerftEntries)
+    {
+        key = perft_key(pos, depth);
+        tte = &PerftTable[mul_hi64(key, PerftEntries)];
+        if ((tte->check ^ tte->nodes) == key)
+            return tte->nodes;
+    }
+
+    uint64_t nodes = 0;
     const bool leaf = (depth == 2);
 
     for (const auto& m : MoveList<LEGAL>(pos))
     {
-        if (Root && depth <= 1)
-            cnt = 1, nodes++;
-        else
-        {
-            pos.do_move(m, st);
-            cnt = leaf ? MoveList<LEGAL>(pos).size() : perft<false>(pos, depth - 1);
-            nodes += cnt;
-            pos.undo_move(m);
-        }
-        if (Root)
-            sync_cout << UCI::move(m, pos.is_chess960()) << ": " << cnt << sync_endl;
+        pos.do_move(m, st);
+        nodes += leaf ? MoveList<LEGAL>(pos).size() : perft(pos, depth - 1);
+        pos.undo_move(m);
     }
+
+    if (tte)
+        tte->nodes = nodes, tte->check = key ^ nodes;
+
     return nodes;
   }
 
+  // perft_root() counts the leaf nodes below the given root move
+  uint64_t perft_root(Position& pos, Move m, Depth depth) {
+
+    if (depth <= 1)
+        return 1;
+
+    StateInfo st;
+
+    pos.do_move(m, st);
+    uint64_t cnt = depth == 2 ? MoveList<LEGAL>(pos).size() : perft(pos, depth - 1);
+    pos.undo_move(m);
+    return cnt;
+  }
+
 } // namespace
 
 
@@ -174,7 +311,7 @@ void Search::clear() {
 
   Threads.main()->wait_for_search_finished();
 
-  Time.availableNodes = 0;
+  Threads.time.availableNodes = 0;
   TT.clear();
   Threads.clear();
   Tablebases::init(UCI::variant_from_name(Options["UCI_Variant"]), Options["SyzygyPath"]); // Free mapped files
@@ -186,21 +323,111 @@ void Search::clear() {
 
 void MainThread::search() {
 
-  if (Limits.perft)
+  sync_prefix(syncPrefix);
+
+  pool.useBreadcrumbs = Options["SMP Breadcrumbs"] && pool.size() > 1;
+  pool.splitMultiPV = Options["SMP MultiPV Split"] && pool.size() > 1;
+
+  // Perft splits the root moves across all the threads, sharing a perft hash
+  // of "Perft Hash" MB, none if 0, allocated for the search only. The counts are printed in the order of the root
+  // moves, as "move: count" lines or, for "go perft <depth> json", a single
+  // JSON object.
+  if (pool.limits.perft)
   {
-      nodes = perft<true>(rootPos, Limits.perft);
-      sync_cout << "\nNodes searched: " << nodes << "\n" << sync_endl;
+      PerftEntries = size_t(Options["Perft Hash"]) * 1024 * 1024 / sizeof(PerftEntry);
+      PerftTable = PerftEntries ? static_cast<PerftEntry*>(aligned_large_pages_alloc(PerftEntries * sizeof(PerftEntry)))
+                                : nullptr;
+      if (PerftTable)
+          std::memset(PerftTable, 0, PerftEntries * sizeof(PerftEntry));
+      else
+          PerftEntries = 0;
+
+      PerftCounts.assign(rootMoves.size(), 0);
+      PerftNextMove = 0;
+
+      TimePoint elapsed = now();
+      pool.start_searching(); // start non-main threads
+      Thread::search();       // main thread takes root moves too
+      pool.wait_for_search_finished();
+      elapsed = now() - elapsed + 1;
+
+      aligned_large_pages_free(PerftTable);
+      PerftTable = nullptr;
+      PerftEntries = 0;
+
+      nodes = 0;
+      for (uint64_t cnt : PerftCounts)
+          nodes += cnt;
+
+      std::stringstream ss;
+      if (pool.limits.perftJson)
+      {
+          ss << "{\"variant\":\"" << variants[rootPos.subvariant()]
+             << "\",\"fen\":\"" << rootPos.fen()
+             << "\",\"depth\":" << pool.limits.perft
+             << ",\"nodes\":" << nodes
+             << ",\"time\":" << elapsed
+             << ",\"nps\":" << nodes * 1000 / elapsed
+             << ",\"divide\":{";
+          for (size_t i = 0; i < rootMoves.size(); ++i)
+              ss << (i ? ",\"" : "\"") << UCI::move(rootMoves[i].pv[0], rootPos.is_chess960())
+                 << "\":" << PerftCounts[i];
+          ss << "}}";
+      }
+      else
+      {
+          for (size_t i = 0; i < rootMoves.size(); ++i)
+              ss << UCI::move(rootMoves[i].pv[0], rootPos.is_chess960()) << ": " << PerftCounts[i] << "\n";
+          ss << "\nNodes searched: " << nodes << "\n";
+      }
+
+      sync_cout << ss.str() << sync_endl;
+      return;
+  }
+
+  // A move of each of the SPSA games, one per thread, see Search::spsa()
+  if (pool.limits.spsa)
+  {
+      pool.start_searching(); // start non-main threads
+      Thread::search();       // main thread plays its game too
+      pool.wait_for_search_finished();
+      return;
+  }
+
+  // Self-play data generation and the analysis of a file of positions, see
+  // datagen.cpp
+  if (pool.limits.datagen)
+  {
+      generate_data();
+      return;
+  }
+
+  if (!pool.limits.analyseFile.empty())
+  {
+      analyse_file();
       return;
   }
 
   Color us = rootPos.side_to_move();
-  Time.init(rootPos.variant(), Limits, us, rootPos.game_ply());
-  TT.new_search();
+  pool.time.init(rootPos.variant(), pool.limits, us, rootPos.game_ply());
+  Cluster::start();
+  timer.start(this);
+  bool pondering = ponder;
+
+  pvInterval = Options["PV Interval"];
+  lastPvTime = 0;
+  pvPending = false;
+  pvSent.clear();
 
 #ifdef USE_NNUE
-  Eval::NNUE::verify();
+  Eval::NNUE::verify(rootPos.variant());
 #endif
 
+  // In a timed game, a move of the book of the variant is played at once
+  Move bookMove = pool.limits.use_time_management() ? Book::probe(rootPos) : MOVE_NONE;
+  if (!std::count(rootMoves.begin(), rootMoves.end(), bookMove))
+      bookMove = MOVE_NONE;
+
   if (rootMoves.empty())
   {
       rootMoves.emplace_back(MOVE_NONE);
@@ -209,65 +436,172 @@ void MainThread::search() {
                    : rootPos.stalemate_value();
       sync_cout << "info depth 0 score " << UCI::value(score) << sync_endl;
   }
+  else if (bookMove)
+  {
+      rootMoves.assign(1, RootMove(bookMove));
+      sync_cout << "info string book move " << UCI::move(bookMove, rootPos.is_chess960()) << sync_endl;
+  }
   else
   {
-      Threads.start_searching(); // start non-main threads
-      Thread::search();          // main thread start searching
+      pool.start_searching(); // start non-main threads
+      Thread::search();       // main thread start searching
   }
 
   // When we reach the maximum depth, we can arrive here without a raise of
-  // Threads.stop. However, if we are pondering or in an infinite search,
+  // pool.stop. However, if we are pondering or in an infinite search,
   // the UCI protocol states that we shouldn't print the best move before the
   // GUI sends a "stop" or "ponderhit" command. We therefore simply wait here
   // until the GUI sends one of those commands.
 
-  while (!Threads.stop && (ponder || Limits.infinite))
+  while (!pool.stop && (ponder || pool.limits.infinite))
   {} // Busy wait for a stop or a ponder reset
 
   // Stop the threads if not already stopped (also raise the stop if
-  // "ponderhit" just reset Threads.ponder).
-  Threads.stop = true;
+  // "ponderhit" just reset pool.ponder).
+  pool.stop = true;
 
   // Wait until all threads have finished
-  Threads.wait_for_search_finished();
+  pool.wait_for_search_finished();
+  timer.stop();
+  Cluster::finish();
 
   // When playing in 'nodes as time' mode, subtract the searched nodes from
   // the available ones before exiting.
-  if (Limits.npmsec)
-      Time.availableNodes += Limits.inc[us] - Threads.nodes_searched();
+  if (pool.limits.npmsec)
+      pool.time.availableNodes += pool.limits.inc[us] - pool.nodes_searched();
 
   Thread* bestThread = this;
   Skill skill = Skill(Options["Skill Level"], Options["UCI_LimitStrength"] ? int(Options["UCI_Elo"]) : 0);
 
   if (   int(Options["MultiPV"]) == 1
-      && !Limits.depth
+      && !pool.limits.depth
       && !skill.enabled()
+      && !bookMove
       && rootMoves[0].pv[0] != MOVE_NONE)
-      bestThread = Threads.get_best_thread();
+      bestThread = pool.get_best_thread();
 
-  bestPreviousScore = bestThread->rootMoves[0].score;
-  bestPreviousAverageScore = bestThread->rootMoves[0].averageScore;
+  // A book move has no score, keep the one of the last search
+  if (!bookMove)
+  {
+      bestPreviousScore = bestThread->rootMoves[0].score;
+      bestPreviousAverageScore = bestThread->rootMoves[0].averageScore;
+  }
 
-  // Send again PV info if we have a new best thread
+  // Send again PV info if we have a new best thread, or if the last update
+  // was held back.
   if (bestThread != this)
-      sync_cout << UCI::pv(bestThread->rootPos, bestThread->completedDepth) << sync_endl;
+      send_pv(bestThread->rootPos, bestThread->completedDepth, true);
+  else if (pvPending)
+      send_pv(rootPos, completedDepth, true);
+
+  // The best line found on the partner board is sent before our best move, to
+  // tell the partner what to play or which piece we are waiting for.
+  Thread* partner = nullptr;
+  for (Thread* th : pool)
+      if (   th->onPartnerBoard && th->completedDepth
+          && (!partner || th->completedDepth > partner->completedDepth))
+          partner = th;
+
+  if (partner)
+  {
+      std::stringstream ss;
+      ss << "info string partner depth " << partner->completedDepth
+         << " score " << UCI::value(partner->rootMoves[0].score) << " pv";
+      for (Move m : partner->rootMoves[0].pv)
+          ss << " " << UCI::move(m, partner->rootPos.is_chess960());
+      sync_cout << ss.str() << sync_endl;
+  }
+
+  // In a cluster, the other nodes vote for the best move too, but for a fixed
+  // depth, at which the move is the one of the leader
+  RootMove best = bestThread->rootMoves[0];
+
+  if (int(Options["MultiPV"]) == 1 && !skill.enabled() && !bookMove && !pool.limits.depth)
+  {
+      Move m = Cluster::vote(best.pv[0], best.score, bestThread->completedDepth);
+      if (m != best.pv[0] && std::count(rootMoves.begin(), rootMoves.end(), m))
+          best = RootMove(m);
+  }
 
   // Best move could be MOVE_NONE when searching on a terminal position
-  sync_cout << "bestmove " << UCI::move(bestThread->rootMoves[0].pv[0], rootPos.is_chess960());
+  sync_cout << "bestmove " << UCI::move(best.pv[0], rootPos.is_chess960());
 
-  if (bestThread->rootMoves[0].pv.size() > 1 || bestThread->rootMoves[0].extract_ponder_from_tt(rootPos))
-      std::cout << " ponder " << UCI::move(bestThread->rootMoves[0].pv[1], rootPos.is_chess960());
+  if (best.pv.size() > 1 || best.extract_ponder_from_tt(rootPos))
+      std::cout << " ponder " << UCI::move(best.pv[1], rootPos.is_chess960());
 
   std::cout << sync_endl;
+
+  // The clock of a ponder search started before the move of the opponent
+  if (!pondering)
+      pool.time.move_played(pool.limits, us, rootPos.game_ply());
 }
 
 
-/// Thread::search() is the main iterative deepening loop. It calls search()
-/// repeatedly with increasing depth until the allocated thinking time has been
-/// consumed, the user stops the search, or the maximum search depth is reached.
+/// Thread::search() is called on all the threads to search the root position,
+/// or to take their share of the perft and self-play work.
 
 void Thread::search() {
 
+  check_networks();
+
+  if (onPartnerBoard)
+  {
+      partner_search();
+      return;
+  }
+
+  if (pool.limits.perft)
+  {
+      for (size_t i; (i = PerftNextMove++) < rootMoves.size(); )
+          PerftCounts[i] = perft_root(rootPos, rootMoves[i].pv[0], pool.limits.perft);
+      return;
+  }
+
+  if (pool.limits.datagen)
+  {
+      self_play();
+      return;
+  }
+
+  if (pool.limits.spsa)
+  {
+      spsa_move();
+      return;
+  }
+
+  if (!pool.limits.analyseFile.empty())
+  {
+      analyse();
+      return;
+  }
+
+  iterative_deepening();
+}
+
+
+/// Thread::partner_search() searches the board of the partner in a bughouse
+/// session, until the search of our board is stopped. Its best line is sent
+/// by the main thread along with our best move.
+
+void Thread::partner_search() {
+
+  MoveList<LEGAL> moves(rootPos);
+  if (!moves.size() || rootPos.is_variant_end())
+      return;
+
+  ownSearch = true;
+  own_search(moves);
+  ownSearch = false;
+}
+
+
+/// Thread::iterative_deepening() is the main iterative deepening loop. It calls
+/// search() repeatedly with increasing depth until the allocated thinking time
+/// has been consumed, the user stops the search, or the maximum search depth is
+/// reached.
+
+void Thread::iterative_deepening() {
+
   // To allow access to (ss-7) up to (ss+2), the stack must be oversized.
   // The former is needed to allow update_continuation_histories(ss-1, ...),
   // which accesses its argument at ss-6, also near the root.
@@ -277,7 +611,8 @@ void Thread::search() {
   Value alpha, beta, delta;
   Move  lastBestMove = MOVE_NONE;
   Depth lastBestMoveDepth = 0;
-  MainThread* mainThread = (this == Threads.main() ? Threads.main() : nullptr);
+  MainThread* mainThread = (this == pool.main() && !ownSearch ? pool.main() : nullptr);
+  RootSearch rootSearch = root_search(rootPos.variant());
   double timeReduction = 1, totBestMoveChanges = 0;
   Color us = rootPos.side_to_move();
   int iterIdx = 0;
@@ -316,17 +651,40 @@ void Thread::search() {
 
   multiPV = std::min(multiPV, rootMoves.size());
 
+  // With "SMP MultiPV Split" the helper threads are spread over the PV lines,
+  // each one searching a single line per iteration. They feed the TT for the
+  // main thread, which searches all of them and is the only one reporting.
+  bool splitLines = pool.splitMultiPV && !ownSearch && multiPV > 1;
+  size_t pvStart = 0, pvEnd = multiPV;
+  if (splitLines && !mainThread)
+      pvStart = idx % multiPV, pvEnd = pvStart + 1;
+
   int searchAgainCounter = 0;
 
   // Iterative deepening loop until requested to stop or the target depth is reached
   while (   ++rootDepth < MAX_PLY
-         && !Threads.stop
-         && !(Limits.depth && mainThread && rootDepth > Limits.depth))
+         && !pool.stop
+         && !ownStop
+         && !(pool.limits.depth && (mainThread || ownSearch) && rootDepth > pool.limits.depth))
   {
       // Age out PV variability metric
       if (mainThread)
           totBestMoveChanges /= 2;
 
+      // A helper of the MultiPV split takes the order of the root moves of the
+      // main thread at its last iteration, so that the line it searches is the
+      // one the main thread has at the same index.
+      if (splitLines && !mainThread)
+      {
+          std::lock_guard<std::mutex> lk(pool.rootOrderMutex);
+          for (size_t k = 0; k < pool.rootOrder.size() && k < rootMoves.size(); ++k)
+          {
+              auto it = std::find(rootMoves.begin() + k, rootMoves.end(), pool.rootOrder[k]);
+              if (it != rootMoves.end())
+                  std::rotate(rootMoves.begin() + k, it, it + 1);
+          }
+      }
+
       // Save the last iteration's scores before the first PV line is searched and
       // all the move scores except the (new) PV are set to -VALUE_INFINITE.
       for (RootMove& rm : rootMoves)
@@ -335,11 +693,20 @@ void Thread::search() {
       size_t pvFirst = 0;
       pvLast = 0;
 
-      if (!Threads.increaseDepth)
+      if (!pool.increaseDepth)
           searchAgainCounter++;
 
+      // Skip the tablebase rank groups before the first line searched
+      while (pvLast <= pvStart && pvStart < pvEnd)
+      {
+          pvFirst = pvLast;
+          for (pvLast++; pvLast < rootMoves.size(); pvLast++)
+              if (rootMoves[pvLast].tbRank != rootMoves[pvFirst].tbRank)
+                  break;
+      }
+
       // MultiPV loop. We perform a full root search for each PV line
-      for (pvIdx = 0; pvIdx < multiPV && !Threads.stop; ++pvIdx)
+      for (pvIdx = pvStart; pvIdx < pvEnd && !pool.stop && !ownStop; ++pvIdx)
       {
           if (pvIdx == pvLast)
           {
@@ -372,7 +739,7 @@ void Thread::search() {
               // Adjust the effective depth searched, but ensure at least one effective increment for every
               // four searchAgain steps (see issue #2717).
               Depth adjustedDepth = std::max(1, rootDepth - failedHighCnt - 3 * (searchAgainCounter + 1) / 4);
-              bestValue = Stockfish::search<Root>(rootPos, ss, alpha, beta, adjustedDepth, false);
+              bestValue = rootSearch(rootPos, ss, alpha, beta, adjustedDepth, false);
 #ifdef HELPMATE
               if (rootPos.is_helpmate()) bestValue = -bestValue;
 #endif
@@ -388,7 +755,7 @@ void Thread::search() {
               // If search has been stopped, we break immediately. Sorting is
               // safe because RootMoves is still valid, although it refers to
               // the previous iteration.
-              if (Threads.stop)
+              if (pool.stop || ownStop)
                   break;
 
               // When failing high/low give some update (without cluttering
@@ -396,8 +763,8 @@ void Thread::search() {
               if (   mainThread
                   && multiPV == 1
                   && (bestValue <= alpha || bestValue >= beta)
-                  && Time.elapsed() > 3000)
-                  sync_cout << UCI::pv(rootPos, rootDepth) << sync_endl;
+                  && pool.elapsed() > 3000)
+                  mainThread->send_pv(rootPos, rootDepth, false);
 
               // In case of failing low/high increase aspiration window and
               // re-search, otherwise exit the loop.
@@ -427,16 +794,29 @@ void Thread::search() {
 #endif
 
           // Sort the PV lines searched so far and update the GUI
-          std::stable_sort(rootMoves.begin() + pvFirst, rootMoves.begin() + pvIdx + 1);
+          std::stable_sort(rootMoves.begin() + std::max(pvFirst, pvStart), rootMoves.begin() + pvIdx + 1);
 
           if (    mainThread
-              && (Threads.stop || pvIdx + 1 == multiPV || Time.elapsed() > 3000))
-              sync_cout << UCI::pv(rootPos, rootDepth) << sync_endl;
+              && (pool.stop || pvIdx + 1 == multiPV || pool.elapsed() > 3000))
+              mainThread->send_pv(rootPos, rootDepth, pool.stop);
       }
 
-      if (!Threads.stop)
+      if (!pool.stop && !ownStop)
+      {
           completedDepth = rootDepth;
 
+          if (mainThread)
+              Cluster::report(completedDepth, rootMoves[0].score, rootMoves[0].pv[0]);
+      }
+
+      if (splitLines && mainThread && !pool.stop)
+      {
+          std::lock_guard<std::mutex> lk(pool.rootOrderMutex);
+          pool.rootOrder.clear();
+          for (const RootMove& rm : rootMoves)
+              pool.rootOrder.push_back(rm.pv[0]);
+      }
+
       if (rootMoves[0].pv[0] != lastBestMove)
       {
           lastBestMove = rootMoves[0].pv[0];
@@ -444,40 +824,42 @@ void Thread::search() {
       }
 
       // Have we found a "mate in x"?
-      if (   Limits.mate
+      if (   pool.limits.mate
           && bestValue >= VALUE_MATE_IN_MAX_PLY
-          && VALUE_MATE - bestValue <= 2 * Limits.mate)
-          Threads.stop = true;
+          && VALUE_MATE - bestValue <= 2 * pool.limits.mate)
+          pool.stop = true;
 
       if (!mainThread)
           continue;
 
       // If the skill level is enabled and time is up, pick a sub-optimal best move
       if (skill.enabled() && skill.time_to_pick(rootDepth))
-          skill.pick_best(multiPV);
+          skill.pick_best(rootMoves, multiPV);
 
       // Use part of the gained time from a previous stable move for the current move
-      for (Thread* th : Threads)
+      for (Thread* th : pool)
       {
           totBestMoveChanges += th->bestMoveChanges;
           th->bestMoveChanges = 0;
       }
 
       // Do we have time for the next iteration? Can we stop searching now?
-      if (    Limits.use_time_management()
-          && !Threads.stop
+      if (    pool.limits.use_time_management()
+          && !pool.stop
           && !mainThread->stopOnPonderhit)
       {
-          double fallingEval = (69 + 13 * (mainThread->bestPreviousAverageScore - bestValue)
-                                    +  6 * (mainThread->iterValue[iterIdx] - bestValue)) / 619.6;
+          const TimeProfile& tp = TimeProfiles[main_variant(rootPos.variant())];
+
+          double fallingEval = (tp.fallingBase + tp.fallingAvg * (mainThread->bestPreviousAverageScore - bestValue)
+                                    +  tp.fallingIter * (mainThread->iterValue[iterIdx] - bestValue)) / (tp.fallingDiv / 10.0);
           fallingEval = std::clamp(fallingEval, 0.5, 1.5);
 
           // If the bestMove is stable over several iterations, reduce time accordingly
-          timeReduction = lastBestMoveDepth + 8 < completedDepth ? 1.57 : 0.65;
+          timeReduction = lastBestMoveDepth + 8 < completedDepth ? tp.stableFactor / 100.0 : tp.changeFactor / 100.0;
           double reduction = (1.4 + mainThread->previousTimeReduction) / (2.08 * timeReduction);
-          double bestMoveInstability = 1 + 1.8 * totBestMoveChanges / Threads.size();
+          double bestMoveInstability = 1 + tp.instability / 10.0 * totBestMoveChanges / pool.size();
 
-          double totalTime = Time.optimum() * fallingEval * reduction * bestMoveInstability;
+          double totalTime = pool.time.optimum() * fallingEval * reduction * bestMoveInstability;
 
           // Cap used time in case of a single legal move for a better viewer experience in tournaments
           // yielding correct scores and sufficiently fast moves.
@@ -485,20 +867,20 @@ void Thread::search() {
               totalTime = std::min(500.0, totalTime);
 
           // Stop the search if we have exceeded the totalTime
-          if (Time.elapsed() > totalTime)
+          if (pool.elapsed() > totalTime)
           {
               // If we are allowed to ponder do not stop the search now but
               // keep pondering until the GUI sends "ponderhit" or "stop".
               if (mainThread->ponder)
                   mainThread->stopOnPonderhit = true;
               else
-                  Threads.stop = true;
+                  pool.stop = true;
           }
           else if (   !mainThread->ponder
-                   && Time.elapsed() > totalTime * 0.50)
-              Threads.increaseDepth = false;
+                   && pool.elapsed() > totalTime * 0.50)
+              pool.increaseDepth = false;
           else
-              Threads.increaseDepth = true;
+              pool.increaseDepth = true;
       }
 
       mainThread->iterValue[iterIdx] = bestValue;
@@ -513,7 +895,7 @@ void Thread::search() {
   // If the skill level is enabled, swap the best PV line with the sub-optimal one
   if (skill.enabled())
       std::swap(rootMoves[0], *std::find(rootMoves.begin(), rootMoves.end(),
-                skill.best ? skill.best : skill.pick_best(multiPV)));
+                skill.best ? skill.best : skill.pick_best(rootMoves, multiPV)));
 }
 
 
@@ -521,7 +903,7 @@ namespace {
 
   // search<>() is the main search function for both PV and non-PV nodes
 
-  template <NodeType nodeType>
+  template <Variant V, NodeType nodeType>
   Value search(Position& pos, Stack* ss, Value alpha, Value beta, Depth depth, bool cutNode) {
 
     constexpr bool PvNode = nodeType != NonPV;
@@ -541,7 +923,7 @@ namespace {
 
     // Dive into quiescence search when the depth reaches zero
     if (depth <= 0)
-        return qsearch<PvNode ? PV : NonPV>(pos, ss, alpha, beta);
+        return qsearch<V, PvNode ? PV : NonPV>(pos, ss, alpha, beta);
 
     assert(-VALUE_INFINITE <= alpha && alpha < beta && beta <= VALUE_INFINITE);
     assert(PvNode || (alpha == beta - 1));
@@ -550,9 +932,6 @@ namespace {
 
     Move pv[MAX_PLY+1], capturesSearched[32], quietsSearched[64];
     StateInfo st;
-#ifdef USE_NNUE
-    ASSERT_ALIGNED(&st, Eval::NNUE::CacheLineSize);
-#endif
 
     TTEntry* tte;
     Key posKey;
@@ -572,10 +951,13 @@ namespace {
     moveCount          = captureCount = quietCount = ss->moveCount = 0;
     bestValue          = -VALUE_INFINITE;
     maxValue           = VALUE_INFINITE;
+    Counters::inc(Counters::SEARCH_NODES);
 
-    // Check for the available remaining time
-    if (thisThread == Threads.main())
-        static_cast<MainThread*>(thisThread)->check_time();
+    // Check for the available remaining time, or the nodes limit
+    if (thisThread->ownSearch)
+        thisThread->check_own_limits();
+    else if (thisThread->pool.limits.nodes && thisThread == thisThread->pool.main())
+        static_cast<MainThread*>(thisThread)->check_nodes();
 
     // Used to send selDepth info to GUI (selDepth counts from 1, ply from 0)
     if (PvNode && thisThread->selDepth < ss->ply + 1)
@@ -587,7 +969,8 @@ namespace {
             return pos.variant_result(ss->ply, VALUE_DRAW);
 
         // Step 2. Check for aborted search and immediate draw
-        if (   Threads.stop.load(std::memory_order_relaxed)
+        if (   thisThread->pool.stop.load(std::memory_order_relaxed)
+            || thisThread->ownStop
             || pos.is_draw(ss->ply)
             || ss->ply >= MAX_PLY)
             return (ss->ply >= MAX_PLY && !ss->inCheck) ? evaluate(pos)
@@ -619,7 +1002,7 @@ namespace {
     // Step 4. Transposition table lookup.
     excludedMove = ss->excludedMove;
     posKey = pos.key();
-    tte = TT.probe(posKey, ss->ttHit);
+    tte = TT.probe(thisThread->ttSlice, posKey, ss->ttHit, thisThread->ttStats);
     ttValue = ss->ttHit ? value_from_tt(tte->value(), ss->ply, pos.rule50_count()) : VALUE_NONE;
     ttMove =  rootNode ? thisThread->rootMoves[thisThread->pvIdx].pv[0]
             : ss->ttHit    ? tte->move() : MOVE_NONE;
@@ -654,8 +1037,7 @@ namespace {
             else if (!ttCapture)
             {
                 int penalty = -stat_bonus(depth);
-                thisThread->mainHistory[us][from_to(ttMove)] << penalty;
-                update_continuation_histories(ss, pos.moved_piece(ttMove), to_sq(ttMove), penalty);
+                update_quiet_histories(pos, ss, ttMove, penalty);
             }
         }
 
@@ -667,25 +1049,25 @@ namespace {
 
     // Step 5. Tablebases probe
 #ifdef EXTINCTION
-    if (pos.is_extinction()) {} else
+    if (V == EXTINCTION_VARIANT) {} else
 #endif
 #ifdef GRID
-    if (pos.is_grid()) {} else
+    if (V == GRID_VARIANT) {} else
 #endif
 #ifdef KOTH
-    if (pos.is_koth()) {} else
+    if (V == KOTH_VARIANT) {} else
 #endif
 #ifdef LOSERS
-    if (pos.is_losers()) {} else
+    if (V == LOSERS_VARIANT) {} else
 #endif
 #ifdef RACE
-    if (pos.is_race()) {} else
+    if (V == RACE_VARIANT) {} else
 #endif
 #ifdef THREECHECK
-    if (pos.is_three_check()) {} else
+    if (V == THREECHECK_VARIANT) {} else
 #endif
 #ifdef HORDE
-    if (pos.is_horde()) {} else
+    if (V == HORDE_VARIANT) {} else
 #endif
 #ifdef HELPMATE
     if (pos.is_helpmate()) {} else
@@ -696,27 +1078,24 @@ namespace {
 #ifdef RELAY
     if (pos.is_relay()) {} else
 #endif
-    if (!rootNode && !excludedMove && TB::Cardinality)
+    if (!rootNode && !excludedMove && thisThread->pool.tbConfig.cardinality)
     {
         int piecesCount = pos.count<ALL_PIECES>();
 
-        if (    piecesCount <= TB::Cardinality
-            && (piecesCount <  TB::Cardinality || depth >= TB::ProbeDepth)
+        if (    piecesCount <= thisThread->pool.tbConfig.cardinality
+            && (piecesCount <  thisThread->pool.tbConfig.cardinality || depth >= thisThread->pool.tbConfig.probeDepth)
             &&  pos.rule50_count() == 0
             && !pos.can_castle(ANY_CASTLING))
         {
             TB::ProbeState err;
-            TB::WDLScore wdl = Tablebases::probe_wdl(pos, &err);
-
-            // Force check of time on the next occasion
-            if (thisThread == Threads.main())
-                static_cast<MainThread*>(thisThread)->callsCnt = 0;
+            TB::WDLScore wdl = Tablebases::probe_wdl(pos, &err, thisThread->wdlCache);
+            Counters::inc(Counters::TB_PROBES);
 
             if (err != TB::ProbeState::FAIL)
             {
                 thisThread->tbHits.fetch_add(1, std::memory_order_relaxed);
 
-                int drawScore = TB::UseRule50 ? 1 : 0;
+                int drawScore = thisThread->pool.tbConfig.useRule50 ? 1 : 0;
 
                 // use the range VALUE_MATE_IN_MAX_PLY to VALUE_TB_WIN_IN_MAX_PLY to score
                 value =  wdl < -drawScore ? VALUE_MATED_IN_MAX_PLY + ss->ply + 1
@@ -731,7 +1110,7 @@ namespace {
                 {
                     tte->save(posKey, value_to_tt(value, ss->ply), ss->ttPv, b,
                               std::min(MAX_PLY - 1, depth + 6),
-                              MOVE_NONE, VALUE_NONE);
+                              MOVE_NONE, VALUE_NONE, thisThread->ttSlice.generation8);
 
                     return value;
                 }
@@ -751,7 +1130,7 @@ namespace {
 
     // Step 6. Static evaluation of the position
     bool skipEarlyPruning;
-    switch (pos.variant())
+    switch (V)
     {
 #ifdef ANTI
     case ANTI_VARIANT:
@@ -802,7 +1181,7 @@ namespace {
     {
         ss->staticEval = eval = evaluate(pos);
         // Save static evaluation into the transposition table
-        tte->save(posKey, VALUE_NONE, ss->ttPv, BOUND_NONE, DEPTH_NONE, MOVE_NONE, eval);
+        tte->save(posKey, VALUE_NONE, ss->ttPv, BOUND_NONE, DEPTH_NONE, MOVE_NONE, eval, thisThread->ttSlice.generation8);
     }
 #ifdef HELPMATE
     if (pos.is_helpmate())
@@ -813,7 +1192,7 @@ namespace {
     if (is_ok((ss-1)->currentMove) && !(ss-1)->inCheck && !priorCapture)
     {
         int bonus = std::clamp(-18 * int((ss-1)->staticEval + ss->staticEval), -1817, 1817);
-        thisThread->mainHistory[~us][from_to((ss-1)->currentMove)] << bonus;
+        quiet_history(thisThread, ~us, (ss-1)->currentMove) << bonus;
     }
 
     // Set up the improvement variable, which is the difference between the current
@@ -833,15 +1212,15 @@ namespace {
         goto moves_loop;
 #endif
 #ifdef LOSERS
-    if (pos.is_losers() && pos.can_capture_losers())
+    if (V == LOSERS_VARIANT && pos.can_capture_losers())
         goto moves_loop;
 #endif
 #ifdef EXTINCTION
-    if (pos.is_extinction()) {} else
+    if (V == EXTINCTION_VARIANT) {} else
 #endif
     if (eval < alpha - 456 - 252 * depth * depth)
     {
-        value = qsearch<NonPV>(pos, ss, alpha - 1, alpha);
+        value = qsearch<V, NonPV>(pos, ss, alpha - 1, alpha);
         if (value < alpha)
             return value;
     }
@@ -857,7 +1236,7 @@ namespace {
 
     // Step 9. Null move search with verification search (~35 Elo)
 #ifdef GRID
-    if (pos.is_grid()) {} else
+    if (V == GRID_VARIANT) {} else
 #endif
     if (   !PvNode
         && (ss-1)->currentMove != MOVE_NULL
@@ -880,7 +1259,7 @@ namespace {
 
         pos.do_null_move(st);
 
-        Value nullValue = -search<NonPV>(pos, ss+1, -beta, -beta+1, depth-R, !cutNode);
+        Value nullValue = -search<V, NonPV>(pos, ss+1, -beta, -beta+1, depth-R, !cutNode);
 
         pos.undo_null_move();
 
@@ -898,7 +1277,7 @@ namespace {
             // until ply exceeds nmpMinPly.
             thisThread->nmpMinPly = ss->ply + 3 * (depth-R) / 4;
 
-            Value v = search<NonPV>(pos, ss, beta-1, beta, depth-R, false);
+            Value v = search<V, NonPV>(pos, ss, beta-1, beta, depth-R, false);
 
             thisThread->nmpMinPly = 0;
 
@@ -915,7 +1294,7 @@ namespace {
         depth -= 2 + 2 * (ss->ttHit && tte->depth() >= depth);
 
     if (depth <= 0)
-        return qsearch<PV>(pos, ss, alpha, beta);
+        return qsearch<V, PV>(pos, ss, alpha, beta);
 
     if (    cutNode
         &&  depth >= 8
@@ -946,7 +1325,7 @@ namespace {
             if (move != excludedMove && pos.legal(move))
             {
 #ifdef RACE
-                assert((pos.is_race() && type_of(pos.moved_piece(move)) == KING) || pos.capture_stage(move));
+                assert((V == RACE_VARIANT && type_of(pos.moved_piece(move)) == KING) || pos.capture_stage(move));
 #else
                 assert(pos.capture_stage(move));
 #endif
@@ -957,21 +1336,23 @@ namespace {
                                                                           [pos.moved_piece(move)]
                                                                           [to_sq(move)];
 
+                pos.prefetch_after(move);
                 pos.do_move(move, st);
 
                 // Perform a preliminary qsearch to verify that the move holds
-                value = -qsearch<NonPV>(pos, ss+1, -probCutBeta, -probCutBeta+1);
+                value = -qsearch<V, NonPV>(pos, ss+1, -probCutBeta, -probCutBeta+1);
 
                 // If the qsearch held, perform the regular search
                 if (value >= probCutBeta)
-                    value = -search<NonPV>(pos, ss+1, -probCutBeta, -probCutBeta+1, depth - 4, !cutNode);
+                    value = -search<V, NonPV>(pos, ss+1, -probCutBeta, -probCutBeta+1, depth - 4, !cutNode);
 
                 pos.undo_move(move);
 
                 if (value >= probCutBeta)
                 {
                     // Save ProbCut data into transposition table
-                    tte->save(posKey, value_to_tt(value, ss->ply), ss->ttPv, BOUND_LOWER, depth - 3, move, ss->staticEval);
+                    tte->save(posKey, value_to_tt(value, ss->ply), ss->ttPv, BOUND_LOWER, depth - 3, move, ss->staticEval,
+                              thisThread->ttSlice.generation8);
                     return value;
                 }
             }
@@ -1001,9 +1382,14 @@ moves_loop: // When in check, search starts here
 
     Move countermove = prevSq != SQ_NONE ? thisThread->counterMoves[pos.piece_on(prevSq)][prevSq] : MOVE_NONE;
 
+    const DropToHistory* dropCont = prevSq != SQ_NONE ? &thisThread->dropContinuation[pos.piece_on(prevSq)][prevSq]
+                                                      : &thisThread->dropContinuation[NO_PIECE][SQ_A1];
+
     MovePicker mp(pos, ttMove, depth, &thisThread->mainHistory,
                                       &captureHistory,
                                       contHist,
+                                      &thisThread->dropHistory,
+                                      dropCont,
                                       countermove,
                                       ss->killers);
 
@@ -1017,6 +1403,9 @@ moves_loop: // When in check, search starts here
                          && (tte->bound() & BOUND_UPPER)
                          && tte->depth() >= depth;
 
+    // Mark this node as being searched
+    ThreadHolding th(thisThread, posKey, ss->ply);
+
     // Step 13. Loop through all pseudo-legal moves until no moves remain
     // or a beta cutoff occurs.
     while ((move = mp.next_move(moveCountPruning)) != MOVE_NONE)
@@ -1062,7 +1451,7 @@ moves_loop: // When in check, search starts here
       // Step 14. Pruning at shallow depth (~120 Elo). Depth conditions are important for mate finding.
       if (  !rootNode
 #ifdef HORDE
-          && (pos.is_horde() || pos.non_pawn_material(us))
+          && (V == HORDE_VARIANT || pos.non_pawn_material(us))
 #else
           && pos.non_pawn_material(us)
 #endif
@@ -1081,7 +1470,7 @@ moves_loop: // When in check, search starts here
               if (   !givesCheck
                   && lmrDepth < 7
                   && !ss->inCheck
-                  && ss->staticEval + 197 + 248 * lmrDepth + PieceValue[pos.variant()][EG][pos.piece_on(to_sq(move))]
+                  && ss->staticEval + 197 + 248 * lmrDepth + PieceValue[V][EG][pos.piece_on(to_sq(move))]
                    + captureHistory[movedPiece][to_sq(move)][type_of(pos.piece_on(to_sq(move)))] / 7 < alpha)
                   continue;
 
@@ -1119,14 +1508,14 @@ moves_loop: // When in check, search starts here
                   && history < -3832 * depth)
                   continue;
 
-              history += 2 * thisThread->mainHistory[us][from_to(move)];
+              history += 2 * quiet_history(thisThread, us, move);
 
               lmrDepth += history / 7011;
               lmrDepth = std::max(lmrDepth, -2);
 
               // Futility pruning: parent node (~13 Elo)
 #ifdef LOSERS
-              if (pos.is_losers()) {} else
+              if (V == LOSERS_VARIANT) {} else
 #endif
               if (   !ss->inCheck
                   && lmrDepth < 12
@@ -1137,7 +1526,7 @@ moves_loop: // When in check, search starts here
 
               // Prune moves with negative SEE (~4 Elo)
 #ifdef ANTI
-              if (pos.is_anti()) {} else
+              if (V == ANTI_VARIANT) {} else
 #endif
 #ifdef HELPMATE
               if (pos.is_helpmate()) {} else
@@ -1172,7 +1561,7 @@ moves_loop: // When in check, search starts here
               Depth singularDepth = (depth - 1) / 2;
 
               ss->excludedMove = move;
-              value = search<NonPV>(pos, ss, singularBeta - 1, singularBeta, singularDepth, cutNode);
+              value = search<V, NonPV>(pos, ss, singularBeta - 1, singularBeta, singularDepth, cutNode);
 #ifdef HELPMATE
               if (pos.is_helpmate()) value = -value;
 #endif
@@ -1235,8 +1624,12 @@ moves_loop: // When in check, search starts here
       newDepth += extension;
       ss->doubleExtensions = (ss-1)->doubleExtensions + (extension == 2);
 
-      // Speculative prefetch as early as possible
-      prefetch(TT.first_entry(pos.key_after(move)));
+      // Speculative prefetch as early as possible, also of the WDL cache entry
+      // when the move resets the 50-move count into the tablebase range
+      Key nextKey = pos.prefetch_after(move);
+      if (   (capture || type_of(movedPiece) == PAWN)
+          && pos.count<ALL_PIECES>() - capture <= thisThread->pool.tbConfig.cardinality)
+          prefetch(thisThread->wdlCache[nextKey]);
 
       // Update the current move (this must be done after singular extension search)
       ss->currentMove = move;
@@ -1259,6 +1652,10 @@ moves_loop: // When in check, search starts here
       if ((ss-1)->moveCount > 8)
           r--;
 
+      // Increase reduction if other threads are searching this position
+      if (th.marked())
+          r++;
+
       // Increase reduction for cut nodes (~3 Elo)
       if (cutNode)
           r += 2;
@@ -1282,7 +1679,7 @@ moves_loop: // When in check, search starts here
       else if (move == ttMove)
           r--;
 
-      ss->statScore =  2 * thisThread->mainHistory[us][from_to(move)]
+      ss->statScore =  2 * quiet_history(thisThread, us, move)
                      + (*contHist[0])[movedPiece][to_sq(move)]
                      + (*contHist[1])[movedPiece][to_sq(move)]
                      + (*contHist[3])[movedPiece][to_sq(move)]
@@ -1306,7 +1703,7 @@ moves_loop: // When in check, search starts here
           // beyond the first move depth. This may lead to hidden double extensions.
           Depth d = std::clamp(newDepth - r, 1, newDepth + 1);
 
-          value = -search<NonPV>(pos, ss+1, -(alpha+1), -alpha, d, true);
+          value = -search<V, NonPV>(pos, ss+1, -(alpha+1), -alpha, d, true);
 #ifdef HELPMATE
           if (pos.is_helpmate())
               value = -value;
@@ -1326,7 +1723,7 @@ moves_loop: // When in check, search starts here
               newDepth += doDeeperSearch - doShallowerSearch + doEvenDeeperSearch;
 
               if (newDepth > d)
-                  value = -search<NonPV>(pos, ss+1, -(alpha+1), -alpha, newDepth, !cutNode);
+                  value = -search<V, NonPV>(pos, ss+1, -(alpha+1), -alpha, newDepth, !cutNode);
 
               int bonus = value <= alpha ? -stat_bonus(newDepth)
                         : value >= beta  ?  stat_bonus(newDepth)
@@ -1343,7 +1740,7 @@ moves_loop: // When in check, search starts here
           if (!ttMove && cutNode)
               r += 2;
 
-          value = -search<NonPV>(pos, ss+1, -(alpha+1), -alpha, newDepth - (r > 3), !cutNode);
+          value = -search<V, NonPV>(pos, ss+1, -(alpha+1), -alpha, newDepth - (r > 3), !cutNode);
 #ifdef HELPMATE
           if (pos.is_helpmate())
               value = -value;
@@ -1358,7 +1755,7 @@ moves_loop: // When in check, search starts here
           (ss+1)->pv = pv;
           (ss+1)->pv[0] = MOVE_NONE;
 
-          value = -search<PV>(pos, ss+1, -beta, -alpha, newDepth, false);
+          value = -search<V, PV>(pos, ss+1, -beta, -alpha, newDepth, false);
 #ifdef HELPMATE
           if (pos.is_helpmate())
               value = -value;
@@ -1374,7 +1771,7 @@ moves_loop: // When in check, search starts here
       // Finished searching the move. If a stop occurred, the return value of
       // the search cannot be trusted, and we return immediately without
       // updating best move, PV and TT.
-      if (Threads.stop.load(std::memory_order_relaxed))
+      if (thisThread->pool.stop.load(std::memory_order_relaxed) || thisThread->ownStop)
           return VALUE_ZERO;
 
       if (rootNode)
@@ -1471,7 +1868,7 @@ moves_loop: // When in check, search starts here
     // completed. But in this case, bestValue is valid because we have fully
     // searched our subtree, and we can anyhow save the result in TT.
     /*
-       if (Threads.stop)
+       if (thisThread->pool.stop)
         return VALUE_DRAW;
     */
 
@@ -1512,10 +1909,15 @@ moves_loop: // When in check, search starts here
 
     // Write gathered information in transposition table
     if (!excludedMove && !(rootNode && thisThread->pvIdx))
-        tte->save(posKey, value_to_tt(bestValue, ss->ply), ss->ttPv,
-                  bestValue >= beta ? BOUND_LOWER :
-                  PvNode && bestMove ? BOUND_EXACT : BOUND_UPPER,
-                  depth, bestMove, ss->staticEval);
+    {
+        Bound b =  bestValue >= beta ? BOUND_LOWER
+                 : PvNode && bestMove ? BOUND_EXACT : BOUND_UPPER;
+
+        tte->save(posKey, value_to_tt(bestValue, ss->ply), ss->ttPv, b, depth, bestMove, ss->staticEval,
+                  thisThread->ttSlice.generation8);
+        Cluster::save(thisThread->clusterOutbox, posKey, value_to_tt(bestValue, ss->ply), b,
+                      depth, bestMove, ss->staticEval);
+    }
 
     assert(bestValue > -VALUE_INFINITE && bestValue < VALUE_INFINITE);
 
@@ -1526,7 +1928,7 @@ moves_loop: // When in check, search starts here
   // qsearch() is the quiescence search function, which is called by the main search
   // function with zero depth, or recursively with further decreasing depth per call.
   // (~155 Elo)
-  template <NodeType nodeType>
+  template <Variant V, NodeType nodeType>
   Value qsearch(Position& pos, Stack* ss, Value alpha, Value beta, Depth depth) {
 
     static_assert(nodeType != Root);
@@ -1538,9 +1940,6 @@ moves_loop: // When in check, search starts here
 
     Move pv[MAX_PLY+1];
     StateInfo st;
-#ifdef USE_NNUE
-    ASSERT_ALIGNED(&st, Eval::NNUE::CacheLineSize);
-#endif
 
     TTEntry* tte;
     Key posKey;
@@ -1561,6 +1960,7 @@ moves_loop: // When in check, search starts here
     bestMove = MOVE_NONE;
     ss->inCheck = pos.checkers();
     moveCount = 0;
+    Counters::inc(Counters::QSEARCH_NODES);
 
     // Step 2. Check for an immediate draw or maximum ply reached
     if (pos.is_variant_end())
@@ -1580,7 +1980,7 @@ moves_loop: // When in check, search starts here
 
     // Step 3. Transposition table lookup
     posKey = pos.key();
-    tte = TT.probe(posKey, ss->ttHit);
+    tte = TT.probe(thisThread->ttSlice, posKey, ss->ttHit, thisThread->ttStats);
     ttValue = ss->ttHit ? value_from_tt(tte->value(), ss->ply, pos.rule50_count()) : VALUE_NONE;
     ttMove = ss->ttHit ? tte->move() : MOVE_NONE;
     pvHit = ss->ttHit && tte->is_pv();
@@ -1619,7 +2019,7 @@ moves_loop: // When in check, search starts here
             // Save gathered info in transposition table
             if (!ss->ttHit)
                 tte->save(posKey, value_to_tt(bestValue, ss->ply), false, BOUND_LOWER,
-                          DEPTH_NONE, MOVE_NONE, ss->staticEval);
+                          DEPTH_NONE, MOVE_NONE, ss->staticEval, thisThread->ttSlice.generation8);
 
             return bestValue;
         }
@@ -1642,6 +2042,7 @@ moves_loop: // When in check, search starts here
     MovePicker mp(pos, ttMove, depth, &thisThread->mainHistory,
                                       &thisThread->captureHistory,
                                       contHist,
+                                      &thisThread->dropHistory,
                                       prevSq);
 
     int quietCheckEvasions = 0;
@@ -1667,10 +2068,10 @@ moves_loop: // When in check, search starts here
             // Futility pruning and moveCount pruning (~10 Elo)
             if (   !givesCheck
 #ifdef EXTINCTION
-                && !pos.is_extinction()
+                && V != EXTINCTION_VARIANT
 #endif
 #ifdef RACE
-                && !(pos.is_race() && type_of(pos.piece_on(from_sq(move))) == KING && rank_of(to_sq(move)) == RANK_8)
+                && !(V == RACE_VARIANT && type_of(pos.piece_on(from_sq(move))) == KING && rank_of(to_sq(move)) == RANK_8)
 #endif
 #ifdef HELPMATE
                 && !pos.is_helpmate()
@@ -1683,16 +2084,16 @@ moves_loop: // When in check, search starts here
                     continue;
 
 #ifdef ATOMIC
-                if (pos.is_atomic())
+                if (V == ATOMIC_VARIANT)
                     futilityValue = futilityBase + pos.see<ATOMIC_VARIANT>(move);
                 else
 #endif
 #ifdef CRAZYHOUSE
-                if (pos.is_house())
+                if (V == CRAZYHOUSE_VARIANT)
                     futilityValue = futilityBase + 2 * PieceValue[CRAZYHOUSE_VARIANT][EG][pos.piece_on(to_sq(move))];
                 else
 #endif
-                futilityValue = futilityBase + PieceValue[pos.variant()][EG][pos.piece_on(to_sq(move))];
+                futilityValue = futilityBase + PieceValue[V][EG][pos.piece_on(to_sq(move))];
 
                 if (futilityValue <= alpha)
                 {
@@ -1725,7 +2126,7 @@ moves_loop: // When in check, search starts here
         }
 
         // Speculative prefetch as early as possible
-        prefetch(TT.first_entry(pos.key_after(move)));
+        pos.prefetch_after(move);
 
         // Update the current move
         ss->currentMove = move;
@@ -1738,7 +2139,7 @@ moves_loop: // When in check, search starts here
 
         // Step 7. Make and search the move
         pos.do_move(move, st, givesCheck);
-        value = -qsearch<nodeType>(pos, ss+1, -beta, -alpha, depth - 1);
+        value = -qsearch<V, nodeType>(pos, ss+1, -beta, -alpha, depth - 1);
 #ifdef HELPMATE
         if (pos.is_helpmate())
             value = -value;
@@ -1780,7 +2181,7 @@ moves_loop: // When in check, search starts here
     // Save gathered info in transposition table
     tte->save(posKey, value_to_tt(bestValue, ss->ply), pvHit,
               bestValue >= beta ? BOUND_LOWER : BOUND_UPPER,
-              ttDepth, bestMove, ss->staticEval);
+              ttDepth, bestMove, ss->staticEval, thisThread->ttSlice.generation8);
 
     assert(bestValue > -VALUE_INFINITE && bestValue < VALUE_INFINITE);
 
@@ -1847,7 +2248,6 @@ moves_loop: // When in check, search starts here
   void update_all_stats(const Position& pos, Stack* ss, Move bestMove, Value bestValue, Value beta, Square prevSq,
                         Move* quietsSearched, int quietCount, Move* capturesSearched, int captureCount, Depth depth) {
 
-    Color us = pos.side_to_move();
     Thread* thisThread = pos.this_thread();
     CapturePieceToHistory& captureHistory = thisThread->captureHistory;
     Piece moved_piece = pos.moved_piece(bestMove);
@@ -1865,10 +2265,7 @@ moves_loop: // When in check, search starts here
 
         // Decrease stats for all non-best quiet moves
         for (int i = 0; i < quietCount; ++i)
-        {
-            thisThread->mainHistory[us][from_to(quietsSearched[i])] << -bonus2;
-            update_continuation_histories(ss, pos.moved_piece(quietsSearched[i]), to_sq(quietsSearched[i]), -bonus2);
-        }
+            update_quiet_histories(pos, ss, quietsSearched[i], -bonus2);
     }
     else
     {
@@ -1921,25 +2318,42 @@ moves_loop: // When in check, search starts here
         ss->killers[0] = move;
     }
 
-    Color us = pos.side_to_move();
-    Thread* thisThread = pos.this_thread();
-    thisThread->mainHistory[us][from_to(move)] << bonus;
-    update_continuation_histories(ss, pos.moved_piece(move), to_sq(move), bonus);
+    update_quiet_histories(pos, ss, move, bonus);
 
     // Update countermove history
     if (is_ok((ss-1)->currentMove))
     {
         Square prevSq = to_sq((ss-1)->currentMove);
-        thisThread->counterMoves[pos.piece_on(prevSq)][prevSq] = move;
+        pos.this_thread()->counterMoves[pos.piece_on(prevSq)][prevSq] = move;
+    }
+  }
+
+
+  // update_quiet_histories() updates the butterfly and continuation histories
+  // of a quiet move, and for a drop the drop histories instead of the butterfly
+  // one, the drop continuation history being the one of the previous move.
+
+  void update_quiet_histories(const Position& pos, Stack* ss, Move move, int bonus) {
+
+    Thread* thisThread = pos.this_thread();
+    quiet_history(thisThread, pos.side_to_move(), move) << bonus;
+    update_continuation_histories(ss, pos.moved_piece(move), to_sq(move), bonus);
+
+#ifdef CRAZYHOUSE
+    if (type_of(move) == DROP && is_ok((ss-1)->currentMove))
+    {
+        Square prevSq = to_sq((ss-1)->currentMove);
+        DropToHistory* dropCont = &thisThread->dropContinuation[pos.piece_on(prevSq)][prevSq];
+        (*dropCont)[type_of(dropped_piece(move))][to_sq(move)] << bonus;
     }
+#endif
   }
 
   // When playing with strength handicap, choose the best move among a set of RootMoves
   // using a statistical rule dependent on 'level'. Idea by Heinz van Saanen.
 
-  Move Skill::pick_best(size_t multiPV) {
+  Move Skill::pick_best(const RootMoves& rootMoves, size_t multiPV) {
 
-    const RootMoves& rootMoves = Threads.main()->rootMoves;
     static PRNG rng(now()); // PRNG sequence should be non-deterministic
 
     // RootMoves are already sorted by score in descending order
@@ -1970,51 +2384,191 @@ moves_loop: // When in check, search starts here
 } // namespace
 
 
-/// MainThread::check_time() is used to print debug info and, more importantly,
-/// to detect when we are out of available time and thus stop the search.
+/// MainThread::check_nodes() is used to detect when the nodes limit is reached.
+/// The time is checked by the timer of the search, see SearchTimer::loop().
 
-void MainThread::check_time() {
+void MainThread::check_nodes() {
 
   if (--callsCnt > 0)
       return;
 
-  // When using nodes, ensure checking rate is not lower than 0.1% of nodes
-  callsCnt = Limits.nodes ? std::min(1024, int(Limits.nodes / 1024)) : 1024;
+  // Ensure checking rate is not lower than 0.1% of nodes
+  callsCnt = std::min(1024, int(pool.limits.nodes / 1024));
+
+  // We should not stop pondering until told so by the GUI
+  if (!ponder && pool.nodes_searched() >= (uint64_t)pool.limits.nodes)
+      pool.stop = true;
+}
+
+
+/// MainThread::ponderhit() switches from pondering to the normal search, when
+/// the GUI sends "ponderhit".
+
+void MainThread::ponderhit() {
 
-  static TimePoint lastInfoTime = now();
+  ponder = false;
+  timer.wake();
+}
+
+
+/// SearchTimer::start() starts the timer of a search, once its limits are set,
+/// and SearchTimer::stop() stops it at the end of the search, both called by the
+/// main thread. The latency of a stop of the timer is then measured.
 
-  TimePoint elapsed = Time.elapsed();
-  TimePoint tick = Limits.startTime + elapsed;
+void SearchTimer::start(MainThread* th) {
+
+  mainThread = th;
+  done = woken = false;
+  deadline = {};
+  thread = std::thread(&SearchTimer::loop, this);
+}
+
+void SearchTimer::stop() {
 
-  if (tick - lastInfoTime >= 1000)
   {
-      lastInfoTime = tick;
-      dbg_print();
+      std::lock_guard<std::mutex> lk(mutex);
+      done = true;
   }
+  cv.notify_one();
+  thread.join();
 
-  // We should not stop pondering until told so by the GUI
-  if (ponder)
+  if (deadline != decltype(deadline)())
+  {
+      using namespace std::chrono;
+      int64_t latency = duration_cast<microseconds>(steady_clock::now() - deadline).count();
+
+      stops++;
+      latencySum += latency;
+      latencyMax = std::max(latencyMax, latency);
+  }
+}
+
+void SearchTimer::wake() {
+
+  {
+      std::lock_guard<std::mutex> lk(mutex);
+      woken = true;
+  }
+  cv.notify_one();
+}
+
+
+/// SearchTimer::loop() is the timer of a search. It sleeps until the time of the
+/// search is out, or for a millisecond with the time counted in nodes, and then
+/// raises the stop, unless pondering. It also prints the debug info every second
+/// and exchanges the TT entries with the nodes of a cluster.
+
+void SearchTimer::loop() {
+
+  ThreadPool& pool = mainThread->pool;
+  TimePoint lastInfoTime = now();
+  std::unique_lock<std::mutex> lk(mutex);
+
+  while (!done)
+  {
+      TimePoint tick = now();
+      TimePoint elapsed = pool.elapsed();
+
+      if (tick - lastInfoTime >= 1000)
+      {
+          lastInfoTime = tick;
+          dbg_print();
+      }
+
+      Cluster::exchange();
+
+      // We should not stop pondering until told so by the GUI
+      if (   !mainThread->ponder
+          && !pool.stop
+          && (   (pool.limits.use_time_management() && (elapsed > pool.time.maximum() - 10 || mainThread->stopOnPonderhit))
+              || (pool.limits.movetime && elapsed >= pool.limits.movetime)))
+      {
+          deadline = std::chrono::steady_clock::now();
+          pool.stop = true;
+      }
+
+      TimePoint next = lastInfoTime + 1000;
+
+      if (Cluster::Active)
+          next = std::min(next, tick + 5);
+
+      if (!mainThread->ponder && !pool.stop)
+      {
+          if (pool.limits.npmsec)
+              next = tick + 1;
+          else
+          {
+              if (pool.limits.use_time_management())
+                  next = std::min(next, pool.limits.startTime + pool.time.maximum() - 9);
+              if (pool.limits.movetime)
+                  next = std::min(next, pool.limits.startTime + pool.limits.movetime);
+          }
+      }
+
+      cv.wait_until(lk, std::chrono::steady_clock::time_point(std::chrono::milliseconds(next)),
+                    [&]{ return done || woken; });
+      woken = false;
+  }
+}
+
+
+/// MainThread::send_pv() sends the PV info of the given root position. The lines
+/// are formatted in a reused buffer before the IO lock is taken. Unless forced,
+/// the updates are sent at most every "PV Interval" ms, and then only for the
+/// lines which changed since they were last sent.
+
+void MainThread::send_pv(const Position& pos, Depth depth, bool force) {
+
+  TimePoint elapsed = pool.elapsed();
+
+  if (!force && pvInterval && elapsed - lastPvTime < pvInterval)
+  {
+      pvPending = true;
       return;
+  }
 
-  if (   (Limits.use_time_management() && (elapsed > Time.maximum() - 10 || stopOnPonderhit))
-      || (Limits.movetime && elapsed >= Limits.movetime)
-      || (Limits.nodes && Threads.nodes_searched() >= (uint64_t)Limits.nodes))
-      Threads.stop = true;
+  pvBuffer.clear();
+  UCI::pv(pvBuffer, pos, depth, force || !pvInterval ? nullptr : &pvSent);
+  lastPvTime = elapsed;
+  pvPending = false;
+
+  if (!pvBuffer.empty())
+      sync_cout << pvBuffer << sync_endl;
 }
 
 
-/// UCI::pv() formats PV information according to the UCI protocol. UCI requires
-/// that all (if any) unsearched PV lines are sent using a previous search score.
+namespace {
+
+  template<typename T>
+  void append(std::string& s, T n) {
+
+    char buf[24];
+    s.append(buf, std::to_chars(buf, buf + sizeof(buf), n).ptr);
+  }
+
+} // namespace
+
 
-string UCI::pv(const Position& pos, Depth depth) {
+/// UCI::pv() appends the PV information to the given string according to the
+/// UCI protocol. UCI requires that all (if any) unsearched PV lines are sent
+/// using a previous search score. If sent is given, it holds a signature of the
+/// lines last sent, and the unchanged lines are skipped.
 
-  std::stringstream ss;
-  TimePoint elapsed = Time.elapsed() + 1;
+void UCI::pv(std::string& out, const Position& pos, Depth depth, std::vector<Key>* sent) {
+
+  const ThreadPool& pool = pos.this_thread()->pool;
+  TimePoint elapsed = pool.elapsed() + 1;
   const RootMoves& rootMoves = pos.this_thread()->rootMoves;
   size_t pvIdx = pos.this_thread()->pvIdx;
   size_t multiPV = std::min((size_t)Options["MultiPV"], rootMoves.size());
-  uint64_t nodesSearched = Threads.nodes_searched();
-  uint64_t tbHits = Threads.tb_hits() + (TB::RootInTB ? rootMoves.size() : 0);
+  bool showWDL = Options["UCI_ShowWDL"];
+  int hashfull = TT.hashfull(pos.this_thread()->ttSlice);
+  uint64_t nodesSearched = pool.nodes_searched() + Cluster::nodes_searched();
+  uint64_t tbHits = pool.tb_hits() + Cluster::tb_hits() + (pool.tbConfig.rootInTB ? rootMoves.size() : 0);
+  constexpr const char* Bounds[] = { "", " lowerbound", " upperbound" };
+
+  if (sent && sent->size() < multiPV)
+      sent->resize(multiPV, 0);
 
   for (size_t i = 0; i < multiPV; ++i)
   {
@@ -2029,36 +2583,60 @@ string UCI::pv(const Position& pos, Depth depth) {
       if (v == -VALUE_INFINITE)
           v = VALUE_ZERO;
 
-      bool tb = TB::RootInTB && abs(v) < VALUE_MATE_IN_MAX_PLY;
+      bool tb = pool.tbConfig.rootInTB && abs(v) < VALUE_MATE_IN_MAX_PLY;
       v = tb ? rootMoves[i].tbScore : v;
 
-      if (ss.rdbuf()->in_avail()) // Not at first line
-          ss << "\n";
+      // Index of the bound of the score in Bounds, 0 for an exact score
+      int bound =  i != pvIdx || tb || !updated ? 0 // tablebase- and previous-scores are exact
+                 : rootMoves[i].scoreLowerbound ? 1
+                 : rootMoves[i].scoreUpperbound ? 2 : 0;
 
-      ss << "info"
-         << " depth "    << d
-         << " seldepth " << rootMoves[i].selDepth
-         << " multipv "  << i + 1
-         << " score "    << UCI::value(v);
+      if (sent)
+      {
+          Key signature = Key(d) << 48 ^ Key(v + VALUE_INFINITE) << 32 ^ Key(bound);
+          for (Move m : rootMoves[i].pv)
+              signature = signature * 6364136223846793005ULL + m;
 
-      if (Options["UCI_ShowWDL"])
-          ss << UCI::wdl(v, pos.game_ply());
+          if ((*sent)[i] == signature)
+              continue;
 
-      if (i == pvIdx && !tb && updated) // tablebase- and previous-scores are exact
-         ss << (rootMoves[i].scoreLowerbound ? " lowerbound" : (rootMoves[i].scoreUpperbound ? " upperbound" : ""));
+          (*sent)[i] = signature;
+      }
 
-      ss << " nodes "    << nodesSearched
-         << " nps "      << nodesSearched * 1000 / elapsed
-         << " hashfull " << TT.hashfull()
-         << " tbhits "   << tbHits
-         << " time "     << elapsed
-         << " pv";
+      if (!out.empty()) // Not at first line
+          out += '\n';
+
+      out += "info depth ";
+      append(out, d);
+      out += " seldepth ";
+      append(out, rootMoves[i].selDepth);
+      out += " multipv ";
+      append(out, i + 1);
+      out += " score ";
+      out += UCI::value(v);
+
+      if (showWDL)
+          out += UCI::wdl(v, pos.game_ply());
+
+      out += Bounds[bound];
+      out += " nodes ";
+      append(out, nodesSearched);
+      out += " nps ";
+      append(out, nodesSearched * 1000 / elapsed);
+      out += " hashfull ";
+      append(out, hashfull);
+      out += " tbhits ";
+      append(out, tbHits);
+      out += " time ";
+      append(out, elapsed);
+      out += " pv";
 
       for (Move m : rootMoves[i].pv)
-          ss << " " << UCI::move(m, pos.is_chess960());
+      {
+          out += ' ';
+          out += UCI::move(m, pos.is_chess960());
+      }
   }
-
-  return ss.str();
 }
 
 
@@ -2070,9 +2648,6 @@ string UCI::pv(const Position& pos, Depth depth) {
 bool RootMove::extract_ponder_from_tt(Position& pos) {
 
     StateInfo st;
-#ifdef USE_NNUE
-    ASSERT_ALIGNED(&st, Eval::NNUE::CacheLineSize);
-#endif
 
     bool ttHit;
 
@@ -2082,7 +2657,7 @@ bool RootMove::extract_ponder_from_tt(Position& pos) {
         return false;
 
     pos.do_move(pv[0], st);
-    TTEntry* tte = TT.probe(pos.key(), ttHit);
+    TTEntry* tte = TT.probe(pos.this_thread()->ttSlice, pos.key(), ttHit, pos.this_thread()->ttStats);
 
     if (ttHit)
     {
@@ -2095,36 +2670,36 @@ bool RootMove::extract_ponder_from_tt(Position& pos) {
     return pv.size() > 1;
 }
 
-void Tablebases::rank_root_moves(Position& pos, Search::RootMoves& rootMoves) {
+Tablebases::Config Tablebases::rank_root_moves(Position& pos, Search::RootMoves& rootMoves) {
 
-    RootInTB = false;
-    UseRule50 = bool(Options["Syzygy50MoveRule"]);
-    ProbeDepth = int(Options["SyzygyProbeDepth"]);
-    Cardinality = int(Options["SyzygyProbeLimit"]);
+    Config config;
+    config.useRule50 = bool(Options["Syzygy50MoveRule"]);
+    config.probeDepth = int(Options["SyzygyProbeDepth"]);
+    config.cardinality = int(Options["SyzygyProbeLimit"]);
     bool dtz_available = true;
 
     // Tables with fewer pieces than SyzygyProbeLimit are searched with
-    // ProbeDepth == DEPTH_ZERO
-    if (Cardinality > MaxCardinality)
+    // probeDepth == DEPTH_ZERO
+    if (config.cardinality > MaxCardinality)
     {
-        Cardinality = MaxCardinality;
-        ProbeDepth = 0;
+        config.cardinality = MaxCardinality;
+        config.probeDepth = 0;
     }
 
-    if (Cardinality >= popcount(pos.pieces()) && !pos.can_castle(ANY_CASTLING))
+    if (config.cardinality >= popcount(pos.pieces()) && !pos.can_castle(ANY_CASTLING))
     {
         // Rank moves using DTZ tables
-        RootInTB = root_probe(pos, rootMoves);
+        config.rootInTB = root_probe(pos, rootMoves);
 
-        if (!RootInTB)
+        if (!config.rootInTB)
         {
             // DTZ tables are missing; try to rank moves using WDL tables
             dtz_available = false;
-            RootInTB = root_probe_wdl(pos, rootMoves);
+            config.rootInTB = root_probe_wdl(pos, rootMoves);
         }
     }
 
-    if (RootInTB)
+    if (config.rootInTB)
     {
         // Sort moves according to TB rank
         std::stable_sort(rootMoves.begin(), rootMoves.end(),
@@ -2132,7 +2707,7 @@ void Tablebases::rank_root_moves(Position& pos, Search::RootMoves& rootMoves) {
 
         // Probe during search only if DTZ is not available and we are winning
         if (dtz_available || rootMoves[0].tbScore <= VALUE_DRAW)
-            Cardinality = 0;
+            config.cardinality = 0;
     }
     else
     {
@@ -2140,6 +2715,8 @@ void Tablebases::rank_root_moves(Position& pos, Search::RootMoves& rootMoves) {
         for (auto& m : rootMoves)
             m.tbRank = 0;
     }
+
+    return config;
 }
 
 } // namespace Stockfish
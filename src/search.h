@@ -19,16 +19,18 @@
 #ifndef SEARCH_H_INCLUDED
 #define SEARCH_H_INCLUDED
 
+#include <algorithm>
+#include <cassert>
+#include <string>
 #include <vector>
 
 #include "misc.h"
 #include "movepick.h"
+#include "position.h"
 #include "types.h"
 
 namespace Stockfish {
 
-class Position;
-
 namespace Search {
 
 
@@ -54,6 +56,36 @@ struct Stack {
 };
 
 
+/// PVLine is the PV of a root move, a vector of moves of fixed capacity, long
+/// enough for any PV of the search. It is never allocated, and a copy copies
+/// only the moves of the PV, so that copying the root moves to the threads is
+/// cheap.
+
+class PVLine {
+
+public:
+  PVLine(size_t n, Move m) : count(n) { std::fill(moves, moves + n, m); }
+  PVLine(const PVLine& pv) : count(pv.count) { std::copy(pv.begin(), pv.end(), moves); }
+  PVLine& operator=(const PVLine& pv) {
+    count = pv.count;
+    std::copy(pv.begin(), pv.end(), moves);
+    return *this;
+  }
+
+  size_t size() const { return count; }
+  void resize(size_t n) { assert(n <= count); count = n; }
+  void push_back(Move m) { assert(count < MAX_PLY + 1); moves[count++] = m; }
+  Move& operator[](size_t i) { return moves[i]; }
+  const Move& operator[](size_t i) const { return moves[i]; }
+  const Move* begin() const { return moves; }
+  const Move* end() const { return moves + count; }
+
+private:
+  size_t count;
+  Move moves[MAX_PLY + 1];
+};
+
+
 /// RootMove struct is used for moves at the root of the tree. For each root move
 /// we store a score and a PV (really a refutation in the case of moves which
 /// fail low). Score is normally set at -VALUE_INFINITE for all non-pv moves.
@@ -77,7 +109,7 @@ struct RootMove {
   int selDepth = 0;
   int tbRank = 0;
   Value tbScore;
-  std::vector<Move> pv;
+  PVLine pv;
 };
 
 using RootMoves = std::vector<RootMove>;
@@ -90,8 +122,8 @@ struct LimitsType {
 
   LimitsType() { // Init explicitly due to broken value-initialization of non POD in MSVC
     time[WHITE] = time[BLACK] = inc[WHITE] = inc[BLACK] = npmsec = movetime = TimePoint(0);
-    movestogo = depth = mate = perft = infinite = 0;
-    nodes = 0;
+    movestogo = depth = mate = perft = perftJson = infinite = randomPlies = spsa = 0;
+    nodes = datagen = 0;
   }
 
   bool use_time_management() const {
@@ -100,14 +132,31 @@ struct LimitsType {
 
   std::vector<Move> searchmoves;
   TimePoint time[COLOR_NB], inc[COLOR_NB], npmsec, movetime, startTime;
-  int movestogo, depth, mate, perft, infinite;
-  int64_t nodes;
+  int movestogo, depth, mate, perft, perftJson, infinite, randomPlies, spsa;
+  int64_t nodes, datagen;
+  std::string datagenFile, analyseFile, spsaFile;
+};
+
+
+/// TrainingEntry is the record of the files written by generate_training_data,
+/// see Thread::self_play(). It holds a position, the score of its search and
+/// the best move, and the result of the game (1 won, 0 drawn, -1 lost), both
+/// from the point of view of the side to move.
+
+struct TrainingEntry {
+  PackedPosition pos;
+  int16_t  score;
+  uint16_t move;
+  int8_t   result;
+  uint8_t  padding[3];
 };
 
-extern LimitsType Limits;
+static_assert(sizeof(TrainingEntry) == 72, "Unexpected TrainingEntry size");
+
 
 void init();
 void clear();
+void spsa(Position& pos, StateListPtr& states, const LimitsType& limits);
 
 } // namespace Search
 
@@ -0,0 +1,756 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2023 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <deque>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "misc.h"
+#include "server.h"
+#include "thread.h"
+#include "tt.h"
+#include "uci.h"
+
+using namespace std;
+
+namespace Stockfish::Server {
+
+namespace {
+
+  // A Games object hosts many games in this process, sharing the networks, the
+  // tablebases and the TT. A game is only its variant, its position, its clock
+  // and a slice of the TT, so that it costs nothing but while it searches. The
+  // searches run on a fixed set of workers, each a thread pool of the given
+  // number of threads, created by its first search: a go is run at once by a
+  // free worker, preferring the one which searched the game last, or else is
+  // queued, and the queued searches are started in the order of their go by a
+  // scheduler thread as the workers finish. The clock of a search runs from its
+  // go, so that the time in the queue is accounted for. A worker with one
+  // thread takes about 26 MB, mostly the histories, the accumulators and the
+  // pawn and material tables of the thread, and a game well under 1 KB. The
+  // output lines of a game start with its id.
+
+  class Games {
+
+    struct Game {
+      string id, variant, position;
+      size_t slice;
+      TimeManagement time; // Moved to the worker while searching
+      int worker = -1, lastWorker = -1; // Searching the game, and the last one
+      bool queued = false, newGame = false;
+      string go; // Of the queued search
+      TimePoint received;
+    };
+
+    struct Worker {
+      std::unique_ptr<ThreadPool> pool; // Null until the first search
+      Game* game = nullptr; // Of the running search, null if the game is gone
+      string last; // Id of the game searched last
+      bool busy = false;
+      std::atomic_bool finished = false;
+    };
+
+  public:
+    Games(size_t s, size_t t, size_t w);
+   ~Games();
+    void command(const string& id, const string& cmd);
+    void close(const string& id);
+
+  private:
+    void schedule();
+    int free_worker(const Game& game) const;
+    void start(Game& game, size_t w);
+    void remove(map<string, Game>::iterator it);
+
+    size_t slices, threads;
+    vector<size_t> sliceGames; // Number of games by slice
+    map<string, Game> games;
+    deque<Game*> queue;
+    vector<std::unique_ptr<Worker>> workers;
+    mutex gamesMutex; // Of the games, the queue and the workers
+    mutex wakeMutex;
+    condition_variable wakeCv; // Of the scheduler, woken by finished searches
+    bool woken = false, done = false;
+    std::thread scheduler;
+  };
+
+  Games::Games(size_t s, size_t t, size_t w) : slices(std::clamp(s, size_t(1), TranspositionTable::MaxSlices)),
+                                               threads(std::clamp(t, size_t(1), size_t(1024))),
+                                               sliceGames(slices) {
+
+    // By default, as many workers as the cores can run at once
+    if (!w)
+        w = std::thread::hardware_concurrency() / threads;
+
+    for (size_t i = 0; i < std::clamp(w, size_t(1), size_t(1024)); ++i)
+        workers.push_back(std::make_unique<Worker>());
+
+    scheduler = std::thread([this] { schedule(); });
+  }
+
+  // The searches are stopped, and the threads destroyed with the workers
+
+  Games::~Games() {
+
+    {
+        lock_guard<mutex> lk(wakeMutex);
+        done = true;
+    }
+    wakeCv.notify_one();
+    scheduler.join();
+
+    for (auto& w : workers)
+        if (w->pool)
+        {
+            w->pool->stop = true;
+            w->pool->set_threads(0);
+        }
+  }
+
+  // Games::schedule() is the loop of the scheduler thread, which waits for the
+  // searches to finish, gives back their clock to their game, and starts the
+  // queued searches on the free workers.
+
+  void Games::schedule() {
+
+    while (true)
+    {
+        {
+            unique_lock<mutex> lk(wakeMutex);
+            wakeCv.wait(lk, [&]{ return woken || done; });
+            if (done)
+                return;
+            woken = false;
+        }
+
+        lock_guard<mutex> lk(gamesMutex);
+
+        for (size_t w = 0; w < workers.size(); ++w)
+        {
+            Worker& worker = *workers[w];
+            if (!worker.busy || !worker.finished.exchange(false))
+                continue;
+
+            worker.busy = false;
+            if (worker.game)
+            {
+                worker.game->time = worker.pool->time;
+                worker.game->worker = -1;
+                worker.game->lastWorker = int(w);
+                worker.game = nullptr;
+            }
+        }
+
+        while (!queue.empty())
+        {
+            Game& game = *queue.front();
+            int free = free_worker(game);
+            if (free < 0)
+                break;
+
+            queue.pop_front();
+            game.queued = false;
+            sync_prefix(game.id + " ");
+            start(game, size_t(free));
+        }
+    }
+  }
+
+  // Games::free_worker() returns a worker which is not searching, preferably
+  // the one which searched the game last, or -1 if there is none.
+
+  int Games::free_worker(const Game& game) const {
+
+    if (game.lastWorker >= 0 && !workers[game.lastWorker]->busy)
+        return game.lastWorker;
+
+    for (size_t w = 0; w < workers.size(); ++w)
+        if (!workers[w]->busy)
+            return int(w);
+
+    return -1;
+  }
+
+  // Games::start() starts the queued search of a game on a free worker, with
+  // the clock of the game. The state of the pool kept from the previous search
+  // is that of another game, if the worker switches games, and is reset then.
+
+  void Games::start(Game& game, size_t w) {
+
+    Worker& worker = *workers[w];
+
+    if (!worker.pool)
+    {
+        worker.pool = std::make_unique<ThreadPool>();
+        worker.pool->ttSlices = slices;
+        worker.pool->set_threads(threads);
+        worker.pool->onSearchFinished = [this, &worker] {
+            worker.finished = true;
+            {
+                lock_guard<mutex> lk(wakeMutex);
+                woken = true;
+            }
+            wakeCv.notify_one();
+        };
+    }
+
+    ThreadPool& pool = *worker.pool;
+
+    if (game.newGame || worker.last != game.id)
+        pool.clear(game.newGame);
+
+    game.newGame = false;
+    game.worker = int(w);
+    worker.game = &game;
+    worker.last = game.id;
+    worker.busy = true;
+
+    pool.ttIdx = game.slice;
+    pool.time = game.time;
+    pool.main()->syncPrefix = game.id + " ";
+    UCI::start_search(pool, UCI::variant_from_name(game.variant), game.position, game.go, game.received);
+  }
+
+  // Games::remove() erases a game, stopping its search, whose worker stays busy
+  // until the search has ended.
+
+  void Games::remove(map<string, Game>::iterator it) {
+
+    Game& game = it->second;
+
+    if (game.worker >= 0)
+    {
+        workers[game.worker]->game = nullptr;
+        workers[game.worker]->pool->stop = true;
+    }
+
+    if (game.queued)
+        queue.erase(std::find(queue.begin(), queue.end(), &game));
+
+    --sliceGames[game.slice];
+    games.erase(it);
+  }
+
+  void Games::close(const string& id) {
+
+    lock_guard<mutex> lk(gamesMutex);
+
+    auto it = games.find(id);
+    if (it != games.end())
+        remove(it);
+  }
+
+  // Games::command() executes the given command of a game, one of position, go,
+  // stop, ponderhit, ucinewgame, isready, quit or setoption name UCI_Variant.
+  // A game is created by its first command, in the current UCI_Variant, with
+  // the slice of the TT used by the fewest games, so that each game has a slice
+  // of its own as long as there are no more games than slices.
+
+  void Games::command(const string& id, const string& cmd) {
+
+    istringstream is(cmd);
+    string token, args;
+    is >> skipws >> token;
+    getline(is >> std::ws, args);
+
+    if (token.empty())
+        return;
+
+    sync_prefix(id + " ");
+
+    unique_lock<mutex> lk(gamesMutex);
+
+    auto [it, created] = games.try_emplace(id);
+    Game& game = it->second;
+
+    if (created)
+    {
+        game.id = id;
+        game.variant = string(Options["UCI_Variant"]);
+        game.position = "startpos";
+        game.slice = size_t(std::min_element(sliceGames.begin(), sliceGames.end()) - sliceGames.begin());
+        ++sliceGames[game.slice];
+    }
+
+    if (token == "position")
+    {
+        if (args.rfind("startpos", 0) == 0 || args.rfind("fen ", 0) == 0)
+            game.position = args;
+    }
+    else if (token == "go")
+    {
+        // The state of a perft is shared by the pools, as are those of the other
+        // modes of the search, which are not commands of a game
+        istringstream gs(args);
+        if (std::find(istream_iterator<string>(gs), istream_iterator<string>(), "perft") != istream_iterator<string>())
+        {
+            sync_cout << "info string Perft is not available in server games" << sync_endl;
+            return;
+        }
+
+        game.go = args;
+        game.received = now();
+
+        // A go while searching ends the running search first, as a stop does,
+        // and is then the first to be started, on its worker if still free.
+        if (game.worker >= 0)
+        {
+            workers[game.worker]->pool->stop = true;
+            if (!game.queued)
+                queue.push_front(&game), game.queued = true;
+            return;
+        }
+
+        if (game.queued)
+            return;
+
+        int free = free_worker(game);
+        if (free >= 0 && queue.empty())
+            start(game, size_t(free));
+        else
+            queue.push_back(&game), game.queued = true;
+    }
+    else if (token == "stop" || token == "ponderhit")
+    {
+        if (game.worker >= 0 && token == "stop")
+            workers[game.worker]->pool->stop = true;
+        else if (game.worker >= 0)
+            workers[game.worker]->pool->main()->ponderhit();
+
+        // A queued search is still run, to answer its go, but for depth 1 or
+        // without pondering.
+        if (game.queued)
+        {
+            istringstream gs(game.go);
+            string word, rest;
+            while (gs >> word)
+                if (word != "ponder")
+                    rest += word + " ";
+            game.go = token == "stop" ? "depth 1" : rest;
+        }
+    }
+    else if (token == "ucinewgame")
+    {
+        // The histories are cleared by the next search of the game. A running
+        // search is stopped and left to its worker, which no longer gives its
+        // clock back to the game.
+        if (game.worker >= 0)
+        {
+            workers[game.worker]->pool->stop = true;
+            workers[game.worker]->game = nullptr;
+            game.lastWorker = game.worker;
+            game.worker = -1;
+        }
+        game.newGame = true;
+        game.time = TimeManagement();
+
+        // The slice is cleared without holding the games, and only if no other
+        // game uses it. The other games only write to their own slices.
+        size_t slice = game.slice;
+        if (sliceGames[slice] == 1)
+        {
+            lk.unlock();
+            TT.clear_slice(slice, slices);
+        }
+    }
+    else if (token == "setoption")
+    {
+        istringstream os(args);
+        string name, value;
+        os >> token >> name >> token >> value;
+        if (name == "UCI_Variant" && std::find(variants.begin(), variants.end(), value) != variants.end())
+            game.variant = value;
+        else
+            sync_cout << "info string Only UCI_Variant can be set per game" << sync_endl;
+    }
+    else if (token == "isready")
+        sync_cout << "readyok" << sync_endl;
+
+    else if (token == "quit")
+        remove(it);
+
+    else
+        sync_cout << "Unknown command: '" << cmd << "'." << sync_endl;
+  }
+
+#if !defined(_WIN32)
+
+  // The output of the games of the connections not yet sent, by game id, and
+  // the pipe waking up the poll() of the listener when there is some.
+  mutex OutputMutex;
+  map<string, string> Output;
+  int WakeFds[2] = { -1, -1 };
+
+  // to_connection() is the sink of the lines written with a prefix while
+  // listening, see sync_redirect(). The lines of a game are batched until the
+  // listener gets to send them, so that a burst of info lines costs a single
+  // wake up and a single write.
+
+  void to_connection(const string& prefix, const string& line) {
+
+    lock_guard<mutex> lk(OutputMutex);
+
+    auto it = Output.find(prefix.substr(0, prefix.find(' ')));
+    if (it == Output.end())
+        return; // The connection is gone
+
+    if (it->second.empty())
+        (void)!write(WakeFds[1], "", 1);
+
+    it->second += line + '\n';
+  }
+
+#endif
+
+} // namespace
+
+
+#if !defined(_WIN32)
+
+/// Server::open_socket() creates a non-blocking socket listening on the given
+/// address, a path for a Unix socket, or a port with an optional host
+/// ("127.0.0.1" by default) for TCP. It returns -1 on failure.
+
+int open_socket(const string& address) {
+
+  int fd = -1;
+
+  if (address.find('/') != string::npos)
+  {
+      sockaddr_un sa = {};
+      struct stat st;
+
+      if (address.size() >= sizeof(sa.sun_path))
+          return -1;
+
+      // Remove a socket left by a previous run, but nothing else
+      if (!stat(address.c_str(), &st) && S_ISSOCK(st.st_mode))
+          unlink(address.c_str());
+
+      sa.sun_family = AF_UNIX;
+      address.copy(sa.sun_path, address.size());
+
+      fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (fd != -1 && bind(fd, (sockaddr*)&sa, sizeof(sa)))
+          ::close(fd), fd = -1;
+  }
+  else
+  {
+      size_t colon = address.rfind(':');
+      string host = colon == string::npos ? "127.0.0.1" : address.substr(0, colon);
+      string port = colon == string::npos ? address : address.substr(colon + 1);
+
+      addrinfo hints = {}, *res;
+      hints.ai_family = AF_UNSPEC;
+      hints.ai_socktype = SOCK_STREAM;
+      hints.ai_flags = AI_PASSIVE;
+
+      if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &res))
+          return -1;
+
+      for (addrinfo* ai = res; ai && fd == -1; ai = ai->ai_next)
+      {
+          int one = 1;
+          fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+          if (fd == -1)
+              continue;
+
+          setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+          if (bind(fd, ai->ai_addr, ai->ai_addrlen))
+              ::close(fd), fd = -1;
+      }
+      freeaddrinfo(res);
+  }
+
+  if (fd != -1 && (::listen(fd, 64) || fcntl(fd, F_SETFL, O_NONBLOCK)))
+      ::close(fd), fd = -1;
+
+  return fd;
+}
+
+#endif
+
+
+/// Server::run() is called when the engine receives the "server [slices [threads
+/// [workers]]]" command, with the number of slices of the TT, 16 by default, the
+/// number of threads of a search, 1 by default, and the number of workers, by
+/// default as many as the cores can run at once. Each input line starts with the
+/// id of a game, followed by a command of the game, see Games::command(). The
+/// server stops on a "quit" line or at the end of the input.
+
+void run(std::istream& args) {
+
+  size_t slices = 16, threads = 1, workers = 0;
+  args >> slices >> threads >> workers;
+
+  Games games(slices, threads, workers);
+  string line, id, cmd;
+
+  while (getline(cin, line))
+  {
+      istringstream ls(line);
+      id.clear(), cmd.clear();
+      ls >> skipws >> id;
+
+      if (id == "quit")
+          break;
+
+      getline(ls >> std::ws, cmd);
+      games.command(id, cmd);
+  }
+}
+
+
+/// Server::listen() is called when the engine receives the "listen <address>
+/// [slices [threads [workers]]]" command, with a port, host:port or the path of
+/// a Unix socket as address. Each connection is an independent UCI session,
+/// playing a game of the server of run(), with the same arguments: "uci" and
+/// "quit" are answered by the listener, which closes the connection on the
+/// latter, and the other commands are those of Games::command(). None of them
+/// waits for a search, other than to stop it, so that the commands are answered
+/// at once, while the searches of more sessions than workers wait for one, an
+/// infinite search holding its worker until it is stopped. The sockets are
+/// non-blocking and served by a single poll() loop. Unless watchStdin is false,
+/// the listener stops on a "quit" line or at the end of the standard input, and
+/// so does the engine.
+
+#if defined(_WIN32)
+
+void listen(std::istream&, bool) {
+  sync_cout << "info string The listen command is not supported on Windows" << sync_endl;
+}
+
+#else
+
+void listen(std::istream& args, bool watchStdin) {
+
+  struct Connection {
+    string id, in, out;
+    bool closing = false;
+  };
+
+  string address, stdinLine;
+  size_t slices = 16, threads = 1, workers = 0, nextId = 0;
+  args >> address >> slices >> threads >> workers;
+
+  int listenFd = open_socket(address);
+  if (listenFd == -1)
+  {
+      sync_cout << "info string Failed to listen on " << address << sync_endl;
+      return;
+  }
+
+  if (pipe(WakeFds))
+  {
+      ::close(listenFd);
+      sync_cout << "info string Failed to listen on " << address << sync_endl;
+      return;
+  }
+
+  fcntl(WakeFds[0], F_SETFL, O_NONBLOCK);
+  fcntl(WakeFds[1], F_SETFL, O_NONBLOCK);
+
+  sync_cout << "info string Listening on " << address << sync_endl;
+
+  map<int, Connection> conns;
+  vector<pollfd> fds;
+  char buf[65536];
+  bool stop = false;
+
+  sync_redirect(to_connection);
+
+  { // Games are destroyed before the output is redirected back to std::cout
+  Games games(slices, threads, workers);
+
+  while (!stop)
+  {
+      fds.clear();
+      fds.push_back({ listenFd, POLLIN, 0 });
+      fds.push_back({ WakeFds[0], POLLIN, 0 });
+      if (watchStdin)
+          fds.push_back({ STDIN_FILENO, POLLIN, 0 });
+      for (auto& [fd, c] : conns)
+          fds.push_back({ fd, short(c.out.empty() ? POLLIN : POLLIN | POLLOUT), 0 });
+
+      if (poll(fds.data(), fds.size(), -1) < 0)
+          continue; // Interrupted by a signal
+
+      // Drain the wake up pipe and collect the pending output
+      if (fds[1].revents)
+      {
+          while (read(WakeFds[0], buf, sizeof(buf)) > 0) {}
+
+          lock_guard<mutex> lk(OutputMutex);
+          for (auto& [fd, c] : conns)
+          {
+              c.out += Output[c.id];
+              Output[c.id].clear();
+          }
+      }
+
+      // Accept the new connections
+      if (fds[0].revents & POLLIN)
+          for (int fd; (fd = accept(listenFd, nullptr, nullptr)) != -1; )
+          {
+              fcntl(fd, F_SETFL, O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+              int one = 1;
+              setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+              conns[fd].id = "c" + std::to_string(++nextId);
+
+              lock_guard<mutex> lk(OutputMutex);
+              Output[conns[fd].id];
+          }
+
+      if (watchStdin && fds[2].revents)
+      {
+          ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+          stdinLine.append(buf, n > 0 ? size_t(n) : 0);
+          stop = n <= 0;
+
+          for (size_t eol; (eol = stdinLine.find('\n')) != string::npos; stdinLine.erase(0, eol + 1))
+          {
+              istringstream ls(stdinLine.substr(0, eol));
+              string token;
+              stop |= (ls >> token) && token == "quit";
+          }
+      }
+
+      for (size_t i = 2 + watchStdin; i < fds.size(); ++i)
+      {
+          Connection& c = conns[fds[i].fd];
+
+          if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+          {
+              ssize_t n = recv(fds[i].fd, buf, sizeof(buf), 0);
+              if (n > 0)
+                  c.in.append(buf, size_t(n));
+
+              // Execute the complete lines, with the output of the commands
+              // answered at once going to the connection through the sink.
+              for (size_t eol; (eol = c.in.find('\n')) != string::npos; c.in.erase(0, eol + 1))
+              {
+                  string line = c.in.substr(0, eol), token;
+                  istringstream ls(line);
+                  ls >> skipws >> token;
+
+                  if (token == "uci")
+                  {
+                      sync_prefix(c.id + " ");
+                      sync_cout << "id name " << engine_info(true)
+                                << "\n"       << Options
+                                << "\nuciok"  << sync_endl;
+                  }
+                  else if (token == "quit")
+                      c.closing = true;
+                  else if (!c.closing)
+                      games.command(c.id, line);
+              }
+
+              // A closing connection stops its game at once, so that its search
+              // no longer writes to the output, which is then drained.
+              if (n <= 0 || c.closing)
+              {
+                  c.closing = true;
+                  games.close(c.id);
+              }
+          }
+      }
+
+      // Send what can be sent, in one write per connection
+      {
+          lock_guard<mutex> lk(OutputMutex);
+          for (auto& [fd, c] : conns)
+          {
+              c.out += Output[c.id];
+              Output[c.id].clear();
+          }
+      }
+
+      for (auto it = conns.begin(); it != conns.end(); )
+      {
+          Connection& c = it->second;
+
+          if (!c.out.empty())
+          {
+#ifdef MSG_NOSIGNAL
+              ssize_t n = send(it->first, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+#else
+              ssize_t n = send(it->first, c.out.data(), c.out.size(), 0);
+#endif
+              if (n > 0)
+                  c.out.erase(0, size_t(n));
+              else if (errno != EAGAIN && errno != EWOULDBLOCK)
+                  c.closing = true, c.out.clear();
+          }
+
+          if (c.closing && (c.out.empty() || stop))
+          {
+              games.close(c.id);
+              {
+                  lock_guard<mutex> lk(OutputMutex);
+                  Output.erase(c.id);
+              }
+              ::close(it->first);
+              it = conns.erase(it);
+          }
+          else
+              ++it;
+      }
+  }
+  }
+
+  sync_redirect(nullptr);
+  sync_prefix("");
+
+  for (auto& [fd, c] : conns)
+      ::close(fd);
+
+  Output.clear();
+  ::close(listenFd);
+  ::close(WakeFds[0]);
+  ::close(WakeFds[1]);
+
+  if (address.find('/') != string::npos)
+      unlink(address.c_str());
+}
+
+#endif
+
+} // namespace Stockfish::Server
@@ -28,6 +28,7 @@
 #include <sstream>
 #include <string_view>
 #include <type_traits>
+#include <unordered_map>
 
 #include "../bitboard.h"
 #include "../movegen.h"
@@ -39,6 +40,7 @@
 #include "tbprobe.h"
 
 #ifndef _WIN32
+#include <dirent.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
@@ -54,6 +56,7 @@
 using namespace Stockfish::Tablebases;
 
 int Stockfish::Tablebases::MaxCardinality;
+uint16_t Stockfish::Tablebases::Generation;
 
 namespace Stockfish {
 
@@ -510,11 +513,20 @@ static_assert(sizeof(LR) == 3, "LR tree entry must be 3 bytes");
 
 // class TBFile memory maps/unmaps the single .rtbw and .rtbz files. Files are
 // memory mapped for best performance. Files are mapped at first access: at init
-// time only existence of the file is checked.
+// time only existence of the file is checked, in the index of the directories.
 class TBFile : public std::ifstream {
 
     std::string fname;
 
+#ifndef _WIN32
+    static constexpr char SepChar = ':';
+#else
+    static constexpr char SepChar = ';';
+#endif
+
+    // Directory of each file found by scan(), by file name
+    static std::unordered_map<std::string, std::string> Index;
+
 public:
     // Look for and open the file among the Paths directories where the .rtbw
     // and .rtbz files can be found. Multiple directories are separated by ";"
@@ -524,22 +536,53 @@ public:
     // C:\tb\wdl345;C:\tb\wdl6;D:\tb\dtz345;D:\tb\dtz6
     static std::string Paths;
 
+    uint64_t size = 0; // Of the file mapped by map()
+
     TBFile(const std::string& f) {
 
-#ifndef _WIN32
-        constexpr char SepChar = ':';
-#else
-        constexpr char SepChar = ';';
-#endif
+        auto it = Index.find(f);
+        if (it != Index.end())
+        {
+            fname = it->second + "/" + f;
+            std::ifstream::open(fname);
+        }
+    }
+
+    static bool exists(const std::string& f) { return Index.count(f); }
+
+    // List the Paths directories once, instead of trying to open every possible
+    // file in each of them. A file in an earlier directory hides the ones of
+    // the same name in the later directories.
+    static void scan() {
+
+        Index.clear();
+
         std::stringstream ss(Paths);
         std::string path;
 
         while (std::getline(ss, path, SepChar))
         {
-            fname = path + "/" + f;
-            std::ifstream::open(fname);
-            if (is_open())
-                return;
+#ifndef _WIN32
+            DIR* dir = opendir(path.c_str());
+            if (!dir)
+                continue;
+
+            while (const dirent* entry = readdir(dir))
+                Index.emplace(entry->d_name, path);
+
+            closedir(dir);
+#else
+            WIN32_FIND_DATAA data;
+            HANDLE find = FindFirstFileA((path + "\\*").c_str(), &data);
+            if (find == INVALID_HANDLE_VALUE)
+                continue;
+
+            do
+                Index.emplace(data.cFileName, path);
+            while (FindNextFileA(find, &data));
+
+            FindClose(find);
+#endif
         }
     }
 
@@ -563,18 +606,19 @@ public:
             exit(EXIT_FAILURE);
         }
 
-        *mapping = statbuf.st_size;
+        *mapping = size = statbuf.st_size;
         *baseAddress = mmap(nullptr, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
-#if defined(MADV_RANDOM)
-        madvise(*baseAddress, statbuf.st_size, MADV_RANDOM);
-#endif
         ::close(fd);
 
+        // Out of address space, the table is treated as missing
         if (*baseAddress == MAP_FAILED)
         {
             std::cerr << "Could not mmap() " << fname << std::endl;
-            exit(EXIT_FAILURE);
+            return *baseAddress = nullptr, nullptr;
         }
+#if defined(MADV_RANDOM)
+        madvise(*baseAddress, statbuf.st_size, MADV_RANDOM);
+#endif
 #else
         // Note FILE_FLAG_RANDOM_ACCESS is only a hint to Windows and as such may get ignored.
         HANDLE fd = CreateFileA(fname.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
@@ -585,6 +629,7 @@ public:
 
         DWORD size_high;
         DWORD size_low = GetFileSize(fd, &size_high);
+        size = (uint64_t(size_high) << 32) | size_low;
 
         if (size_low % 64 != 16)
         {
@@ -598,7 +643,7 @@ public:
         if (!mmap)
         {
             std::cerr << "CreateFileMapping() failed" << std::endl;
-            exit(EXIT_FAILURE);
+            return *baseAddress = nullptr, nullptr;
         }
 
         *mapping = (uint64_t)mmap;
@@ -608,7 +653,8 @@ public:
         {
             std::cerr << "MapViewOfFile() failed, name = " << fname
                       << ", error = " << GetLastError() << std::endl;
-            exit(EXIT_FAILURE);
+            CloseHandle(mmap);
+            return nullptr;
         }
 #endif
         uint8_t* data = (uint8_t*)*baseAddress;
@@ -623,6 +669,19 @@ public:
         return data + 4; // Skip Magics's header
     }
 
+    // Ask for the whole file to be read ahead, backed by huge pages if the
+    // kernel supports it for files, when a table is mapped again
+    static void advise_hot(void* baseAddress, uint64_t size) {
+
+#if defined(MADV_WILLNEED)
+        madvise(baseAddress, size, MADV_WILLNEED);
+#endif
+#if defined(MADV_HUGEPAGE)
+        madvise(baseAddress, size, MADV_HUGEPAGE);
+#endif
+        (void)baseAddress, (void)size;
+    }
+
     static void unmap(void* baseAddress, uint64_t mapping) {
 
 #ifndef _WIN32
@@ -635,6 +694,7 @@ public:
 };
 
 std::string TBFile::Paths;
+std::unordered_map<std::string, std::string> TBFile::Index;
 
 // struct PairsData contains low level indexing information to access TB data.
 // There are 8, 4 or 2 PairsData records for each TBTable, according to type of
@@ -661,20 +721,104 @@ struct PairsData {
     uint16_t map_idx[4];           // WDLWin, WDLLoss, WDLCursedWin, WDLBlessedLoss (used in DTZ)
 };
 
+// struct TBMapping is the memory mapping of a TBFile. While 'ready' is false
+// the file must be mapped, under 'mutex', before a probe. With a budget for the
+// mapped files (option SyzygyMapBudgetMB) a mapping can be evicted again, so
+// that probes count themselves as 'users' of the mapping and leave a trace in
+// 'referenced' for the clock replacement of TBMappings::evict().
+struct TBMapping {
+    std::atomic_bool ready;
+    std::atomic_bool referenced;
+    std::atomic<int> users;
+    std::mutex mutex;
+    void* baseAddress;
+    uint64_t mapping;
+    uint64_t size;
+    bool evicted;
+
+    TBMapping() : ready(false), referenced(false), users(0), baseAddress(nullptr), size(0), evicted(false) {}
+
+    // Unmap the file if no probe uses it. A probe increments 'users' before
+    // loading 'ready', which is cleared here before loading 'users', so that
+    // either the probe waits for a new mapping or the mapping survives.
+    bool try_unmap() {
+
+        std::unique_lock<std::mutex> lk(mutex, std::try_to_lock);
+
+        if (!lk || !ready || !baseAddress)
+            return false;
+
+        ready = false;
+
+        if (users)
+        {
+            ready = true;
+            return false;
+        }
+
+        TBFile::unmap(baseAddress, mapping);
+        baseAddress = nullptr;
+        evicted = true;
+        return true;
+    }
+};
+
+// TBMappings keeps the mapped files within the budget, evicting the ones
+// which have not been probed since the last pass of its clock hand.
+class TBMappings {
+
+    std::mutex mutex;
+    std::vector<TBMapping*> mapped;
+    size_t hand = 0;
+    uint64_t mappedBytes = 0;
+
+public:
+    uint64_t budget = 0; // Zero for no limit, set at init time
+
+    void clear() { mapped.clear(); hand = 0; mappedBytes = 0; }
+
+    // Account for a new mapping, evicting the cold ones beyond the budget
+    void add(TBMapping* m) {
+
+        std::scoped_lock<std::mutex> lk(mutex);
+
+        mapped.push_back(m);
+        mappedBytes += m->size;
+
+        // Two passes clear all the references, a third one is left for the
+        // mappings which were in use
+        for (size_t visited = 0; mappedBytes > budget && visited < 3 * mapped.size(); ++visited)
+        {
+            hand %= mapped.size();
+            TBMapping* victim = mapped[hand];
+
+            if (   victim == m
+                || victim->referenced.exchange(false, std::memory_order_relaxed)
+                || !victim->try_unmap())
+            {
+                ++hand;
+                continue;
+            }
+
+            mappedBytes -= victim->size;
+            mapped.erase(mapped.begin() + hand);
+        }
+    }
+};
+
+TBMappings TBMappings;
+
 // struct TBTable contains indexing information to access the corresponding TBFile.
 // There are 2 types of TBTable, corresponding to a WDL or a DTZ file. TBTable
 // is populated at init time but the nested PairsData records are populated at
 // first access, when the corresponding file is memory mapped.
 template<TBType Type>
-struct TBTable {
+struct TBTable : TBMapping {
     using Ret = typename std::conditional<Type == WDL, WDLScore, int>::type;
 
     static constexpr int Sides = Type == WDL ? 2 : 1;
 
-    std::atomic_bool ready;
-    void* baseAddress;
     uint8_t* map;
-    uint64_t mapping;
     Variant variant;
     Key key;
     Key key2;
@@ -689,7 +833,7 @@ struct TBTable {
         return &items[stm % Sides][hasPawns ? f : 0];
     }
 
-    TBTable() : ready(false), baseAddress(nullptr) {}
+    TBTable() = default;
     explicit TBTable(Variant v, const std::string& code);
     explicit TBTable(const TBTable<WDL>& wdl);
 
@@ -840,20 +984,14 @@ void TBTables::add(Variant variant, const std::vector<PieceType>& w, const std::
     for (PieceType pt : b)
         code += PieceToChar[pt];
 
-    TBFile file(code + WdlSuffixes[variant]);
-
-    if (file.is_open()) // Only WDL file is checked
-        file.close();
-    else if (variant != CHESS_VARIANT && code.find("P") == std::string::npos &&
-             PawnlessWdlSuffixes[variant])
+    // Only WDL file is checked
+    if (!TBFile::exists(code + WdlSuffixes[variant]))
     {
-        TBFile pawnlessFile(code + PawnlessWdlSuffixes[variant]);
-        if (!pawnlessFile.is_open()) // Only WDL file is checked
+        if (   variant == CHESS_VARIANT || code.find("P") != std::string::npos
+            || !PawnlessWdlSuffixes[variant]
+            || !TBFile::exists(code + PawnlessWdlSuffixes[variant]))
             return;
-        pawnlessFile.close();
     }
-    else
-        return;
 
     MaxCardinality = std::max((int)(w.size() + b.size()), MaxCardinality);
 
@@ -1591,24 +1729,10 @@ void set(T& e, uint8_t* data) {
         }
 }
 
-// If the TB file corresponding to the given position is already memory mapped
-// then return its base address, otherwise try to memory map and init it. Called
-// at every probe, memory map and init only at first access. Function is thread
-// safe and can be called concurrently.
+// Memory map and init the TB file corresponding to the given position, run
+// by mapped() at the first access and after each eviction of the mapping.
 template<TBType Type>
-void* mapped(TBTable<Type>& e, const Position& pos) {
-
-    static std::mutex mutex;
-
-    // Use 'acquire' to avoid a thread reading 'ready' == true while
-    // another is still working. (compiler reordering may cause this).
-    if (e.ready.load(std::memory_order_acquire))
-        return e.baseAddress; // Could be nullptr if file does not exist
-
-    std::scoped_lock<std::mutex> lk(mutex);
-
-    if (e.ready.load(std::memory_order_relaxed)) // Recheck under lock
-        return e.baseAddress;
+void map_table(TBTable<Type>& e, const Position& pos) {
 
     constexpr uint8_t Magic[SUBVARIANT_NB][2][4] = {
         {
@@ -1844,10 +1968,11 @@ void* mapped(TBTable<Type>& e, const Position& pos) {
     TBFile file(fname + Suffixes[e.variant]);
 
     if (file.is_open())
-        data = file.map(&e.baseAddress, &e.mapping, Magic[e.variant][Type == WDL]);
+        data = file.map(&e.baseAddress, &e.mapping, Magic[e.variant][Type == WDL]), e.size = file.size;
     else if (fname.find("P") == std::string::npos && PawnlessSuffixes[e.variant]) {
         TBFile pawnlessFile(fname + PawnlessSuffixes[e.variant]);
         data = pawnlessFile.map(&e.baseAddress, &e.mapping, PawnlessMagic[e.variant][Type == WDL]);
+        e.size = pawnlessFile.size;
     }
 
     if (data) {
@@ -1875,12 +2000,60 @@ void* mapped(TBTable<Type>& e, const Position& pos) {
             assert(e.key == key);
         }
 #endif
+
+        // A table mapped again after an eviction is a hot one
+        if (e.evicted)
+            TBFile::advise_hot(e.baseAddress, e.size);
+
+        if (TBMappings.budget)
+            TBMappings.add(&e);
     }
 
     e.ready.store(true, std::memory_order_release);
+}
+
+// If the TB file corresponding to the given position is already memory mapped
+// then return its base address, otherwise try to memory map and init it. Called
+// at every probe, memory map and init only at first access. Function is thread
+// safe and can be called concurrently: threads only wait for the mapping of the
+// table they probe, not for the ones of other tables.
+template<TBType Type>
+void* mapped(TBTable<Type>& e, const Position& pos) {
+
+    // A sequentially consistent load, also to pair with try_unmap(), avoids a
+    // thread reading 'ready' == true while another is still working
+    if (e.ready.load())
+        return e.baseAddress; // Could be nullptr if file does not exist
+
+    std::scoped_lock<std::mutex> lk(e.mutex);
+
+    if (!e.ready.load(std::memory_order_relaxed)) // Recheck under lock
+        map_table(e, pos);
+
     return e.baseAddress;
 }
 
+// MappingUse keeps the mapping of a table from being evicted during a probe,
+// only needed with a budget for the mapped files
+class MappingUse {
+
+    TBMapping* m;
+
+public:
+    explicit MappingUse(TBMapping* e) : m(TBMappings.budget ? e : nullptr) {
+
+        if (!m)
+            return;
+
+        m->users.fetch_add(1);
+
+        if (!m->referenced.load(std::memory_order_relaxed))
+            m->referenced.store(true, std::memory_order_relaxed);
+    }
+
+   ~MappingUse() { if (m) m->users.fetch_sub(1, std::memory_order_release); }
+};
+
 template<TBType Type, typename Ret = typename TBTable<Type>::Ret>
 Ret result_to_score(Value value) {
 
@@ -1911,7 +2084,12 @@ Ret probe_table(const Position& pos, ProbeState* result, WDLScore wdl = WDLDraw)
 
     TBTable<Type>* entry = TBTables.get<Type>(pos.material_key());
 
-    if (!entry || !mapped(*entry, pos))
+    if (!entry)
+        return *result = FAIL, Ret();
+
+    MappingUse use(entry);
+
+    if (!mapped(*entry, pos))
         return *result = FAIL, Ret();
 
     return do_probe_table(pos, entry, wdl, result);
@@ -2093,13 +2271,19 @@ WDLScore search(Position& pos, ProbeState* result) {
 /// safe, nor it needs to be.
 void Tablebases::init(Variant variant, const std::string& paths) {
 
+    TBMappings.clear();
     TBTables.clear();
+    TBMappings.budget = uint64_t(int(Options["SyzygyMapBudgetMB"])) << 20;
     MaxCardinality = 0;
+    ++Generation; // Invalidate the WDL caches of the threads
+    Generation += !Generation; // Zero is the generation of the empty entries
     TBFile::Paths = paths;
 
     if (paths.empty() || paths == "<empty>")
         return;
 
+    TBFile::scan();
+
     // MapB1H1H7[] encodes a square below a1-h8 diagonal to 0..27
     int code = 0;
     for (Square s = SQ_A1; s <= SQ_H8; ++s)
@@ -2302,6 +2486,26 @@ WDLScore Tablebases::probe_wdl(Position& pos, ProbeState* result) {
     return search<false>(pos, result);
 }
 
+// Probe the WDL table through the given cache, which also remembers the failed
+// probes. Only the side to move, the pieces and, for the variants, the other
+// terms of the position key matter and the caller has checked that there is
+// neither a castling right nor a 50-move count.
+WDLScore Tablebases::probe_wdl(Position& pos, ProbeState* result, WDLCache& cache) {
+
+    WDLEntry* e = cache[pos.key()];
+    const uint32_t key32 = uint32_t(pos.key() >> 32);
+
+    if (e->key32 == key32 && e->generation == Generation)
+    {
+        *result = ProbeState(e->state);
+        return WDLScore(e->wdl);
+    }
+
+    WDLScore wdl = probe_wdl(pos, result);
+    *e = { key32, Generation, int8_t(wdl), int8_t(*result) };
+    return wdl;
+}
+
 // Probe the DTZ table for a particular position.
 // If *result != FAIL, the probe was successful.
 // The return value is from the point of view of the side to move:
@@ -21,6 +21,7 @@
 
 #include <ostream>
 
+#include "../misc.h"
 #include "../search.h"
 
 namespace Stockfish::Tablebases {
@@ -42,14 +43,36 @@ enum ProbeState {
     THREAT            =  3  // Threatening to force capture in giveaway
 };
 
+// Each thread caches the outcome of its WDL probes, keyed by the high bits of
+// the position key. Entries are tagged with the generation of the tables they
+// were read from, so that none survives a reload of the tables by init().
+struct WDLEntry {
+    uint32_t key32;
+    uint16_t generation;
+    int8_t   wdl;
+    int8_t   state;
+};
+
+using WDLCache = HashTable<WDLEntry>;
+
 extern int MaxCardinality;
+extern uint16_t Generation;
+
+// How a search probes the tables, as set up at its root by rank_root_moves()
+struct Config {
+    int cardinality = 0;
+    bool rootInTB = false;
+    bool useRule50 = true;
+    Depth probeDepth = 0;
+};
 
 void init(Variant v, const std::string& paths);
 WDLScore probe_wdl(Position& pos, ProbeState* result);
+WDLScore probe_wdl(Position& pos, ProbeState* result, WDLCache& cache);
 int probe_dtz(Position& pos, ProbeState* result);
 bool root_probe(Position& pos, Search::RootMoves& rootMoves);
 bool root_probe_wdl(Position& pos, Search::RootMoves& rootMoves);
-void rank_root_moves(Position& pos, Search::RootMoves& rootMoves);
+Config rank_root_moves(Position& pos, Search::RootMoves& rootMoves);
 
 inline std::ostream& operator<<(std::ostream& os, const WDLScore v) {
 
@@ -19,22 +19,38 @@
 #include <cassert>
 
 #include <algorithm> // For std::count
+#include <iostream>
 #include "movegen.h"
 #include "search.h"
 #include "thread.h"
 #include "uci.h"
 #include "syzygy/tbprobe.h"
 #include "tt.h"
+#include "nnue/evaluate_nnue.h"
 
 namespace Stockfish {
 
 ThreadPool Threads; // Global object
 
+namespace {
+
+  // If OS already scheduled us on a different group than 0 then don't overwrite
+  // the choice, eventually we are one of many one-threaded processes running on
+  // some Windows NUMA hardware, for instance in fishtest. To make it simple,
+  // just check if running threads are below a threshold, in this case all this
+  // NUMA machinery is not needed. The threads of the pools of the games of the
+  // "server" command are left to the OS, which spreads them over the cores.
+  bool binds_threads(const ThreadPool& pool) {
+    return &pool == &Threads && Options["Threads"] > 8;
+  }
+
+} // namespace
+
 
 /// Thread constructor launches the thread and waits until it goes to sleep
-/// in idle_loop(). Note that 'searching' and 'exit' should be already set.
+/// in idle_loop(). Note that 'pool', 'searching' and 'exit' should be already set.
 
-Thread::Thread(size_t n) : idx(n), stdThread(&Thread::idle_loop, this) {
+Thread::Thread(ThreadPool& p, size_t n) : pool(p), idx(n), stdThread(&Thread::idle_loop, this) {
 
   wait_for_search_finished();
 }
@@ -53,19 +69,54 @@ Thread::~Thread() {
 }
 
 
+/// Thread::operator new() allocates the threads on large pages, as most of their
+/// tens of MB are the histories and the NNUE accumulators, probed at every node.
+/// With bound threads, it is called from a thread bound to the node of the new
+/// thread, which commits or first touches the pages there, see set_threads().
+
+void* Thread::operator new(size_t size) {
+
+  void* mem = aligned_large_pages_alloc(size);
+  if (!mem)
+  {
+      std::cerr << "Failed to allocate " << size / 1024 << "KB for a search thread." << std::endl;
+      std::exit(EXIT_FAILURE);
+  }
+  return mem;
+}
+
+void Thread::operator delete(void* mem) {
+
+  aligned_large_pages_free(mem);
+}
+
+
 /// Thread::clear() reset histories, usually before a new game
 
 void Thread::clear() {
 
   counterMoves.fill(MOVE_NONE);
   mainHistory.fill(0);
+  dropHistory.fill(0);
   captureHistory.fill(0);
 
+  for (auto& to : dropContinuation)
+      for (auto& h : to)
+          h->fill(0);
+
   for (bool inCheck : { false, true })
       for (StatsType c : { NoCaptures, Captures })
           for (auto& to : continuationHistory[inCheck][c])
               for (auto& h : to)
                   h->fill(-71);
+
+  ttStats = {};
+
+#ifdef USE_NNUE
+  accumulatorCache.clear();
+  std::fill(std::begin(nnueUpdates), std::end(nnueUpdates), 0);
+  std::fill(std::begin(nnueRefreshes), std::end(nnueRefreshes), 0);
+#endif
 }
 
 
@@ -79,6 +130,17 @@ void Thread::start_searching() {
 }
 
 
+/// Thread::run_job() wakes up the thread to run the given function instead of
+/// a search. As for a search, wait_for_search_finished() waits for its end.
+
+void Thread::run_job(std::function<void()> f) {
+
+  wait_for_search_finished();
+  job = std::move(f);
+  start_searching();
+}
+
+
 /// Thread::wait_for_search_finished() blocks on the condition variable
 /// until the thread has finished searching.
 
@@ -94,13 +156,8 @@ void Thread::wait_for_search_finished() {
 
 void Thread::idle_loop() {
 
-  // If OS already scheduled us on a different group than 0 then don't overwrite
-  // the choice, eventually we are one of many one-threaded processes running on
-  // some Windows NUMA hardware, for instance in fishtest. To make it simple,
-  // just check if running threads are below a threshold, in this case all this
-  // NUMA machinery is not needed.
-  if (Options["Threads"] > 8)
-      WinProcGroup::bindThisThread(idx);
+  if (binds_threads(pool))
+      numaNode = WinProcGroup::bindThisThread(idx);
 
   while (true)
   {
@@ -114,16 +171,97 @@ void Thread::idle_loop() {
 
       lk.unlock();
 
+      if (job)
+      {
+          std::function<void()> f = std::move(job);
+          job = nullptr;
+          f();
+          continue;
+      }
+
+      pool.init_root(this);
+      alloc_tables(rootPos.variant());
       search();
+
+      if (this == pool.main() && pool.onSearchFinished)
+          pool.onSearchFinished();
   }
 }
 
-/// ThreadPool::set() creates/destroys threads to match the requested number.
-/// Created and launched threads will immediately go to sleep in idle_loop.
-/// Upon resizing, threads are recreated to allow for binding if necessary.
+
+/// Thread::alloc_tables() sizes the pawn, material and WDL cache tables of the
+/// thread as set by the options, for positions of the given variant. It is called by
+/// the thread itself before each search, so that no memory is spent on threads which
+/// never search, and only after any binding to a NUMA node. Evaluations outside of a
+/// search must call it too.
+
+void Thread::alloc_tables([[maybe_unused]] Variant v) {
+
+  size_t pawnHashKB = size_t(Options["Pawn Hash KB"]);
+#ifdef HORDE
+  // With up to 36 pawns on the board, horde has far more pawn structures
+  if (v == HORDE_VARIANT)
+      pawnHashKB = std::max(pawnHashKB, size_t(Options["Horde Pawn Hash KB"]));
+#endif
+
+  pawnsTable.resize(pawnHashKB * 1024);
+  materialTable.resize(size_t(Options["Material Hash KB"]) * 1024);
+  wdlCache.resize(size_t(Options["Syzygy Hash KB"]) * 1024);
+}
+
+/// Thread::check_networks() empties the refresh cache of the accumulators if the
+/// networks have changed since it was filled, as a new network may reuse the
+/// memory of an old one, by which the entries are keyed. Each thread checks its
+/// own cache before evaluating, as the networks may be loaded by the search of
+/// another pool meanwhile.
+
+void Thread::check_networks() {
+
+#ifdef USE_NNUE
+  const uint64_t version = Eval::NNUE::networksVersion;
+  if (networksVersion != version)
+  {
+      accumulatorCache.clear();
+      networksVersion = version;
+  }
+#endif
+}
+
+/// ThreadPool::set() creates/destroys threads to match the requested number, as
+/// set_threads() does, then sets up what depends on the threads of the UCI
+/// searches: the TT, the search parameters and the network replicas.
 
 void ThreadPool::set(size_t requested) {
 
+  set_threads(requested);
+
+  if (requested > 0)
+  {
+      // Reallocate the hash with the new threadpool size
+      TT.resize(size_t(Options["Hash"]));
+
+      for (Thread* th : threads)
+          th->ttSlice = TT.slice(ttIdx, ttSlices);
+
+      // Init thread number dependent search params.
+      Search::init();
+
+#ifdef USE_NNUE
+      // The threads may now be bound to other nodes
+      Eval::NNUE::replicate();
+#endif
+  }
+}
+
+
+/// ThreadPool::set_threads() creates/destroys threads to match the requested
+/// number. Created and launched threads will immediately go to sleep in
+/// idle_loop. Upon resizing, threads are recreated to allow for binding if
+/// necessary, a bound thread being allocated and constructed by a temporary
+/// thread bound to the same node. The pool must not be searching.
+
+void ThreadPool::set_threads(size_t requested) {
+
   if (threads.size() > 0)   // destroy any existing thread(s)
   {
       main()->wait_for_search_finished();
@@ -134,29 +272,45 @@ void ThreadPool::set(size_t requested) {
 
   if (requested > 0)   // create new thread(s)
   {
-      threads.push_back(new MainThread(0));
+      auto create = [&](size_t idx) -> Thread* {
+          return idx ? new Thread(*this, idx) : new MainThread(*this, 0);
+      };
 
       while (threads.size() < requested)
-          threads.push_back(new Thread(threads.size()));
-      clear();
+      {
+          size_t idx = threads.size();
+          Thread* th = nullptr;
 
-      // Reallocate the hash with the new threadpool size
-      TT.resize(size_t(Options["Hash"]));
+          if (binds_threads(*this))
+              std::thread([&] { WinProcGroup::bindThisThread(idx); th = create(idx); }).join();
+          else
+              th = create(idx);
 
-      // Init thread number dependent search params.
-      Search::init();
+          threads.push_back(th);
+      }
+      clear();
   }
 }
 
 
-/// ThreadPool::clear() sets threadPool data to initial values
+/// ThreadPool::clear() sets threadPool data to initial values. Each thread
+/// resets its own histories, all at the same time, which also first touches
+/// their pages on the NUMA node the thread is bound to. Without the histories,
+/// only the state kept by the main thread from the previous search is reset.
 
-void ThreadPool::clear() {
+void ThreadPool::clear(bool histories) {
 
-  for (Thread* th : threads)
-      th->clear();
+  if (histories)
+  {
+      for (Thread* th : threads)
+          th->run_job([th] { th->clear(); });
+
+      for (Thread* th : threads)
+          th->wait_for_search_finished();
+  }
 
   main()->callsCnt = 0;
+  main()->timer.stops = main()->timer.latencySum = main()->timer.latencyMax = 0;
   main()->bestPreviousScore = VALUE_INFINITE;
   main()->bestPreviousAverageScore = VALUE_INFINITE;
   main()->previousTimeReduction = 1.0;
@@ -167,23 +321,25 @@ void ThreadPool::clear() {
 /// returns immediately. Main thread will wake up other threads and start the search.
 
 void ThreadPool::start_thinking(Position& pos, StateListPtr& states,
-                                const Search::LimitsType& limits, bool ponderMode) {
+                                const Search::LimitsType& searchLimits, bool ponderMode) {
 
   main()->wait_for_search_finished();
 
   main()->stopOnPonderhit = stop = false;
   increaseDepth = true;
   main()->ponder = ponderMode;
-  Search::Limits = limits;
-  Search::RootMoves rootMoves;
+  limits = searchLimits;
+  tbConfig = {};
+  setupRootMoves.clear();
+  rootOrder.clear();
 
   for (const auto& m : MoveList<LEGAL>(pos))
       if (   limits.searchmoves.empty()
           || std::count(limits.searchmoves.begin(), limits.searchmoves.end(), m))
-          rootMoves.emplace_back(m);
+          setupRootMoves.emplace_back(m);
 
-  if (!rootMoves.empty())
-      Tablebases::rank_root_moves(pos, rootMoves);
+  if (!setupRootMoves.empty())
+      tbConfig = Tablebases::rank_root_moves(pos, setupRootMoves);
 
   // After ownership transfer 'states' becomes empty, so if we stop the search
   // and call 'go' again without setting a new position states.get() == nullptr.
@@ -192,31 +348,74 @@ void ThreadPool::start_thinking(Position& pos, StateListPtr& states,
   if (states.get())
       setupStates = std::move(states); // Ownership transfer, states is now empty
 
-  // We use Position::set() to set root position across threads. But there are
-  // some StateInfo fields (previous, pliesFromNull, capturedPiece) that cannot
-  // be deduced from a fen string, so set() clears them and they are set from
-  // setupStates->back() later. The rootState is per thread, earlier states are shared
-  // since they are read-only.
+  // The threads copy the root position and the root moves as they start
+  // searching, see init_root(). The position may not outlive this call, so it
+  // is copied first, with its current state. The earlier states, linked from
+  // setupStates->back(), are shared since they are read-only.
+  setupPos.clone(pos, &setupState, nullptr);
+
+  // In a bughouse session, the last "Partner Threads" threads search the board
+  // of the partner meanwhile, sharing the TT and the networks with the others,
+  // see Thread::partner_search(). The board is copied without its earlier
+  // states, as its moves may be replaced by the "partner" command while searching.
+  size_t partnerThreads = 0;
+#ifdef BUGHOUSE
+  if (   partnerBoard
+      && !limits.perft && !limits.datagen && !limits.spsa && limits.analyseFile.empty())
+  {
+      partnerThreads = std::min(size_t(Options["Partner Threads"]), threads.size() - 1);
+      partnerPos.clone(*partnerBoard, &partnerState, nullptr);
+      partnerState.previous = nullptr;
+      partnerState.pliesFromNull = 0;
+  }
+#endif
+
+  // The threads probe the slice of the TT of the pool, in a new generation
+  TT.new_search(ttIdx);
+
   for (Thread* th : threads)
   {
       th->nodes = th->tbHits = th->nmpMinPly = th->bestMoveChanges = 0;
       th->rootDepth = th->completedDepth = 0;
-      th->rootMoves = rootMoves;
-      th->rootPos.set(pos.fen(), pos.is_chess960(), pos.subvariant(), &th->rootState, th);
-      th->rootState = setupStates->back();
+      th->onPartnerBoard = th->id() >= threads.size() - partnerThreads;
+      th->ttSlice = TT.slice(ttIdx, ttSlices);
   }
 
   main()->start_searching();
 }
 
+
+/// ThreadPool::init_root() sets the root position and the root moves of the given
+/// thread to those of the search started by start_thinking(). It is called by each
+/// thread as it starts searching, all the threads setting up their roots in parallel.
+
+void ThreadPool::init_root(Thread* th) const {
+
+  if (th->onPartnerBoard)
+  {
+      th->rootMoves.clear();
+      th->rootPos.clone(partnerPos, &th->rootState, th);
+      return;
+  }
+
+  th->rootMoves = setupRootMoves;
+  th->rootPos.clone(setupPos, &th->rootState, th);
+}
+
 Thread* ThreadPool::get_best_thread() const {
 
     Thread* bestThread = threads.front();
     std::map<Move, int64_t> votes;
     Value minScore = VALUE_NONE;
 
+    // The threads on the partner board search another position
+    std::vector<Thread*> board;
+    for (Thread* th : threads)
+        if (!th->onPartnerBoard)
+            board.push_back(th);
+
     // Find minimum score of all threads
-    for (Thread* th: threads)
+    for (Thread* th: board)
         minScore = std::min(minScore, th->rootMoves[0].score);
 
     // Vote according to score and depth, and select the best thread
@@ -224,10 +423,10 @@ Thread* ThreadPool::get_best_thread() const {
             return (th->rootMoves[0].score - minScore + 14) * int(th->completedDepth);
         };
 
-    for (Thread* th : threads)
+    for (Thread* th : board)
         votes[th->rootMoves[0].pv[0]] += thread_value(th);
 
-    for (Thread* th : threads)
+    for (Thread* th : board)
         if (abs(bestThread->rootMoves[0].score) >= VALUE_TB_WIN_IN_MAX_PLY)
         {
             // Make sure we pick the shortest mate / TB conversion or stave off mate the longest
@@ -20,20 +20,30 @@
 #define THREAD_H_INCLUDED
 
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <functional>
 #include <mutex>
 #include <thread>
 #include <vector>
 
+#include "cluster.h"
+#include "evaluate.h"
 #include "material.h"
 #include "movepick.h"
 #include "pawns.h"
 #include "position.h"
 #include "search.h"
+#include "syzygy/tbprobe.h"
 #include "thread_win32_osx.h"
+#include "timeman.h"
+#include "tt.h"
 
 namespace Stockfish {
 
+struct MainThread;
+struct ThreadPool;
+
 /// Thread class keeps together all the thread-related stuff. We use
 /// per-thread pawn and material hash tables so that once we get a
 /// pointer to an entry its life time is unlimited and we don't have
@@ -41,26 +51,49 @@ namespace Stockfish {
 
 class Thread {
 
+public:
+  ThreadPool& pool; // The pool of the thread, whose searches it takes part in
+
+private:
   std::mutex mutex;
   std::condition_variable cv;
   size_t idx;
   bool exit = false, searching = true; // Set before starting std::thread
+  std::function<void()> job; // Run instead of a search, see run_job()
   NativeThread stdThread;
 
+  void iterative_deepening();
+  void own_search(const MoveList<LEGAL>& moves);
+  void self_play();
+  void spsa_move();
+  void analyse();
+  void partner_search();
+
 public:
-  explicit Thread(size_t);
+  Thread(ThreadPool& p, size_t n);
   virtual ~Thread();
+  static void* operator new(size_t size);
+  static void operator delete(void* mem);
   virtual void search();
   void clear();
   void idle_loop();
+  void alloc_tables(Variant v);
+  void check_networks();
   void start_searching();
+  void run_job(std::function<void()> f);
   void wait_for_search_finished();
   size_t id() const { return idx; }
+  void check_own_limits();
 
+  int numaNode = -1; // Node the thread is bound to, or -1
   Pawns::Table pawnsTable;
   Material::Table materialTable;
   size_t pvIdx, pvLast;
   std::atomic<uint64_t> nodes, tbHits, bestMoveChanges;
+  bool ownSearch = false, ownStop = false; // Searching a position of its own, see own_search()
+  bool onPartnerBoard = false; // Searching the board of the partner, see ThreadPool::start_thinking()
+  int ownCallsCnt;
+  TimePoint ownStartTime;
   int selDepth, nmpMinPly;
   Value bestValue, optimism[COLOR_NB];
 
@@ -71,8 +104,46 @@ public:
   Value rootDelta;
   CounterMoveHistory counterMoves;
   ButterflyHistory mainHistory;
+  DropHistory dropHistory;
+  DropContinuationHistory dropContinuation;
   CapturePieceToHistory captureHistory;
   ContinuationHistory continuationHistory[2][2];
+  TranspositionTable::Slice ttSlice; // Of the pool, see ThreadPool::start_thinking()
+  TTStats ttStats;
+  Tablebases::WDLCache wdlCache;
+  Cluster::Outbox clusterOutbox;
+#ifdef USE_NNUE
+  Eval::NNUE::AccumulatorCache accumulatorCache;
+  Eval::NNUE::AccumulatorStack accumulatorStack;
+  uint64_t nnueUpdates[VARIANT_NB], nnueRefreshes[VARIANT_NB];
+  uint64_t networksVersion = 0; // Of the networks of the refresh cache
+#endif
+};
+
+
+/// SearchTimer is the thread which stops the search of the main thread at its
+/// deadline, sleeping until then, so that the time is not polled by the search.
+/// It also runs the periodic tasks of the search. The latency of its stops, from
+/// the deadline to the end of the search, is measured in microseconds.
+
+class SearchTimer {
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool done, woken;
+  std::chrono::steady_clock::time_point deadline; // Of its last stop, or the epoch
+  MainThread* mainThread; // Whose search is timed
+  std::thread thread;
+
+  void loop();
+
+public:
+  void start(MainThread* th);
+  void stop();
+  void wake();
+
+  uint64_t stops = 0;
+  int64_t latencySum = 0, latencyMax = 0;
 };
 
 
@@ -83,36 +154,60 @@ struct MainThread : public Thread {
   using Thread::Thread;
 
   void search() override;
-  void check_time();
+  void generate_data();
+  void analyse_file();
+  void check_nodes();
+  void ponderhit();
+  void send_pv(const Position& pos, Depth depth, bool force);
 
   double previousTimeReduction;
   Value bestPreviousScore;
   Value bestPreviousAverageScore;
   Value iterValue[4];
   int callsCnt;
-  bool stopOnPonderhit;
+  std::atomic_bool stopOnPonderhit;
   std::atomic_bool ponder;
+  SearchTimer timer;
+  std::string syncPrefix; // Prefix of the output lines of the search, see sync_prefix()
+  std::string pvBuffer; // Info lines being sent, reused by send_pv()
+  std::vector<Key> pvSent; // Signatures of the lines last sent, by MultiPV index
+  TimePoint pvInterval, lastPvTime;
+  bool pvPending; // Updates held back by the option "PV Interval"
 };
 
 
 /// ThreadPool struct handles all the threads-related stuff like init, starting,
 /// parking and, most importantly, launching a thread. All the access to threads
-/// is done through this class.
+/// is done through this class. The pool holds the state of its search, so that
+/// the games of the "server" command search at the same time, each with a pool
+/// of its own probing a slice of the TT, while Threads runs the UCI searches.
 
 struct ThreadPool {
 
   void start_thinking(Position&, StateListPtr&, const Search::LimitsType&, bool = false);
-  void clear();
+  void init_root(Thread* th) const;
+  void clear(bool histories = true);
   void set(size_t);
+  void set_threads(size_t);
 
   MainThread* main()        const { return static_cast<MainThread*>(threads.front()); }
   uint64_t nodes_searched() const { return accumulate(&Thread::nodes); }
   uint64_t tb_hits()        const { return accumulate(&Thread::tbHits); }
+  TimePoint elapsed()       const { return limits.npmsec ? TimePoint(nodes_searched()) : time.elapsed(); }
   Thread* get_best_thread() const;
   void start_searching();
   void wait_for_search_finished() const;
 
   std::atomic_bool stop, increaseDepth;
+  const Position* partnerBoard = nullptr; // Of the "partner" command, in a bughouse session
+  Search::LimitsType limits;
+  TimeManagement time;
+  Tablebases::Config tbConfig;
+  size_t ttIdx = 0, ttSlices = 1; // The slice of the TT probed by the threads
+  bool useBreadcrumbs, splitMultiPV; // Options "SMP Breadcrumbs" and "SMP MultiPV Split"
+  std::mutex rootOrderMutex;
+  std::vector<Move> rootOrder; // Of the root moves of the main thread, for the MultiPV split
+  std::function<void()> onSearchFinished; // Called by the main thread after each search
 
   auto cbegin() const noexcept { return threads.cbegin(); }
   auto begin() noexcept { return threads.begin(); }
@@ -123,13 +218,19 @@ struct ThreadPool {
 
 private:
   StateListPtr setupStates;
+  Position setupPos;
+  StateInfo setupState;
+  Search::RootMoves setupRootMoves;
+  Position partnerPos;
+  StateInfo partnerState;
   std::vector<Thread*> threads;
 
   uint64_t accumulate(std::atomic<uint64_t> Thread::* member) const {
 
     uint64_t sum = 0;
     for (Thread* th : threads)
-        sum += (th->*member).load(std::memory_order_relaxed);
+        if (!th->onPartnerBoard)
+            sum += (th->*member).load(std::memory_order_relaxed);
     return sum;
   }
 };
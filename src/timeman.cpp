@@ -20,48 +20,49 @@
 #include <cfloat>
 #include <cmath>
 
+#include "misc.h"
 #include "search.h"
 #include "timeman.h"
 #include "uci.h"
 
 namespace Stockfish {
 
-TimeManagement Time; // Our global time management object
-
-constexpr int MoveHorizon[VARIANT_NB] = { // Plan time management at most this many moves ahead
-  50,
+// The time profiles of the variants, by default those of chess but for the move
+// horizon, shorter in the variants with short games.
+TimeProfile TimeProfiles[VARIANT_NB] = {
+  { 50 },
 #ifdef ANTI
-  29,
+  { 29 },
 #endif
 #ifdef ATOMIC
-  29,
+  { 29 },
 #endif
 #ifdef CRAZYHOUSE
-  50,
+  { 50 },
 #endif
 #ifdef EXTINCTION
-  50,
+  { 50 },
 #endif
 #ifdef GRID
-  50,
+  { 50 },
 #endif
 #ifdef HORDE
-  50,
+  { 50 },
 #endif
 #ifdef KOTH
-  50,
+  { 50 },
 #endif
 #ifdef LOSERS
-  50,
+  { 50 },
 #endif
 #ifdef RACE
-  20,
+  { 20 },
 #endif
 #ifdef THREECHECK
-  50,
+  { 50 },
 #endif
 #ifdef TWOKINGS
-  50,
+  { 50 },
 #endif
 };
 
@@ -72,13 +73,15 @@ constexpr int MoveHorizon[VARIANT_NB] = { // Plan time management at most this m
 
 void TimeManagement::init(Variant var, Search::LimitsType& limits, Color us, int ply) {
 
+  const TimeProfile& tp = TimeProfiles[main_variant(var)];
+
   // if we have no time, no need to initialize TM, except for the start time,
   // which is used by movetime.
   startTime = limits.startTime;
   if (limits.time[us] == 0)
       return;
 
-  TimePoint moveOverhead    = TimePoint(Options["Move Overhead"]);
+  TimePoint moveOverhead    = move_overhead(limits, us, ply);
   TimePoint slowMover       = TimePoint(Options["Slow Mover"]);
   TimePoint npmsec          = TimePoint(Options["nodestime"]);
 
@@ -102,7 +105,7 @@ void TimeManagement::init(Variant var, Search::LimitsType& limits, Color us, int
   }
 
   // Maximum move horizon of 50 moves
-  int mtg = limits.movestogo ? std::min(limits.movestogo, MoveHorizon[var]) : MoveHorizon[var];
+  int mtg = limits.movestogo ? std::min(limits.movestogo, tp.horizon) : tp.horizon;
 
   // Make sure timeLeft is > 0 since we may use it as a divisor
   TimePoint timeLeft =  std::max(TimePoint(1),
@@ -120,18 +123,18 @@ void TimeManagement::init(Variant var, Search::LimitsType& limits, Color us, int
   // game time for the current move, so also cap to 20% of available game time.
   if (limits.movestogo == 0)
   {
-      optScale = std::min(0.0120 + std::pow(ply + 3.0, 0.45) * 0.0039,
+      optScale = std::min(tp.optBase / 10000.0 + std::pow(ply + 3.0, tp.optExponent / 100.0) * (tp.optPly / 10000.0),
                            0.2 * limits.time[us] / double(timeLeft))
                  * optExtra;
-      maxScale = std::min(7.0, 4.0 + ply / 12.0);
+      maxScale = std::min(tp.maxCap / 10.0, tp.maxBase / 10.0 + ply / double(tp.maxPlies));
   }
 
   // x moves in y seconds (+ z increment)
   else
   {
-      optScale = std::min((0.88 + ply / 116.4) / mtg,
+      optScale = std::min((tp.mtgOpt / 100.0 + ply / (tp.mtgPlies / 10.0)) / mtg,
                             0.88 * limits.time[us] / double(timeLeft));
-      maxScale = std::min(6.3, 1.5 + 0.11 * mtg);
+      maxScale = std::min(tp.mtgMaxCap / 10.0, tp.mtgMaxBase / 10.0 + tp.mtgMaxSlope / 100.0 * mtg);
   }
 
   // Never use more than 80% of the available time for this move
@@ -142,4 +145,70 @@ void TimeManagement::init(Variant var, Search::LimitsType& limits, Color us, int
       optimumTime += optimumTime / 4;
 }
 
+
+/// TimeManagement::move_played() is called once the best move of a search is
+/// sent, to record the time of the clock before the move and the time used to
+/// play it, from the receipt of "go" to the flush of "bestmove".
+
+void TimeManagement::move_played(const Search::LimitsType& limits, Color us, int ply) {
+
+  if (!limits.time[us] || limits.npmsec)
+  {
+      lastMove[us].ply = -1;
+      return;
+  }
+
+  lastMove[us] = { ply, limits.time[us], limits.inc[us], now() - limits.startTime, limits.movestogo };
+}
+
+
+/// TimeManagement::move_overhead() returns the time to reserve per move for the
+/// delays which are out of the clock of the engine, such as the transmission of
+/// the moves. On the next move of a game, the time the GUI reports is compared
+/// to the one expected from the time the engine measured, and the difference,
+/// the lag of the move, is recorded. With the option "Adaptive Move Overhead",
+/// the overhead is based on the lags of the last moves rather than the fixed
+/// "Move Overhead", so that fast links waste no time and slow ones do not flag.
+
+TimePoint TimeManagement::move_overhead(const Search::LimitsType& limits, Color us, int ply) {
+
+  TimePoint fixed = TimePoint(Options["Move Overhead"]);
+
+  // The clock of the previous move of the game, unless the time control added
+  // time since, in which case the lag is not known.
+  const LastMove& last = lastMove[us];
+
+  if (   last.ply + 2 == ply
+      && last.movestogo != 1
+      && !limits.npmsec)
+  {
+      TimePoint lag = last.time - last.used + last.inc - limits.time[us];
+
+      if (lag > -50 && lag < 10000)
+          lags[lagsMeasured++ % LagCount] = std::max(lag, TimePoint(0));
+  }
+  lastMove[us].ply = -1;
+
+  if (!Options["Adaptive Move Overhead"] || lagsMeasured < 4)
+      return fixed;
+
+  size_t n = std::min(lagsMeasured, LagCount);
+  TimePoint sorted[LagCount];
+  std::copy(lags, lags + n, sorted);
+  std::sort(sorted, sorted + n);
+
+  // Reserve the 90th percentile of the lags, with a margin
+  TimePoint p90 = sorted[(n - 1) * 9 / 10];
+  TimePoint overhead = p90 + p90 / 4 + 5;
+
+  // Reported only when it changes, not at every move
+  if (overhead != lastOverhead)
+      sync_cout << "info string Move Overhead " << overhead << " ms, lags of the last " << n
+                << " moves: median " << sorted[n / 2] << ", 90% " << p90
+                << ", max " << sorted[n - 1] << " ms" << sync_endl;
+  lastOverhead = overhead;
+
+  return overhead;
+}
+
 } // namespace Stockfish
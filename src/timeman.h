@@ -21,30 +21,72 @@
 
 #include "misc.h"
 #include "search.h"
-#include "thread.h"
 
 namespace Stockfish {
 
+/// TimeProfile holds the parameters of the time management of a variant, for
+/// the allocation of the time to the moves and for its use by the search. They
+/// are integers, scaled as commented, so that they can be tuned with tune.h, as
+/// in TUNE(TimeProfiles[CRAZYHOUSE_VARIANT].maxCap). The defaults are the ones
+/// tuned for chess.
+
+struct TimeProfile {
+  int horizon;                // Plan at most this many moves ahead
+  int optBase       = 120;    // Share of the time for a move, x 1/10000, ...
+  int optPly        = 39;     // ... plus this times (ply + 3) ^ optExponent
+  int optExponent   = 45;     // x 1/100
+  int maxBase       = 40;     // Maximum over optimum time, x 1/10, plus ...
+  int maxPlies      = 12;     // ... one per this many plies ...
+  int maxCap        = 70;     // ... up to this, x 1/10
+  int mtgOpt        = 88;     // With moves to go, share of the time per move, x 1/100, ...
+  int mtgPlies      = 1164;   // ... plus one per this many plies, x 1/10
+  int mtgMaxBase    = 15;     // Maximum over optimum time, x 1/10, ...
+  int mtgMaxSlope   = 11;     // ... plus this per move to go, x 1/100, ...
+  int mtgMaxCap     = 63;     // ... up to this, x 1/10
+  int fallingBase   = 69;     // Falling eval of the search: this, ...
+  int fallingAvg    = 13;     // ... plus this times the drop from the average score, ...
+  int fallingIter   = 6;      // ... plus this times the drop from an earlier iteration, ...
+  int fallingDiv    = 6196;   // ... over this, x 1/10
+  int stableFactor  = 157;    // Time reduction with a stable best move, x 1/100
+  int changeFactor  = 65;     // Time reduction otherwise, x 1/100
+  int instability   = 18;     // Time increase per best move change and thread, x 1/10
+};
+
+extern TimeProfile TimeProfiles[VARIANT_NB];
+
 /// The TimeManagement class computes the optimal time to think depending on
 /// the maximum available time, the game move number and other parameters.
 
 class TimeManagement {
 public:
   void init(Variant var, Search::LimitsType& limits, Color us, int ply);
+  void move_played(const Search::LimitsType& limits, Color us, int ply);
   TimePoint optimum() const { return optimumTime; }
   TimePoint maximum() const { return maximumTime; }
-  TimePoint elapsed() const { return Search::Limits.npmsec ?
-                                     TimePoint(Threads.nodes_searched()) : now() - startTime; }
+  TimePoint elapsed() const { return now() - startTime; } // See ThreadPool::elapsed()
 
   int64_t availableNodes; // When in 'nodes as time' mode
 
 private:
+  TimePoint move_overhead(const Search::LimitsType& limits, Color us, int ply);
+
   TimePoint startTime;
   TimePoint optimumTime;
   TimePoint maximumTime;
-};
 
-extern TimeManagement Time;
+  // The clock at the last move of each side, and the lags measured from it,
+  // see move_overhead()
+  struct LastMove {
+    int ply = -1;
+    TimePoint time, inc, used;
+    int movestogo;
+  } lastMove[COLOR_NB];
+
+  static constexpr size_t LagCount = 32;
+  TimePoint lags[LagCount];
+  size_t lagsMeasured = 0;
+  TimePoint lastOverhead = -1; // The adaptive overhead last reported
+};
 
 } // namespace Stockfish
 
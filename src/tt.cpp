@@ -17,6 +17,7 @@
 */
 
 #include <cstring>   // For std::memset
+#include <fstream>
 #include <iostream>
 #include <thread>
 
@@ -33,23 +34,23 @@ TranspositionTable TT; // Our global transposition table
 /// TTEntry::save() populates the TTEntry with a new node's data, possibly
 /// overwriting an old position. Update is not atomic and can be racy.
 
-void TTEntry::save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev) {
+void TTEntry::save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev, uint8_t generation8) {
 
   // Preserve any existing move for the same position
-  if (m || (uint16_t)k != key16)
+  if (m || (TTKey)k != keyBits)
       move16 = (uint16_t)m;
 
   // Overwrite less valuable entries (cheapest checks first)
   if (   b == BOUND_EXACT
-      || (uint16_t)k != key16
+      || (TTKey)k != keyBits
       || d - DEPTH_OFFSET + 2 * pv > depth8 - 4)
   {
       assert(d > DEPTH_OFFSET);
       assert(d < 256 + DEPTH_OFFSET);
 
-      key16     = (uint16_t)k;
+      keyBits   = (TTKey)k;
       depth8    = (uint8_t)(d - DEPTH_OFFSET);
-      genBound8 = (uint8_t)(TT.generation8 | uint8_t(pv) << 2 | b);
+      genBound8 = (uint8_t)(generation8 | uint8_t(pv) << 2 | b);
       value16   = (int16_t)v;
       eval16    = (int16_t)ev;
   }
@@ -59,15 +60,31 @@ void TTEntry::save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev)
 /// TranspositionTable::resize() sets the size of the transposition table,
 /// measured in megabytes. Transposition table consists of a power of 2 number
 /// of clusters and each cluster consists of ClusterSize number of TTEntry.
+/// If option SharedHash names a segment, the table is mapped from it instead,
+/// so that all the engine processes using the same name and size share it.
 
 void TranspositionTable::resize(size_t mbSize) {
 
   Threads.main()->wait_for_search_finished();
 
-  aligned_large_pages_free(table);
+  free_table();
 
   clusterCount = mbSize * 1024 * 1024 / sizeof(Cluster);
 
+  const std::string name = Options["SharedHash"];
+  if (!name.empty() && name != "<empty>")
+  {
+      table = static_cast<Cluster*>(shared_memory_alloc(name, clusterCount * sizeof(Cluster)));
+      if (table)
+      {
+          shared = true;
+          return; // Zero filled when created, otherwise already in use
+      }
+
+      sync_cout << "info string Unable to map shared hash " << name
+                << " of " << mbSize << "MB, using a private table" << sync_endl;
+  }
+
   table = static_cast<Cluster*>(aligned_large_pages_alloc(clusterCount * sizeof(Cluster)));
   if (!table)
   {
@@ -80,11 +97,56 @@ void TranspositionTable::resize(size_t mbSize) {
 }
 
 
+/// TranspositionTable::free_table() releases the table, whatever its origin
+
+void TranspositionTable::free_table() {
+
+  if (shared)
+      shared_memory_free(table, clusterCount * sizeof(Cluster));
+  else
+      aligned_large_pages_free(table);
+
+  table = nullptr;
+  shared = false;
+}
+
+
+/// TranspositionTable::slice() returns the idx-th of the given number of equal
+/// parts of the table, so that the games hosted by the "server" command, each
+/// searching with a thread pool of its own, do not overwrite each other's
+/// entries, nor age them with their searches. Its generation is the one of the
+/// last new_search() of the index. slice(0, 1) is the whole table, searched by
+/// the UCI searches. A slice is valid until resize() or the next new_search().
+
+TranspositionTable::Slice TranspositionTable::slice(size_t idx, size_t slices) const {
+
+  assert(idx < slices && slices <= MaxSlices);
+
+  const size_t len = clusterCount / slices;
+  return { table + idx * len, len, generations[idx] };
+}
+
+
+/// TranspositionTable::clear_slice() zeroes a part of the table, see slice()
+
+void TranspositionTable::clear_slice(size_t idx, size_t slices) {
+
+  assert(idx < slices);
+
+  const size_t len = clusterCount / slices;
+  std::memset(&table[idx * len], 0, len * sizeof(Cluster));
+}
+
+
 /// TranspositionTable::clear() initializes the entire transposition table to zero,
-//  in a multi-threaded way.
+//  in a multi-threaded way. A shared table is left alone, as other processes
+//  may be using its entries.
 
 void TranspositionTable::clear() {
 
+  if (shared)
+      return;
+
   std::vector<std::thread> threads;
 
   for (size_t idx = 0; idx < size_t(Options["Threads"]); ++idx)
@@ -107,6 +169,130 @@ void TranspositionTable::clear() {
 
   for (std::thread& th : threads)
       th.join();
+
+  // Warm start from the file of option HashFile, if any
+  const std::string filename = Options["HashFile"];
+  if (!filename.empty() && filename != "<empty>")
+      load(filename, UCI::variant_from_name(Options["UCI_Variant"]));
+}
+
+
+/// The header of a hash file, written before the clusters. These start on a page
+/// boundary so that the file can also be mapped directly.
+
+namespace {
+
+  constexpr char HashFileMagic[8] = "SFHASH";
+  constexpr std::uint32_t HashFileVersion = 1;
+  constexpr std::size_t HashFileAlignment = 4096;
+
+  struct HashFileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t variant;
+    std::uint64_t clusterCount;
+    std::uint32_t clusterSize;
+    std::uint32_t generation;
+    char engine[64];
+  };
+
+  static_assert(sizeof(HashFileHeader) <= HashFileAlignment);
+
+  // Large tables are streamed in chunks
+  constexpr std::size_t HashFileChunk = 64 * 1024 * 1024;
+
+} // namespace
+
+
+/// TranspositionTable::save() writes the table to a file, tagged with the
+/// engine version and the main variant it was filled with.
+
+bool TranspositionTable::save(const std::string& filename, Variant v) const {
+
+  Threads.main()->wait_for_search_finished();
+
+  HashFileHeader header = {};
+  std::memcpy(header.magic, HashFileMagic, sizeof(HashFileMagic));
+  header.version = HashFileVersion;
+  header.variant = std::uint32_t(main_variant(v));
+  header.clusterCount = clusterCount;
+  header.clusterSize = sizeof(Cluster);
+  header.generation = generations[0];
+  std::strncpy(header.engine, engine_info().c_str(), sizeof(header.engine) - 1);
+
+  std::ofstream stream(filename, std::ios::binary);
+  char padding[HashFileAlignment] = {};
+  std::memcpy(padding, &header, sizeof(header));
+  stream.write(padding, HashFileAlignment);
+
+  const char* data = reinterpret_cast<const char*>(table);
+  const std::size_t size = clusterCount * sizeof(Cluster);
+  for (std::size_t pos = 0; pos < size && stream; pos += HashFileChunk)
+      stream.write(data + pos, std::streamsize(std::min(HashFileChunk, size - pos)));
+
+  return bool(stream);
+}
+
+
+/// TranspositionTable::load() reads a table written by save() for the same
+/// main variant, whose positions share their keys with its subvariants, and
+/// the same Hash size. The generation is rebased to the saved one, so that
+/// the loaded entries keep their relative age.
+
+bool TranspositionTable::load(const std::string& filename, Variant v) {
+
+  Threads.main()->wait_for_search_finished();
+
+  std::ifstream stream(filename, std::ios::binary);
+  char padding[HashFileAlignment];
+  HashFileHeader header;
+
+  if (!stream.read(padding, HashFileAlignment))
+      return false;
+
+  std::memcpy(&header, padding, sizeof(header));
+  header.engine[sizeof(header.engine) - 1] = '\0';
+
+  if (   std::memcmp(header.magic, HashFileMagic, sizeof(HashFileMagic))
+      || header.version != HashFileVersion
+      || header.clusterSize != sizeof(Cluster))
+  {
+      sync_cout << "info string " << filename << " is not a hash file of this engine" << sync_endl;
+      return false;
+  }
+
+  if (header.variant != std::uint32_t(main_variant(v)))
+  {
+      sync_cout << "info string " << filename << " holds a hash of variant "
+                << (header.variant < VARIANT_NB ? variants[header.variant] : "?") << sync_endl;
+      return false;
+  }
+
+  if (header.clusterCount != clusterCount)
+  {
+      sync_cout << "info string " << filename << " holds a hash of "
+                << header.clusterCount * sizeof(Cluster) / (1024 * 1024) << "MB" << sync_endl;
+      return false;
+  }
+
+  if (engine_info().compare(0, sizeof(header.engine) - 1, header.engine))
+      sync_cout << "info string " << filename << " was saved by " << header.engine << sync_endl;
+
+  char* data = reinterpret_cast<char*>(table);
+  const std::size_t size = clusterCount * sizeof(Cluster);
+  for (std::size_t pos = 0; pos < size && stream; pos += HashFileChunk)
+      stream.read(data + pos, std::streamsize(std::min(HashFileChunk, size - pos)));
+
+  generations[0] = uint8_t(header.generation);
+
+  if (!stream)
+  {
+      sync_cout << "info string " << filename << " is truncated" << sync_endl;
+      std::memset(table, 0, size);
+      return false;
+  }
+
+  return true;
 }
 
 
@@ -117,17 +303,21 @@ void TranspositionTable::clear() {
 /// minus 8 times its relative age. TTEntry t1 is considered more valuable than
 /// TTEntry t2 if its replace value is greater than that of t2.
 
-TTEntry* TranspositionTable::probe(const Key key, bool& found) const {
+TTEntry* TranspositionTable::probe(const Slice& s, const Key key, bool& found, TTStats& stats) const {
 
-  TTEntry* const tte = first_entry(key);
-  const uint16_t key16 = (uint16_t)key;  // Use the low 16 bits as key inside the cluster
+  TTEntry* const tte = first_entry(s, key);
+  const TTKey keyBits = (TTKey)key;  // Use the low bits as key inside the cluster
+
+  ++stats.probes;
 
   for (int i = 0; i < ClusterSize; ++i)
-      if (tte[i].key16 == key16 || !tte[i].depth8)
+      if (tte[i].keyBits == keyBits || !tte[i].depth8)
       {
-          tte[i].genBound8 = uint8_t(generation8 | (tte[i].genBound8 & (GENERATION_DELTA - 1))); // Refresh
+          tte[i].genBound8 = uint8_t(s.generation8 | (tte[i].genBound8 & (GENERATION_DELTA - 1))); // Refresh
 
-          return found = (bool)tte[i].depth8, &tte[i];
+          found = (bool)tte[i].depth8;
+          ++(found ? stats.hits : stats.emptyFills);
+          return &tte[i];
       }
 
   // Find an entry to be replaced according to the replacement strategy
@@ -138,25 +328,64 @@ TTEntry* TranspositionTable::probe(const Key key, bool& found) const {
       // is needed to keep the unrelated lowest n bits from affecting
       // the result) to calculate the entry age correctly even after
       // generation8 overflows into the next cycle.
-      if (  replace->depth8 - ((GENERATION_CYCLE + generation8 - replace->genBound8) & GENERATION_MASK)
-          >   tte[i].depth8 - ((GENERATION_CYCLE + generation8 -   tte[i].genBound8) & GENERATION_MASK))
+      if (  replace->depth8 - ((GENERATION_CYCLE + s.generation8 - replace->genBound8) & GENERATION_MASK)
+          >   tte[i].depth8 - ((GENERATION_CYCLE + s.generation8 -   tte[i].genBound8) & GENERATION_MASK))
           replace = &tte[i];
 
+  ++((replace->genBound8 & GENERATION_MASK) == s.generation8 ? stats.depthReplacements
+                                                            : stats.agedReplacements);
+  stats.pvEvictions += replace->is_pv();
+
   return found = false, replace;
 }
 
 
 /// TranspositionTable::hashfull() returns an approximation of the hashtable
-/// occupation during a search. The hash is x permill full, as per UCI protocol.
+/// occupation of a slice during a search. The hash is x permill full, as per UCI protocol.
 
-int TranspositionTable::hashfull() const {
+int TranspositionTable::hashfull(const Slice& s) const {
+
+  const int samples = int(std::min(s.clusters, size_t(1000)));
 
   int cnt = 0;
-  for (int i = 0; i < 1000; ++i)
+  for (int i = 0; i < samples; ++i)
       for (int j = 0; j < ClusterSize; ++j)
-          cnt += table[i].entry[j].depth8 && (table[i].entry[j].genBound8 & GENERATION_MASK) == generation8;
+          cnt += s.table[i].entry[j].depth8 && (s.table[i].entry[j].genBound8 & GENERATION_MASK) == s.generation8;
+
+  return cnt * 1000 / (samples * ClusterSize);
+}
+
+
+/// TranspositionTable::stats() sums up the TTStats of all threads, reporting
+/// the replacements and evictions relative to the misses of full clusters.
+
+std::string TranspositionTable::stats() const {
+
+  TTStats s = {};
+  for (Thread* th : Threads)
+  {
+      s.probes            += th->ttStats.probes;
+      s.hits              += th->ttStats.hits;
+      s.falseMatches      += th->ttStats.falseMatches;
+      s.emptyFills        += th->ttStats.emptyFills;
+      s.depthReplacements += th->ttStats.depthReplacements;
+      s.agedReplacements  += th->ttStats.agedReplacements;
+      s.pvEvictions       += th->ttStats.pvEvictions;
+  }
 
-  return cnt / ClusterSize;
+  const uint64_t replacements = s.depthReplacements + s.agedReplacements;
+  auto percent = [](uint64_t n, uint64_t total) {
+      return std::to_string(total ? 100 * n / total : 0) + "%";
+  };
+
+  return "TT probes " + std::to_string(s.probes)
+       + ", hits " + percent(s.hits, s.probes)
+       + ", false matches " + std::to_string(s.falseMatches)
+       + ", empty fills " + percent(s.emptyFills, s.probes)
+       + ", replacements " + percent(replacements, s.probes)
+       + " (depth " + percent(s.depthReplacements, replacements)
+       + ", aged " + percent(s.agedReplacements, replacements)
+       + ", PV " + percent(s.pvEvictions, replacements) + ")";
 }
 
 } // namespace Stockfish
@@ -24,7 +24,8 @@
 
 namespace Stockfish {
 
-/// TTEntry struct is the 10 bytes transposition table entry, defined as below:
+/// TTEntry struct is the 10 bytes transposition table entry, defined as below
+/// (12 bytes with a 32 bit key in the 64 bytes cluster layout, see TT_CLUSTER_64):
 ///
 /// key        16 bit
 /// depth       8 bit
@@ -35,6 +36,12 @@ namespace Stockfish {
 /// value      16 bit
 /// eval value 16 bit
 
+#if defined(TT_CLUSTER_64)
+using TTKey = uint32_t;
+#else
+using TTKey = uint16_t;
+#endif
+
 struct TTEntry {
 
   Move  move()  const { return (Move )move16; }
@@ -43,12 +50,12 @@ struct TTEntry {
   Depth depth() const { return (Depth)depth8 + DEPTH_OFFSET; }
   bool is_pv()  const { return (bool)(genBound8 & 0x4); }
   Bound bound() const { return (Bound)(genBound8 & 0x3); }
-  void save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev);
+  void save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev, uint8_t generation8);
 
 private:
   friend class TranspositionTable;
 
-  uint16_t key16;
+  TTKey    keyBits;
   uint8_t  depth8;
   uint8_t  genBound8;
   uint16_t move16;
@@ -56,23 +63,46 @@ private:
   int16_t  eval16;
 };
 
+static_assert(sizeof(TTEntry) == sizeof(TTKey) + 8, "Unexpected TTEntry size");
+
+
+/// TTStats counts the outcome of the probes of one thread. A probe either hits,
+/// fills an empty entry or picks a victim, which has a lower depth in the
+/// current generation or belongs to an older one. False matches are the hits
+/// whose move turns out not to be pseudo legal, a lower bound of the number of
+/// key collisions.
+
+struct TTStats {
+  uint64_t probes, hits, falseMatches, emptyFills,
+           depthReplacements, agedReplacements, pvEvictions;
+};
+
 
 /// A TranspositionTable is an array of Cluster, of size clusterCount. Each
 /// cluster consists of ClusterSize number of TTEntry. Each non-empty TTEntry
 /// contains information on exactly one position. The size of a Cluster should
 /// divide the size of a cache line for best performance, as the cacheline is
-/// prefetched when possible.
+/// prefetched when possible. The default layout packs two clusters of 3 entries
+/// in a cache line, the one of TT_CLUSTER_64 (make ttcluster=64) a single
+/// cluster of 5 entries with 32 bit keys, trading an entry per cache line for
+/// far fewer key collisions in large tables.
 
 class TranspositionTable {
 
+#if defined(TT_CLUSTER_64)
+  static constexpr int ClusterSize = 5;
+  static constexpr int ClusterBytes = 64;
+#else
   static constexpr int ClusterSize = 3;
+  static constexpr int ClusterBytes = 32;
+#endif
 
   struct Cluster {
     TTEntry entry[ClusterSize];
-    char padding[2]; // Pad to 32 bytes
+    char padding[ClusterBytes - ClusterSize * sizeof(TTEntry)]; // Pad to ClusterBytes
   };
 
-  static_assert(sizeof(Cluster) == 32, "Unexpected Cluster size");
+  static_assert(sizeof(Cluster) == ClusterBytes, "Unexpected Cluster size");
 
   // Constants used to refresh the hash table periodically
   static constexpr unsigned GENERATION_BITS  = 3;                                // nb of bits reserved for other things
@@ -81,23 +111,44 @@ class TranspositionTable {
   static constexpr int      GENERATION_MASK  = (0xFF << GENERATION_BITS) & 0xFF; // mask to pull out generation number
 
 public:
- ~TranspositionTable() { aligned_large_pages_free(table); }
-  void new_search() { generation8 += GENERATION_DELTA; } // Lower bits are used for other things
-  TTEntry* probe(const Key key, bool& found) const;
-  int hashfull() const;
+  static constexpr size_t MaxSlices = 1024;
+
+  /// A Slice is the part of the table probed by the threads of a search, with
+  /// the generation of the search, see slice(). Each thread holds the one of
+  /// its thread pool.
+  struct Slice {
+    Cluster* table;
+    size_t clusters;
+    uint8_t generation8;
+  };
+
+ ~TranspositionTable() { free_table(); }
+  void new_search(size_t idx) { generations[idx] += GENERATION_DELTA; } // Lower bits are used for other things
+  TTEntry* probe(const Slice& s, const Key key, bool& found, TTStats& stats) const;
+  int hashfull(const Slice& s) const;
+  std::string stats() const;
   void resize(size_t mbSize);
   void clear();
+  bool save(const std::string& filename, Variant v) const;
+  bool load(const std::string& filename, Variant v);
 
-  TTEntry* first_entry(const Key key) const {
-    return &table[mul_hi64(key, clusterCount)].entry[0];
+  Slice slice(size_t idx, size_t slices) const;
+  void clear_slice(size_t idx, size_t slices);
+
+  TTEntry* first_entry(const Slice& s, const Key key) const {
+    return &s.table[mul_hi64(key, s.clusters)].entry[0];
   }
 
 private:
   friend struct TTEntry;
 
+  void free_table();
+
   size_t clusterCount;
   Cluster* table;
-  uint8_t generation8; // Size must be not bigger than TTEntry::genBound8
+  bool shared = false; // Table is a shared memory segment, see option SharedHash
+  uint8_t generations[MaxSlices]; // Of the searches of each slice index, the first one also of the whole table.
+                                  // Size must be not bigger than TTEntry::genBound8
 };
 
 extern TranspositionTable TT;
@@ -31,6 +31,8 @@ namespace Stockfish {
 bool Tune::update_on_last;
 const UCI::Option* LastOption = nullptr;
 static std::map<std::string, int> TuneResults;
+static std::vector<Tune::Param> TuneParams;
+static bool Setting = false; // Options are being set by Tune::set()
 
 string Tune::next(string& names, bool pop) {
 
@@ -53,7 +55,7 @@ string Tune::next(string& names, bool pop) {
 
 static void on_tune(const UCI::Option& o) {
 
-  if (!Tune::update_on_last || LastOption == &o)
+  if (!Setting && (!Tune::update_on_last || LastOption == &o))
       Tune::read_options();
 }
 
@@ -68,6 +70,7 @@ static void make_option(const string& n, int v, const SetRange& r) {
 
   Options[n] << UCI::Option(v, r(v).first, r(v).second, on_tune);
   LastOption = &Options[n];
+  TuneParams.push_back({ n, r(v).first, r(v).second });
 
   // Print formatted parameters, ready to be copy-pasted in Fishtest
   std::cout << n << ","
@@ -78,6 +81,20 @@ static void make_option(const string& n, int v, const SetRange& r) {
             << std::endl;
 }
 
+const std::vector<Tune::Param>& Tune::params() { return TuneParams; }
+
+// Sets the options of the parameters, in the order of params(), then the values
+// of the parameters, running the post-update functions once.
+void Tune::set(const std::vector<int>& values) {
+
+  Setting = true;
+  for (size_t i = 0; i < values.size() && i < TuneParams.size(); ++i)
+      Options[TuneParams[i].name] = std::to_string(values[i]);
+  Setting = false;
+
+  read_options();
+}
+
 template<> void Tune::Entry<int>::init_option() { make_option(name, value, range); }
 
 template<> void Tune::Entry<int>::read_option() {
@@ -72,6 +72,10 @@ struct SetRange {
 /// once, after the engine receives the last UCI option, that is the one defined
 /// and created as the last one, so the GUI should send the options in the same
 /// order in which have been defined.
+///
+/// The parameters can also be tuned by the engine itself with the "spsa" command,
+/// which plays games between the parameters shifted up and down, see
+/// MainThread::spsa().
 
 class Tune {
 
@@ -141,12 +145,20 @@ class Tune {
   std::vector<std::unique_ptr<EntryBase>> list;
 
 public:
+  // A parameter, as the option made by init()
+  struct Param {
+    std::string name;
+    int min, max;
+  };
+
   template<typename... Args>
   static int add(const std::string& names, Args&&... args) {
     return instance().add(SetDefaultRange, names.substr(1, names.size() - 2), args...); // Remove trailing parenthesis
   }
   static void init() { for (auto& e : instance().list) e->init_option(); read_options(); } // Deferred, due to UCI::Options access
   static void read_options() { for (auto& e : instance().list) e->read_option(); }
+  static const std::vector<Param>& params();
+  static void set(const std::vector<int>& values);
   static bool update_on_last;
 };
 
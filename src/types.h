@@ -638,6 +638,17 @@ struct DirtyPiece {
   // From and to squares, which may be SQ_NONE
   Square from[12];
   Square to[12];
+#ifdef CRAZYHOUSE
+
+  // Number of changed in-hand counts. A drop takes a piece out of the hand of
+  // the mover and a capture may put a piece into the hand of the capturer.
+  int hand_num;
+  Piece handPiece[2];
+
+  // In-hand count of handPiece before and after the move
+  int handFrom[2];
+  int handTo[2];
+#endif
 };
 
 /// Score enum stores a middlegame and an endgame value in a single integer (enum).
@@ -18,16 +18,22 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cmath>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <string>
 
 #include "benchmark.h"
+#include "book.h"
+#include "cluster.h"
 #include "evaluate.h"
 #include "movegen.h"
 #include "position.h"
 #include "search.h"
+#include "server.h"
 #include "thread.h"
 #include "timeman.h"
 #include "tt.h"
@@ -119,15 +125,13 @@ namespace {
   // position() is called when the engine receives the "position" UCI command.
   // It sets up the position that is described in the given FEN string ("fen") or
   // the initial position ("startpos") and then makes the moves given in the following
-  // move list ("moves").
+  // move list ("moves"). It returns the position as FEN and moves, for the cluster.
 
-  void position(Position& pos, istringstream& is, StateListPtr& states) {
+  string position(Position& pos, istringstream& is, StateListPtr& states, Variant variant) {
 
     Move m;
     string token, fen;
 
-    Variant variant = UCI::variant_from_name(Options["UCI_Variant"]);
-
     is >> token;
     if (token == "startpos")
     {
@@ -138,19 +142,91 @@ namespace {
         while (is >> token && token != "moves")
             fen += token + " ";
     else
-        return;
+        return string();
 
     states = StateListPtr(new std::deque<StateInfo>(1)); // Drop the old state and create a new one
     pos.set(fen, Options["UCI_Chess960"], variant, &states->back(), Threads.main());
 
     // Parse the move list, if any
+    string moves;
     while (is >> token && (m = UCI::to_move(pos, token)) != MOVE_NONE)
     {
         states->emplace_back();
         pos.do_move(m, states->back());
+        moves += " " + token;
     }
+
+    return "fen " + fen + " moves" + moves;
   }
 
+  void position(Position& pos, istringstream& is, StateListPtr& states) {
+
+    Variant variant = UCI::variant_from_name(Options["UCI_Variant"]);
+    string setup = position(pos, is, states, variant);
+
+    if (!setup.empty())
+        Cluster::set_position(variants[variant], Options["UCI_Chess960"], setup);
+  }
+
+#ifdef BUGHOUSE
+  // partner() handles the "partner" command of a bughouse session, which sets up
+  // the board of the partner, searched along with ours by the threads given in the
+  // option "Partner Threads". After "partner position ...", as for our board, the
+  // moves of "partner moves ..." are played on it, and the pieces they capture go
+  // at once to the pockets of our board, without our position being sent again.
+  // The flow is one way: the pieces we capture are not put in the pockets of the
+  // partner board, whose position comes with them from the GUI, as the pockets
+  // also hold the captures of the opponents of the partner.
+
+  void partner(Position& pos, Position& board, StateListPtr& boardStates, istringstream& is) {
+
+    string token;
+    Move m;
+    bool transferred = false;
+
+    if (!pos.is_bughouse())
+    {
+        sync_cout << "info string Partner boards are only played in bughouse" << sync_endl;
+        return;
+    }
+
+    is >> token;
+    if (token == "position")
+    {
+        if (!position(board, is, boardStates, pos.subvariant()).empty())
+            Threads.partnerBoard = &board;
+        return;
+    }
+
+    if (token != "moves" || !Threads.partnerBoard)
+    {
+        sync_cout << "info string Unknown partner command, or no partner position" << sync_endl;
+        return;
+    }
+
+    while (is >> token && (m = UCI::to_move(board, token)) != MOVE_NONE)
+    {
+        Square to = to_sq(m);
+        Piece captured =  type_of(m) == EN_PASSANT ? make_piece(~board.side_to_move(), PAWN)
+                        : type_of(m) == CASTLING || type_of(m) == DROP ? NO_PIECE
+                        : board.is_promoted(to) ? make_piece(color_of(board.piece_on(to)), PAWN)
+                        : board.piece_on(to);
+
+        // A piece keeps its colour, given to the partner of the side capturing it
+        if (captured != NO_PIECE)
+            pos.transfer_to_hand(captured), transferred = true;
+
+        boardStates->emplace_back();
+        board.do_move(m, boardStates->back());
+    }
+
+    // The nodes of a cluster get the position without its moves, which would not
+    // account for the pieces given
+    if (transferred)
+        Cluster::set_position(variants[pos.subvariant()], Options["UCI_Chess960"], "fen " + pos.fen() + " moves");
+  }
+#endif
+
   // trace_eval() prints the evaluation of the current position, consistent with
   // the UCI options set so far.
 
@@ -159,15 +235,214 @@ namespace {
     StateListPtr states(new std::deque<StateInfo>(1));
     Position p;
     p.set(pos.fen(), Options["UCI_Chess960"], pos.variant(), &states->back(), Threads.main());
+    Threads.main()->alloc_tables(p.variant());
 
 #ifdef USE_NNUE
-    Eval::NNUE::verify();
+    Eval::NNUE::verify(p.variant());
 #endif
+    Threads.main()->check_networks();
 
     sync_cout << "\n" << Eval::trace(p) << sync_endl;
   }
 
 
+  // eval_batch() scores a stream of FENs read from stdin, one per line, until
+  // an empty line, "end" or the end of the input, and prints for each of them
+  // the static evaluation from the point of view of the side to move. The FENs
+  // are of the variant given as argument, or else of the current UCI_Variant.
+  // With "file <path>" the positions are read in place from a file of packed
+  // positions instead, see pack_fens(). When a network is available, the
+  // positions are scored in batches by the raw NNUE output, otherwise one by
+  // one with the raw classical evaluation, both as in the trace of the eval
+  // command. Positions in check have no static evaluation and are scored "none".
+
+  void eval_batch(istringstream& is) {
+
+    constexpr std::size_t BatchSize = 1024;
+
+    string token, fen, path;
+    Variant variant = UCI::variant_from_name(Options["UCI_Variant"]);
+    const PackedPosition* packed = nullptr;
+    std::size_t packedSize = 0, packedCount = 0, next = 0;
+
+    if ((is >> token) && token == "file")
+    {
+        is >> path;
+        packed = static_cast<const PackedPosition*>(map_file(path, packedSize));
+        if (!packed)
+        {
+            sync_cout << "info string Unable to open file " << path << sync_endl;
+            return;
+        }
+        packedCount = packedSize / sizeof(PackedPosition);
+    }
+    else if (!token.empty())
+        variant = UCI::variant_from_name(token);
+
+    Threads.main()->alloc_tables(variant);
+
+    // Reset the margin of the lazy evaluation, as for the trace
+    Threads.main()->bestValue = VALUE_ZERO;
+    Threads.main()->optimism[WHITE] = Threads.main()->optimism[BLACK] = VALUE_ZERO;
+
+    std::deque<Position> positions(BatchSize);
+    std::deque<StateInfo> states(BatchSize);
+    std::vector<const Position*> batch;
+    std::vector<Value> values(BatchSize);
+    bool verified[VARIANT_NB] = {};
+    bool more = true;
+
+#ifdef USE_NNUE
+    std::vector<const Position*> nnueBatch;
+    std::vector<std::size_t> nnueIndex;
+    std::vector<Value> nnueValues(BatchSize);
+#endif
+
+    while (more)
+    {
+        batch.clear();
+        while (batch.size() < BatchSize && (more = packed ? next < packedCount
+                                                          : getline(cin, fen) && !fen.empty() && fen != "end"))
+        {
+            Position& pos = positions[batch.size()];
+            if (packed)
+                pos.set_packed(packed[next++], &states[batch.size()], Threads.main());
+            else
+                pos.set(fen, Options["UCI_Chess960"], variant, &states[batch.size()], Threads.main());
+
+#ifdef USE_NNUE
+            if (!verified[pos.variant()])
+                Eval::NNUE::verify(pos.variant());
+#endif
+            verified[pos.variant()] = true;
+            batch.push_back(&pos);
+        }
+
+        if (batch.empty())
+            break;
+
+#ifdef USE_NNUE
+        Threads.main()->check_networks();
+        nnueBatch.clear();
+        nnueIndex.clear();
+#endif
+        for (std::size_t i = 0; i < batch.size(); ++i)
+        {
+            if (batch[i]->checkers())
+            {
+                values[i] = VALUE_NONE;
+                continue;
+            }
+#ifdef USE_NNUE
+            if (Eval::useNNUE && Eval::nnueAvailable[batch[i]->variant()])
+            {
+                nnueBatch.push_back(batch[i]);
+                nnueIndex.push_back(i);
+                continue;
+            }
+#endif
+            values[i] = Eval::classical(*batch[i]);
+        }
+
+#ifdef USE_NNUE
+        Eval::NNUE::evaluate_batch(nnueBatch.data(), nnueBatch.size(), nnueValues.data());
+        for (std::size_t i = 0; i < nnueBatch.size(); ++i)
+            values[nnueIndex[i]] = nnueValues[i];
+#endif
+
+        stringstream ss;
+        for (std::size_t i = 0; i < batch.size(); ++i)
+            ss << (i ? "\n" : "")
+               << (values[i] == VALUE_NONE ? "none"
+                   : UCI::value(std::clamp(values[i], VALUE_TB_LOSS_IN_MAX_PLY + 1, VALUE_TB_WIN_IN_MAX_PLY - 1)));
+        sync_cout << ss.str() << sync_endl;
+    }
+
+    unmap_file(packed, packedSize);
+  }
+
+
+  // pack_fens() reads FENs from stdin like eval_batch() and appends them to the
+  // given file as packed positions, see PackedPosition. The FENs are of the
+  // variant given as second argument, or else of the current UCI_Variant.
+
+  void pack_fens(istringstream& is) {
+
+    string path, token, fen;
+    if (!(is >> path))
+    {
+        sync_cout << "The filename must be specified" << sync_endl;
+        return;
+    }
+
+    Variant variant = UCI::variant_from_name(is >> token ? token : string(Options["UCI_Variant"]));
+    std::ofstream file(path, std::ios::binary | std::ios::app);
+    StateInfo st;
+    Position pos;
+    std::size_t count = 0;
+
+    while (getline(cin, fen) && !fen.empty() && fen != "end")
+    {
+        PackedPosition pp = pos.set(fen, Options["UCI_Chess960"], variant, &st, Threads.main()).pack();
+        file.write(reinterpret_cast<const char*>(&pp), sizeof(pp));
+        ++count;
+    }
+
+    sync_cout << (file ? "info string Packed " + std::to_string(count) + " positions to " + path
+                       : "info string Failed to write " + path) << sync_endl;
+  }
+
+
+  // make_book() writes the book of a variant with the moves read from stdin,
+  // one "<fen> | <move> [<weight>]" per line, until an empty line or "end".
+  // The weight defaults to 1, the weights of a repeated move are summed up.
+
+  void make_book(istringstream& is) {
+
+    string path, token, line;
+    if (!(is >> path))
+    {
+        sync_cout << "The filename must be specified" << sync_endl;
+        return;
+    }
+
+    Variant variant = UCI::variant_from_name(is >> token ? token : string(Options["UCI_Variant"]));
+    std::vector<Book::Entry> entries;
+    StateInfo st;
+    Position pos;
+    std::size_t skipped = 0;
+
+    while (getline(cin, line) && !line.empty() && line != "end")
+    {
+        size_t bar = line.find('|');
+        if (bar == string::npos)
+        {
+            ++skipped;
+            continue;
+        }
+
+        istringstream ms(line.substr(bar + 1));
+        int weight = 1;
+        ms >> token >> weight;
+
+        pos.set(line.substr(0, bar), Options["UCI_Chess960"], variant, &st, Threads.main());
+        Move m = UCI::to_move(pos, token);
+        if (m == MOVE_NONE || weight <= 0)
+        {
+            ++skipped;
+            continue;
+        }
+
+        entries.push_back({ pos.key(), uint16_t(m), uint16_t(std::min(weight, 0xFFFF)), 0 });
+    }
+
+    bool saved = Book::save(path, variant, entries);
+    sync_cout << (saved ? "info string Saved " + std::to_string(entries.size()) + " moves to " + path
+                        : "info string Failed to write " + path)
+              << (skipped ? ", skipped " + std::to_string(skipped) + " lines" : "") << sync_endl;
+  }
+
+
   // setoption() is called when the engine receives the "setoption" UCI command.
   // The function updates the UCI option ("name") to the given value ("value").
 
@@ -202,15 +477,17 @@ namespace {
 
   // go() is called when the engine receives the "go" UCI command. The function
   // sets the thinking time and other parameters from the input string, then starts
-  // with a search.
+  // with a search by the given pool. The clock runs from startTime, when the
+  // command was received.
 
-  void go(Position& pos, istringstream& is, StateListPtr& states) {
+  void go(Position& pos, istringstream& is, StateListPtr& states,
+          TimePoint startTime = now(), ThreadPool& pool = Threads) {
 
     Search::LimitsType limits;
     string token;
     bool ponderMode = false;
 
-    limits.startTime = now(); // The search starts as early as possible
+    limits.startTime = startTime; // The search starts as early as possible
 
     while (is >> token)
         if (token == "searchmoves") // Needs to be the last command on the line
@@ -227,24 +504,166 @@ namespace {
         else if (token == "movetime")  is >> limits.movetime;
         else if (token == "mate")      is >> limits.mate;
         else if (token == "perft")     is >> limits.perft;
+        else if (token == "json")      limits.perftJson = 1;
         else if (token == "infinite")  limits.infinite = 1;
         else if (token == "ponder")    ponderMode = true;
 
-    Threads.start_thinking(pos, states, limits, ponderMode);
+    pool.start_thinking(pos, states, limits, ponderMode);
   }
 
 
-  // bench() is called when the engine receives the "bench" command.
-  // Firstly, a list of UCI commands is set up according to the bench
-  // parameters, then it is run one by one, printing a summary at the end.
+  // analyse() starts the analysis of the positions of a file of FENs, EPDs or
+  // packed positions (if its name ends with ".pack") of the current variant,
+  // spread over the threads, each with a search of its own, see Thread::analyse().
+  // The limit is given as in "analyse suite.epd depth 12", "nodes" and "movetime"
+  // are also accepted, and defaults to depth 10.
 
-  void bench(Position& pos, istream& args, StateListPtr& states) {
+  void analyse(Position& pos, istringstream& is, StateListPtr& states) {
+
+    Search::LimitsType limits;
+    string token;
+
+    limits.startTime = now();
+
+    if (!(is >> limits.analyseFile))
+    {
+        sync_cout << "The filename must be specified" << sync_endl;
+        return;
+    }
+
+    while (is >> token)
+        if (token == "depth")         is >> limits.depth;
+        else if (token == "nodes")    is >> limits.nodes;
+        else if (token == "movetime") is >> limits.movetime;
+
+    if (!limits.depth && !limits.nodes && !limits.movetime)
+        limits.depth = 10;
+
+    Threads.start_thinking(pos, states, limits);
+  }
 
+
+  // generate_training_data() starts self-play games from the current position
+  // on all the threads, see Thread::self_play(). The parameters are the search
+  // limit per move (depth 8 by default, nodes or movetime), the number of
+  // positions, the number of random plies at the start of each game and the
+  // output file, e.g.
+  // "generate_training_data depth 9 count 1000000 randomplies 8 file data.bin".
+
+  void generate_training_data(Position& pos, istringstream& is, StateListPtr& states) {
+
+    Search::LimitsType limits;
     string token;
-    uint64_t num, nodes = 0, cnt = 1;
 
-    vector<string> list = setup_bench(pos, args);
+    limits.startTime = now();
+    limits.datagen = 100000;
+    limits.randomPlies = 8;
+    limits.datagenFile = "training_data.bin";
+
+    while (is >> token)
+        if (token == "depth")            is >> limits.depth;
+        else if (token == "nodes")       is >> limits.nodes;
+        else if (token == "movetime")    is >> limits.movetime;
+        else if (token == "count")       is >> limits.datagen;
+        else if (token == "randomplies") is >> limits.randomPlies;
+        else if (token == "file")        is >> limits.datagenFile;
+
+    if (!limits.depth && !limits.nodes && !limits.movetime)
+        limits.depth = 8;
+
+    if (limits.datagen <= 0 || pos.is_variant_end() || !MoveList<LEGAL>(pos).size())
+    {
+        sync_cout << "info string No game can be played from this position" << sync_endl;
+        return;
+    }
+
+    Threads.start_thinking(pos, states, limits);
+  }
+
+
+  // tune_spsa() tunes the parameters flagged with TUNE() by self-play games from
+  // the current position on all the threads, see MainThread::spsa(). The
+  // parameters are the search limit per move (nodes 5000 by default, depth or
+  // movetime), the number of iterations, the number of random plies at the
+  // start of each game and the output file of the parameters after each
+  // iteration, e.g. "spsa nodes 10000 iterations 2000 randomplies 8 file spsa.csv".
+  // As bench, it returns once done.
+
+  void tune_spsa(Position& pos, istringstream& is, StateListPtr& states) {
+
+    Search::LimitsType limits;
+    string token;
+
+    limits.startTime = now();
+    limits.spsa = 1000;
+    limits.randomPlies = 8;
+    limits.spsaFile = "spsa.csv";
+
+    while (is >> token)
+        if (token == "depth")            is >> limits.depth;
+        else if (token == "nodes")       is >> limits.nodes;
+        else if (token == "movetime")    is >> limits.movetime;
+        else if (token == "iterations")  is >> limits.spsa;
+        else if (token == "randomplies") is >> limits.randomPlies;
+        else if (token == "file")        is >> limits.spsaFile;
+
+    if (!limits.depth && !limits.nodes && !limits.movetime)
+        limits.nodes = 5000;
+
+    if (limits.spsa <= 0 || pos.is_variant_end() || !MoveList<LEGAL>(pos).size())
+    {
+        sync_cout << "info string No game can be played from this position" << sync_endl;
+        return;
+    }
+
+    Search::spsa(pos, states, limits);
+  }
+
+
+  // nnue_stats() reports, per variant, how often the NNUE accumulators of the
+  // threads were updated incrementally and how often they had to be refreshed
+  // from scratch, one line per variant evaluated.
+
+  string nnue_stats() {
+
+    std::stringstream ss;
+#ifdef USE_NNUE
+    for (Variant v = CHESS_VARIANT; v < VARIANT_NB; ++v)
+    {
+        uint64_t updates = 0, refreshes = 0;
+        for (Thread* th : Threads)
+        {
+            updates += th->nnueUpdates[v];
+            refreshes += th->nnueRefreshes[v];
+        }
+        if (updates + refreshes)
+            ss << "NNUE " << variants[v] << " : " << updates << " incremental, "
+               << refreshes << " refreshes (" << 100 * refreshes / (updates + refreshes) << "%)" << endl;
+    }
+#endif
+    return ss.str();
+  }
+
+
+  // BenchResult is the result of the search of a bench position
+  struct BenchResult {
+    string fen;
+    uint64_t nodes;
+    double ms;
+  };
+
+  // run_bench() runs the UCI commands of a bench one by one, and returns the
+  // time they took, from the last "ucinewgame", and their number of nodes.
+  // The results of the searches are appended to the given vector, if any.
+
+  TimePoint run_bench(Position& pos, const vector<string>& list, StateListPtr& states,
+                      uint64_t& nodes, vector<BenchResult>* results = nullptr) {
+
+    string token;
+    uint64_t num, cnt = 1;
+
     num = count_if(list.begin(), list.end(), [](const string& s) { return s.find("go ") == 0 || s.find("eval") == 0; });
+    nodes = 0;
 
     TimePoint elapsed = now();
 
@@ -258,9 +677,15 @@ namespace {
             cerr << "\nPosition: " << cnt++ << '/' << num << " (" << pos.fen() << ")" << endl;
             if (token == "go")
             {
+               string fen = pos.fen();
+               auto start = std::chrono::steady_clock::now();
                go(pos, is, states);
                Threads.main()->wait_for_search_finished();
                nodes += Threads.nodes_searched();
+               if (results)
+                   results->push_back({ fen, Threads.nodes_searched(),
+                                        std::chrono::duration<double, std::milli>(
+                                            std::chrono::steady_clock::now() - start).count() });
             }
             else
                trace_eval(pos);
@@ -268,18 +693,247 @@ namespace {
         else if (token == "setoption")  setoption(is);
         else if (token == "position")   position(pos, is, states);
         else if (token == "ucinewgame") { Search::clear(); elapsed = now(); } // Search::clear() may take a while
+        else if (token == "packed") // Set up in place from the mapped file, see setup_bench()
+        {
+            size_t idx;
+            is >> idx;
+            states = StateListPtr(new std::deque<StateInfo>(1));
+            pos.set_packed(bench_packed(idx), &states->back(), Threads.main());
+        }
     }
 
-    elapsed = now() - elapsed + 1; // Ensure positivity to avoid a 'divide by zero'
+    return now() - elapsed + 1; // Ensure positivity to avoid a 'divide by zero'
+  }
+
+
+  // bench() is called when the engine receives the "bench" command.
+  // Firstly, a list of UCI commands is set up according to the bench
+  // parameters, then it is run one by one, printing a summary at the end.
+
+  void bench(Position& pos, istream& args, StateListPtr& states) {
+
+    uint64_t nodes;
+    TimePoint elapsed = run_bench(pos, setup_bench(pos, args), states, nodes);
+    const SearchTimer& timer = Threads.main()->timer;
 
     dbg_print();
 
     cerr << "\n==========================="
          << "\nTotal time (ms) : " << elapsed
          << "\nNodes searched  : " << nodes
-         << "\nNodes/second    : " << 1000 * nodes / elapsed << endl;
+         << "\nNodes/second    : " << 1000 * nodes / elapsed
+         << "\nStartup (ms)    : " << startup_times()
+         << "\n" << TT.stats() << endl;
+
+    // Report how long the searches stopped on time took to end, from the deadline
+    if (timer.stops)
+        cerr << "Stop latency (us) : average " << timer.latencySum / int64_t(timer.stops)
+             << ", maximum " << timer.latencyMax << " over " << timer.stops << " stops" << endl;
+
+    cerr << nnue_stats();
+  }
+
+
+  // smpbench() searches the bench positions to a fixed depth once for each
+  // count of a comma separated list of thread counts, and reports the time to
+  // depth and its speedup over the first count. The arguments are the ones of
+  // bench, without the limit type: [variant] [ttSize] [threads] [depth]
+  // [fenFile] [evalType], as in "smpbench atomic 64 1,2,4,8 14".
+
+  void smpbench(Position& pos, istream& args, StateListPtr& states) {
+
+    vector<string> tokens;
+    string token;
+
+    while (args >> token)
+        tokens.push_back(token);
+
+    // Insert the defaults of the variant, the TT size and the thread counts
+    if (tokens.empty() || !std::count(variants.begin(), variants.end(), tokens[0]))
+        tokens.insert(tokens.begin(), string(Options["UCI_Variant"]));
+    if (tokens.size() < 2)
+        tokens.push_back("16");
+    if (tokens.size() < 3)
+        tokens.push_back("1,2,4,8");
+
+    Variant variant = UCI::variant_from_name(tokens[0]);
+    string threadList = tokens[2];
+    string depth = tokens.size() > 3 ? tokens[3] : variant == CHESS_VARIANT ? "13" : "12";
+    string fenFile = tokens.size() > 4 ? tokens[4] : "default";
+    string evalType = tokens.size() > 5 ? tokens[5] : variant == CHESS_VARIANT ? "mixed" : "classical";
+
+    vector<std::pair<string, TimePoint>> results;
+    istringstream threadCounts(threadList);
+
+    while (std::getline(threadCounts, token, ','))
+    {
+        istringstream is(tokens[0] + " " + tokens[1] + " " + token + " " + depth + " "
+                         + fenFile + " depth " + evalType);
+        uint64_t nodes;
+        TimePoint elapsed = run_bench(pos, setup_bench(pos, is), states, nodes);
+        results.emplace_back(token, elapsed);
+
+        cerr << "\nThreads " << token << " : " << elapsed << " ms, "
+             << nodes << " nodes, " << 1000 * nodes / elapsed << " nps" << endl;
+    }
+
+    cerr << "\n==========================="
+         << "\nTime to depth " << depth << " (" << tokens[0] << ")" << endl;
+
+    for (auto& [threads, elapsed] : results)
+        cerr << "Threads " << std::setw(4) << threads << " : " << std::setw(8) << elapsed
+             << " ms, speedup " << std::fixed << std::setprecision(2)
+             << double(results.front().second) / elapsed << endl;
   }
 
+
+  // benchreport() runs the default bench of each variant, or of the given one,
+  // a number of times, and prints a JSON report with a line per variant: its
+  // signature (the nodes of a run), whether all the runs searched the same
+  // nodes, the mean and standard deviation over the runs of the speed and of
+  // the time, and the same for each position. The times of the positions are
+  // their times to depth. Given a baseline, a previous report, the speed of
+  // each variant is compared to the baseline one by a Welch t-test, which is
+  // significant at the 95% level. The arguments are [runs] [variant|all]
+  // [depth|default] [baseline], as in "benchreport 10 all default base.json".
+
+  void benchreport(Position& pos, istream& args, StateListPtr& states) {
+
+    struct Stats { double mean, stdev; int n; };
+
+    auto stats = [](const vector<double>& x) {
+        double sum = 0, sumSq = 0;
+        for (double v : x)
+            sum += v, sumSq += v * v;
+        double mean = sum / x.size();
+        double var = x.size() > 1 ? std::max(sumSq - x.size() * mean * mean, 0.0) / (x.size() - 1) : 0;
+        return Stats{ mean, std::sqrt(var), int(x.size()) };
+    };
+
+    auto json = [](const Stats& s) {
+        std::stringstream ss;
+        ss << std::fixed << std::setprecision(2)
+           << "{\"mean\":" << s.mean << ",\"stdev\":" << s.stdev << "}";
+        return ss.str();
+    };
+
+    int runs = 5;
+    string varname = "all", depth = "default", baseline, token;
+    if (args >> token)
+        runs = std::max(std::stoi(token), 1);
+    args >> varname >> depth >> baseline;
+
+    // The speed of the variants in the baseline, read back from its lines
+    std::map<string, Stats> base;
+    if (!baseline.empty())
+    {
+        std::ifstream file(baseline);
+        if (!file.is_open())
+        {
+            sync_cout << "info string Unable to open baseline " << baseline << sync_endl;
+            return;
+        }
+
+        auto number = [](const string& line, const string& key) {
+            size_t idx = line.find("\"" + key + "\":");
+            return idx == string::npos ? 0.0 : std::atof(line.c_str() + idx + key.size() + 3);
+        };
+
+        string line;
+        while (std::getline(file, line))
+        {
+            size_t idx = line.find("\"variant\":\"");
+            if (idx == string::npos)
+                continue;
+            string name = line.substr(idx + 11, line.find('"', idx + 11) - idx - 11);
+            base[name] = { number(line, "nps_mean"), number(line, "nps_stdev"), int(number(line, "runs")) };
+        }
+    }
+
+    // Approximation of the two-sided 95% quantile of Student's t distribution
+    auto critical = [](double df) {
+        constexpr double T[] = { 12.71, 4.30, 3.18, 2.78, 2.57, 2.45, 2.36, 2.31, 2.26, 2.23 };
+        return df < 1 ? T[0] : df <= 10 ? T[int(df) - 1] : 1.96 + 2.6 / df;
+    };
+
+    vector<string> lines;
+    Variant first = varname == "all" ? CHESS_VARIANT : UCI::variant_from_name(varname);
+    Variant last = varname == "all" ? Variant(SUBVARIANT_NB - 1) : first;
+
+    for (Variant v = first; v <= last; ++v)
+    {
+        string limit = depth != "default" ? depth : v == CHESS_VARIANT ? "13" : "12";
+        vector<vector<BenchResult>> results(runs);
+        vector<double> nps, ms;
+
+        for (auto& r : results)
+        {
+            istringstream is(variants[v] + " 16 1 " + limit);
+            uint64_t nodes;
+            run_bench(pos, setup_bench(pos, is), states, nodes, &r);
+
+            double total = 0;
+            for (const BenchResult& b : r)
+                total += b.ms;
+            ms.push_back(total);
+            nps.push_back(1000 * nodes / std::max(total, 1e-3));
+        }
+
+        bool deterministic = true;
+        uint64_t signature = 0;
+        for (const BenchResult& b : results[0])
+            signature += b.nodes;
+
+        std::stringstream ss;
+        Stats sn = stats(nps);
+        ss << std::fixed << std::setprecision(2)
+           << "{\"variant\":\"" << variants[v] << "\",\"depth\":" << limit << ",\"runs\":" << runs
+           << ",\"nps_mean\":" << sn.mean << ",\"nps_stdev\":" << sn.stdev
+           << ",\"time\":" << json(stats(ms));
+
+        if (base.count(variants[v]) && base[variants[v]].n > 0)
+        {
+            // Welch's t-test of the speed against the baseline one
+            const Stats& b = base[variants[v]];
+            double va = sn.stdev * sn.stdev / sn.n, vb = b.stdev * b.stdev / b.n;
+            double se = std::sqrt(va + vb);
+            double t = se > 0 ? (sn.mean - b.mean) / se : 0;
+            double df = sn.n > 1 && b.n > 1 && va + vb > 0
+                      ? (va + vb) * (va + vb) / (va * va / (sn.n - 1) + vb * vb / (b.n - 1)) : 1;
+            ss << ",\"baseline\":{\"nps_mean\":" << b.mean
+               << ",\"change_percent\":" << 100 * (sn.mean - b.mean) / std::max(b.mean, 1.0)
+               << ",\"t\":" << t << ",\"df\":" << df
+               << ",\"significant\":" << (se > 0 && std::abs(t) > critical(df) ? "true" : "false") << "}";
+        }
+
+        ss << ",\"positions\":[";
+        for (size_t i = 0; i < results[0].size(); ++i)
+        {
+            vector<double> pnps, pms;
+            for (auto& r : results)
+            {
+                deterministic &= r[i].nodes == results[0][i].nodes;
+                pms.push_back(r[i].ms);
+                pnps.push_back(1000 * r[i].nodes / std::max(r[i].ms, 1e-3));
+            }
+            ss << (i ? "," : "") << "{\"fen\":\"" << results[0][i].fen << "\",\"nodes\":" << results[0][i].nodes
+               << ",\"nps\":" << json(stats(pnps)) << ",\"time\":" << json(stats(pms)) << "}";
+        }
+        ss << "],\"signature\":" << signature << ",\"deterministic\":" << (deterministic ? "true" : "false") << "}";
+
+        lines.push_back(ss.str());
+    }
+
+    std::stringstream report;
+    report << "{\"runs\":" << runs << ",\"variants\":[\n";
+    for (size_t i = 0; i < lines.size(); ++i)
+        report << lines[i] << (i + 1 < lines.size() ? ",\n" : "\n");
+    report << "]}";
+
+    sync_cout << report.str() << sync_endl;
+  }
+
+
   // The win rate model returns the probability of winning (in per mille units) given an
   // eval and a game ply. It fits the LTC fishtest statistics rather accurately.
   int win_rate_model(Value v, int ply) {
@@ -320,6 +974,10 @@ void UCI::loop(int argc, char* argv[]) {
   Position pos;
   string token, cmd;
   StateListPtr states(new std::deque<StateInfo>(1));
+#ifdef BUGHOUSE
+  Position partnerBoard;
+  StateListPtr partnerStates;
+#endif
 
   pos.set(StartFENs[CHESS_VARIANT], false, CHESS_VARIANT, &states->back(), Threads.main());
 
@@ -344,7 +1002,7 @@ void UCI::loop(int argc, char* argv[]) {
       // has played. The search should continue, but should also switch from pondering
       // to the normal search.
       else if (token == "ponderhit")
-          Threads.main()->ponder = false; // Switch to the normal search
+          Threads.main()->ponderhit(); // Switch to the normal search
 
       else if (token == "uci")
           sync_cout << "id name " << engine_info(true)
@@ -354,16 +1012,57 @@ void UCI::loop(int argc, char* argv[]) {
       else if (token == "setoption")  setoption(is);
       else if (token == "go")         go(pos, is, states);
       else if (token == "position")   position(pos, is, states);
-      else if (token == "ucinewgame") Search::clear();
+      else if (token == "ucinewgame") { Search::clear(); Threads.partnerBoard = nullptr; }
       else if (token == "isready")    sync_cout << "readyok" << sync_endl;
+#ifdef BUGHOUSE
+      else if (token == "partner")    partner(pos, partnerBoard, partnerStates, is);
+#endif
 
       // Add custom non-UCI commands, mainly for debugging purposes.
       // These commands must not be used during a search!
       else if (token == "flip")     pos.flip();
       else if (token == "bench")    bench(pos, is, states);
+      else if (token == "smpbench") smpbench(pos, is, states);
+      else if (token == "speedtest") speedtest(is);
+      else if (token == "benchreport") benchreport(pos, is, states);
       else if (token == "d")        sync_cout << pos << sync_endl;
       else if (token == "eval")     trace_eval(pos);
+      else if (token == "evalbatch") eval_batch(is);
+      else if (token == "pack")     pack_fens(is);
+      else if (token == "makebook") make_book(is);
+      else if (token == "generate_training_data") generate_training_data(pos, is, states);
+      else if (token == "spsa")     tune_spsa(pos, is, states);
+      else if (token == "analyse")  analyse(pos, is, states);
+      else if (token == "server")   Server::run(is);
+      else if (token == "listen")   { Server::listen(is, argc == 1); token = "quit"; }
+      else if (token == "cluster")  { Cluster::serve(is, argc == 1); token = "quit"; }
       else if (token == "compiler") sync_cout << compiler_info() << sync_endl;
+      else if (token == "ttstats")  sync_cout << "info string " << TT.stats() << sync_endl;
+#if defined(USE_STATS)
+      else if (token == "stats")    sync_cout << Counters::report() << '\n' << nnue_stats() << TT.stats() << sync_endl;
+#else
+      else if (token == "stats")    sync_cout << "info string Counters not compiled in, use make stats=yes" << sync_endl;
+#endif
+      else if (token == "savehash" || token == "loadhash")
+      {
+          // The variant of the hash file is the one of UCI_Variant, as for HashFile
+          Variant variant = UCI::variant_from_name(Options["UCI_Variant"]);
+          std::string f;
+          if (!(is >> skipws >> f))
+              sync_cout << "The filename must be specified" << sync_endl;
+          else if (token == "savehash")
+          {
+              bool saved = TT.save(f, variant);
+              sync_cout << (saved ? "Hash saved successfully to " + f
+                                  : "Failed to save the hash to " + f) << sync_endl;
+          }
+          else
+          {
+              bool loaded = TT.load(f, variant);
+              sync_cout << (loaded ? "Hash loaded successfully from " + f
+                                   : "Failed to load the hash from " + f) << sync_endl;
+          }
+      }
 #ifdef USE_NNUE
       else if (token == "export_net")
       {
@@ -371,7 +1070,15 @@ void UCI::loop(int argc, char* argv[]) {
           std::string f;
           if (is >> skipws >> f)
               filename = f;
-          Eval::NNUE::save_eval(filename);
+          Eval::NNUE::save_eval(filename, pos.variant());
+      }
+      else if (token == "export_image")
+      {
+          std::string f;
+          if (is >> skipws >> f)
+              Eval::NNUE::save_image(f, pos.variant());
+          else
+              sync_cout << "Failed to export a network image. The filename must be specified" << sync_endl;
       }
 #endif
       else if (token == "--help" || token == "help" || token == "--license" || token == "license")
@@ -388,6 +1095,24 @@ void UCI::loop(int argc, char* argv[]) {
 }
 
 
+/// UCI::start_search() starts a search of the position given by the arguments of
+/// a "position" command in the given variant, with the limits given by those of
+/// a "go" command and the clock running from startTime, by the given pool. It is
+/// used by the game server, which keeps the games as text between their searches.
+
+void UCI::start_search(ThreadPool& pool, Variant v, const string& position, const string& go, TimePoint startTime) {
+
+  Position pos;
+  StateListPtr states;
+  istringstream ps(position), gs(go);
+
+  string setup = ::Stockfish::position(pos, ps, states, v);
+  if (!setup.empty())
+      Cluster::set_position(variants[v], Options["UCI_Chess960"], setup);
+  ::Stockfish::go(pos, gs, states, startTime, pool);
+}
+
+
 /// UCI::value() converts a Value to a string by adhering to the UCI protocol specification:
 ///
 /// cp <x>    The score from the engine's point of view in centipawns.
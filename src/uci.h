@@ -23,11 +23,13 @@
 #include <string>
 #include <vector>
 
+#include "misc.h"
 #include "types.h"
 
 namespace Stockfish {
 
 class Position;
+struct ThreadPool;
 
 namespace UCI {
 
@@ -79,10 +81,11 @@ private:
 
 void init(OptionsMap&);
 void loop(int argc, char* argv[]);
+void start_search(ThreadPool& pool, Variant v, const std::string& position, const std::string& go, TimePoint startTime);
 std::string value(Value v);
 std::string square(Square s);
 std::string move(Move m, bool chess960);
-std::string pv(const Position& pos, Depth depth);
+void pv(std::string& out, const Position& pos, Depth depth, std::vector<Key>* sent = nullptr);
 std::string wdl(Value v, int ply);
 Move to_move(const Position& pos, std::string& str);
 Variant variant_from_name(const std::string& str);
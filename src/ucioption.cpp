@@ -21,6 +21,8 @@
 #include <ostream>
 #include <sstream>
 
+#include "book.h"
+#include "cluster.h"
 #include "evaluate.h"
 #include "misc.h"
 #include "search.h"
@@ -40,9 +42,14 @@ namespace UCI {
 /// 'On change' actions, triggered by an option's value change
 static void on_clear_hash(const Option&) { Search::clear(); }
 static void on_hash_size(const Option& o) { TT.resize(size_t(o)); }
+static void on_shared_hash(const Option&) { TT.resize(size_t(Options["Hash"])); }
+static void on_hash_file(const Option& o) { if (!string(o).empty() && string(o) != "<empty>") TT.load(o, variant_from_name(Options["UCI_Variant"])); }
 static void on_logger(const Option& o) { start_logger(o); }
 static void on_threads(const Option& o) { Threads.set(size_t(o)); }
+static void on_cluster_nodes(const Option& o) { Cluster::init(o); }
 static void on_tb_path(const Option& o) { Tablebases::init(UCI::variant_from_name(Options["UCI_Variant"]), o); }
+static void on_tb_budget(const Option&) { Tablebases::init(UCI::variant_from_name(Options["UCI_Variant"]), Options["SyzygyPath"]); }
+static void on_book_file(const Option&) { Book::init(); }
 #ifdef USE_NNUE
 static void on_use_NNUE(const Option&) { Eval::NNUE::init(); }
 static void on_eval_file(const Option&) { Eval::NNUE::init(); }
@@ -64,12 +71,28 @@ void init(OptionsMap& o) {
 
   o["Debug Log File"]        << Option("", on_logger);
   o["Threads"]               << Option(1, 1, 1024, on_threads);
+  o["SMP Breadcrumbs"]       << Option(false);
+  o["SMP MultiPV Split"]     << Option(false);
+#ifdef BUGHOUSE
+  o["Partner Threads"]       << Option(0, 0, 1023);
+#endif
+  o["Cluster Nodes"]         << Option("<empty>", on_cluster_nodes);
   o["Hash"]                  << Option(16, 1, MaxHashMB, on_hash_size);
   o["Clear Hash"]            << Option(on_clear_hash);
+  o["SharedHash"]            << Option("<empty>", on_shared_hash);
+  o["HashFile"]              << Option("<empty>", on_hash_file);
+  o["Pawn Hash KB"]          << Option(12288, 1, 1048576);
+#ifdef HORDE
+  o["Horde Pawn Hash KB"]    << Option(49152, 1, 1048576);
+#endif
+  o["Material Hash KB"]      << Option(320, 1, 1048576);
+  o["Syzygy Hash KB"]        << Option(256, 1, 1048576);
+  o["Perft Hash"]            << Option(16, 0, MaxHashMB);
   o["Ponder"]                << Option(false);
   o["MultiPV"]               << Option(1, 1, 500);
   o["Skill Level"]           << Option(20, -20, 20);
   o["Move Overhead"]         << Option(10, 0, 5000);
+  o["Adaptive Move Overhead"] << Option(false);
   o["Slow Mover"]            << Option(100, 10, 1000);
   o["nodestime"]             << Option(0, 0, 10000);
   o["UCI_Chess960"]          << Option(false);
@@ -78,13 +101,21 @@ void init(OptionsMap& o) {
   o["UCI_LimitStrength"]     << Option(false);
   o["UCI_Elo"]               << Option(1320, 1320, 3190);
   o["UCI_ShowWDL"]           << Option(false);
+  o["PV Interval"]           << Option(0, 0, 10000);
   o["SyzygyPath"]            << Option("<empty>", on_tb_path);
   o["SyzygyProbeDepth"]      << Option(1, 1, 100);
   o["Syzygy50MoveRule"]      << Option(true);
   o["SyzygyProbeLimit"]      << Option(7, 0, 7);
+  o["SyzygyMapBudgetMB"]     << Option(0, 0, 1048576, on_tb_budget);
+  o["BookFile"]              << Option("<empty>", on_book_file);
+  for (Variant v = Variant(CHESS_VARIANT + 1); v < SUBVARIANT_NB; ++v)
+      o["BookFile_" + variants[v]] << Option("<empty>", on_book_file);
 #ifdef USE_NNUE
   o["Use NNUE"]              << Option(true, on_use_NNUE);
   o["EvalFile"]              << Option(EvalFileDefaultName, on_eval_file);
+  for (Variant v = Variant(CHESS_VARIANT + 1); v < VARIANT_NB; ++v)
+      o["EvalFile_" + variants[v]] << Option("<empty>", on_eval_file);
+  o["NumaReplicateNNUE"]     << Option(false, on_eval_file);
 #endif
 }
 
@@ -12,8 +12,10 @@ echo "perft testing started"
 
 cat << EOF > perft.exp
    set timeout 10
-   lassign \$argv variant pos depth result
+   lassign \$argv variant pos depth result threads
+   if {\$threads eq ""} {set threads 1}
    spawn ./stockfish
+   send "setoption name Threads value \$threads\\n"
    send "setoption name UCI_Variant value \$variant\\n"
    send "position \$pos\\ngo perft \$depth\\n"
    expect "Nodes searched? \$result" {} timeout {exit 1}
@@ -40,6 +42,27 @@ if [[ $1 == "" || $1 == "variant" ]]; then
   expect perft.exp horde startpos 6 5396554 > /dev/null
   expect perft.exp kingofthehill startpos 5 4865609 > /dev/null
   expect perft.exp racingkings startpos 5 9472927 > /dev/null
+  expect perft.exp twokings startpos 5 4629168 > /dev/null
+  expect perft.exp twokings "fen 4k2k/8/8/8/8/8/8/r3K2K w - - 0 1" 5 110782 > /dev/null
+fi
+
+# threaded perft, split across the threads with a shared perft hash
+if [[ $1 == "" || $1 == "threads" ]]; then
+  expect perft.exp chess "fen r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq -" 5 193690690 4 > /dev/null
+  expect perft.exp crazyhouse startpos 5 4888832 4 > /dev/null
+fi
+
+# threaded perft with a perft hash and its JSON output, without expect, also
+# run alone by "perft.sh shell" where expect is not installed
+if [[ $1 == "" || $1 == "threads" || $1 == "shell" ]]; then
+  perft_shell()
+  {
+    printf "setoption name Threads value 4\nsetoption name Perft Hash value 16\nsetoption name UCI_Variant value %s\nposition %s\ngo perft %s\nquit\n" "$1" "$2" "$3" | ./stockfish
+  }
+  perft_shell chess startpos 5 | grep -q "^Nodes searched: 4865609$"
+  perft_shell crazyhouse startpos 5 | grep -q "^Nodes searched: 4888832$"
+  perft_shell atomic startpos "4 json" \
+    | grep -q '^{"variant":"atomic",.*"depth":4,"nodes":197326,.*"divide":{"a2a3":8457,.*}}$'
 fi
 
 rm perft.exp